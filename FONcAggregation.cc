@@ -0,0 +1,598 @@
+// FONcAggregation.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <DDS.h>
+#include <Structure.h>
+#include <Array.h>
+#include <Grid.h>
+#include <Str.h>
+#include <AttrTable.h>
+#include <ConstraintEvaluator.h>
+#include <escaping.h>
+
+#include <BESDataHandlerInterface.h>
+#include <BESContainer.h>
+#include <BESDataNames.h>
+#include <BESInternalError.h>
+#include <BESDebug.h>
+
+#include "FONcAggregation.h"
+#include "FONcRequestHandler.h"
+#include "FONcWorkerPool.h"
+
+using namespace libdap;
+using namespace std;
+
+namespace {
+
+/** @brief Owns the append tasks; declared before the pool that runs them
+ * so that the pool is stopped before they are deleted
+ */
+struct AppendTasks {
+    vector<FONcTask *> d_tasks;
+    ~AppendTasks()
+    {
+        for (vector<FONcTask *>::iterator i = d_tasks.begin(); i != d_tasks.end(); i++)
+            delete *i;
+    }
+};
+
+/** @brief Copy each attribute and attribute container of one table to
+ * another
+ */
+void copy_attributes(AttrTable &from, AttrTable &to)
+{
+    AttrTable::Attr_iter i = from.attr_begin();
+    AttrTable::Attr_iter e = from.attr_end();
+    for (; i != e; i++) {
+        if (from.get_attr_type(i) == Attr_container)
+            to.append_container(new AttrTable(*from.get_attr_table(i)), from.get_name(i));
+        else
+            to.append_attr(from.get_name(i), from.get_type(i), from.get_attr_vector(i));
+    }
+}
+
+} // namespace
+
+/** @brief Copy the values of one container, once it is read, into the
+ * aggregated variables
+ *
+ * Each container has its own part of the aggregated variables, so the
+ * tasks of different containers can run at the same time.
+ */
+class FONcAggregation::AppendContainer: public FONcTask {
+private:
+    FONcAggregation *d_agg;
+    unsigned int d_container;
+
+public:
+    AppendContainer(FONcAggregation *agg, unsigned int container) :
+        d_agg(agg), d_container(container)
+    {
+    }
+
+    virtual void run()
+    {
+        d_agg->append(d_container);
+    }
+};
+
+/** @brief Should the containers of this request be aggregated?
+ *
+ * Only if FONc.AggregateContainers is set and more than one container
+ * was named. Requests that call server functions are left to the
+ * response builder, since the functions make a new DDS.
+ *
+ * @param dhi The request
+ * @returns true if FONcAggregation should read the request's data
+ */
+bool FONcAggregation::requested(BESDataHandlerInterface &dhi)
+{
+    if (!FONcRequestHandler::aggregate_containers || dhi.containers.size() < 2) return false;
+
+    return dhi.data[POST_CONSTRAINT].find('(') == string::npos;
+}
+
+/** @brief Set up the aggregation of the containers of a request
+ *
+ * @param dds The DDS of the request, with a Structure for each container;
+ * it is not read yet
+ * @param dhi The request, used for the names of the containers
+ */
+FONcAggregation::FONcAggregation(DDS *dds, BESDataHandlerInterface &dhi) :
+    d_dds(dds), d_agg_dds(0), d_dim_name(FONcRequestHandler::aggregation_dimension), d_concat(false)
+{
+    list<BESContainer *>::iterator i = dhi.containers.begin();
+    list<BESContainer *>::iterator e = dhi.containers.end();
+    for (; i != e; i++) {
+        d_names.push_back((*i)->get_symbolic_name());
+    }
+}
+
+FONcAggregation::~FONcAggregation()
+{
+    vector<Piece *>::iterator i = d_pieces.begin();
+    vector<Piece *>::iterator e = d_pieces.end();
+    for (; i != e; i++) {
+        delete *i;
+    }
+
+    delete d_agg_dds;
+}
+
+/** @brief Does the first dimension of this variable have the aggregation
+ * dimension's name?
+ *
+ * @param btp An Array or a Grid
+ */
+bool FONcAggregation::is_record(BaseType *btp)
+{
+    if (btp->type() == dods_grid_c) return is_record(static_cast<Grid *>(btp)->get_array());
+
+    Array *a = dynamic_cast<Array *>(btp);
+    return a && a->dimensions() > 0 && a->dimension_name(a->dim_begin()) == d_dim_name;
+}
+
+/** @brief Check that the containers can be aggregated
+ *
+ * Every top level variable of the DDS must be the Structure of a
+ * container, and each container must project the same variables, with
+ * the same types, in the same order.
+ *
+ * @returns true if the containers can be aggregated
+ */
+bool FONcAggregation::plan()
+{
+    vector<string>::iterator ni = d_names.begin();
+    vector<string>::iterator ne = d_names.end();
+    for (; ni != ne; ni++) {
+        Structure *s = dynamic_cast<Structure *>(d_dds->var(*ni));
+        if (!s || !s->send_p()) {
+            BESDEBUG("fonc", "FONcAggregation::plan() - no projected Structure for container " << *ni << endl);
+            return false;
+        }
+        d_containers.push_back(s);
+    }
+
+    DDS::Vars_iter vi = d_dds->var_begin();
+    DDS::Vars_iter ve = d_dds->var_end();
+    unsigned int sent = 0;
+    for (; vi != ve; vi++) {
+        if ((*vi)->send_p()) sent++;
+    }
+    if (sent != d_containers.size()) {
+        BESDEBUG("fonc", "FONcAggregation::plan() - the DDS holds variables that are not containers" << endl);
+        return false;
+    }
+
+    Structure *first = d_containers[0];
+    for (unsigned int k = 1; k < d_containers.size(); k++) {
+        Constructor::Vars_iter fi = first->var_begin();
+        Constructor::Vars_iter fe = first->var_end();
+        Constructor::Vars_iter ci = d_containers[k]->var_begin();
+        Constructor::Vars_iter ce = d_containers[k]->var_end();
+        while (true) {
+            while (fi != fe && !(*fi)->send_p())
+                fi++;
+            while (ci != ce && !(*ci)->send_p())
+                ci++;
+            if (fi == fe || ci == ce) break;
+            if ((*fi)->name() != (*ci)->name() || (*fi)->type_name() != (*ci)->type_name()) {
+                BESDEBUG("fonc", "FONcAggregation::plan() - container " << d_names[k] << " does not match " << d_names[0] << endl);
+                return false;
+            }
+            fi++;
+            ci++;
+        }
+        if (fi != fe || ci != ce) {
+            BESDEBUG("fonc", "FONcAggregation::plan() - container " << d_names[k] << " does not match " << d_names[0] << endl);
+            return false;
+        }
+    }
+
+    Constructor::Vars_iter fi = first->var_begin();
+    Constructor::Vars_iter fe = first->var_end();
+    for (; fi != fe && !d_concat; fi++) {
+        if ((*fi)->send_p() && is_record(*fi)) d_concat = true;
+    }
+
+    BESDEBUG("fonc", "FONcAggregation::plan() - aggregating " << d_containers.size() << " containers "
+        << (d_concat ? "along " : "on a new dimension ") << d_dim_name << endl);
+
+    return true;
+}
+
+/** @brief Find a variable of a container
+ *
+ * @param container The index of the container
+ * @param member The name of the container's variable
+ * @param part For a Grid, the name of its array or of one of its maps
+ * @returns The variable
+ * @throws BESInternalError if it is not found
+ */
+BaseType *FONcAggregation::find(unsigned int container, const string &member, const string &part)
+{
+    BaseType *btp = d_containers[container]->var(member);
+    if (btp && !part.empty()) {
+        Grid *g = dynamic_cast<Grid *>(btp);
+        btp = 0;
+        if (g && g->get_array()->name() == part) {
+            btp = g->get_array();
+        }
+        else if (g) {
+            Grid::Map_iter mi = g->map_begin();
+            Grid::Map_iter me = g->map_end();
+            for (; mi != me && !btp; mi++) {
+                if ((*mi)->name() == part) btp = *mi;
+            }
+        }
+    }
+
+    if (!btp) {
+        string err = "fileout.netcdf - Container " + d_names[container] + " has no variable " + member;
+        if (!part.empty()) err += "." + part;
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
+
+    return btp;
+}
+
+/** @brief The length of the aggregation dimension of a concatenated
+ * variable
+ *
+ * This is the sum of the lengths of that dimension in each container,
+ * which are known once the constraint is parsed.
+ */
+int FONcAggregation::record_extent(const string &member, const string &part)
+{
+    int extent = 0;
+    for (unsigned int k = 0; k < d_containers.size(); k++) {
+        Array *a = dynamic_cast<Array *>(find(k, member, part));
+        if (!a) {
+            string err = "fileout.netcdf - Variable " + member + " of container " + d_names[k] + " is not an array";
+            throw BESInternalError(err, __FILE__, __LINE__);
+        }
+        extent += a->dimension_size(a->dim_begin(), true);
+    }
+
+    return extent;
+}
+
+/** @brief Make the new variable that holds the values of a variable of
+ * every container
+ *
+ * @param proto The variable of the first container, an Array or a simple
+ * type
+ * @param member The name of the container's variable
+ * @param part For a Grid, the name of its array or map
+ * @param name The name of the new variable
+ * @returns The new Array; it belongs to the caller
+ */
+Array *FONcAggregation::new_piece(BaseType *proto, const string &member, const string &part, const string &name)
+{
+    Array *a = dynamic_cast<Array *>(proto);
+    BaseType *elem = a ? a->var() : proto;
+
+    Piece *piece = new Piece;
+    d_pieces.push_back(piece);
+    piece->member = member;
+    piece->part = part;
+    piece->strings = elem->type() == dods_str_c || elem->type() == dods_url_c;
+    piece->width = elem->width();
+
+    piece->out = new Array(name, elem);
+    Array::Dim_iter di;
+    if (d_concat) {
+        piece->out->append_dim(record_extent(member, part), d_dim_name);
+        di = a->dim_begin() + 1;
+    }
+    else {
+        piece->out->append_dim(d_containers.size(), d_dim_name);
+        if (a) di = a->dim_begin();
+    }
+    if (a) {
+        for (; di != a->dim_end(); di++) {
+            piece->out->append_dim(a->dimension_size(di, true), a->dimension_name(di));
+        }
+    }
+
+    piece->out->set_attr_table(proto->get_attr_table());
+    piece->out->set_send_p(true);
+
+    // The lengths of each container's part are known once the constraint
+    // is parsed, so the values can be copied straight into the buffer of
+    // the new variable as each container is read.
+    unsigned int offset = 0;
+    for (unsigned int k = 0; k < d_containers.size(); k++) {
+        piece->offsets.push_back(offset);
+        offset += container_length(k, piece);
+    }
+    if (piece->strings)
+        piece->str_values.resize(piece->out->length());
+    else
+        piece->out->reserve_value_capacity(piece->out->length());
+
+    return piece->out;
+}
+
+/** @brief The number of values a container adds to a piece
+ *
+ * @param container The index of the container
+ * @param piece The aggregated variable
+ */
+unsigned int FONcAggregation::container_length(unsigned int container, Piece *piece)
+{
+    if (!d_concat) return piece->out->length() / d_containers.size();
+
+    Array *a = dynamic_cast<Array *>(find(container, piece->member, piece->part));
+    return a ? a->length() : 1;
+}
+
+/** @brief Copy a variable of the first container, with its data
+ */
+BaseType *FONcAggregation::copy(BaseType *btp)
+{
+    BaseType *c = btp->ptr_duplicate();
+    c->set_parent(0);
+    return c;
+}
+
+/** @brief Build the aggregated DDS once the first container is read
+ *
+ * The global attributes are those of the DDS and of the first container.
+ */
+void FONcAggregation::build()
+{
+    d_agg_dds = new DDS(0, d_dds->get_dataset_name());
+    d_agg_dds->filename(d_dds->filename());
+
+    Structure *first = d_containers[0];
+    copy_attributes(d_dds->get_attr_table(), d_agg_dds->get_attr_table());
+    copy_attributes(first->get_attr_table(), d_agg_dds->get_attr_table());
+
+    Constructor::Vars_iter vi = first->var_begin();
+    Constructor::Vars_iter ve = first->var_end();
+    for (; vi != ve; vi++) {
+        BaseType *m = *vi;
+        if (!m->send_p()) continue;
+
+        BaseType *out = 0;
+        switch (m->type()) {
+        case dods_array_c:
+            if (!d_concat || is_record(m))
+                out = new_piece(m, m->name(), "", m->name());
+            else
+                out = copy(m);
+            break;
+
+        case dods_grid_c: {
+            Grid *g = static_cast<Grid *>(m);
+            Array *ga = g->get_array();
+            if (d_concat && is_record(g)) {
+                Grid *ng = new Grid(g->name());
+                ng->set_attr_table(g->get_attr_table());
+                Array *na = new_piece(ga, g->name(), ga->name(), ga->name());
+                na->set_send_p(ga->send_p());
+                ng->set_array(na);
+
+                Grid::Map_iter mi = g->map_begin();
+                Grid::Map_iter me = g->map_end();
+                for (; mi != me; mi++) {
+                    Array *map = static_cast<Array *>(*mi);
+                    Array *nm;
+                    if (is_record(map))
+                        nm = new_piece(map, g->name(), map->name(), map->name());
+                    else
+                        nm = static_cast<Array *>(copy(map));
+                    nm->set_send_p(map->send_p());
+                    ng->add_map(nm, false);
+                }
+                ng->set_send_p(true);
+                out = ng;
+            }
+            else if (d_concat) {
+                out = copy(g);
+            }
+            else {
+                // A Grid cannot have a dimension that has no map, so the
+                // array is written on its own, followed by the maps.
+                if (ga->send_p()) {
+                    Array *na = new_piece(ga, g->name(), ga->name(), g->name());
+                    na->set_attr_table(g->get_attr_table());
+                    d_agg_dds->add_var_nocopy(na);
+                }
+                Grid::Map_iter mi = g->map_begin();
+                Grid::Map_iter me = g->map_end();
+                for (; mi != me; mi++) {
+                    if ((*mi)->send_p() && !d_agg_dds->var((*mi)->name()))
+                        d_agg_dds->add_var_nocopy(copy(*mi));
+                }
+            }
+            break;
+        }
+
+        case dods_structure_c:
+        case dods_sequence_c:
+            out = copy(m);
+            break;
+
+        default:
+            if (d_concat)
+                out = copy(m);
+            else
+                out = new_piece(m, m->name(), "", m->name());
+            break;
+        }
+
+        if (out) d_agg_dds->add_var_nocopy(out);
+    }
+}
+
+/** @brief Copy the values of one container into the aggregated variables
+ *
+ * @param container The index of the container
+ * @throws BESInternalError if a variable has a different shape than in
+ * the first container
+ */
+void FONcAggregation::append(unsigned int container)
+{
+    vector<Piece *>::iterator i = d_pieces.begin();
+    vector<Piece *>::iterator e = d_pieces.end();
+    for (; i != e; i++) {
+        Piece *piece = *i;
+        BaseType *src = find(container, piece->member, piece->part);
+        Array *a = dynamic_cast<Array *>(src);
+        unsigned int n = a ? a->length() : 1;
+        unsigned int offset = piece->offsets[container];
+
+        if (n != container_length(container, piece) || offset + n > static_cast<unsigned int>(piece->out->length())) {
+            string err = "fileout.netcdf - Variable " + piece->member + " of container " + d_names[container]
+                + " does not have the same shape as in " + d_names[0];
+            throw BESInternalError(err, __FILE__, __LINE__);
+        }
+
+        if (piece->strings) {
+            if (a) {
+                vector<string> values;
+                a->value(values);
+                for (unsigned int v = 0; v < n && v < values.size(); v++)
+                    piece->str_values[offset + v].swap(values[v]);
+            }
+            else {
+                piece->str_values[offset] = static_cast<Str *>(src)->value();
+            }
+        }
+        else if (n > 0) {
+            void *buf = piece->out->get_buf() + static_cast<vector<char>::size_type>(offset) * piece->width;
+            src->buf2val(&buf);
+        }
+    }
+
+    // The values are copied, so free the container's memory
+    Constructor::Vars_iter vi = d_containers[container]->var_begin();
+    Constructor::Vars_iter ve = d_containers[container]->var_end();
+    for (; vi != ve; vi++) {
+        (*vi)->clear_local_data();
+    }
+}
+
+/** @brief Mark the aggregated variables as read
+ *
+ * The numeric values were copied into the variables' buffers by
+ * append(); only the strings are moved in here.
+ */
+void FONcAggregation::finish()
+{
+    vector<Piece *>::iterator i = d_pieces.begin();
+    vector<Piece *>::iterator e = d_pieces.end();
+    for (; i != e; i++) {
+        Piece *piece = *i;
+        if (piece->strings) {
+            piece->out->set_value(piece->str_values, piece->str_values.size());
+            vector<string>().swap(piece->str_values);
+        }
+    }
+
+    DDS::Vars_iter vi = d_agg_dds->var_begin();
+    DDS::Vars_iter ve = d_agg_dds->var_end();
+    for (; vi != ve; vi++) {
+        (*vi)->set_read_p(true);
+    }
+}
+
+/** @brief Read the containers and return the DDS to transform
+ *
+ * The containers are read in the order they were named by this thread.
+ * Once a container is read, its values are copied into the aggregated
+ * variables by a FONcWorkerPool with FONc.AggregationThreads threads
+ * while the next container is read. No more containers are read ahead of
+ * the copies than there are threads, which bounds the memory used for
+ * containers that are read but not yet copied.
+ *
+ * If the containers cannot be aggregated, the DDS is read as it would be
+ * without aggregation and returned as is.
+ *
+ * @param eval The constraint evaluator of the request
+ * @param ce The constraint of the request
+ * @returns The DDS to transform; it belongs to this object or is the
+ * DDS passed to the constructor
+ */
+DDS *FONcAggregation::read(ConstraintEvaluator &eval, const string &ce)
+{
+    eval.parse_constraint(www2id(ce, "%", "%20"), *d_dds);
+    d_dds->tag_nested_sequences();
+
+    if (!plan()) {
+        DDS::Vars_iter vi = d_dds->var_begin();
+        DDS::Vars_iter ve = d_dds->var_end();
+        for (; vi != ve; vi++) {
+            if ((*vi)->send_p()) (*vi)->intern_data(eval, *d_dds);
+        }
+        return d_dds;
+    }
+
+    AppendTasks tasks;
+    for (unsigned int k = 0; k < d_containers.size(); k++) {
+        tasks.d_tasks.push_back(new AppendContainer(this, k));
+    }
+
+    FONcWorkerPool pool(FONcRequestHandler::aggregation_threads);
+
+    unsigned int window = pool.threads();
+    for (unsigned int k = 0; k < d_containers.size(); k++) {
+        if (window && k >= window) pool.wait(tasks.d_tasks[k - window]);
+
+        BESDEBUG("fonc", "FONcAggregation::read() - reading container " << d_names[k] << endl);
+        d_containers[k]->intern_data(eval, *d_dds);
+
+        if (k == 0) build();
+        pool.submit(tasks.d_tasks[k]);
+    }
+
+    for (unsigned int k = 0; k < tasks.d_tasks.size(); k++) {
+        pool.wait(tasks.d_tasks[k]);
+    }
+
+    finish();
+
+    return d_agg_dds;
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcAggregation::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcAggregation::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "containers =";
+    vector<string>::const_iterator i = d_names.begin();
+    vector<string>::const_iterator e = d_names.end();
+    for (; i != e; i++) {
+        strm << " " << *i;
+    }
+    strm << endl;
+    strm << BESIndent::LMarg << "dimension = " << d_dim_name << (d_concat ? " (concatenated)" : " (new)") << endl;
+    strm << BESIndent::LMarg << "aggregated variables = " << d_pieces.size() << endl;
+    BESIndent::UnIndent();
+}
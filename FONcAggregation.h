@@ -0,0 +1,107 @@
+// FONcAggregation.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef FONcAggregation_h_
+#define FONcAggregation_h_ 1
+
+#include <vector>
+#include <string>
+
+#include <BESObj.h>
+
+class BESDataHandlerInterface;
+
+namespace libdap {
+class BaseType;
+class Array;
+class Structure;
+class DDS;
+class ConstraintEvaluator;
+}
+
+/** @brief Join the containers of a request into one dataset
+ *
+ * When a request names several containers, the BES puts the variables of
+ * each container in a Structure named for that container. If every
+ * container holds the same variables, this class reads the containers and
+ * joins them into a new DDS that FONcTransform writes as a single netcdf
+ * file. The containers are read one at a time by the request's thread,
+ * since the handlers and the constraint evaluator are not thread safe;
+ * the values of each container are copied into the joined variables by
+ * a pool of threads while the next container is read.
+ *
+ * Variables whose first dimension is FONc.AggregationDimension are
+ * concatenated along that dimension; the others are taken from the first
+ * container. If no variable uses that dimension, a new leading dimension
+ * with that name and one element per container is added to every
+ * variable.
+ */
+class FONcAggregation: public BESObj {
+private:
+    // A variable of the new DDS built from the same variable of each
+    // container. For Grids, part is the name of the Grid's array or map.
+    // The values of container k start at element offsets[k] of out's
+    // buffer (or of str_values for strings).
+    struct Piece {
+        std::string member;
+        std::string part;
+        libdap::Array *out;
+        bool strings;
+        unsigned int width;
+        std::vector<unsigned int> offsets;
+        std::vector<std::string> str_values;
+    };
+
+    class AppendContainer;
+
+    libdap::DDS *d_dds;
+    libdap::DDS *d_agg_dds;
+    std::vector<std::string> d_names;
+    std::vector<libdap::Structure *> d_containers;
+    std::string d_dim_name;
+    bool d_concat;
+    std::vector<Piece *> d_pieces;
+
+    bool plan();
+    bool is_record(libdap::BaseType *btp);
+    int record_extent(const std::string &member, const std::string &part);
+    libdap::BaseType *find(unsigned int container, const std::string &member, const std::string &part);
+    libdap::Array *new_piece(libdap::BaseType *proto, const std::string &member, const std::string &part,
+        const std::string &name);
+    libdap::BaseType *copy(libdap::BaseType *btp);
+    unsigned int container_length(unsigned int container, Piece *piece);
+    void build();
+    void append(unsigned int container);
+    void finish();
+
+public:
+    FONcAggregation(libdap::DDS *dds, BESDataHandlerInterface &dhi);
+    virtual ~FONcAggregation();
+
+    virtual libdap::DDS *read(libdap::ConstraintEvaluator &eval, const std::string &ce);
+
+    virtual void dump(std::ostream &strm) const;
+
+    static bool requested(BESDataHandlerInterface &dhi);
+};
+
+#endif // FONcAggregation_h_
@@ -0,0 +1,196 @@
+// FONcArena.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <new>
+
+#include <BESDebug.h>
+#include <BESIndent.h>
+
+#include "FONcArena.h"
+#include "FONcRequestHandler.h"
+
+using namespace std;
+
+// The size of the blocks the objects are carved from
+#define FONC_ARENA_BLOCK_SIZE (64 * 1024)
+
+// Each object starts with the arena it came from, or null if it came
+// from the heap. This keeps the objects aligned for any type.
+#define FONC_ARENA_HEADER_SIZE 16
+
+FONcArena *FONcArena::Current = 0;
+size_t FONcArena::HighWater = 0;
+size_t FONcArena::ScratchHighWater = 0;
+
+FONcArena::FONcArena() :
+    d_next(0), d_left(0), d_used(0), d_reserved(0), d_allocations(0)
+{
+}
+
+/** @brief Free all of the blocks at once
+ *
+ * The destructors of the objects in the blocks must have run already.
+ */
+FONcArena::~FONcArena()
+{
+    if (Current == this) Current = 0;
+
+    BESDEBUG("fonc", "FONcArena::~FONcArena() - " << d_allocations << " allocations used " << d_used << " of "
+        << d_reserved << " bytes" << endl);
+
+    vector<char *>::iterator i = d_blocks.begin();
+    vector<char *>::iterator e = d_blocks.end();
+    for (; i != e; i++)
+        ::operator delete(*i);
+}
+
+/** @brief Carve memory out of the current block
+ *
+ * @param bytes The size of the memory
+ * @return Memory aligned for any type, valid until the arena is destroyed
+ */
+void *FONcArena::allocate(size_t bytes)
+{
+    bytes = (bytes + FONC_ARENA_HEADER_SIZE - 1) / FONC_ARENA_HEADER_SIZE * FONC_ARENA_HEADER_SIZE;
+
+    if (bytes > d_left) {
+        // Large requests get a block of their own, so the current block
+        // is not wasted
+        if (bytes > FONC_ARENA_BLOCK_SIZE / 4) {
+            char *block = static_cast<char *>(::operator new(bytes));
+            d_blocks.push_back(block);
+            d_reserved += bytes;
+            d_used += bytes;
+            d_allocations++;
+            if (d_used > HighWater) HighWater = d_used;
+            return block;
+        }
+
+        d_next = static_cast<char *>(::operator new(FONC_ARENA_BLOCK_SIZE));
+        d_blocks.push_back(d_next);
+        d_left = FONC_ARENA_BLOCK_SIZE;
+        d_reserved += FONC_ARENA_BLOCK_SIZE;
+    }
+
+    void *p = d_next;
+    d_next += bytes;
+    d_left -= bytes;
+    d_used += bytes;
+    d_allocations++;
+    if (d_used > HighWater) HighWater = d_used;
+
+    return p;
+}
+
+/** @brief The scratch buffer of the arena
+ *
+ * @param bytes The size needed
+ * @return A buffer of at least that size, valid until the next call
+ */
+char *FONcArena::scratch(size_t bytes)
+{
+    if (bytes > d_scratch.size()) {
+        d_scratch.resize(bytes);
+        if (bytes > ScratchHighWater) ScratchHighWater = bytes;
+    }
+
+    return d_scratch.empty() ? 0 : &d_scratch[0];
+}
+
+/** @brief Allocate a FONc object, in the current arena if there is one
+ *
+ * The operator new of the FONc classes calls this.
+ */
+void *FONcArena::allocate_object(size_t bytes)
+{
+    char *p;
+    if (Current)
+        p = static_cast<char *>(Current->allocate(bytes + FONC_ARENA_HEADER_SIZE));
+    else
+        p = static_cast<char *>(::operator new(bytes + FONC_ARENA_HEADER_SIZE));
+
+    *reinterpret_cast<FONcArena **>(p) = Current;
+
+    return p + FONC_ARENA_HEADER_SIZE;
+}
+
+/** @brief Free a FONc object made by allocate_object()
+ *
+ * Objects in an arena are freed with the arena.
+ */
+void FONcArena::release_object(void *p)
+{
+    if (!p) return;
+
+    char *start = static_cast<char *>(p) - FONC_ARENA_HEADER_SIZE;
+    if (!*reinterpret_cast<FONcArena **>(start)) ::operator delete(start);
+}
+
+/** @brief A scratch buffer, from the current arena if there is one
+ *
+ * The arena keeps its buffer for the rest of the response, so buffers
+ * larger than a slab (FONc.SlabSize), which the memory accountant
+ * only grants for one write, are not kept.
+ *
+ * @param bytes The size needed
+ * @param fallback Used for the buffer when there is no arena or the
+ * buffer is too large to keep
+ * @return A buffer of at least that size
+ */
+char *FONcArena::scratch(size_t bytes, vector<char> &fallback)
+{
+    if (Current && bytes <= static_cast<size_t>(FONcRequestHandler::slab_size) * 1024)
+        return Current->scratch(bytes);
+
+    fallback.resize(bytes);
+    return fallback.empty() ? 0 : &fallback[0];
+}
+
+/** @brief Write the largest arena and scratch buffer of the responses
+ * this process has made
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcArena::dump_high_water(ostream &strm)
+{
+    strm << BESIndent::LMarg << "FONcArena high water marks" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "objects = " << HighWater << " bytes" << endl;
+    strm << BESIndent::LMarg << "scratch = " << ScratchHighWater << " bytes" << endl;
+    BESIndent::UnIndent();
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcArena::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcArena::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "blocks = " << d_blocks.size() << endl;
+    strm << BESIndent::LMarg << "allocations = " << d_allocations << endl;
+    strm << BESIndent::LMarg << "bytes used = " << d_used << " of " << d_reserved << endl;
+    strm << BESIndent::LMarg << "scratch = " << d_scratch.size() << " bytes" << endl;
+    BESIndent::UnIndent();
+    dump_high_water(strm);
+}
@@ -0,0 +1,110 @@
+// FONcArena.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef FONcArena_h_
+#define FONcArena_h_ 1
+
+#include <cstddef>
+#include <vector>
+
+#include <BESObj.h>
+
+/** @brief Memory for the FONc objects and the write buffers of one
+ * response
+ *
+ * A response makes one FONc object for each variable, dimension and map
+ * it writes. While FONcArena::Current is set, those objects are carved
+ * out of large blocks in the order they are made (a monotonic arena)
+ * instead of being allocated one at a time. Deleting one of them runs
+ * its destructor but does not free its memory; all of the blocks are
+ * freed together when the arena is destroyed. FONcTransform owns the
+ * arena of its response and makes it current (see Use) only while the
+ * response is built, so the objects must be deleted before it is,
+ * which FONcTransform's destructor does.
+ *
+ * The arena also keeps one scratch buffer that the write methods reuse
+ * for the converted values of each variable in turn, up to the size of
+ * a slab.
+ *
+ * An arena is used by one thread at a time.
+ */
+class FONcArena: public BESObj {
+private:
+    std::vector<char *> d_blocks;
+    char *d_next;
+    size_t d_left;
+
+    size_t d_used;
+    size_t d_reserved;
+    unsigned long d_allocations;
+
+    std::vector<char> d_scratch;
+
+    static size_t HighWater;
+    static size_t ScratchHighWater;
+
+    FONcArena(const FONcArena &);
+    FONcArena &operator=(const FONcArena &);
+
+public:
+    FONcArena();
+    virtual ~FONcArena();
+
+    virtual void *allocate(size_t bytes);
+    virtual char *scratch(size_t bytes);
+
+    virtual size_t used() const { return d_used; }
+    virtual size_t reserved() const { return d_reserved; }
+    virtual unsigned long allocations() const { return d_allocations; }
+
+    static void *allocate_object(size_t bytes);
+    static void release_object(void *p);
+    static char *scratch(size_t bytes, std::vector<char> &fallback);
+
+    static size_t high_water() { return HighWater; }
+    static size_t scratch_high_water() { return ScratchHighWater; }
+    static void dump_high_water(std::ostream &strm);
+
+    virtual void dump(std::ostream &strm) const;
+
+    static FONcArena *Current;
+
+    /** @brief Make an arena the current one for a scope
+     *
+     * The arena that was current before is put back when the scope ends,
+     * normally or by an exception. With a null arena the objects made in
+     * the scope come from the heap.
+     */
+    class Use {
+    private:
+        FONcArena *d_previous;
+
+        Use(const Use &);
+        Use &operator=(const Use &);
+
+    public:
+        Use(FONcArena *arena) : d_previous(Current) { Current = arena; }
+        ~Use() { Current = d_previous; }
+    };
+};
+
+#endif // FONcArena_h_
@@ -29,18 +29,39 @@
 //      pwest       Patrick West <pwest@ucar.edu>
 //      jgarcia     Jose Garcia <jgarcia@ucar.edu>
 
+#include "config.h"
+
+#include <stdint.h>
+
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+#include <Structure.h>
+#include <Str.h>
+#include <D4Enum.h>
+
 #include <BESInternalError.h>
 #include <BESDebug.h>
 
 #include "FONcRequestHandler.h" // For access to the handler's keys
+#include "FONcSettings.h"
 #include "FONcArray.h"
 #include "FONcDim.h"
 #include "FONcGrid.h"
 #include "FONcMap.h"
+#include "FONcEnum.h"
 #include "FONcUtils.h"
 #include "FONcAttributes.h"
+#include "FONcMemoryAccountant.h"
+#include "FONcWriter.h"
 
 vector<FONcDim *> FONcArray::Dimensions;
+vector<FONcArray *> FONcArray::RecordArrays;
+std::set<string> FONcArray::ReducedDims;
 
 const int MAX_CHUNK_SIZE = 1024;
 
@@ -54,8 +75,17 @@ const int MAX_CHUNK_SIZE = 1024;
  */
 FONcArray::FONcArray(BaseType *b) :
         FONcBaseType(), d_a(0), d_array_type(NC_NAT), d_ndims(0), d_actual_ndims(0), d_nelements(1), d_dim_ids(0),
-        d_dim_sizes(0), d_str_data(0), d_dont_use_it(false), d_chunksizes(0), d_grid_maps(0)
+        d_dim_sizes(0), d_str_data(0), d_dont_use_it(false), d_chunksizes(0), d_grid_maps(0),
+        d_is_compound(false), d_compound_size(0), d_is_packed(false), d_unpacked_type(NC_NAT), d_scale_factor(1.0),
+        d_add_offset(0.0), d_quantize_algorithm(0), d_quantize_digits(0), d_quantize_in_library(false), d_lazy(false),
+        d_str_bytes(0), d_enum(0),
+        d_record(false), d_record_ncid(0), d_chunk_bytes(0), d_chunks_across(0), d_cache_size(0), d_cache_hits(0),
+        d_cache_misses(0), d_cache_rereads(0), d_cached_first(0), d_cached_end(0), d_reduced(false)
 {
+    d_default_cache.size = 0;
+    d_default_cache.nelems = 0;
+    d_default_cache.preemption = 0;
+
     d_a = dynamic_cast<Array *>(b);
     if (!d_a) {
         string s = "File out netcdf, FONcArray was passed a variable that is not a DAP Array";
@@ -71,10 +101,20 @@ FONcArray::FONcArray(BaseType *b) :
  * here, but their reference count is decremented
  *
  * The DAP Array instance does not belong to the FONcArray instance, so
- * it is not deleted.
+ * it is not deleted. The arrays made for the members of an Array of
+ * Structures do, and are.
  */
 FONcArray::~FONcArray()
 {
+    FONcMemoryAccountant::TheAccountant()->release(d_str_bytes);
+
+    vector<FONcArray *>::iterator m = d_members.begin();
+    for (; m != d_members.end(); ++m)
+        delete *m;
+    vector<Array *>::iterator ma = d_member_arrays.begin();
+    for (; ma != d_member_arrays.end(); ++ma)
+        delete *ma;
+
     // Added jhrg 8/28/13
     vector<FONcDim*>::iterator d = d_dims.begin();
     while (d != d_dims.end()) {
@@ -90,6 +130,68 @@ FONcArray::~FONcArray()
     }
 }
 
+/** @brief Read the _FillValue and missing_value attributes of an array
+ *
+ * @param attrs The attributes of the array
+ * @param missing Value-result parameter; the values are appended
+ */
+static void missing_values(AttrTable &attrs, vector<double> &missing)
+{
+    for (AttrTable::Attr_iter i = attrs.attr_begin(); i != attrs.attr_end(); ++i) {
+        string name = attrs.get_name(i);
+        if (name == "_FillValue" || name == "missing_value") {
+            for (unsigned int v = 0; v < attrs.get_attr_num(i); v++) {
+                istringstream iss(attrs.get_attr(i, v));
+                double value;
+                iss >> value;
+                if (!iss.fail()) missing.push_back(value);
+            }
+        }
+    }
+}
+
+/** @brief The range of the values of an array given by its
+ * actual_range attribute
+ *
+ * @return true if the attribute has two numbers, smallest first
+ */
+static bool actual_range(AttrTable &attrs, double &low, double &high)
+{
+    AttrTable::Attr_iter i = attrs.simple_find("actual_range");
+    if (i == attrs.attr_end() || attrs.get_attr_num(i) != 2) return false;
+
+    istringstream first(attrs.get_attr(i, 0));
+    istringstream last(attrs.get_attr(i, 1));
+    first >> low;
+    last >> high;
+    return !first.fail() && !last.fail() && low <= high;
+}
+
+/** @brief The value of an attribute, without the quotes of a DAP2
+ * string attribute
+ */
+static string attribute_value(AttrTable &attrs, const string &name)
+{
+    string value = attrs.get_attr(name);
+    if (value.size() >= 2 && value[0] == '"' && value[value.size() - 1] == '"')
+        value = value.substr(1, value.size() - 2);
+    return value;
+}
+
+/** @brief Is an array the coordinate variable of a CF time axis?
+ *
+ * It is if it has the attribute axis=T, standard_name=time, or units of
+ * the form 'units since date'.
+ *
+ * @param a A one dimensional array named for its dimension
+ */
+static bool time_axis(Array *a)
+{
+    AttrTable &attrs = a->get_attr_table();
+    return attribute_value(attrs, "axis") == "T" || attribute_value(attrs, "standard_name") == "time"
+        || attribute_value(attrs, "units").find(" since ") != string::npos;
+}
+
 /** @brief Converts the DAP Array to a FONcArray
  *
  * Does this by converting the name to a valid netcdf variable name,
@@ -107,11 +209,63 @@ FONcArray::~FONcArray()
 void FONcArray::convert(vector<string> embed)
 {
     FONcBaseType::convert(embed);
-    _varname = FONcUtils::gen_name(embed, _varname, _orig_varname);
+    _varname = FONcUtils::gen_var_name(embed, _varname, _orig_varname);
 
     BESDEBUG("fonc", "FONcArray::convert() - converting array " << _varname << endl);
 
     d_array_type = FONcUtils::get_nc_type(d_a->var());
+
+    // Arrays of Enums are arrays of a netcdf enum type when the file uses
+    // the enhanced data model. d_array_type is then the integer type of
+    // the enum, which holds the values just as DAP4 does.
+    if (d_a->var()->type() == dods_enum_c && FONcUtils::enhanced_model) {
+        D4Enum *e = static_cast<D4Enum *>(d_a->var());
+        d_enum = e->enumeration();
+        d_array_type = FONcEnum::base_type(e->element_type());
+    }
+
+    if (d_array_type == NC_INT64 || d_array_type == NC_UINT64)
+        FONcUtils::require_enhanced_model(d_a->var()->type_name(), d_a->name());
+
+    // Arrays of Structures can be stored as arrays of a compound type,
+    // but only in netCDF-4 files that use the enhanced data model, and
+    // only if every member is simple. Otherwise each member is stored as
+    // an array of its own.
+    if (d_a->var()->type() == dods_structure_c) {
+        bool compound = isNetCDF4() && !FONcSettings::Current.classic_model
+            && FONcRequestHandler::compound_structure_arrays && convert_compound();
+        if (!compound) {
+            convert_members(embed);
+            return;
+        }
+    }
+
+    // With FONc.LazyReads the values of numeric Arrays, including the
+    // arrays of Grids, are not read before the transform, but one slab at
+    // a time as they are written. Arrays whose values are needed now
+    // (strings, compounds, the maps of Grids and other coordinate
+    // variables) are read here.
+    if (!d_a->read_p()) {
+        bool numeric = d_array_type != NC_NAT && d_array_type != NC_CHAR;
+        Grid *g = dynamic_cast<Grid *>(d_a->get_parent());
+        bool maybe_map = g ? g->get_array() != d_a
+            : (d_a->dimensions() == 1 && d_a->name() == d_a->dimension_name(d_a->dim_begin()));
+        if (numeric && !d_is_compound && !maybe_map && d_a->dimensions() > 0) {
+            d_lazy = true;
+            Array::Dim_iter di = d_a->dim_begin();
+            for (; di != d_a->dim_end(); di++) {
+                d_lazy_start.push_back(d_a->dimension_start(di, true));
+                d_lazy_stride.push_back(d_a->dimension_stride(di, true));
+                d_lazy_stop.push_back(d_a->dimension_stop(di, true));
+            }
+            BESDEBUG("fonc", "FONcArray::convert() - " << _varname << " will be read lazily" << endl);
+        }
+        else {
+            d_a->read();
+            d_a->set_read_p(true);
+        }
+    }
+
     d_ndims = d_a->dimensions();
     d_actual_ndims = d_ndims; //replace this with _a->dimensions(); below TODO
     if (d_array_type == NC_CHAR) {
@@ -120,14 +274,31 @@ void FONcArray::convert(vector<string> embed)
         d_ndims++;
     }
 
-    d_dim_ids.reserve(d_ndims);
-    d_dim_sizes.reserve(d_ndims);
+    d_dim_ids.resize(d_ndims);
+    d_dim_sizes.resize(d_ndims);
 
     Array::Dim_iter di = d_a->dim_begin();
     Array::Dim_iter de = d_a->dim_end();
     int dimnum = 0;
     for (; di != de; di++) {
         int size = d_a->dimension_size(di, true);
+
+        // The dimensions of an overview are reduced in every array that
+        // uses them, so they stay shared
+        size_t factor = 1;
+        if (FONcSettings::Current.overview_factor > 1 && ReducedDims.count(d_a->dimension_name(di)))
+            factor = FONcSettings::Current.overview_factor;
+        d_in_sizes.push_back(size);
+        d_reduce.push_back(factor);
+        if (factor > 1) {
+            if (d_is_compound) {
+                string err = "fileout.netcdf - " + _varname + " is an array of structures, which cannot be reduced";
+                throw BESInternalError(err, __FILE__, __LINE__);
+            }
+            size = (size + factor - 1) / factor;
+            d_reduced = true;
+        }
+
         d_dim_sizes[dimnum] = size;
         d_nelements *= size;
 
@@ -141,10 +312,16 @@ void FONcArray::convert(vector<string> embed)
         // same name and same size as another dimension, then it is a
         // shared dimension. Create it only once and share the FONcDim
         FONcDim *use_dim = find_dim(embed, d_a->dimension_name(di), size);
+        // Only a dimension that comes first in every array can be the
+        // record dimension
+        if (dimnum > 0) use_dim->set_inner();
         d_dims.push_back(use_dim);
         dimnum++;
     }
 
+    if (d_actual_ndims == 1 && d_a->name() == d_a->dimension_name(d_a->dim_begin()) && time_axis(d_a))
+        d_dims[0]->set_time();
+
     // if this array is a string array, then add the length dimension
     if (d_array_type == NC_CHAR) {
         // get the data from the dap array
@@ -153,6 +330,30 @@ void FONcArray::convert(vector<string> embed)
         d_str_data.reserve(array_length);
         d_a->value(d_str_data);
 
+        // An overview of strings has the first string of each block
+        if (d_reduced) {
+            vector<string> first(d_nelements);
+            vector<size_t> index(d_actual_ndims, 0);
+            for (int element = 0; element < d_nelements; element++) {
+                size_t offset = 0;
+                for (int d = 0; d < d_actual_ndims; d++)
+                    offset = offset * d_in_sizes[d] + index[d] * d_reduce[d];
+                first[element].swap(d_str_data[offset]);
+                for (int d = d_actual_ndims - 1; d >= 0 && ++index[d] == d_dim_sizes[d]; d--)
+                    index[d] = 0;
+            }
+            d_str_data.swap(first);
+            array_length = d_nelements;
+        }
+
+        // Report the copy of the strings; it is kept until this object
+        // is deleted.
+        size_t str_bytes = array_length * sizeof(string);
+        for (int i = 0; i < array_length; i++)
+            str_bytes += d_str_data[i].capacity();
+        FONcMemoryAccountant::TheAccountant()->reserve(str_bytes, false, "the strings of " + _varname);
+        d_str_bytes = str_bytes;
+
         // determine the max length of the strings
         size_t max_length = 0;
         for (int i = 0; i < array_length; i++) {
@@ -165,6 +366,7 @@ void FONcArray::convert(vector<string> embed)
         string lendim_name = _varname + "_len";
 
         FONcDim *use_dim = find_dim(empty_embed, lendim_name, max_length, true);
+        use_dim->set_inner();
         // Added static_cast to suppress warning. 12.27.2011 jhrg
         if (use_dim->size() < static_cast<int>(max_length)) {
             use_dim->update_size(max_length);
@@ -184,6 +386,22 @@ void FONcArray::convert(vector<string> embed)
         d_chunksizes.push_back(max_length <= MAX_CHUNK_SIZE ? max_length: MAX_CHUNK_SIZE);
     }
 
+    // Floating point arrays, including the arrays of Grids, can be packed
+    // into integers or quantized, but not the maps of Grids or the other
+    // coordinate variables.
+    Grid *grid = dynamic_cast<Grid *>(d_a->get_parent());
+    bool coordinate = grid ? grid->get_array() != d_a
+        : (d_actual_ndims == 1 && d_a->name() == d_a->dimension_name(d_a->dim_begin()));
+    if ((d_array_type == NC_FLOAT || d_array_type == NC_DOUBLE) && !coordinate) {
+        if (FONcSettings::Current.packs(d_a->name()) && !d_reduced)
+            convert_packed();
+        if (!d_is_packed && FONcSettings::Current.quantizes(d_a->name()))
+            convert_quantized();
+    }
+
+    // The values that are skipped when the blocks are reduced
+    if (d_reduced && d_missing.empty()) missing_values(d_a->get_attr_table(), d_missing);
+
     // If this array has a single dimension, and the name of the array
     // and the name of that dimension are the same, then this array
     // might be used as a map for a grid defined elsewhere.
@@ -255,6 +473,682 @@ FONcArray::find_dim(vector<string> &embed, const string &name, int size, bool ig
     return ret_dim;
 }
 
+/** @brief Make a dimension the record (unlimited) dimension of the file
+ *
+ * The dimension is found by name or, if spec is 'time' and no dimension
+ * has that name, as the dimension of a CF time axis. It is not used if
+ * it is not the first dimension of every array that uses it.
+ *
+ * @param spec The name of the dimension, or time; empty for none
+ * @return The record dimension, or null if there is none
+ */
+FONcDim *FONcArray::set_record_dimension(const string &spec)
+{
+    if (spec.empty()) return 0;
+
+    FONcDim *record = 0;
+    vector<FONcDim *>::iterator i = FONcArray::Dimensions.begin();
+    vector<FONcDim *>::iterator e = FONcArray::Dimensions.end();
+    for (; i != e && !record; i++) {
+        if ((*i)->name() == spec) record = *i;
+    }
+    for (i = FONcArray::Dimensions.begin(); i != e && !record && spec == "time"; i++) {
+        if ((*i)->time()) record = *i;
+    }
+
+    if (!record) {
+        BESDEBUG("fonc", "FONcArray::set_record_dimension() - no dimension matches " << spec << endl);
+        return 0;
+    }
+    if (record->inner()) {
+        BESDEBUG("fonc", "FONcArray::set_record_dimension() - " << record->name()
+            << " is not the first dimension of every array, so it cannot be the record dimension" << endl);
+        return 0;
+    }
+
+    BESDEBUG("fonc", "FONcArray::set_record_dimension() - " << record->name() << " is the record dimension" << endl);
+    record->set_unlimited();
+    return record;
+}
+
+/** @brief Map a member of a Structure to a compound field type
+ *
+ * The compound fields use the netCDF-4 unsigned types, so unlike the
+ * netCDF-3 mapping, the values need no conversion when they are copied
+ * into the compound buffer.
+ *
+ * @param field The Structure member
+ * @param size Set to the size in bytes of the field
+ * @returns The netcdf type of the field, NC_NAT if it cannot be a field
+ */
+static nc_type compound_field_type(BaseType *field, size_t &size)
+{
+    switch (field->type()) {
+    case dods_byte_c:
+    case dods_uint8_c:
+        size = 1;
+        return NC_UBYTE;
+    case dods_int8_c:
+        size = 1;
+        return NC_BYTE;
+    case dods_int16_c:
+        size = 2;
+        return NC_SHORT;
+    case dods_uint16_c:
+        size = 2;
+        return NC_USHORT;
+    case dods_int32_c:
+        size = 4;
+        return NC_INT;
+    case dods_uint32_c:
+        size = 4;
+        return NC_UINT;
+    case dods_int64_c:
+        size = 8;
+        return NC_INT64;
+    case dods_uint64_c:
+        size = 8;
+        return NC_UINT64;
+    case dods_float32_c:
+        size = 4;
+        return NC_FLOAT;
+    case dods_float64_c:
+        size = 8;
+        return NC_DOUBLE;
+    default:
+        size = 0;
+        return NC_NAT;
+    }
+}
+
+/** @brief Lay out the compound type for an Array of Structures
+ *
+ * Each member of the Structure that is to be sent becomes a field of the
+ * compound, aligned on its own size as a C compiler would. Only simple
+ * numeric members can be fields.
+ *
+ * @return false, with nothing laid out, if a member of the Structure is
+ * not a simple numeric type
+ */
+bool FONcArray::convert_compound()
+{
+    Structure *s = dynamic_cast<Structure *>(d_a->var());
+    if (!s) {
+        string err = "fileout.netcdf - Array " + _varname + " does not hold a Structure";
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
+
+    size_t offset = 0;
+    size_t max_align = 1;
+    Constructor::Vars_iter vi = s->var_begin();
+    Constructor::Vars_iter ve = s->var_end();
+    for (; vi != ve; vi++) {
+        if (!(*vi)->send_p()) continue;
+
+        CompoundField field;
+        size_t size;
+        field.name = FONcUtils::id2netcdf((*vi)->name());
+        field.type = compound_field_type(*vi, size);
+        if (field.type == NC_NAT) {
+            BESDEBUG("fonc", "FONcArray::convert_compound() - member " << (*vi)->name() << " of " << _varname
+                << " cannot be a compound field" << endl);
+            d_fields.clear();
+            return false;
+        }
+
+        offset = (offset + size - 1) / size * size;
+        field.offset = offset;
+        offset += size;
+        if (size > max_align) max_align = size;
+
+        d_fields.push_back(field);
+    }
+
+    d_compound_size = (offset + max_align - 1) / max_align * max_align;
+    d_is_compound = true;
+
+    BESDEBUG("fonc", "FONcArray::convert_compound() - " << _varname << " has " << d_fields.size() << " fields, "
+        << d_compound_size << " bytes per element" << endl);
+    return true;
+}
+
+/** @brief Make an array of one member of the elements of an Array of
+ * Structures
+ *
+ * The array has the dimensions of the Array of Structures, followed by
+ * those of the member if it is an array itself.
+ *
+ * @param member The member, in the template Structure of the array
+ * @param index The position of the member in the Structure
+ * @return The array, or null if the member cannot be stored this way (a
+ * Sequence or Grid)
+ * @throws BESInternalError if an element is missing
+ */
+Array *FONcArray::member_array(BaseType *member, int index)
+{
+    Array *inner = dynamic_cast<Array *>(member);
+    BaseType *proto = inner ? inner->var() : member;
+    Type type = proto->type();
+    if (type == dods_sequence_c || type == dods_grid_c || type == dods_array_c || type == dods_opaque_c)
+        return 0;
+
+    std::auto_ptr<Array> a(new Array(member->name(), proto));
+    a->set_attr_table(member->get_attr_table());
+
+    Array::Dim_iter di = d_a->dim_begin();
+    Array::Dim_iter de = d_a->dim_end();
+    for (; di != de; di++)
+        a->append_dim(d_a->dimension_size(di, true), d_a->dimension_name(di));
+    int per_element = 1;
+    if (inner) {
+        di = inner->dim_begin();
+        de = inner->dim_end();
+        for (; di != de; di++) {
+            a->append_dim(inner->dimension_size(di, true), inner->dimension_name(di));
+            per_element *= inner->dimension_size(di, true);
+        }
+    }
+
+    int length = d_a->length();
+    int total = length * per_element;
+    a->set_length(total);
+    if (type == dods_structure_c) a->vec_resize(total);
+
+    size_t width = proto->width();
+    vector<char> values;
+    if (proto->is_simple_type() && type != dods_str_c && type != dods_url_c) values.resize(total * width);
+    vector<string> strs;
+
+    for (int element = 0; element < length; element++) {
+        Structure *s = dynamic_cast<Structure *>(d_a->var(element));
+        if (!s) {
+            string err = (string) "fileout.netcdf - Missing element of array of structures " + _varname;
+            throw BESInternalError(err, __FILE__, __LINE__);
+        }
+        BaseType *v = *(s->var_begin() + index);
+
+        if (type == dods_structure_c) {
+            for (int i = 0; i < per_element; i++)
+                a->set_vec(element * per_element + i, inner ? static_cast<Array *>(v)->var(i) : v);
+        }
+        else if (type == dods_str_c || type == dods_url_c) {
+            if (inner) {
+                vector<string> element_strs;
+                static_cast<Array *>(v)->value(element_strs);
+                strs.insert(strs.end(), element_strs.begin(), element_strs.end());
+            }
+            else {
+                strs.push_back(static_cast<Str *>(v)->value());
+            }
+        }
+        else if (!values.empty()) {
+            void *value = &values[element * per_element * width];
+            v->buf2val(&value);
+        }
+    }
+
+    if (!strs.empty())
+        a->set_value(strs, total);
+    else if (!values.empty())
+        a->val2buf(&values[0]);
+
+    a->set_send_p(true);
+    a->set_read_p(true);
+    return a.release();
+}
+
+/** @brief Store each member of an Array of Structures as an array of its
+ * own
+ *
+ * The members are named as the members of a Structure are, with the
+ * name of the array embedded: member m of the array a becomes a.m. A
+ * member that is a Structure becomes an Array of Structures in turn.
+ *
+ * @param embed The parent names of this array
+ * @throws BESInternalError if an element is missing
+ */
+void FONcArray::convert_members(vector<string> embed)
+{
+    BESDEBUG("fonc", "FONcArray::convert_members() - storing the members of " << _varname << " as arrays" << endl);
+
+    if (!d_a->read_p()) {
+        d_a->read();
+        d_a->set_read_p(true);
+    }
+
+    embed.push_back(name());
+
+    Structure *s = dynamic_cast<Structure *>(d_a->var());
+    int index = 0;
+    Constructor::Vars_iter vi = s->var_begin();
+    Constructor::Vars_iter ve = s->var_end();
+    for (; vi != ve; vi++, index++) {
+        if (!(*vi)->send_p()) continue;
+
+        Array *member = member_array(*vi, index);
+        if (!member) {
+            BESDEBUG("fonc", "FONcArray::convert_members() - skipping member " << (*vi)->name() << endl);
+            continue;
+        }
+        d_member_arrays.push_back(member);
+
+        FONcArray *fa = new FONcArray(member);
+        fa->setVersion(_ncVersion);
+        d_members.push_back(fa);
+        fa->convert(embed);
+    }
+
+    // Nothing of the array itself is defined or written
+    if (d_members.empty()) d_dont_use_it = true;
+}
+
+/** @brief Define the compound type used by this Array
+ *
+ * The type is named for the variable with a '_t' suffix. Once defined,
+ * d_array_type holds the id of the new type.
+ *
+ * @param ncid The id of the NetCDF file or group
+ * @throws BESInternalError if the type cannot be defined
+ */
+void FONcArray::define_compound(int ncid)
+{
+    string type_name = _varname + "_t";
+    int stax = nc_def_compound(ncid, d_compound_size, type_name.c_str(), &d_array_type);
+    if (stax != NC_NOERR) {
+        string err = (string) "fileout.netcdf - Failed to define compound type " + type_name;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+
+    vector<CompoundField>::iterator i = d_fields.begin();
+    vector<CompoundField>::iterator e = d_fields.end();
+    for (; i != e; i++) {
+        stax = nc_insert_compound(ncid, d_array_type, (*i).name.c_str(), (*i).offset, (*i).type);
+        if (stax != NC_NOERR) {
+            string err = (string) "fileout.netcdf - Failed to add field " + (*i).name + " to compound type " + type_name;
+            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+        }
+    }
+}
+
+/** @brief Write an Array of Structures as an array of compound values
+ *
+ * The fields of every element are packed into a single buffer that is
+ * written with one call to the netcdf library.
+ *
+ * @param ncid The id of the NetCDF file or group
+ * @throws BESInternalError if an element is not a Structure or the
+ * values cannot be written
+ */
+void FONcArray::write_compound(int ncid)
+{
+    if (d_nelements == 0) return;
+
+    FONcMemoryReservation reservation(d_compound_size * d_nelements, false, _varname);
+    vector<char> fallback;
+    char *data = FONcArena::scratch(d_compound_size * d_nelements, fallback);
+    memset(data, 0, d_compound_size * d_nelements);
+
+    for (int element = 0; element < d_nelements; element++) {
+        Structure *s = dynamic_cast<Structure *>(d_a->var(element));
+        if (!s) {
+            string err = (string) "fileout.netcdf - Missing element of array of structures " + _varname;
+            throw BESInternalError(err, __FILE__, __LINE__);
+        }
+
+        char *record = data + element * d_compound_size;
+        vector<CompoundField>::size_type field = 0;
+        Constructor::Vars_iter vi = s->var_begin();
+        Constructor::Vars_iter ve = s->var_end();
+        for (; vi != ve && field < d_fields.size(); vi++) {
+            if (!(*vi)->send_p()) continue;
+
+            void *value = record + d_fields[field].offset;
+            (*vi)->buf2val(&value);
+            field++;
+        }
+    }
+
+    vector<size_t> start(d_ndims, 0);
+    FONcUtils::put_vara(ncid, _varid, d_ndims, &start[0], &d_dim_sizes[0], data, d_compound_size, _varname);
+}
+
+/** @brief Set up an array of floating point values to be packed
+ *
+ * The values are stored as shorts or bytes (FONcSettings pack_bits) that
+ * readers unpack using the CF scale_factor and add_offset attributes.
+ * Arrays that are already packed are left alone. Values that match the
+ * _FillValue or missing_value of the array are stored as the _FillValue
+ * of the packed type.
+ */
+void FONcArray::convert_packed()
+{
+    AttrTable &attrs = d_a->get_attr_table();
+    for (AttrTable::Attr_iter i = attrs.attr_begin(); i != attrs.attr_end(); ++i) {
+        string name = attrs.get_name(i);
+        if (name == "scale_factor" || name == "add_offset") {
+            BESDEBUG("fonc", "FONcArray::convert_packed() - " << _varname << " is already packed" << endl);
+            return;
+        }
+    }
+
+    // The range of the values of an array read lazily comes from its
+    // actual_range attribute or from reading it once more before it is
+    // written; that extra read is limited to arrays within
+    // FONc.InMemoryThreshold
+    size_t threshold = static_cast<size_t>(FONcSettings::Current.in_memory_threshold) * 1024;
+    size_t width = (d_array_type == NC_FLOAT) ? sizeof(dods_float32) : sizeof(dods_float64);
+    double low, high;
+    if (d_lazy && threshold > 0 && d_nelements * width > threshold && !actual_range(attrs, low, high)) {
+        BESDEBUG("fonc", "FONcArray::convert_packed() - " << _varname << " is read lazily, larger than the "
+            << "in-memory threshold and has no actual_range, so it is not packed" << endl);
+        return;
+    }
+
+    d_is_packed = true;
+    d_unpacked_type = d_array_type;
+    d_array_type = FONcSettings::Current.pack_bits == 8 ? NC_BYTE : NC_SHORT;
+    missing_values(attrs, d_missing);
+
+    BESDEBUG("fonc", "FONcArray::convert_packed() - packing " << _varname << " into "
+        << FONcSettings::Current.pack_bits << " bits" << endl);
+}
+
+/** @brief Set up an array of floating point values to be quantized
+ *
+ * Quantizing sets the bits of each value that are not needed for the
+ * requested precision to zero (or, for BitGroom, alternately to zero and
+ * one) so that deflate compresses them well. The number of digits (or
+ * bits, for BitRound) is limited to the precision of the type.
+ */
+void FONcArray::convert_quantized()
+{
+    d_quantize_algorithm = FONcSettings::Current.quantize_algorithm;
+    d_quantize_digits = FONcSettings::Current.quantize_digits;
+
+    int most;
+    if (d_quantize_algorithm == FONcSettings::quantize_bitround)
+        most = (d_array_type == NC_FLOAT) ? 23 : 52;
+    else
+        most = (d_array_type == NC_FLOAT) ? 7 : 15;
+    if (d_quantize_digits > most) d_quantize_digits = most;
+
+    missing_values(d_a->get_attr_table(), d_missing);
+
+    BESDEBUG("fonc", "FONcArray::convert_quantized() - quantizing " << _varname << " with algorithm "
+        << d_quantize_algorithm << " to " << d_quantize_digits << endl);
+}
+
+/** @brief Find the smallest and largest values of an array
+ *
+ * NaNs and missing values are skipped.
+ *
+ * @return false if there are no values that are not missing
+ */
+template<typename T>
+static bool value_range(const T *values, size_t n, const vector<double> &missing, double &low, double &high)
+{
+    vector<T> skip(missing.begin(), missing.end());
+    bool found = false;
+    T lo = 0, hi = 0;
+    for (size_t i = 0; i < n; i++) {
+        T v = values[i];
+        if (v != v || std::find(skip.begin(), skip.end(), v) != skip.end()) continue;
+        if (!found) {
+            lo = hi = v;
+            found = true;
+        }
+        else if (v < lo)
+            lo = v;
+        else if (v > hi)
+            hi = v;
+    }
+    low = lo;
+    high = hi;
+    return found;
+}
+
+/** @brief Pack floating point values into integers
+ *
+ * @param src The values
+ * @param dst The packed values
+ * @param n The number of values
+ * @param scale The scale_factor
+ * @param offset The add_offset
+ * @param missing Values stored as fill values, as are NaNs
+ * @param limit The largest packed value; -limit is the smallest and
+ * -limit - 1 is the fill value
+ */
+template<typename SRC, typename DST>
+static void pack(const SRC *src, DST *dst, size_t n, double scale, double offset, const vector<double> &missing,
+    int limit)
+{
+    vector<SRC> skip(missing.begin(), missing.end());
+    const DST fill = static_cast<DST>(-limit - 1);
+    const double inverse = 1.0 / scale;
+    for (size_t i = 0; i < n; i++) {
+        SRC v = src[i];
+        if (v != v || std::find(skip.begin(), skip.end(), v) != skip.end()) {
+            dst[i] = fill;
+            continue;
+        }
+        double p = floor((v - offset) * inverse + 0.5);
+        if (p > limit) p = limit;
+        if (p < -limit) p = -limit;
+        dst[i] = static_cast<DST>(p);
+    }
+}
+
+/** @brief Compute the scale_factor and add_offset of a packed array
+ *
+ * The values between the smallest and largest value are mapped onto all
+ * but one of the values of the packed type; the remaining one, the most
+ * negative, is the _FillValue. The range of an array read lazily is
+ * taken from its actual_range attribute if it has one.
+ */
+void FONcArray::pack_range()
+{
+    double low = 0, high = 0;
+    bool found = false;
+
+    if (d_lazy && actual_range(d_a->get_attr_table(), low, high)) {
+        found = true;
+    }
+    else if (d_nelements > 0) {
+        // Other arrays read lazily are read twice, once here and again as
+        // they are written; convert_packed() only packs those within
+        // FONc.InMemoryThreshold
+        size_t width = (d_unpacked_type == NC_FLOAT) ? sizeof(dods_float32) : sizeof(dods_float64);
+        int split = 0;
+        size_t split_count = d_dim_sizes[0];
+        if (d_lazy) plan_slabs(width, d_ndims, split, split_count);
+
+        vector<size_t> start(d_ndims, 0);
+        vector<size_t> count(d_dim_sizes.begin(), d_dim_sizes.end());
+        size_t total = d_nelements;
+        try {
+            for (size_t offset = 0; offset < total;) {
+                size_t n = slab_at(offset, total, split, split_count, start, count);
+                const char *in = d_lazy ? read_slab(start, count) : d_a->get_buf() + offset * width;
+                double slab_low, slab_high;
+                bool slab_found;
+                if (d_unpacked_type == NC_FLOAT)
+                    slab_found = value_range(reinterpret_cast<const dods_float32 *>(in), n, d_missing, slab_low,
+                        slab_high);
+                else
+                    slab_found = value_range(reinterpret_cast<const dods_float64 *>(in), n, d_missing, slab_low,
+                        slab_high);
+                if (slab_found) {
+                    low = found ? std::min(low, slab_low) : slab_low;
+                    high = found ? std::max(high, slab_high) : slab_high;
+                    found = true;
+                }
+                offset += n;
+            }
+        }
+        catch (...) {
+            // Put the constraint back so the array can be written again
+            if (d_lazy) end_slabs();
+            throw;
+        }
+        if (d_lazy) end_slabs();
+    }
+
+    double steps = (d_array_type == NC_BYTE) ? 254.0 : 65534.0;
+    if (!found || high == low) {
+        d_scale_factor = 1.0;
+        d_add_offset = low;
+    }
+    else {
+        d_scale_factor = (high - low) / steps;
+        d_add_offset = (high + low) / 2.0;
+    }
+
+    BESDEBUG("fonc", "FONcArray::pack_range() - " << _varname << " range: " << low << " to " << high
+        << ", scale_factor: " << d_scale_factor << ", add_offset: " << d_add_offset << endl);
+}
+
+/** @brief Fill a buffer with packed values
+ *
+ * @param in The first value
+ * @param first The index of the first value
+ * @param n The number of values
+ * @param out The buffer, with room for n packed values
+ */
+void FONcArray::fill_packed(const char *in, size_t /*first*/, size_t n, char *out) const
+{
+    int limit = (d_array_type == NC_BYTE) ? 127 : 32767;
+    if (d_unpacked_type == NC_FLOAT) {
+        const dods_float32 *values = reinterpret_cast<const dods_float32 *>(in);
+        if (d_array_type == NC_BYTE)
+            pack(values, reinterpret_cast<signed char *>(out), n, d_scale_factor, d_add_offset, d_missing, limit);
+        else
+            pack(values, reinterpret_cast<short *>(out), n, d_scale_factor, d_add_offset, d_missing, limit);
+    }
+    else {
+        const dods_float64 *values = reinterpret_cast<const dods_float64 *>(in);
+        if (d_array_type == NC_BYTE)
+            pack(values, reinterpret_cast<signed char *>(out), n, d_scale_factor, d_add_offset, d_missing, limit);
+        else
+            pack(values, reinterpret_cast<short *>(out), n, d_scale_factor, d_add_offset, d_missing, limit);
+    }
+}
+
+/** @brief Quantize floating point values
+ *
+ * This is used when the netcdf library cannot quantize the values
+ * itself. The bits below the precision to keep are rounded away
+ * (BitRound, GranularBR) or alternately shaved and set (BitGroom), as
+ * netCDF-C does. NaNs, infinities, zeros and missing values are copied
+ * unchanged.
+ *
+ * @param src The values
+ * @param dst The quantized values
+ * @param n The number of values
+ * @param first The index of the first value in the array; BitGroom
+ * alternates on it
+ * @param algorithm One of the FONcSettings QuantizeAlgorithm values
+ * @param digits The significant digits (bits for BitRound) to keep
+ * @param missing Values that are not quantized
+ */
+template<typename F, typename U>
+static void quantize(const F *src, F *dst, size_t n, size_t first, int algorithm, int digits,
+    const vector<double> &missing)
+{
+    const int mantissa_bits = (sizeof(F) == 4) ? 23 : 52;
+    const double bits_per_digit = 3.32192809488736; // log2(10)
+
+    int keep = digits;
+    if (algorithm == FONcSettings::quantize_bitgroom)
+        keep = static_cast<int>(ceil(digits * bits_per_digit)) + 1;
+
+    vector<F> skip(missing.begin(), missing.end());
+    for (size_t i = 0; i < n; i++) {
+        F v = src[i];
+        dst[i] = v;
+        if (v != v || v - v != 0 || v == 0 || std::find(skip.begin(), skip.end(), v) != skip.end()) continue;
+
+        if (algorithm == FONcSettings::quantize_granularbr) {
+            // Keep the bits down to the power of two just below the
+            // last significant decimal digit of this value
+            int exponent;
+            frexp(v, &exponent);
+            double digit = floor(log10(fabs(static_cast<double>(v)))) + 1;
+            int quantum = static_cast<int>(floor((digit - digits) * bits_per_digit));
+            keep = exponent - 1 - quantum;
+            if (keep < 1) keep = 1;
+        }
+        if (keep >= mantissa_bits) continue;
+
+        int zero_bits = mantissa_bits - keep;
+        U mask = ~((static_cast<U>(1) << zero_bits) - 1);
+        U u;
+        memcpy(&u, &v, sizeof(U));
+        if (algorithm == FONcSettings::quantize_bitgroom) {
+            if ((first + i) % 2 == 0)
+                u &= mask;
+            else
+                u |= ~mask;
+        }
+        else {
+            u += static_cast<U>(1) << (zero_bits - 1);
+            u &= mask;
+        }
+        memcpy(&dst[i], &u, sizeof(U));
+    }
+}
+
+/** @brief Fill a buffer with quantized values
+ *
+ * @param in The first value
+ * @param first The index of the first value
+ * @param n The number of values
+ * @param out The buffer, with room for n values
+ */
+void FONcArray::fill_quantized(const char *in, size_t first, size_t n, char *out) const
+{
+    if (d_array_type == NC_FLOAT)
+        quantize<dods_float32, uint32_t>(reinterpret_cast<const dods_float32 *>(in),
+            reinterpret_cast<dods_float32 *>(out), n, first, d_quantize_algorithm, d_quantize_digits, d_missing);
+    else
+        quantize<dods_float64, uint64_t>(reinterpret_cast<const dods_float64 *>(in),
+            reinterpret_cast<dods_float64 *>(out), n, first, d_quantize_algorithm, d_quantize_digits, d_missing);
+}
+
+/** @brief Make the chunks of this array fit the chunk size of the response
+ *
+ * Each chunk starts as up to MAX_CHUNK_SIZE values along each dimension.
+ * If that is larger than the chunk size (in KB) of the response, the
+ * leading dimensions of the chunk are halved until it fits or all but
+ * the last dimension are one value long.
+ *
+ * @param ncid The id of the netcdf file, used to find the size of the
+ * type of the array
+ */
+void FONcArray::fit_chunks(int ncid)
+{
+    size_t type_size = 0;
+    int stax = nc_inq_type(ncid, d_array_type, 0, &type_size);
+    if (stax != NC_NOERR) {
+        string err = "fileout.netcdf - Failed to get the size of the type of " + _varname;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+
+    size_t target = static_cast<size_t>(FONcSettings::Current.chunk_size) * 1024;
+    size_t bytes = type_size;
+    for (vector<size_t>::size_type i = 0; i < d_chunksizes.size(); i++)
+        bytes *= d_chunksizes[i];
+
+    for (vector<size_t>::size_type dim = 0; dim + 1 < d_chunksizes.size() && bytes > target; dim++) {
+        while (d_chunksizes[dim] > 1 && bytes > target) {
+            bytes /= d_chunksizes[dim];
+            d_chunksizes[dim] = (d_chunksizes[dim] + 1) / 2;
+            bytes *= d_chunksizes[dim];
+        }
+    }
+
+    BESDEBUG("fonc", "FONcArray::fit_chunks() - " << _varname << " chunks are " << bytes << " bytes" << endl);
+}
+
 /** @brief define the DAP Array in the netcdf file
  *
  * This includes creating the dimensions, if they haven't already been
@@ -273,6 +1167,14 @@ void FONcArray::define(int ncid)
 {
     BESDEBUG("fonc", "FONcArray::define() - defining array '" << _varname << "'" << endl);
 
+    if (!d_members.empty()) {
+        vector<FONcArray *>::iterator m = d_members.begin();
+        for (; m != d_members.end(); ++m)
+            (*m)->define(ncid);
+        _defined = true;
+        return;
+    }
+
     if (!_defined && !d_dont_use_it) {
         vector<FONcDim *>::iterator i = d_dims.begin();
         vector<FONcDim *>::iterator e = d_dims.end();
@@ -286,7 +1188,17 @@ void FONcArray::define(int ncid)
             dimnum++;
         }
 
-        int stax = nc_def_var(ncid, _varname.c_str(), d_array_type, d_ndims, &d_dim_ids[0], &_varid);
+        if (d_is_compound) define_compound(ncid);
+
+        // Strings and compounds are written whole, as they are read
+        d_record = !d_dims.empty() && d_dims[0]->unlimited() && d_array_type != NC_CHAR && !d_is_compound;
+        if (d_record) {
+            d_record_ncid = ncid;
+            RecordArrays.push_back(this);
+        }
+
+        nc_type var_type = d_enum ? FONcEnum::define_type(ncid, d_enum) : d_array_type;
+        int stax = nc_def_var(ncid, _varname.c_str(), var_type, d_ndims, &d_dim_ids[0], &_varid);
         if (stax != NC_NOERR) {
             string err = (string) "fileout.netcdf - Failed to define variable " + _varname;
             FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
@@ -294,21 +1206,34 @@ void FONcArray::define(int ncid)
 
         if (isNetCDF4()) {
             BESDEBUG("fonc", "FONcArray::define() Working netcdf-4 branch " << endl);
-           if (FONcRequestHandler::chunk_size == 0)
+            // A variable with an unlimited dimension must be chunked; its
+            // records are written one at a time, so a chunk holds one
+            if (!d_dims.empty() && d_dims[0]->unlimited()) {
+                d_chunksizes[0] = 1;
+                if (FONcSettings::Current.chunk_size > 0) fit_chunks(ncid);
+                stax = nc_def_var_chunking(ncid, _varid, NC_CHUNKED, &d_chunksizes[0]);
+            }
+            else if (FONcSettings::Current.chunk_size == 0) {
                 // I have no idea if chunksizes is needed in this case.
                 stax = nc_def_var_chunking(ncid, _varid, NC_CONTIGUOUS, &d_chunksizes[0]);
-            else
+            }
+            else {
+                fit_chunks(ncid);
                 stax = nc_def_var_chunking(ncid, _varid, NC_CHUNKED, &d_chunksizes[0]);
+            }
 
             if (stax != NC_NOERR) {
                 string err = "fileout.netcdf - Failed to define chunking for variable " + _varname;
                 FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
             }
 
-            if (FONcRequestHandler::use_compression) {
-                int shuffle = 0;
+            if ((!d_dims.empty() && d_dims[0]->unlimited()) || FONcSettings::Current.chunk_size > 0)
+                size_chunk_cache(ncid);
+
+            if (FONcSettings::Current.deflate_level > 0) {
+                int shuffle = FONcSettings::Current.shuffle ? 1 : 0;
                 int deflate = 1;
-                int deflate_level = 4;
+                int deflate_level = FONcSettings::Current.deflate_level;
                 stax = nc_def_var_deflate(ncid, _varid, shuffle, deflate, deflate_level);
 
                 if (stax != NC_NOERR) {
@@ -317,6 +1242,19 @@ void FONcArray::define(int ncid)
                     FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
                 }
             }
+
+#ifdef HAVE_NC_DEF_VAR_QUANTIZE
+            // The library quantizes the values as they are written and
+            // adds the attribute that records it
+            if (d_quantize_algorithm) {
+                stax = nc_def_var_quantize(ncid, _varid, d_quantize_algorithm, d_quantize_digits);
+                if (stax != NC_NOERR) {
+                    string err = (string) "fileout.netcdf - Failed to define quantization for variable " + _varname;
+                    FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+                }
+                d_quantize_in_library = true;
+            }
+#endif
         }
 
         // If the array type is NC_SHORT it may have been an unsigned byte type before,
@@ -330,7 +1268,8 @@ void FONcArray::define(int ncid)
         AttrTable &attrs = d_a->get_attr_table();
         if (d_array_type == NC_SHORT && attrs.get_size()) {
             for (AttrTable::Attr_iter iter = attrs.attr_begin(); iter != attrs.attr_end(); iter++)
-                if (attrs.get_name(iter) == "_FillValue" && attrs.get_attr_type(iter) == Attr_byte)
+                if (attrs.get_name(iter) == "_FillValue"
+                    && (attrs.get_attr_type(iter) == Attr_byte || attrs.get_attr_type(iter) == Attr_uint8))
                     (*iter)->type = Attr_int16;
         }
 
@@ -338,6 +1277,15 @@ void FONcArray::define(int ncid)
         FONcAttributes::add_variable_attributes(ncid, _varid, d_a);
         FONcAttributes::add_original_name(ncid, _varid, _varname, _orig_varname);
 
+        if (d_quantize_algorithm && !d_quantize_in_library)
+            FONcAttributes::add_quantize_attribute(ncid, _varid, _varname, d_quantize_algorithm, d_quantize_digits);
+
+        if (d_is_packed) {
+            pack_range();
+            FONcAttributes::add_packing_attributes(ncid, _varid, _varname, d_unpacked_type, d_array_type,
+                d_scale_factor, d_add_offset);
+        }
+
         _defined = true;
     }
     else {
@@ -370,161 +1318,841 @@ void FONcArray::write(int ncid)
         return;
     }
 
-    ncopts = NC_VERBOSE;
-    int stax = NC_NOERR;
+    if (!d_members.empty()) {
+        vector<FONcArray *>::iterator m = d_members.begin();
+        for (; m != d_members.end(); ++m)
+            (*m)->write(ncid);
+        return;
+    }
 
-    if (d_array_type != NC_CHAR) {
-        string var_type = d_a->var()->type_name();
+    if (d_is_compound) {
+        write_compound(ncid);
+        BESDEBUG("fonc", "FONcArray::write() END  var: " << _varname <<  "[" << d_nelements << "]" << endl);
+        return;
+    }
 
-        // create array to hold data hyperslab
-        switch (d_array_type) {
-        case NC_BYTE: {
-            unsigned char *data = new unsigned char[d_nelements];
-            d_a->buf2val((void**) &data);
-            stax = nc_put_var_uchar(ncid, _varid, data);
-            delete[] data;
+    if (d_record) {
+        BESDEBUG("fonc", "FONcArray::write() - " << _varname << " is written with the records" << endl);
+        return;
+    }
 
-            if (stax != NC_NOERR) {
-                string err = "fileout.netcdf - Failed to create array of bytes for " + _varname;
-                FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
-            }
+    ncopts = NC_VERBOSE;
+
+    if (d_array_type == NC_CHAR) {
+        write_strings(ncid);
+    }
+    else {
+        switch (d_array_type) {
+        case NC_BYTE:
+        case NC_UBYTE:
+        case NC_SHORT:
+        case NC_USHORT:
+        case NC_INT:
+        case NC_UINT:
+        case NC_INT64:
+        case NC_UINT64:
+        case NC_FLOAT:
+        case NC_DOUBLE:
             break;
+
+        default:
+            string err = (string) "Failed to transform array of unknown type in file out netcdf";
+            throw BESInternalError(err, __FILE__, __LINE__);
         }
 
-        case NC_SHORT: {
-            short *data = new short[d_nelements];
+        // Every type but those that must be converted is stored in the DAP
+        // buffer just as netcdf expects it, so it is written from that
+        // buffer without a copy.
+        size_t in_width, out_width;
+        Filler fill;
+        if (conversion(in_width, out_width, fill) || d_lazy || d_reduced)
+            write_converted(ncid, in_width, out_width, fill, 0, d_nelements ? d_dim_sizes[0] : 0);
+        else if (d_nelements > 0) {
+            vector<size_t> start(d_ndims, 0);
+            // The values of the DAP Array outlive the writer, so a
+            // FONcWriter can write them without a copy
+            count_chunks(0, d_dim_sizes[0]);
+            if (FONcWriter::Current)
+                FONcWriter::Current->put(ncid, _varid, d_ndims, &start[0], &d_dim_sizes[0], d_a->get_buf(), _varname);
+            else
+                FONcUtils::put_vara(ncid, _varid, d_ndims, &start[0], &d_dim_sizes[0], d_a->get_buf(), value_width(),
+                    _varname);
+        }
+    }
 
-            // Given Byte/UInt8 will always be unsigned they must map
-            // to a NetCDF type that will support unsigned bytes.  This
-            // detects the original variable was of type Byte and typecasts
-            // each data value to a short.
-            if (var_type == "Byte") {
+    release_chunk_cache(ncid);
 
-                unsigned char *orig_data = new unsigned char[d_nelements];
-                d_a->buf2val((void**) &orig_data);
+    BESDEBUG("fonc", "FONcArray::write() END  var: " << _varname <<  "[" << d_nelements << "]" << endl);
+}
 
-                for (int d_i = 0; d_i < d_nelements; d_i++)
-                    data[d_i] = orig_data[d_i];
+/** @brief How the values of the array are converted to the netcdf type
+ *
+ * Given Byte/UInt8 will always be unsigned they must map to a NetCDF type
+ * that will support unsigned bytes, so they are written as shorts. Since
+ * UInt16 also maps to NC_INT, its values are widened to ints. KY
+ * 2012-10-25. Packed and quantized arrays are converted too. The values
+ * of an Enum are those of its integer type.
+ *
+ * @param in_width Set to the size of a DAP value
+ * @param out_width Set to the size of the netcdf value
+ * @param fill Set to the method that converts the values, or null
+ * @return true if the values are converted
+ */
+bool FONcArray::conversion(size_t &in_width, size_t &out_width, Filler &fill) const
+{
+    Type var_type = d_a->var()->type();
+    if (var_type == dods_enum_c) var_type = static_cast<D4Enum *>(d_a->var())->element_type();
+
+    in_width = out_width = value_width();
+    fill = 0;
+    if (d_is_packed) {
+        in_width = d_unpacked_type == NC_FLOAT ? sizeof(dods_float32) : sizeof(dods_float64);
+        out_width = d_array_type == NC_BYTE ? sizeof(signed char) : sizeof(short);
+        fill = &FONcArray::fill_packed;
+    }
+    else if (d_quantize_algorithm && !d_quantize_in_library) {
+        fill = &FONcArray::fill_quantized;
+    }
+    else if (d_array_type == NC_SHORT && (var_type == dods_byte_c || var_type == dods_uint8_c)) {
+        in_width = sizeof(dods_byte);
+        fill = &FONcArray::fill_widened_bytes;
+    }
+    else if (d_array_type == NC_INT && var_type == dods_uint16_c) {
+        in_width = sizeof(dods_uint16);
+        fill = &FONcArray::fill_widened_uint16s;
+    }
 
-                delete[] orig_data;
-            }
-            else {
-                d_a->buf2val((void**) &data);
-            }
-            int stax = nc_put_var_short(ncid, _varid, data);
-            delete[] data;
+    return fill != 0;
+}
 
-            if (stax != NC_NOERR) {
-                string err = (string) "fileout.netcdf - Failed to create array of shorts for " + _varname;
-                FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
-            }
-            break;
+/** @brief The number of rows (along the first dimension) of the slabs
+ * this array will be written in
+ *
+ * The same choice write_converted() makes, except that it cannot know
+ * if the memory budget will allow an array to be converted in one piece.
+ *
+ * @return The number of rows of the array if it is written in one piece,
+ * one if its slabs are parts of a row
+ */
+size_t FONcArray::planned_slab_rows() const
+{
+    if (d_nelements == 0) return 0;
+    if (d_record) return 1;
+
+    int split = 0;
+    size_t split_count = d_dim_sizes[0];
+    if (d_array_type == NC_CHAR) {
+        plan_slabs(1, d_actual_ndims, split, split_count);
+        return split ? 1 : split_count;
+    }
+
+    size_t in_width, out_width;
+    Filler fill;
+    bool converted = conversion(in_width, out_width, fill) || d_reduced;
+    int limit = d_reduced ? 1 : d_ndims;
+    size_t threshold = static_cast<size_t>(FONcSettings::Current.in_memory_threshold) * 1024;
+    if (d_lazy || (FONcRequestHandler::async_writes && converted))
+        plan_slabs(std::max(in_width, out_width), limit, split, split_count);
+    else if (converted && threshold > 0 && d_nelements * out_width > threshold)
+        plan_slabs(out_width, limit, split, split_count);
+
+    return split ? 1 : split_count;
+}
+
+/** @brief Is an odd number prime?
+ */
+static bool odd_prime(size_t n)
+{
+    for (size_t f = 3; f * f <= n; f += 2)
+        if (n % f == 0) return false;
+    return n > 1;
+}
+
+/** @brief Size the chunk cache of a chunked netCDF-4 array for the way
+ * it will be written
+ *
+ * Each slab covers whole rows of the array, or part of one row, so only
+ * the row of chunks (along the first dimension) a slab ends in can be
+ * partly written when the next slab starts; the chunks that slab covers
+ * are finished in the one write. If the slabs do not end on chunk boundaries, the cache is
+ * made to hold a row of chunks and one more, up to FONc.MaxChunkCache KB.
+ * Chunks that are fully written are evicted first.
+ *
+ * @param ncid The id of the netcdf file or group
+ * @throws BESInternalError if the cache cannot be set
+ */
+void FONcArray::size_chunk_cache(int ncid)
+{
+    size_t type_size = 0;
+    int stax = nc_inq_type(ncid, d_array_type, 0, &type_size);
+    if (stax == NC_NOERR)
+        stax = nc_get_var_chunk_cache(ncid, _varid, &d_default_cache.size, &d_default_cache.nelems,
+            &d_default_cache.preemption);
+    if (stax != NC_NOERR) {
+        string err = "fileout.netcdf - Failed to get the chunk cache of " + _varname;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+
+    d_chunk_bytes = type_size;
+    d_chunks_across = 1;
+    for (vector<size_t>::size_type i = 0; i < d_chunksizes.size(); i++) {
+        d_chunk_bytes *= d_chunksizes[i];
+        if (i > 0) d_chunks_across *= (d_dim_sizes[i] + d_chunksizes[i] - 1) / d_chunksizes[i];
+    }
+
+    size_t slab_rows = planned_slab_rows();
+    if (slab_rows == 0 || slab_rows % d_chunksizes[0] == 0 || slab_rows == d_dim_sizes[0]) return;
+
+    size_t needed = (d_chunks_across + 1) * d_chunk_bytes;
+    size_t limit = static_cast<size_t>(FONcRequestHandler::max_chunk_cache) * 1024;
+    if (needed <= d_default_cache.size) return;
+    if (needed > limit) {
+        BESDEBUG("fonc", "FONcArray::size_chunk_cache() - " << _varname << " needs a chunk cache of " << needed
+            << " bytes, more than FONc.MaxChunkCache" << endl);
+        if (limit <= d_default_cache.size) return;
+        needed = limit;
+    }
+
+    // HDF5 wants a prime number of hash slots, many more than the chunks
+    size_t nelems = std::max(d_default_cache.nelems, 10 * (d_chunks_across + 1)) | 1;
+    while (!odd_prime(nelems))
+        nelems += 2;
+
+    stax = nc_set_var_chunk_cache(ncid, _varid, needed, nelems, 1.0f);
+    if (stax != NC_NOERR) {
+        string err = "fileout.netcdf - Failed to set the chunk cache of " + _varname;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+    d_cache_size = needed;
+
+    BESDEBUG("fonc", "FONcArray::size_chunk_cache() - " << _varname << ": slabs of " << slab_rows << " rows, chunks of "
+        << d_chunksizes[0] << " rows, " << d_chunks_across << " chunks per row of " << d_chunk_bytes
+        << " bytes; cache of " << needed << " bytes, " << nelems << " slots" << endl);
+}
+
+/** @brief Estimate the chunks a slab finds in the chunk cache
+ *
+ * The counts come from a model of the cache, which holds the most recent
+ * rows of chunks that fit in it; netcdf does not report its own hits and
+ * misses, and its cache is not strictly least recently used by rows.
+ *
+ * @param row The first row of the slab
+ * @param n The number of rows
+ */
+void FONcArray::count_chunks(size_t row, size_t n)
+{
+    if (!d_chunk_bytes || n == 0) return;
+
+    size_t cache = d_cache_size ? d_cache_size : d_default_cache.size;
+    size_t cached_rows = cache / (d_chunks_across * d_chunk_bytes);
+    size_t first = row / d_chunksizes[0];
+    size_t end = (row + n - 1) / d_chunksizes[0] + 1;
+    for (size_t r = first; r < end; r++) {
+        if (r >= d_cached_first && r < d_cached_end) {
+            d_cache_hits += d_chunks_across;
         }
+        else {
+            d_cache_misses += d_chunks_across;
+            if (r < d_cached_end) d_cache_rereads += d_chunks_across;
+        }
+    }
+    d_cached_end = std::max(d_cached_end, end);
+    d_cached_first = d_cached_end > cached_rows ? d_cached_end - cached_rows : 0;
+}
 
-        case NC_INT: {
-            int *data = new int[d_nelements];
-            // Since UInt16 also maps to NC_INT, we need to obtain the data correctly
-            // KY 2012-10-25
-            if (var_type == "UInt16") {
-                unsigned short *orig_data = new unsigned short[d_nelements];
-                d_a->buf2val((void**) &orig_data);
+/** @brief Report the chunk cache counts of this array and put back the
+ * default cache
+ *
+ * Setting the cache again flushes the chunks of the array, so its memory
+ * is freed before the next array is written.
+ *
+ * @param ncid The id of the netcdf file or group
+ * @throws BESInternalError if the cache cannot be set
+ */
+void FONcArray::release_chunk_cache(int ncid)
+{
+    if (!d_chunk_bytes) return;
 
-                for (int d_i = 0; d_i < d_nelements; d_i++)
-                    data[d_i] = orig_data[d_i];
+    // These are counted from a model of the cache, not read from netcdf
+    BESDEBUG("fonc", "FONcArray::release_chunk_cache() - " << _varname << " chunk cache, estimated: " << d_cache_hits
+        << " hits, " << d_cache_misses << " misses, " << d_cache_rereads << " read back" << endl);
 
-                delete[] orig_data;
-            }
-            else {
-                d_a->buf2val((void**) &data);
-            }
+    if (!d_cache_size) return;
 
-            int stax = nc_put_var_int(ncid, _varid, data);
-            delete[] data;
+    // The writer may still be writing this array
+    if (FONcWriter::Current) FONcWriter::Current->sync();
 
-            if (stax != NC_NOERR) {
-                string err = (string) "fileout.netcdf - Failed to create array of ints for " + _varname;
-                FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
-            }
-            break;
+    int stax = nc_set_var_chunk_cache(ncid, _varid, d_default_cache.size, d_default_cache.nelems,
+        d_default_cache.preemption);
+    if (stax != NC_NOERR) {
+        string err = "fileout.netcdf - Failed to set the chunk cache of " + _varname;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+    d_cache_size = 0;
+}
+
+/** @brief Write the arrays that use the record dimension
+ *
+ * The arrays are written one record at a time, each record of every
+ * array in turn, which is the order of the records in a netCDF-3 file.
+ * So a streamed response never holds more than a record of each array,
+ * and an array read lazily is read one record at a time.
+ *
+ * @throws BESInternalError if the values cannot be written
+ */
+void FONcArray::write_records()
+{
+    if (RecordArrays.empty()) return;
+
+    size_t records = RecordArrays[0]->d_dim_sizes[0];
+    BESDEBUG("fonc", "FONcArray::write_records() - writing " << records << " records of " << RecordArrays.size()
+        << " arrays" << endl);
+
+    for (size_t record = 0; record < records; record++) {
+        vector<FONcArray *>::iterator i = RecordArrays.begin();
+        vector<FONcArray *>::iterator e = RecordArrays.end();
+        for (; i != e; i++) {
+            size_t in_width, out_width;
+            Filler fill;
+            (*i)->conversion(in_width, out_width, fill);
+            (*i)->write_converted((*i)->d_record_ncid, in_width, out_width, fill, record, 1);
         }
+    }
 
-        case NC_FLOAT: {
-            float *data = new float[d_nelements];
-            d_a->buf2val((void**) &data);
-            int stax = nc_put_var_float(ncid, _varid, data);
-            delete[] data;
+    vector<FONcArray *>::iterator i = RecordArrays.begin();
+    vector<FONcArray *>::iterator e = RecordArrays.end();
+    for (; i != e; i++)
+        (*i)->release_chunk_cache((*i)->d_record_ncid);
+}
 
-            if (stax != NC_NOERR) {
-                string err = (string) "fileout.netcdf - Failed to create array of floats for " + _varname;
-                FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
-            }
-            break;
+/** @brief Copy unsigned values into a wider signed type
+ */
+template<typename SRC, typename DST>
+static void widen(const char *in, char *out, size_t n)
+{
+    const SRC *src = reinterpret_cast<const SRC *>(in);
+    DST *dst = reinterpret_cast<DST *>(out);
+    for (size_t i = 0; i < n; i++)
+        dst[i] = src[i];
+}
+
+/** @brief Fill a buffer with Byte values widened to shorts
+ *
+ * @param in The first value
+ * @param first The index of the first value
+ * @param n The number of values
+ * @param out The buffer, with room for n shorts
+ */
+void FONcArray::fill_widened_bytes(const char *in, size_t /*first*/, size_t n, char *out) const
+{
+    widen<dods_byte, short>(in, out, n);
+}
+
+/** @brief Fill a buffer with UInt16 values widened to ints
+ *
+ * @param in The first value
+ * @param first The index of the first value
+ * @param n The number of values
+ * @param out The buffer, with room for n ints
+ */
+void FONcArray::fill_widened_uint16s(const char *in, size_t /*first*/, size_t n, char *out) const
+{
+    widen<dods_uint16, int>(in, out, n);
+}
+
+/** @brief Reduce the blocks of a slab of an array to one value each
+ *
+ * A block is the factor[d] values along each dimension d (fewer at the
+ * far edges) that make one value of the overview. NaNs and the missing
+ * values are skipped; a block with nothing else is given the first
+ * missing value, or NaN.
+ *
+ * The values of each block are read a run at a time along the last
+ * dimension. The mean, min and max are computed as they are read; only
+ * the mode keeps the values of the block.
+ *
+ * @param in The values of the slab
+ * @param shape The dimensions of the slab
+ * @param factor The reduction factor of each dimension
+ * @param method One of the FONcSettings OverviewMethod values
+ * @param missing Values that are skipped
+ * @param out The reduced values
+ */
+template<typename T>
+static void reduce_blocks(const T *in, const vector<size_t> &shape, const vector<size_t> &factor, int method,
+    const vector<double> &missing, T *out)
+{
+    size_t nd = shape.size();
+    size_t last = nd - 1;
+    vector<size_t> out_shape(nd), stride(nd), o(nd, 0), lo(nd), hi(nd), b(nd);
+    size_t n_out = 1;
+    for (size_t d = 0; d < nd; d++) {
+        out_shape[d] = (shape[d] + factor[d] - 1) / factor[d];
+        n_out *= out_shape[d];
+    }
+    stride[last] = 1;
+    for (size_t d = last; d > 0; d--)
+        stride[d - 1] = stride[d] * shape[d];
+
+    vector<T> skip(missing.begin(), missing.end());
+    const T empty = skip.empty() ? std::numeric_limits<T>::quiet_NaN() : skip[0];
+    vector<T> block;
+
+    for (size_t k = 0; k < n_out; k++) {
+        for (size_t d = 0; d < nd; d++) {
+            lo[d] = o[d] * factor[d];
+            hi[d] = std::min(lo[d] + factor[d], shape[d]);
+            b[d] = lo[d];
         }
 
-        case NC_DOUBLE: {
-            double *data = new double[d_nelements];
-            d_a->buf2val((void**) &data);
-            int stax = nc_put_var_double(ncid, _varid, data);
-            delete[] data;
+        double sum = 0;
+        size_t count = 0;
+        T low = 0, high = 0;
+        block.clear();
+        for (;;) {
+            const T *run = in;
+            for (size_t d = 0; d < last; d++)
+                run += b[d] * stride[d];
+            for (size_t x = lo[last]; x < hi[last]; x++) {
+                T v = run[x];
+                if (v != v || (!skip.empty() && std::find(skip.begin(), skip.end(), v) != skip.end())) continue;
+                if (method == FONcSettings::overview_mode) {
+                    block.push_back(v);
+                    continue;
+                }
+                if (!count || v < low) low = v;
+                if (!count || v > high) high = v;
+                sum += v;
+                count++;
+            }
 
-            if (stax != NC_NOERR) {
-                string err = (string) "fileout.netcdf - Failed to create array of doubles for " + _varname;
-                FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+            // The next run of the block
+            size_t d = last;
+            while (d > 0 && ++b[d - 1] == hi[d - 1]) {
+                b[d - 1] = lo[d - 1];
+                d--;
             }
-            break;
+            if (d == 0) break;
         }
 
-        default:
-            string err = (string) "Failed to transform array of unknown type in file out netcdf";
-            throw BESInternalError(err, __FILE__, __LINE__);
+        if (method == FONcSettings::overview_mode) {
+            // The most common value; the smallest of those that tie
+            out[k] = empty;
+            std::sort(block.begin(), block.end());
+            size_t best = 0;
+            for (size_t i = 0; i < block.size();) {
+                size_t j = i;
+                while (j < block.size() && block[j] == block[i])
+                    j++;
+                if (j - i > best) {
+                    best = j - i;
+                    out[k] = block[i];
+                }
+                i = j;
+            }
         }
+        else if (!count)
+            out[k] = empty;
+        else if (method == FONcSettings::overview_min)
+            out[k] = low;
+        else if (method == FONcSettings::overview_max)
+            out[k] = high;
+        else if (std::numeric_limits<T>::is_integer)
+            out[k] = static_cast<T>(floor(sum / count + 0.5));
+        else
+            out[k] = static_cast<T>(sum / count);
+
+        for (size_t d = nd; d > 0 && ++o[d - 1] == out_shape[d - 1]; d--)
+            o[d - 1] = 0;
     }
-    else {
-        // special case for string data. Could have put this in the
-        // switch, but it's pretty big
-        size_t var_count[d_ndims];
-        size_t var_start[d_ndims];
-        int dim = 0;
-        for (dim = 0; dim < d_ndims; dim++) {
-            // the count for each of the dimensions will always be 1 except
-            // for the string length dimension
-            var_count[dim] = 1;
-
-            // the start for each of the dimensions will start at 0. We will
-            // bump this up in the while loop below
-            var_start[dim] = 0;
-        }
-
-        for (int element = 0; element < d_nelements; element++) {
-            var_count[d_ndims - 1] = d_str_data[element].size() + 1;
-            var_start[d_ndims - 1] = 0;
-
-            // write out the string
-            int stax = nc_put_vara_text(ncid, _varid, var_start, var_count, d_str_data[element].c_str());
-            if (stax != NC_NOERR) {
-                string err = (string) "fileout.netcdf - Failed to create array of strings for " + _varname;
-                FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+}
+
+/** @brief Reduce a slab of an array for an overview
+ *
+ * Coordinate variables are always averaged, so their values are the
+ * centres of the blocks of the arrays that use them.
+ *
+ * @param in The values of the slab, of the type of the DAP Array
+ * @param in_rows The number of rows (along the first dimension) of the
+ * slab
+ * @param out The reduced values, of the same type
+ * @throws BESInternalError if the type of the array cannot be reduced
+ */
+void FONcArray::reduce_slab(const char *in, size_t in_rows, char *out) const
+{
+    vector<size_t> shape(d_in_sizes);
+    shape[0] = in_rows;
+
+    int method = FONcSettings::Current.overview_method;
+    if (d_actual_ndims == 1 && d_a->name() == d_a->dimension_name(d_a->dim_begin()))
+        method = FONcSettings::overview_mean;
+
+    Type var_type = d_a->var()->type();
+    if (var_type == dods_enum_c) var_type = static_cast<D4Enum *>(d_a->var())->element_type();
+    switch (var_type) {
+    case dods_byte_c:
+    case dods_uint8_c:
+        reduce_blocks(reinterpret_cast<const dods_byte *>(in), shape, d_reduce, method, d_missing,
+            reinterpret_cast<dods_byte *>(out));
+        break;
+    case dods_int8_c:
+        reduce_blocks(reinterpret_cast<const dods_int8 *>(in), shape, d_reduce, method, d_missing,
+            reinterpret_cast<dods_int8 *>(out));
+        break;
+    case dods_int16_c:
+        reduce_blocks(reinterpret_cast<const dods_int16 *>(in), shape, d_reduce, method, d_missing,
+            reinterpret_cast<dods_int16 *>(out));
+        break;
+    case dods_uint16_c:
+        reduce_blocks(reinterpret_cast<const dods_uint16 *>(in), shape, d_reduce, method, d_missing,
+            reinterpret_cast<dods_uint16 *>(out));
+        break;
+    case dods_int32_c:
+        reduce_blocks(reinterpret_cast<const dods_int32 *>(in), shape, d_reduce, method, d_missing,
+            reinterpret_cast<dods_int32 *>(out));
+        break;
+    case dods_uint32_c:
+        reduce_blocks(reinterpret_cast<const dods_uint32 *>(in), shape, d_reduce, method, d_missing,
+            reinterpret_cast<dods_uint32 *>(out));
+        break;
+    case dods_int64_c:
+        reduce_blocks(reinterpret_cast<const dods_int64 *>(in), shape, d_reduce, method, d_missing,
+            reinterpret_cast<dods_int64 *>(out));
+        break;
+    case dods_uint64_c:
+        reduce_blocks(reinterpret_cast<const dods_uint64 *>(in), shape, d_reduce, method, d_missing,
+            reinterpret_cast<dods_uint64 *>(out));
+        break;
+    case dods_float32_c:
+        reduce_blocks(reinterpret_cast<const dods_float32 *>(in), shape, d_reduce, method, d_missing,
+            reinterpret_cast<dods_float32 *>(out));
+        break;
+    case dods_float64_c:
+        reduce_blocks(reinterpret_cast<const dods_float64 *>(in), shape, d_reduce, method, d_missing,
+            reinterpret_cast<dods_float64 *>(out));
+        break;
+    default:
+        string err = "fileout.netcdf - Cannot reduce " + _varname + " for an overview";
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
+}
+
+/** @brief Write an array whose values must be converted to fit the
+ * netcdf type, or that is read lazily
+ *
+ * The converted values are written in one piece if they are within the
+ * in-memory threshold of the response and the memory budget allows.
+ * Otherwise they are written in slabs of about FONc.SlabSize KB (see
+ * plan_slabs()), so the conversion only needs a buffer of that size.
+ * Arrays that are read lazily are always read and written in slabs. So
+ * are arrays written by a FONcWriter, which converts each slab into one
+ * of its two buffers while it writes the other.
+ *
+ * The rows of an overview are each made from d_reduce[0] rows of the DAP
+ * Array; each slab, of whole rows, is reduced before it is converted.
+ *
+ * @param ncid The id of the netcdf file
+ * @param in_width The size of a DAP value
+ * @param out_width The size of the netcdf value
+ * @param fill The method that converts a run of values into the buffer,
+ * or null if the DAP values are written as they are
+ * @param first_row The first row to write
+ * @param nrows The number of rows to write
+ * @throws BESInternalError if the values cannot be written
+ */
+void FONcArray::write_converted(int ncid, size_t in_width, size_t out_width, Filler fill, size_t first_row,
+    size_t nrows)
+{
+    if (d_nelements == 0 || nrows == 0) return;
+
+    size_t rows = d_dim_sizes[0];
+    size_t row_elements = d_nelements / rows;
+    size_t first = first_row * row_elements;
+    size_t end = (first_row + nrows) * row_elements;
+
+    // The rows of the DAP Array
+    size_t in_rows = d_reduced ? d_in_sizes[0] : rows;
+    size_t in_row_elements = row_elements;
+    if (d_reduced) {
+        in_row_elements = 1;
+        for (vector<size_t>::size_type d = 1; d < d_in_sizes.size(); d++)
+            in_row_elements *= d_in_sizes[d];
+    }
+    size_t in_per_row = d_reduced ? d_reduce[0] * in_row_elements : row_elements;
+
+    FONcWriter *writer = FONcWriter::Current;
+
+    // The bytes of a converted row, and of a reduced row
+    size_t row_bytes = ((fill ? out_width : 0) + (d_reduced ? in_width : 0)) * row_elements;
+    size_t bytes = nrows * row_bytes;
+    size_t threshold = static_cast<size_t>(FONcSettings::Current.in_memory_threshold) * 1024;
+    bool in_memory = !d_lazy && !writer && (threshold == 0 || bytes <= threshold);
+
+    FONcMemoryReservation whole(in_memory ? bytes : 0, true, _varname);
+    bool whole_granted = in_memory && whole.granted();
+
+    // An overview is reduced whole rows at a time, so only its first
+    // dimension is split
+    int limit = d_reduced ? 1 : d_ndims;
+    int split = 0;
+    size_t split_count = nrows;
+    size_t slab_values = end - first;
+    if (d_lazy || writer) {
+        size_t width = std::max(in_width * in_per_row / row_elements, out_width);
+        slab_values = std::min(plan_slabs(width, limit, split, split_count), end - first);
+    }
+    else if (!whole_granted) {
+        slab_values = std::min(plan_slabs(out_width, limit, split, split_count), end - first);
+    }
+    BESDEBUG("fonc", "FONcArray::write_converted() - writing " << _varname << " in slabs of " << split_count
+        << " along dimension " << split << endl);
+
+    // The writer has its own buffers
+    size_t out_bytes = (fill && !writer) ? slab_values * out_width : 0;
+    size_t reduced_bytes = d_reduced ? slab_values * in_width : 0;
+    size_t in_values = d_reduced ? slab_values / row_elements * in_per_row : slab_values;
+    FONcMemoryReservation slab(whole_granted ? 0 : out_bytes + reduced_bytes, false, _varname);
+    FONcMemoryReservation input(d_lazy ? in_values * in_width : 0, false, _varname);
+
+    // The converted values go in the scratch buffer of the response
+    vector<char> fallback;
+    char *data = FONcArena::scratch(out_bytes, fallback);
+    vector<char> reduced(reduced_bytes);
+
+    vector<size_t> start(d_ndims, 0);
+    vector<size_t> count(d_dim_sizes.begin(), d_dim_sizes.end());
+    try {
+        for (size_t offset = first; offset < end;) {
+            size_t values = slab_at(offset, end, split, split_count, start, count);
+            const char *in;
+            if (d_reduced) {
+                vector<size_t> in_start(d_in_sizes.size(), 0);
+                vector<size_t> in_count(d_in_sizes.begin(), d_in_sizes.end());
+                in_start[0] = start[0] * d_reduce[0];
+                in_count[0] = std::min((start[0] + count[0]) * d_reduce[0], in_rows) - in_start[0];
+                if (d_lazy)
+                    in = read_slab(in_start, in_count);
+                else
+                    in = d_a->get_buf() + in_start[0] * in_row_elements * in_width;
+                reduce_slab(in, in_count[0], &reduced[0]);
+                in = &reduced[0];
+            }
+            else {
+                in = d_lazy ? read_slab(start, count) : d_a->get_buf() + offset * in_width;
             }
 
-            // bump up the start.
-            if (element + 1 < d_nelements) {
-                bool done = false;
-                dim = d_ndims - 2;
-                while (!done) {
-                    var_start[dim] = var_start[dim] + 1;
-                    if (var_start[dim] == d_dim_sizes[dim]) {
-                        var_start[dim] = 0;
-                        dim--;
-                    }
-                    else {
-                        done = true;
-                    }
+            // The chunks of a row are counted with its first slab
+            if (offset % row_elements == 0) count_chunks(start[0], split ? 1 : count[0]);
+            if (writer) {
+                char *buffer = writer->buffer(values * out_width);
+                if (fill)
+                    (this->*fill)(in, offset, values, buffer);
+                else
+                    memcpy(buffer, in, values * out_width);
+                writer->put(ncid, _varid, d_ndims, &start[0], &count[0], buffer, _varname);
+            }
+            else {
+                const char *out = in;
+                if (fill) {
+                    (this->*fill)(in, offset, values, data);
+                    out = data;
                 }
+                FONcUtils::put_vara(ncid, _varid, d_ndims, &start[0], &count[0], out, out_width, _varname);
             }
+            offset += values;
         }
     }
+    catch (...) {
+        // Put the constraint back so the array can be written again
+        if (d_lazy) end_slabs();
+        throw;
+    }
 
-    BESDEBUG("fonc", "FONcArray::write() END  var: " << _varname <<  "[" << d_nelements << "]" << endl);
+    if (d_lazy) end_slabs();
+}
+
+/** @brief The size of one value of the netcdf type of this array
+ */
+size_t FONcArray::value_width() const
+{
+    switch (d_array_type) {
+    case NC_BYTE:
+    case NC_UBYTE:
+        return 1;
+    case NC_SHORT:
+    case NC_USHORT:
+        return 2;
+    case NC_INT64:
+    case NC_UINT64:
+    case NC_DOUBLE:
+        return 8;
+    default:
+        return 4;
+    }
+}
+
+/** @brief Plan the slabs of an array that is read lazily or written in
+ * pieces
+ *
+ * A slab is a run of values that is also a hyperslab of the array: one
+ * index of each dimension before the split dimension, split_count
+ * indexes of that dimension and all of each dimension after it. The
+ * split dimension is the first for which a slab holds at most about
+ * FONc.SlabSize KB, so the slabs are whole rows (along the first
+ * dimension) unless a single row is larger than that.
+ *
+ * @param width The size of the largest of the DAP and netcdf values
+ * @param limit The number of leading dimensions that may be split
+ * @param split Set to the split dimension
+ * @param split_count Set to the indexes of the split dimension in a
+ * slab, at least one
+ * @return The number of values in a full slab
+ */
+size_t FONcArray::plan_slabs(size_t width, int limit, int &split, size_t &split_count) const
+{
+    size_t slab_values = static_cast<size_t>(FONcRequestHandler::slab_size) * 1024 / width;
+
+    // The values in one index of each dimension
+    vector<size_t> inner(d_ndims, 1);
+    for (int d = d_ndims - 2; d >= 0; d--)
+        inner[d] = inner[d + 1] * d_dim_sizes[d + 1];
+
+    split = limit - 1;
+    for (int d = 0; d < limit; d++) {
+        if (inner[d] <= slab_values) {
+            split = d;
+            break;
+        }
+    }
+
+    split_count = slab_values / inner[split];
+    if (split_count < 1) split_count = 1;
+    if (split_count > d_dim_sizes[split]) split_count = d_dim_sizes[split];
+    return split_count * inner[split];
+}
+
+/** @brief The slab that starts at a value of an array
+ *
+ * The slab does not go past the end of the split dimension or past the
+ * values being written.
+ *
+ * @param offset The index of the first value of the slab
+ * @param end The index after the last value being written, at the end
+ * of a row
+ * @param split The split dimension chosen by plan_slabs()
+ * @param split_count The indexes of the split dimension in a full slab
+ * @param start Set to the start of the slab in each dimension
+ * @param count Set to the count of the slab in each dimension
+ * @return The number of values in the slab
+ */
+size_t FONcArray::slab_at(size_t offset, size_t end, int split, size_t split_count, vector<size_t> &start,
+    vector<size_t> &count) const
+{
+    size_t inner = 1;
+    for (int d = d_ndims - 1; d > split; d--) {
+        start[d] = 0;
+        count[d] = d_dim_sizes[d];
+        inner *= d_dim_sizes[d];
+    }
+
+    size_t index = offset / inner;
+    for (int d = split; d >= 0; d--) {
+        start[d] = index % d_dim_sizes[d];
+        count[d] = 1;
+        index /= d_dim_sizes[d];
+    }
+
+    count[split] = std::min(std::min(split_count, d_dim_sizes[split] - start[split]), (end - offset) / inner);
+    return count[split] * inner;
+}
+
+/** @brief Read a slab of a lazily read array from its handler
+ *
+ * The constraint of each dimension is narrowed to the slab and the
+ * Array is read again, so the handler reads only those values. A
+ * FONcWriter keeps writing the last slab while the next is converted,
+ * but not while it is read.
+ *
+ * @param start The start of the slab in each dimension, counted in the
+ * constrained array
+ * @param count The count of the slab in each dimension
+ * @return The values of the slab
+ */
+const char *FONcArray::read_slab(const vector<size_t> &start, const vector<size_t> &count)
+{
+    Array::Dim_iter di = d_a->dim_begin();
+    for (vector<int>::size_type d = 0; d < d_lazy_start.size(); d++, di++)
+        d_a->add_constraint(di, d_lazy_start[d] + start[d] * d_lazy_stride[d], d_lazy_stride[d],
+            d_lazy_start[d] + (start[d] + count[d] - 1) * d_lazy_stride[d]);
+
+    // The handler may use libnetcdf, which is not thread safe, so the
+    // writer, if any, is kept out of it during the read
+    FONcWriter::Hold hold(FONcWriter::Current);
+    d_a->set_read_p(false);
+    d_a->read();
+    d_a->set_read_p(true);
+
+    return d_a->get_buf();
+}
+
+/** @brief Put back the constraint of a lazily read array and free the
+ * values of its last slab
+ */
+void FONcArray::end_slabs()
+{
+    Array::Dim_iter di = d_a->dim_begin();
+    for (vector<int>::size_type d = 0; d < d_lazy_start.size(); d++, di++)
+        d_a->add_constraint(di, d_lazy_start[d], d_lazy_stride[d], d_lazy_stop[d]);
+    d_a->clear_local_data();
+    d_a->set_read_p(false);
+}
+
+/** @brief Write an array of strings
+ *
+ * The strings become the rows of the last (string length) dimension,
+ * padded with nulls. They are written in slabs of about FONc.SlabSize KB,
+ * each with one write; a slab is whole rows along the first dimension
+ * unless a row is larger than that, and always whole strings.
+ *
+ * @param ncid The id of the netcdf file
+ * @throws BESInternalError if the values cannot be written
+ */
+void FONcArray::write_strings(int ncid)
+{
+    if (d_nelements == 0) return;
+
+    size_t length = d_dim_sizes[d_ndims - 1];
+    size_t total = d_nelements * length;
+    int split;
+    size_t split_count;
+    size_t slab_bytes = plan_slabs(1, d_actual_ndims, split, split_count);
+
+    FONcWriter *writer = FONcWriter::Current;
+    FONcMemoryReservation slab(writer ? 0 : slab_bytes, false, _varname);
+    vector<char> fallback;
+    char *data = writer ? 0 : FONcArena::scratch(slab_bytes, fallback);
+
+    vector<size_t> start(d_ndims, 0);
+    vector<size_t> count(d_dim_sizes.begin(), d_dim_sizes.end());
+    for (size_t offset = 0; offset < total;) {
+        size_t bytes = slab_at(offset, total, split, split_count, start, count);
+        char *buffer = writer ? writer->buffer(bytes) : data;
+        memset(buffer, 0, bytes);
+
+        size_t first = offset / length;
+        for (size_t element = 0; element < bytes / length; element++) {
+            const string &str = d_str_data[first + element];
+            memcpy(buffer + element * length, str.data(), std::min(str.size(), length - 1));
+        }
+
+        // The chunks of a row are counted with its first slab
+        if (offset % (total / d_dim_sizes[0]) == 0) count_chunks(start[0], split ? 1 : count[0]);
+        if (writer)
+            writer->put(ncid, _varid, d_ndims, &start[0], &count[0], buffer, _varname);
+        else
+            FONcUtils::put_vara(ncid, _varid, d_ndims, &start[0], &count[0], buffer, 1, _varname);
+        offset += bytes;
+    }
 }
 
 /** @brief returns the name of the DAP Array
@@ -552,6 +2180,20 @@ void FONcArray::dump(ostream &strm) const
     strm << BESIndent::LMarg << "ndims = " << d_ndims << endl;
     strm << BESIndent::LMarg << "actual ndims = " << d_actual_ndims << endl;
     strm << BESIndent::LMarg << "nelements = " << d_nelements << endl;
+    strm << BESIndent::LMarg << "record variable? " << (d_record ? "true" : "false") << endl;
+    strm << BESIndent::LMarg << "reduced for an overview? " << (d_reduced ? "true" : "false") << endl;
+    if (d_chunk_bytes) {
+        strm << BESIndent::LMarg << "chunk cache = " << (d_cache_size ? d_cache_size : d_default_cache.size)
+            << " bytes, estimated " << d_cache_hits << " hits, " << d_cache_misses << " misses, " << d_cache_rereads
+            << " read back" << endl;
+    }
+    if (d_is_compound) {
+        strm << BESIndent::LMarg << "compound size = " << d_compound_size << ", fields:";
+        vector<CompoundField>::const_iterator fi = d_fields.begin();
+        for (; fi != d_fields.end(); fi++)
+            strm << " " << (*fi).name << "@" << (*fi).offset;
+        strm << endl;
+    }
     if (d_dims.size()) {
         strm << BESIndent::LMarg << "dimensions:" << endl;
         BESIndent::Indent();
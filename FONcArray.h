@@ -34,6 +34,7 @@
 
 #include <vector>
 #include <string>
+#include <set>
 
 #include "FONcBaseType.h"
 
@@ -43,6 +44,7 @@ class FONcMap;
 namespace libdap {
 class BaseType;
 class Array;
+class D4EnumDef;
 }
 
 /** @brief A DAP Array with file out netcdf information included
@@ -90,8 +92,127 @@ private:
     // calling the FONcMap->decref() method they are not deleted. jhrg 8/28/13
     std::vector<FONcMap*> d_grid_maps;
 
+    // An Array of Structures written as an array of a netCDF-4 compound
+    // type. Each field of the Structure is stored at an offset in the
+    // compound; d_compound_size is the size of one element, with padding.
+    struct CompoundField {
+        std::string name;
+        nc_type type;
+        size_t offset;
+    };
+    bool d_is_compound;
+    size_t d_compound_size;
+    std::vector<CompoundField> d_fields;
+
+    // An Array of Structures that cannot be a compound array is stored
+    // as an array for each member; d_member_arrays are the DAP Arrays made
+    // for them, which belong to this object.
+    std::vector<FONcArray *> d_members;
+    std::vector<libdap::Array *> d_member_arrays;
+
+    // A floating point array packed into shorts or bytes, with the CF
+    // scale_factor and add_offset attributes. Values that match one of
+    // d_missing are written as the _FillValue.
+    bool d_is_packed;
+    nc_type d_unpacked_type;
+    double d_scale_factor;
+    double d_add_offset;
+    std::vector<double> d_missing;
+
+    // A floating point array quantized with one of the FONcSettings
+    // QuantizeAlgorithm values (0 for none), by the netcdf library if it
+    // can, otherwise as the values are written
+    int d_quantize_algorithm;
+    int d_quantize_digits;
+    bool d_quantize_in_library;
+
+    // An array whose values are read from the handler one slab at a
+    // time; d_lazy_start, stride and stop are the constraint of each of
+    // its dimensions.
+    bool d_lazy;
+    std::vector<int> d_lazy_start;
+    std::vector<int> d_lazy_stride;
+    std::vector<int> d_lazy_stop;
+
+    // The bytes of string data reported to the FONcMemoryAccountant
+    size_t d_str_bytes;
+
+    // The enumeration of an Array of Enums written with a netcdf enum
+    // type, otherwise null
+    libdap::D4EnumDef *d_enum;
+
+    // A numeric array whose first dimension is the record dimension. Its
+    // values are written by write_records(), one record at a time, in
+    // d_record_ncid (the file or group it is defined in).
+    bool d_record;
+    int d_record_ncid;
+
+    // The chunk cache of a chunked netCDF-4 array. Slabs that end part
+    // way through a row of chunks (along the first dimension) leave those
+    // chunks partly written, so the cache is made large enough to keep
+    // that row until the next slab fills it. d_cache_size is 0 if the
+    // default cache, d_default_cache, is used.
+    struct ChunkCache {
+        size_t size;
+        size_t nelems;
+        float preemption;
+    };
+    size_t d_chunk_bytes;
+    size_t d_chunks_across;
+    size_t d_cache_size;
+    ChunkCache d_default_cache;
+
+    // A model of that cache, counted as the slabs are written: the chunks
+    // found in the cache, those brought in and those brought in after an
+    // earlier slab partly wrote them (compressed, evicted and read back)
+    unsigned long d_cache_hits;
+    unsigned long d_cache_misses;
+    unsigned long d_cache_rereads;
+    size_t d_cached_first;      // the rows of chunks in the cache
+    size_t d_cached_end;
+
+    // An array reduced for an overview: each block of d_reduce values
+    // (one factor per dimension, 1 for those that are not reduced) of the
+    // DAP Array, whose dimensions are d_in_sizes, is written as one value
+    bool d_reduced;
+    std::vector<size_t> d_reduce;
+    std::vector<size_t> d_in_sizes;
+
     FONcDim * find_dim(std::vector<std::string> &embed, const std::string &name, int size, bool ignore_size = false);
 
+    bool convert_compound();
+    libdap::Array *member_array(libdap::BaseType *member, int index);
+    void convert_members(std::vector<std::string> embed);
+    void define_compound(int ncid);
+    void convert_packed();
+    void convert_quantized();
+    void pack_range();
+    void fit_chunks(int ncid);
+    void write_compound(int ncid);
+
+    // Converts the n values at in, the first of which is value first of
+    // the array, into out
+    typedef void (FONcArray::*Filler)(const char *in, size_t first, size_t n, char *out) const;
+    void fill_widened_bytes(const char *in, size_t first, size_t n, char *out) const;
+    void fill_widened_uint16s(const char *in, size_t first, size_t n, char *out) const;
+    void fill_packed(const char *in, size_t first, size_t n, char *out) const;
+    void fill_quantized(const char *in, size_t first, size_t n, char *out) const;
+    bool conversion(size_t &in_width, size_t &out_width, Filler &fill) const;
+    size_t planned_slab_rows() const;
+    void size_chunk_cache(int ncid);
+    void count_chunks(size_t row, size_t n);
+    void release_chunk_cache(int ncid);
+    void reduce_slab(const char *in, size_t in_rows, char *out) const;
+    void write_converted(int ncid, size_t in_width, size_t out_width, Filler fill, size_t first_row, size_t nrows);
+
+    size_t value_width() const;
+    size_t plan_slabs(size_t width, int limit, int &split, size_t &split_count) const;
+    size_t slab_at(size_t offset, size_t end, int split, size_t split_count, std::vector<size_t> &start,
+        std::vector<size_t> &count) const;
+    const char *read_slab(const std::vector<size_t> &start, const std::vector<size_t> &count);
+    void end_slabs();
+    void write_strings(int ncid);
+
 public:
     FONcArray(libdap::BaseType *b);
     virtual ~FONcArray();
@@ -108,7 +229,12 @@ public:
 
     virtual void dump(std::ostream &strm) const;
 
+    static FONcDim *set_record_dimension(const std::string &spec);
+    static void write_records();
+
     static std::vector<FONcDim *> Dimensions;
+    static std::vector<FONcArray *> RecordArrays;
+    static std::set<std::string> ReducedDims;
 };
 
 #endif // FONcArray_h_
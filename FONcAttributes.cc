@@ -30,8 +30,13 @@
 //      jgarcia     Jose Garcia <jgarcia@ucar.edu>
 
 #include <sstream>
+#include <vector>
+#include <map>
 
 using std::istringstream;
+using std::vector;
+using std::map;
+using std::make_pair;
 
 #include <netcdf.h>
 
@@ -43,6 +48,11 @@ using std::istringstream;
 
 #include "FONcAttributes.h"
 #include "FONcUtils.h"
+#include "FONcStructure.h"
+#include "FONcMemoryAccountant.h"
+#include "FONcSettings.h"
+
+map<AttrTable *, FONcAttributeList> FONcAttributes::Translated;
 
 /** @brief Add the attributes for an OPeNDAP variable to the netcdf file
  *
@@ -91,15 +101,30 @@ void FONcAttributes::add_variable_attributes(int ncid, int varid, BaseType *b) {
  * constructor classes for the variable. It starts with the outermost
  * parent of the variable.
  *
+ * Every member of a Structure, and every map of a Grid, gets the same
+ * attributes from its parents, so the attributes of a parent are
+ * translated once per response and kept in FONcAttributes::Translated.
+ *
  * @param ncid The id of the netcdf file being written to
  * @param varid The netcdf variable id to associate the attributes to
  * @param b The OPeNDAP variable containing the parent's attributes.
  * @param emb_name The name of the embedded BaseType
+ * @note If FONcStructure::AsGroups is set, the walk stops at the first
+ * Structure parent. It always stops at the root group of a DMR, and at
+ * any DAP4 group when groups are written as netcdf groups.
  * @throws BESInternalError if there is a problem writing the attributes for
  * the variable.
  */
 void FONcAttributes::add_variable_attributes_worker(int ncid, int varid, BaseType *b, string &emb_name) {
 
+    // When Structures are written as groups their attributes are written
+    // once, as attributes of the group, and are not copied to each member.
+    if (FONcStructure::AsGroups && b->type() == dods_structure_c) return;
+
+    // The same goes for DAP4 groups. The attributes of the root group are
+    // the global attributes of the file.
+    if (b->type() == dods_group_c && (FONcUtils::enhanced_model || !b->get_parent())) return;
+
     BaseType *parent = b->get_parent();
     if (parent) {
         FONcAttributes::add_variable_attributes_worker(ncid, varid, parent, emb_name);
@@ -109,7 +134,14 @@ void FONcAttributes::add_variable_attributes_worker(int ncid, int varid, BaseTyp
     }
     emb_name += b->name();
     // addattrs_workerA(ncid, varid, b, emb_name);
-    add_attributes(ncid, varid,  b->get_attr_table(), b->name(), emb_name);
+
+    AttrTable *attrs = &b->get_attr_table();
+    map<AttrTable *, FONcAttributeList>::iterator i = Translated.find(attrs);
+    if (i == Translated.end()) {
+        i = Translated.insert(make_pair(attrs, FONcAttributeList())).first;
+        translate(*attrs, emb_name, false, i->second);
+    }
+    put_attributes(ncid, varid, i->second);
 }
 
 
@@ -128,6 +160,25 @@ void FONcAttributes::add_variable_attributes_worker(int ncid, int varid, BaseTyp
  */
 void FONcAttributes::add_attributes(int ncid, int varid, AttrTable &attrs, const string &var_name, const string &prepend_attr) {
 
+    BESDEBUG("fonc", "FONcAttributes::add_attributes() - Adding the attributes of " << var_name << endl);
+
+    FONcAttributeList list;
+    translate(attrs, prepend_attr, varid == NC_GLOBAL, list);
+    put_attributes(ncid, varid, list);
+}
+
+/** @brief Translate the attributes of an AttrTable into netcdf attributes
+ *
+ * Attribute containers are flattened into the list, in order.
+ *
+ * @param attrs The OPenDAP AttrTable containing the attributes
+ * @param prepend_attr Any name to prepend to the name of the attribute
+ * @param global True if the attributes are global attributes
+ * @param list Add the netcdf attributes to this list
+ * @throws BESInternalError if an attribute has an unknown type
+ */
+void FONcAttributes::translate(AttrTable &attrs, const string &prepend_attr, bool global, FONcAttributeList &list) {
+
     unsigned int num_attrs = attrs.get_size();
     if (num_attrs) {
         AttrTable::Attr_iter i = attrs.attr_begin();
@@ -135,29 +186,46 @@ void FONcAttributes::add_attributes(int ncid, int varid, AttrTable &attrs, const
         for (; i != e; i++) {
             unsigned int num_vals = attrs.get_attr_num(i);
             if (num_vals) {
-                add_attributes_worker(ncid, varid, var_name, attrs, i, prepend_attr);
+                translate_worker(attrs, i, prepend_attr, global, list);
             }
         }
     }
 }
 
+/** @brief Parse the values of an attribute into netcdf values
+ *
+ * @param T The type of the netcdf values
+ * @param P The type the values are read as
+ */
+template<typename T, typename P>
+static void parse_values(AttrTable &attrs, AttrTable::Attr_iter &attr, FONcAttribute &nc_attr)
+{
+    unsigned int num_vals = attrs.get_attr_num(attr);
+    nc_attr.count = num_vals;
+    nc_attr.values.resize(num_vals * sizeof(T));
+    T *vals = reinterpret_cast<T *>(&nc_attr.values[0]);
+    for (unsigned int attri = 0; attri < num_vals; attri++) {
+        string val = attrs.get_attr(attr, attri);
+        istringstream is(val);
+        P pval = 0;
+        is >> pval;
+        vals[attri] = (T) pval;
+    }
+}
 
-
-/** @brief helper function for add_attributes that writes out a single
+/** @brief helper function for translate that translates a single
  * attribute
  *
- * @param ncid The id of the netcdf file being written to
- * @param varid The netcdf variable id
- * @param var_name the name of the variable (flattened)
  * @param attrs the AttrTable that contains the attribute to be written
  * @param attr the iterator into the AttrTable for the attribute to be written
  * @param prepend_attr any attribute name to prepend to the name of this
  * attribute. Use of this parameter is deprecated.
- * @throws BESInternalError if there is a problem writing this attribute
+ * @param global True if the attribute is a global attribute
+ * @param list Add the netcdf attribute(s) to this list
+ * @throws BESInternalError if the attribute has an unknown type
  */
-void FONcAttributes::add_attributes_worker(int ncid, int varid, const string &var_name,
-        AttrTable &attrs, AttrTable::Attr_iter &attr,
-        const string &prepend_attr) {
+void FONcAttributes::translate_worker(AttrTable &attrs, AttrTable::Attr_iter &attr, const string &prepend_attr,
+        bool global, FONcAttributeList &list) {
 
     AttrType attrType = attrs.get_attr_type(attr);
 
@@ -171,7 +239,7 @@ void FONcAttributes::add_attributes_worker(int ncid, int varid, const string &va
         // If we're doing global attributes AND it's an attr table, and its name is "special"
         // (ends with "_GLOBAL"), then we suppress the use of the attrTable name in
         // the NetCDF Attributes name.
-        if (varid == NC_GLOBAL  && attrType==Attr_container && BESUtil::endsWith(attr_name, "_GLOBAL")) {
+        if (global && attrType==Attr_container && BESUtil::endsWith(attr_name, "_GLOBAL")) {
             BESDEBUG("fonc",
                     "Suppressing global AttributeTable name '" << attr_name << "' from inclusion in NetCDF attributes namespace chain." << endl);
             new_attr_name = "";
@@ -181,176 +249,106 @@ void FONcAttributes::add_attributes_worker(int ncid, int varid, const string &va
         }
     }
 
-#if 0
-    // This was the old way of doing it and it polluted the attribute names
-    // by prepending full qualified variable names to the attribute name..
-    string new_name = new_attr_name;
-    if (!var_name.empty()) {
-        new_name = var_name + FONC_ATTRIBUTE_SEPARATOR + new_attr_name;
+    if (attrType == Attr_container) {
+        // flatten
+        BESDEBUG("fonc", "Attribute " << attr_name << " is an attribute container. new_attr_name: \"" << new_attr_name << "\"" << endl);
+        AttrTable *container = attrs.get_attr_table(attr);
+        if (container) {
+            translate(*container, new_attr_name, global, list);
+        }
+        return;
     }
 
-    // BESDEBUG("fonc","new_name: " << new_name << " new_attr_name: " << new_attr_name << " var_name: " << var_name << endl);
-
-    new_name = FONcUtils::id2netcdf(new_name);
-#endif
-
-    string new_name = FONcUtils::id2netcdf(new_attr_name);;
+    list.push_back(FONcAttribute());
+    FONcAttribute &nc_attr = list.back();
+    nc_attr.name = FONcUtils::id2netcdf(new_attr_name);
 
+    unsigned int attri = 0;
+    unsigned int num_vals = attrs.get_attr_num(attr);
 
-    if (varid == NC_GLOBAL) {
-        BESDEBUG("fonc", "FONcAttributes::addattrs() - Adding global attributes " << attr_name << endl);
+    // Values are parsed into a buffer of (at most) doubles; string values
+    // are joined into one string.
+    size_t attr_bytes = 0;
+    if (attrType == Attr_string || attrType == Attr_url || attrType == Attr_other_xml) {
+        for (attri = 0; attri < num_vals; attri++)
+            attr_bytes += attrs.get_attr(attr, attri).length() + 1;
     }
     else {
-        BESDEBUG("fonc", "FONcAttributes::addattrs() - Adding attribute " << new_name << endl);
+        attr_bytes = num_vals * sizeof(double);
     }
+    FONcMemoryReservation reservation(attr_bytes, false, "attribute " + nc_attr.name);
 
-    int stax = NC_NOERR;
-    unsigned int attri = 0;
-    unsigned int num_vals = attrs.get_attr_num(attr);
     switch (attrType) {
-    case Attr_container: {
-        // flatten
-        BESDEBUG("fonc", "Attribute " << attr_name << " is an attribute container. new_attr_name: \"" << new_attr_name << "\"" << endl);
-        AttrTable *container = attrs.get_attr_table(attr);
-        if (container) {
-            add_attributes(ncid, varid, *container, var_name, new_attr_name);
-        }
-    }
-        break;
-    case Attr_byte: {
+    case Attr_byte:
+    case Attr_uint8:
         // unsigned char
-        unsigned char vals[num_vals];
-        for (attri = 0; attri < num_vals; attri++) {
-            string val = attrs.get_attr(attr, attri);
-            istringstream is(val);
-            unsigned int uival = 0;
-            is >> uival;
-            vals[attri] = (unsigned char) uival;
-        }
-        stax = nc_put_att_uchar(ncid, varid, new_name.c_str(), NC_BYTE,
-                num_vals, vals);
-        if (stax != NC_NOERR) {
-            string err = (string) "File out netcdf, "
-                    + "failed to write byte attribute " + new_name;
-            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
-        }
-    }
+        nc_attr.type = NC_BYTE;
+        nc_attr.kind = "byte";
+        parse_values<unsigned char, unsigned int>(attrs, attr, nc_attr);
+        break;
+    case Attr_int8:
+        // signed char
+        nc_attr.type = NC_BYTE;
+        nc_attr.kind = "int8";
+        parse_values<signed char, int>(attrs, attr, nc_attr);
         break;
-    case Attr_int16: {
+    case Attr_int16:
         // short
-        short vals[num_vals];
-        for (attri = 0; attri < num_vals; attri++) {
-            string val = attrs.get_attr(attr, attri);
-            istringstream is(val);
-            short sval = 0;
-            is >> sval;
-            vals[attri] = sval;
-        }
-        stax = nc_put_att_short(ncid, varid, new_name.c_str(), NC_SHORT,
-                num_vals, vals);
-        if (stax != NC_NOERR) {
-            string err = (string) "File out netcdf, "
-                    + "failed to write short attribute " + new_name;
-            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
-        }
-    }
+        nc_attr.type = NC_SHORT;
+        nc_attr.kind = "short";
+        parse_values<short, short>(attrs, attr, nc_attr);
         break;
-    case Attr_uint16: {
+    case Attr_uint16:
         // unsigned short
         // (needs to be big enough to store an unsigned short
-        int vals[num_vals];
-        for (attri = 0; attri < num_vals; attri++) {
-            string val = attrs.get_attr(attr, attri);
-            istringstream is(val);
-            int ival = 0;
-            is >> ival;
-            vals[attri] = ival;
-        }
-        stax = nc_put_att_int(ncid, varid, new_name.c_str(), NC_INT, num_vals,
-                vals);
-        if (stax != NC_NOERR) {
-            string err = (string) "File out netcdf, "
-                    + "failed to write unsinged short attribute " + new_name;
-            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
-        }
-    }
+        nc_attr.type = NC_INT;
+        nc_attr.kind = "unsigned short";
+        parse_values<int, int>(attrs, attr, nc_attr);
         break;
-    case Attr_int32: {
+    case Attr_int32:
         // int
-        int vals[num_vals];
-        for (attri = 0; attri < num_vals; attri++) {
-            string val = attrs.get_attr(attr, attri);
-            istringstream is(val);
-            int ival = 0;
-            is >> ival;
-            vals[attri] = ival;
-        }
-        stax = nc_put_att_int(ncid, varid, new_name.c_str(), NC_INT, num_vals,
-                vals);
-        if (stax != NC_NOERR) {
-            string err = (string) "File out netcdf, "
-                    + "failed to write int attribute " + new_name;
-            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
-        }
-    }
+        nc_attr.type = NC_INT;
+        nc_attr.kind = "int";
+        parse_values<int, int>(attrs, attr, nc_attr);
         break;
-    case Attr_uint32: {
+    case Attr_uint32:
         // uint
         // needs to be big enough to store an unsigned int
-        int vals[num_vals];
-        for (attri = 0; attri < num_vals; attri++) {
-            string val = attrs.get_attr(attr, attri);
-            istringstream is(val);
-            int lval = 0;
-            is >> lval;
-            vals[attri] = lval;
+        nc_attr.type = NC_INT;
+        nc_attr.kind = "unsigned int";
+        parse_values<int, int>(attrs, attr, nc_attr);
+        break;
+    case Attr_int64:
+    case Attr_uint64:
+        // 64-bit integers, which only the enhanced data model has; other
+        // files get the nearest double
+        if (!FONcUtils::enhanced_model) {
+            nc_attr.type = NC_DOUBLE;
+            nc_attr.kind = "double";
+            parse_values<double, double>(attrs, attr, nc_attr);
         }
-        stax = nc_put_att_int(ncid, varid, new_name.c_str(), NC_INT, num_vals,
-                vals);
-        if (stax != NC_NOERR) {
-            string err = (string) "File out netcdf, "
-                    + "failed to write byte attribute " + new_name;
-            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+        else if (attrType == Attr_int64) {
+            nc_attr.type = NC_INT64;
+            nc_attr.kind = "int64";
+            parse_values<long long, long long>(attrs, attr, nc_attr);
+        }
+        else {
+            nc_attr.type = NC_UINT64;
+            nc_attr.kind = "uint64";
+            parse_values<unsigned long long, unsigned long long>(attrs, attr, nc_attr);
         }
-    }
         break;
-    case Attr_float32: {
+    case Attr_float32:
         // float
-        float vals[num_vals];
-        for (attri = 0; attri < num_vals; attri++) {
-            string val = attrs.get_attr(attr, attri);
-            istringstream is(val);
-            float fval = 0;
-            is >> fval;
-            vals[attri] = fval;
-        }
-        stax = nc_put_att_float(ncid, varid, new_name.c_str(), NC_FLOAT,
-                num_vals, vals);
-        if (stax != NC_NOERR) {
-            string err = (string) "File out netcdf, "
-                    + "failed to write float attribute " + new_name;
-            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
-        }
-    }
+        nc_attr.type = NC_FLOAT;
+        nc_attr.kind = "float";
+        parse_values<float, float>(attrs, attr, nc_attr);
         break;
-    case Attr_float64: {
+    case Attr_float64:
         // double
-        double vals[num_vals];
-        for (attri = 0; attri < num_vals; attri++) {
-            string val = attrs.get_attr(attr, attri);
-            istringstream is(val);
-            double dval = 0;
-            is >> dval;
-            vals[attri] = dval;
-        }
-        stax = nc_put_att_double(ncid, varid, new_name.c_str(), NC_DOUBLE,
-                num_vals, vals);
-        if (stax != NC_NOERR) {
-            string err = (string) "File out netcdf, "
-                    + "failed to write double attribute " + new_name;
-            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
-        }
-    }
+        nc_attr.type = NC_DOUBLE;
+        nc_attr.kind = "double";
+        parse_values<double, double>(attrs, attr, nc_attr);
         break;
     case Attr_string:
     case Attr_url:
@@ -361,24 +359,84 @@ void FONcAttributes::add_attributes_worker(int ncid, int varid, const string &va
         for (attri = 1; attri < num_vals; attri++) {
             val += "\n" + attrs.get_attr(attr, attri);
         }
-        stax = nc_put_att_text(ncid, varid, new_name.c_str(), val.length(),
-                val.c_str());
-        if (stax != NC_NOERR) {
-            string err = (string) "File out netcdf, "
-                    + "failed to write string attribute " + new_name;
-            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
-        }
+        nc_attr.type = NC_CHAR;
+        nc_attr.kind = "string";
+        nc_attr.count = val.length();
+        nc_attr.values.assign(val.begin(), val.end());
     }
         break;
-    case Attr_unknown: {
+    default: {
         string err = (string) "File out netcdf, "
-                + "failed to write unknown type of attribute " + new_name;
-        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+                + "failed to write unknown type of attribute " + nc_attr.name;
+        FONcUtils::handle_error(NC_NOERR, err, __FILE__, __LINE__);
     }
         break;
     }
 }
 
+/** @brief Write translated attributes to a variable
+ *
+ * @param ncid The id of the netcdf file being written to
+ * @param varid The netcdf variable id
+ * @param list The attributes
+ * @throws BESInternalError if there is a problem writing an attribute
+ */
+void FONcAttributes::put_attributes(int ncid, int varid, const FONcAttributeList &list) {
+
+    FONcAttributeList::const_iterator i = list.begin();
+    FONcAttributeList::const_iterator e = list.end();
+    for (; i != e; i++) {
+        const FONcAttribute &nc_attr = *i;
+
+        if (varid == NC_GLOBAL) {
+            BESDEBUG("fonc", "FONcAttributes::addattrs() - Adding global attributes " << nc_attr.name << endl);
+        }
+        else {
+            BESDEBUG("fonc", "FONcAttributes::addattrs() - Adding attribute " << nc_attr.name << endl);
+        }
+
+        const void *vals = nc_attr.values.empty() ? "" : (const void *) &nc_attr.values[0];
+        int stax = NC_NOERR;
+        switch (nc_attr.type) {
+        case NC_BYTE:
+            stax = nc_put_att_uchar(ncid, varid, nc_attr.name.c_str(), NC_BYTE, nc_attr.count,
+                    (const unsigned char *) vals);
+            break;
+        case NC_SHORT:
+            stax = nc_put_att_short(ncid, varid, nc_attr.name.c_str(), NC_SHORT, nc_attr.count,
+                    (const short *) vals);
+            break;
+        case NC_INT:
+            stax = nc_put_att_int(ncid, varid, nc_attr.name.c_str(), NC_INT, nc_attr.count, (const int *) vals);
+            break;
+        case NC_FLOAT:
+            stax = nc_put_att_float(ncid, varid, nc_attr.name.c_str(), NC_FLOAT, nc_attr.count,
+                    (const float *) vals);
+            break;
+        case NC_DOUBLE:
+            stax = nc_put_att_double(ncid, varid, nc_attr.name.c_str(), NC_DOUBLE, nc_attr.count,
+                    (const double *) vals);
+            break;
+        case NC_INT64:
+            stax = nc_put_att_longlong(ncid, varid, nc_attr.name.c_str(), NC_INT64, nc_attr.count,
+                    (const long long *) vals);
+            break;
+        case NC_UINT64:
+            stax = nc_put_att_ulonglong(ncid, varid, nc_attr.name.c_str(), NC_UINT64, nc_attr.count,
+                    (const unsigned long long *) vals);
+            break;
+        default:
+            stax = nc_put_att_text(ncid, varid, nc_attr.name.c_str(), nc_attr.count, (const char *) vals);
+            break;
+        }
+        if (stax != NC_NOERR) {
+            string err = (string) "File out netcdf, "
+                    + "failed to write " + nc_attr.kind + " attribute " + nc_attr.name;
+            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+        }
+    }
+}
+
 /** @brief Adds an attribute for the variable if the variable name had
  * to be modified in any way
  *
@@ -407,3 +465,77 @@ void FONcAttributes::add_original_name(int ncid, int varid,
     }
 }
 
+
+/** @brief Adds the CF packing attributes of a packed variable
+ *
+ * The scale_factor and add_offset are written with the type of the
+ * unpacked values and the _FillValue with the packed type. Any
+ * _FillValue, missing_value and valid range attributes copied from the
+ * DAP variable hold unpacked values, so they are removed first.
+ *
+ * @param ncid The id of the netcdf open file
+ * @param varid The id of the packed variable
+ * @param var_name The name of the variable, for error messages
+ * @param unpacked The type of the unpacked values, NC_FLOAT or NC_DOUBLE
+ * @param packed The type of the packed values, NC_SHORT or NC_BYTE
+ * @param scale_factor The value of the scale_factor attribute
+ * @param add_offset The value of the add_offset attribute
+ * @throws BESInternalError if there is a problem writing the attributes
+ */
+void FONcAttributes::add_packing_attributes(int ncid, int varid, const string &var_name, nc_type unpacked,
+        nc_type packed, double scale_factor, double add_offset) {
+    const char *unpacked_attrs[] = { "_FillValue", "missing_value", "valid_min", "valid_max", "valid_range" };
+    for (unsigned int i = 0; i < sizeof(unpacked_attrs) / sizeof(unpacked_attrs[0]); i++) {
+        int stax = nc_del_att(ncid, varid, unpacked_attrs[i]);
+        if (stax != NC_NOERR && stax != NC_ENOTATT) {
+            string err = (string) "File out netcdf, failed to remove attribute " + unpacked_attrs[i] + " of "
+                    + var_name;
+            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+        }
+    }
+
+    int stax = nc_put_att_double(ncid, varid, "scale_factor", unpacked, 1, &scale_factor);
+    if (stax == NC_NOERR)
+        stax = nc_put_att_double(ncid, varid, "add_offset", unpacked, 1, &add_offset);
+    if (stax == NC_NOERR) {
+        int fill = (packed == NC_BYTE) ? -128 : -32768;
+        stax = nc_put_att_int(ncid, varid, "_FillValue", packed, 1, &fill);
+    }
+    if (stax != NC_NOERR) {
+        string err = (string) "File out netcdf, failed to write the packing attributes of " + var_name;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+}
+
+/** @brief Adds the attribute that records how a variable was quantized
+ *
+ * The names are those netCDF-C uses when it quantizes a variable itself.
+ *
+ * @param ncid The id of the netcdf open file
+ * @param varid The id of the quantized variable
+ * @param var_name The name of the variable, for error messages
+ * @param algorithm One of the FONcSettings QuantizeAlgorithm values
+ * @param digits The number of significant digits (bits for BitRound)
+ * @throws BESInternalError if there is a problem writing the attribute
+ */
+void FONcAttributes::add_quantize_attribute(int ncid, int varid, const string &var_name, int algorithm,
+        int digits) {
+    string attr_name;
+    switch (algorithm) {
+    case FONcSettings::quantize_bitgroom:
+        attr_name = "_QuantizeBitGroomNumberOfSignificantDigits";
+        break;
+    case FONcSettings::quantize_granularbr:
+        attr_name = "_QuantizeGranularBitRoundNumberOfSignificantDigits";
+        break;
+    default:
+        attr_name = "_QuantizeBitRoundNumberOfSignificantBits";
+        break;
+    }
+
+    int stax = nc_put_att_int(ncid, varid, attr_name.c_str(), NC_INT, 1, &digits);
+    if (stax != NC_NOERR) {
+        string err = (string) "File out netcdf, failed to write attribute " + attr_name + " of " + var_name;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+}
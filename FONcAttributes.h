@@ -35,6 +35,8 @@
 #include <netcdf.h>
 
 #include <string>
+#include <vector>
+#include <map>
 using std::string ;
 
 #include <BaseType.h>
@@ -42,6 +44,22 @@ using namespace libdap ;
 
 class FONcBaseType ;
 
+/** @brief An attribute translated from DAP, ready to be written with
+ * nc_put_att_*()
+ */
+struct FONcAttribute
+{
+    std::string name ;
+    nc_type type ;
+    const char *kind ;
+    size_t count ;
+    std::vector<char> values ;
+
+    FONcAttribute() : type( NC_CHAR ), kind( "string" ), count( 0 ) { }
+} ;
+
+typedef std::vector<FONcAttribute> FONcAttributeList ;
+
 /** @brief A class that provides static methods to help write out
  * attributes for a given variable
  *
@@ -50,16 +68,28 @@ class FONcBaseType ;
  * BaseType. Since netcdf is a flattened data structure, any variables
  * within a structure or grid will write out attributes for the
  * structure or grid along with its own attributes.
+ *
+ * Attributes are translated (named, typed and parsed) before they are
+ * written. The attributes of those parent structures and grids are
+ * translated once per response and kept in Translated, keyed by their
+ * AttrTable, then written to each member.
  */
 class FONcAttributes
 {
 private:
     static void	add_variable_attributes_worker( int ncid, int varid, BaseType *b, string &emb_name ) ;
-    static void	add_attributes_worker( int ncid, int varid, const string &var_name, AttrTable &attrs, AttrTable::Attr_iter &attr, const string &prepend_attr ) ;
+    static void	translate( AttrTable &attrs, const string &prepend_attr, bool global, FONcAttributeList &list ) ;
+    static void	translate_worker( AttrTable &attrs, AttrTable::Attr_iter &attr, const string &prepend_attr, bool global, FONcAttributeList &list ) ;
+    static void	put_attributes( int ncid, int varid, const FONcAttributeList &list ) ;
 public:
+    static std::map<AttrTable *, FONcAttributeList> Translated ;
+
     static void add_attributes( int ncid, int varid, AttrTable &attrs, const string &var_name, const string &prepend_attr ) ;
     static void add_variable_attributes( int ncid, int varid, BaseType *b ) ;
     static void add_original_name( int ncid, int varid, const string &var_name, const string &orig ) ;
+    static void add_packing_attributes( int ncid, int varid, const string &var_name, nc_type unpacked,
+                                        nc_type packed, double scale_factor, double add_offset ) ;
+    static void add_quantize_attribute( int ncid, int varid, const string &var_name, int algorithm, int digits ) ;
 } ;
 
 #endif // FONcAttributes
@@ -53,7 +53,7 @@ void FONcBaseType::convert(vector<string> embed)
 void FONcBaseType::define(int ncid)
 {
     if (!_defined) {
-        _varname = FONcUtils::gen_name(_embed, _varname, _orig_varname);
+        _varname = FONcUtils::gen_var_name(_embed, _varname, _orig_varname);
         BESDEBUG("fonc", "FONcBaseType::define - defining '" << _varname << "'" << endl);
         int stax = nc_def_var(ncid, _varname.c_str(), type(), 0, NULL, &_varid);
         if (stax != NC_NOERR) {
@@ -61,6 +61,21 @@ void FONcBaseType::define(int ncid)
             FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
         }
 
+        // A scalar is a single value, so chunking it only adds HDF5 overhead.
+        // Store it in the dataset's object header (compact) when the library
+        // supports that and contiguously otherwise.
+        if (isNetCDF4()) {
+#ifdef NC_COMPACT
+            stax = nc_def_var_chunking(ncid, _varid, NC_COMPACT, NULL);
+#else
+            stax = nc_def_var_chunking(ncid, _varid, NC_CONTIGUOUS, NULL);
+#endif
+            if (stax != NC_NOERR) {
+                string err = (string) "fileout.netcdf - " + "Failed to define storage for variable " + _varname;
+                FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+            }
+        }
+
         BESDEBUG("fonc", "FONcBaseType::define - done defining " << _varname << endl);
     }
 }
@@ -38,10 +38,14 @@
 
 
 #include <BESObj.h>
+
+#include "FONcArena.h"
 //#include <BaseType.h>
 
 #define RETURNAS_NETCDF "netcdf"
 #define RETURNAS_NETCDF4 "netcdf-4"
+#define RETURNAS_ZARR "zarr"
+#define RETURNAS_NETCDF4_REFS "netcdf-4-refs"
 
 namespace libdap {
 class BaseType;
@@ -69,6 +73,10 @@ protected:
 public:
     virtual ~FONcBaseType() { }
 
+    // The FONc objects of a response are made in its arena
+    static void *operator new(size_t bytes) { return FONcArena::allocate_object(bytes); }
+    static void operator delete(void *p) { FONcArena::release_object(p); }
+
     virtual void convert(std::vector<std::string> embed);
     virtual void define(int ncid);
     virtual void write(int /*ncid*/) {  }
@@ -35,6 +35,8 @@
 #include "FONcByte.h"
 #include "FONcUtils.h"
 #include "FONcAttributes.h"
+#include "FONcWriter.h"
+#include "FONcNc3Stream.h"
 
 /** @brief Constructor for FONcByte that takes a DAP Byte
  *
@@ -104,9 +106,16 @@ FONcByte::write( int ncid )
 {
     BESDEBUG( "fonc", "FOncByte::write for var " << _varname << endl ) ;
     size_t var_index[] = {0} ;
-    unsigned char *data = new unsigned char ;
+    unsigned char value = 0 ;
+    unsigned char *data = &value ;
     _b->buf2val( (void**)&data ) ;
-    int stax = nc_put_var1_uchar( ncid, _varid, var_index, data ) ;
+    if( FONcWriter::Current )
+    {
+	FONcWriter::Current->put_var1( ncid, _varid, NC_UBYTE, data, _varname ) ;
+	return ;
+    }
+    int stax = FONcNc3Stream::Current ? FONcNc3Stream::Current->put_var1( _varid, NC_UBYTE, data )
+		   : nc_put_var1_uchar( ncid, _varid, var_index, data ) ;
     if( stax != NC_NOERR )
     {
 	string err = (string)"fileout.netcdf - "
@@ -114,7 +123,6 @@ FONcByte::write( int ncid )
 		     + _varname ;
 	FONcUtils::handle_error( stax, err, __FILE__, __LINE__ ) ;
     }
-    delete data ;
 }
 
 /** @brief returns the name of the DAP Byte
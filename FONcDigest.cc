@@ -0,0 +1,383 @@
+// FONcDigest.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <BESDebug.h>
+#include <BESIndent.h>
+
+#include "FONcDigest.h"
+
+using namespace std;
+
+// The CRC-32C polynomial, reflected
+#define FONC_CRC32C_POLY 0x82f63b78U
+
+#define XXH_PRIME1 11400714785074694791ULL
+#define XXH_PRIME2 14029467366897019727ULL
+#define XXH_PRIME3 1609587929392839161ULL
+#define XXH_PRIME4 9650029242287828579ULL
+#define XXH_PRIME5 2870177450012600261ULL
+
+static unsigned int crc32c_table[256];
+
+static void make_crc32c_table()
+{
+    for (unsigned int n = 0; n < 256; ++n) {
+        unsigned int c = n;
+        for (int k = 0; k < 8; ++k)
+            c = (c & 1) ? (c >> 1) ^ FONC_CRC32C_POLY : c >> 1;
+        crc32c_table[n] = c;
+    }
+}
+
+static unsigned int crc32c_software(unsigned int crc, const unsigned char *data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+        crc = crc32c_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define FONC_CRC32C_SSE42 1
+
+/** @brief CRC-32C using the SSE 4.2 crc32 instruction, eight bytes at a
+ * time
+ */
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_sse42(unsigned int crc, const unsigned char *data, size_t size)
+{
+    unsigned long long c = crc;
+    for (; size >= 8; size -= 8, data += 8) {
+        unsigned long long word;
+        memcpy(&word, data, 8);
+        c = __builtin_ia32_crc32di(c, word);
+    }
+    unsigned int c32 = c;
+    for (; size; --size, ++data)
+        c32 = __builtin_ia32_crc32qi(c32, *data);
+    return c32;
+}
+#endif
+
+static unsigned int (*crc32c_update)(unsigned int, const unsigned char *, size_t) = 0;
+
+static unsigned long long rotl64(unsigned long long x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static unsigned int rotr32(unsigned int x, int r)
+{
+    return (x >> r) | (x << (32 - r));
+}
+
+static unsigned long long read_le64(const unsigned char *p)
+{
+    unsigned long long v = 0;
+    for (int i = 7; i >= 0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static unsigned long long xxh64_round(unsigned long long acc, unsigned long long input)
+{
+    acc += input * XXH_PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME1;
+}
+
+static unsigned long long xxh64_merge(unsigned long long acc, unsigned long long lane)
+{
+    acc ^= xxh64_round(0, lane);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static const unsigned int sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+/** @brief Start a digest
+ *
+ * @param algorithm The algorithm; digest_none makes a digest that does
+ * nothing
+ */
+FONcDigest::FONcDigest(Algorithm algorithm) :
+    d_algorithm(algorithm), d_bytes(0), d_crc(0xffffffffU), d_buffered(0)
+{
+    if (!crc32c_update) {
+        make_crc32c_table();
+        crc32c_update = crc32c_software;
+#ifdef FONC_CRC32C_SSE42
+        if (__builtin_cpu_supports("sse4.2")) crc32c_update = crc32c_sse42;
+#endif
+    }
+
+    d_lanes[0] = XXH_PRIME1 + XXH_PRIME2;
+    d_lanes[1] = XXH_PRIME2;
+    d_lanes[2] = 0;
+    d_lanes[3] = 0 - XXH_PRIME1;
+
+    static const unsigned int sha256_h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f,
+        0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    memcpy(d_state, sha256_h, sizeof d_state);
+}
+
+/** @brief Process one 32 byte stripe of xxHash64 */
+void FONcDigest::xxh64_stripe(const unsigned char *stripe)
+{
+    for (int i = 0; i < 4; ++i)
+        d_lanes[i] = xxh64_round(d_lanes[i], read_le64(stripe + 8 * i));
+}
+
+/** @brief Process one 64 byte block of SHA-256 */
+void FONcDigest::sha256_block(const unsigned char *block)
+{
+    unsigned int w[64];
+    for (int i = 0; i < 16; ++i)
+        w[i] = (block[4 * i] << 24) | (block[4 * i + 1] << 16) | (block[4 * i + 2] << 8) | block[4 * i + 3];
+    for (int i = 16; i < 64; ++i) {
+        unsigned int s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        unsigned int s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    unsigned int a = d_state[0], b = d_state[1], c = d_state[2], d = d_state[3];
+    unsigned int e = d_state[4], f = d_state[5], g = d_state[6], h = d_state[7];
+    for (int i = 0; i < 64; ++i) {
+        unsigned int t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i]
+            + w[i];
+        unsigned int t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    d_state[0] += a;
+    d_state[1] += b;
+    d_state[2] += c;
+    d_state[3] += d;
+    d_state[4] += e;
+    d_state[5] += f;
+    d_state[6] += g;
+    d_state[7] += h;
+}
+
+/** @brief Add bytes to the digest
+ *
+ * @param data The bytes
+ * @param size The number of bytes
+ */
+void FONcDigest::update(const char *data, size_t size)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    d_bytes += size;
+
+    switch (d_algorithm) {
+    case digest_crc32c:
+        d_crc = crc32c_update(d_crc, p, size);
+        break;
+
+    case digest_xxh64:
+    case digest_sha256: {
+        size_t unit = d_algorithm == digest_xxh64 ? 32 : 64;
+        if (d_buffered) {
+            size_t n = unit - d_buffered < size ? unit - d_buffered : size;
+            memcpy(d_buffer + d_buffered, p, n);
+            d_buffered += n;
+            p += n;
+            size -= n;
+            if (d_buffered < unit) break;
+            if (unit == 32) xxh64_stripe(d_buffer);
+            else sha256_block(d_buffer);
+            d_buffered = 0;
+        }
+        for (; size >= unit; size -= unit, p += unit) {
+            if (unit == 32) xxh64_stripe(p);
+            else sha256_block(p);
+        }
+        memcpy(d_buffer, p, size);
+        d_buffered = size;
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+/** @brief Finish the digest
+ *
+ * Call this once, after the last update().
+ *
+ * @return The digest in hex, as sha256sum and the like print it, or an
+ * empty string for digest_none
+ */
+string FONcDigest::hex()
+{
+    char text[65];
+    text[0] = 0;
+
+    switch (d_algorithm) {
+    case digest_crc32c:
+        snprintf(text, sizeof text, "%08x", ~d_crc);
+        break;
+
+    case digest_xxh64: {
+        unsigned long long h;
+        if (d_bytes >= 32) {
+            h = rotl64(d_lanes[0], 1) + rotl64(d_lanes[1], 7) + rotl64(d_lanes[2], 12) + rotl64(d_lanes[3], 18);
+            for (int i = 0; i < 4; ++i)
+                h = xxh64_merge(h, d_lanes[i]);
+        }
+        else {
+            h = XXH_PRIME5;
+        }
+        h += d_bytes;
+
+        const unsigned char *p = d_buffer;
+        size_t left = d_buffered;
+        for (; left >= 8; left -= 8, p += 8) {
+            h ^= xxh64_round(0, read_le64(p));
+            h = rotl64(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+        }
+        if (left >= 4) {
+            unsigned long long word = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long long) p[3] << 24);
+            h ^= word * XXH_PRIME1;
+            h = rotl64(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+            left -= 4;
+            p += 4;
+        }
+        for (; left; --left, ++p) {
+            h ^= *p * XXH_PRIME5;
+            h = rotl64(h, 11) * XXH_PRIME1;
+        }
+
+        h ^= h >> 33;
+        h *= XXH_PRIME2;
+        h ^= h >> 29;
+        h *= XXH_PRIME3;
+        h ^= h >> 32;
+        snprintf(text, sizeof text, "%016llx", h);
+        break;
+    }
+
+    case digest_sha256: {
+        unsigned long long bits = d_bytes * 8;
+        d_buffer[d_buffered++] = 0x80;
+        if (d_buffered > 56) {
+            memset(d_buffer + d_buffered, 0, 64 - d_buffered);
+            sha256_block(d_buffer);
+            d_buffered = 0;
+        }
+        memset(d_buffer + d_buffered, 0, 56 - d_buffered);
+        for (int i = 0; i < 8; ++i)
+            d_buffer[56 + i] = (bits >> (56 - 8 * i)) & 0xff;
+        sha256_block(d_buffer);
+        d_buffered = 0;
+
+        for (int i = 0; i < 8; ++i)
+            snprintf(text + 8 * i, 9, "%08x", d_state[i]);
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    return text;
+}
+
+/** @brief The algorithm with a name
+ *
+ * @param name crc32c, xxh64 or sha256
+ * @return The algorithm, or digest_none if the name is not one of those
+ */
+FONcDigest::Algorithm FONcDigest::algorithm_id(const string &name)
+{
+    if (name == "crc32c") return digest_crc32c;
+    if (name == "xxh64") return digest_xxh64;
+    if (name == "sha256") return digest_sha256;
+    return digest_none;
+}
+
+/** @brief The name of an algorithm
+ */
+string FONcDigest::algorithm_name(Algorithm algorithm)
+{
+    switch (algorithm) {
+    case digest_crc32c:
+        return "crc32c";
+    case digest_xxh64:
+        return "xxh64";
+    case digest_sha256:
+        return "sha256";
+    default:
+        return "none";
+    }
+}
+
+/** @brief The name of an algorithm in an HTTP digest field
+ *
+ * The names of the IANA Hash Algorithms for HTTP Digest Fields registry;
+ * xxh64, which is not registered, keeps its own name.
+ */
+string FONcDigest::field_name(Algorithm algorithm)
+{
+    switch (algorithm) {
+    case digest_crc32c:
+        return "crc32c";
+    case digest_xxh64:
+        return "xxh64";
+    case digest_sha256:
+        return "sha-256";
+    default:
+        return "none";
+    }
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcDigest::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcDigest::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "algorithm = " << algorithm_name(d_algorithm) << endl;
+    strm << BESIndent::LMarg << "bytes = " << d_bytes << endl;
+    BESIndent::UnIndent();
+}
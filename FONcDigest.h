@@ -0,0 +1,89 @@
+// FONcDigest.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef FONcDigest_h_
+#define FONcDigest_h_ 1
+
+#include <string>
+
+#include <BESObj.h>
+
+/** @brief A checksum of a response, computed as it is sent
+ *
+ * With FONc.ResponseDigest set, FONcTransmitter passes each block of the
+ * file it sends to update(), so the digest costs no second read of the
+ * file, and logs the result. The digest is of the netcdf file, before any
+ * transfer encoding, so a client can check the file it saves. It is also
+ * passed to the front end in the form of an HTTP digest field (RFC 9530).
+ *
+ * - crc32c: CRC-32C (Castagnoli), using the SSE 4.2 crc32 instruction
+ *   when the processor has it
+ * - xxh64: xxHash64 with a seed of 0
+ * - sha256: SHA-256
+ */
+class FONcDigest: public BESObj {
+public:
+    enum Algorithm {
+        digest_none, digest_crc32c, digest_xxh64, digest_sha256
+    };
+
+private:
+    Algorithm d_algorithm;
+    unsigned long long d_bytes;
+
+    // CRC-32C
+    unsigned int d_crc;
+
+    // xxHash64: the four accumulators
+    unsigned long long d_lanes[4];
+
+    // SHA-256
+    unsigned int d_state[8];
+
+    // The bytes of a partial xxHash64 stripe or SHA-256 block
+    unsigned char d_buffer[64];
+    size_t d_buffered;
+
+    void sha256_block(const unsigned char *block);
+    void xxh64_stripe(const unsigned char *stripe);
+
+    FONcDigest(const FONcDigest &);
+    FONcDigest &operator=(const FONcDigest &);
+
+public:
+    FONcDigest(Algorithm algorithm);
+    virtual ~FONcDigest() { }
+
+    virtual void update(const char *data, size_t size);
+    virtual std::string hex();
+
+    virtual Algorithm algorithm() const { return d_algorithm; }
+    virtual unsigned long long bytes() const { return d_bytes; }
+
+    static Algorithm algorithm_id(const std::string &name);
+    static std::string algorithm_name(Algorithm algorithm);
+    static std::string field_name(Algorithm algorithm);
+
+    virtual void dump(std::ostream &strm) const;
+};
+
+#endif // FONcDigest_h_
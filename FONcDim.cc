@@ -47,7 +47,7 @@ int FONcDim::DimNameNum = 0;
  * @param size The size of the dimension
  */
 FONcDim::FONcDim(const string &name, int size) :
-    _name(name), _size(size), _dimid(0), _defined(false), _ref(1)
+    _name(name), _size(size), _dimid(0), _defined(false), _ref(1), _unlimited(false), _inner(false), _time(false)
 {
 }
 
@@ -69,9 +69,16 @@ void FONcDim::decref()
  * If the dimension has not already been created by an array that shares
  * this dimension, then define the dimension in the netcdf file.
  *
+ * Dimensions are shared by arrays throughout the file, so when ncid is a
+ * netCDF-4 group the dimension is defined in the root group, where
+ * it is visible to every group.
+ *
  * If the dimension name is empty, the create a default one using an
  * incremented counter.
  *
+ * The record dimension is defined as NC_UNLIMITED; its length is set by
+ * the records written.
+ *
  * @param ncid The id of the NetCDF file
  * @throws BESInternalError if there is a problem defining the
  * dimension
@@ -88,7 +95,12 @@ void FONcDim::define(int ncid)
         else {
             _name = FONcUtils::id2netcdf(_name);
         }
-        int stax = nc_def_dim(ncid, _name.c_str(), _size, &_dimid);
+        int root = ncid;
+        int parent;
+        while (nc_inq_grp_parent(root, &parent) == NC_NOERR)
+            root = parent;
+
+        int stax = nc_def_dim(root, _name.c_str(), _unlimited ? NC_UNLIMITED : _size, &_dimid);
         if (stax != NC_NOERR) {
             string err = (string) "fileout.netcdf - " + "Failed to add dimension " + _name;
             FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
@@ -110,6 +122,7 @@ void FONcDim::dump(ostream &strm) const
     strm << BESIndent::LMarg << "name = " << _name << endl;
     strm << BESIndent::LMarg << "size = " << _size << endl;
     strm << BESIndent::LMarg << "dimid = " << _dimid << endl;
+    strm << BESIndent::LMarg << "unlimited? " << (_unlimited ? "true" : "false") << endl;
     strm << BESIndent::LMarg << "already defined? ";
     if (_defined)
         strm << "true";
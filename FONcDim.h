@@ -34,6 +34,8 @@
 
 #include <BESObj.h>
 
+#include "FONcArena.h"
+
 /** @brief A class that represents the dimension of an array.
  *
  * This class represents a dimension of a DAP Array with additional
@@ -49,9 +51,16 @@ private:
     int				_dimid ;
     bool			_defined ;
     int				_ref ;
+    bool			_unlimited ;
+    bool			_inner ;
+    bool			_time ;
 public:
     				FONcDim( const string &name, int size ) ;
     virtual			~FONcDim() {}
+
+    // Dimensions are made in the arena of the response
+    static void *		operator new( size_t bytes ) { return FONcArena::allocate_object( bytes ) ; }
+    static void			operator delete( void *p ) { FONcArena::release_object( p ) ; }
     virtual void		incref() { _ref++ ; }
     virtual void		decref() ;
 
@@ -63,6 +72,15 @@ public:
     virtual int			dimid() { return _dimid ; }
     virtual bool		defined() { return _defined ; }
 
+    // Only the first dimension of every array using it can be the
+    // record dimension
+    virtual void		set_unlimited() { _unlimited = true ; }
+    virtual bool		unlimited() { return _unlimited ; }
+    virtual void		set_inner() { _inner = true ; }
+    virtual bool		inner() { return _inner ; }
+    virtual void		set_time() { _time = true ; }
+    virtual bool		time() { return _time ; }
+
     virtual void		dump( ostream &strm ) const ;
 
     static int			DimNameNum ;
@@ -36,6 +36,8 @@
 #include "FONcDouble.h"
 #include "FONcUtils.h"
 #include "FONcAttributes.h"
+#include "FONcWriter.h"
+#include "FONcNc3Stream.h"
 
 /** @brief Constructor for FOncDouble that takes a DAP Float64
  *
@@ -102,9 +104,16 @@ FONcDouble::write( int ncid )
 {
     BESDEBUG( "fonc", "FONcDouble::write for var " << _varname << endl ) ;
     size_t var_index[] = {0} ;
-    double *data = new double ;
+    double value = 0 ;
+    double *data = &value ;
     _f->buf2val( (void**)&data ) ;
-    int stax = nc_put_var1_double( ncid, _varid, var_index, data ) ;
+    if( FONcWriter::Current )
+    {
+	FONcWriter::Current->put_var1( ncid, _varid, NC_DOUBLE, data, _varname ) ;
+	return ;
+    }
+    int stax = FONcNc3Stream::Current ? FONcNc3Stream::Current->put_var1( _varid, NC_DOUBLE, data )
+		   : nc_put_var1_double( ncid, _varid, var_index, data ) ;
     if( stax != NC_NOERR )
     {
 	string err = (string)"fileout.netcdf - "
@@ -112,7 +121,6 @@ FONcDouble::write( int ncid )
 		     + _varname ;
 	FONcUtils::handle_error( stax, err, __FILE__, __LINE__ ) ;
     }
-    delete data ;
     BESDEBUG( "fonc", "FONcDouble::done write for var " << _varname << endl ) ;
 }
 
@@ -0,0 +1,417 @@
+// FONcEncoder.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <unistd.h>
+#include <errno.h>
+
+#include <deque>
+#include <vector>
+#include <sstream>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <BESInternalError.h>
+#include <BESDebug.h>
+#include <BESIndent.h>
+#include <BESUtil.h>
+
+#include "FONcEncoder.h"
+#include "FONcWorkerPool.h"
+#include "FONcDigest.h"
+
+using namespace std;
+
+// The size of the blocks read from the file and compressed on their own
+#define FONC_ENCODER_BLOCK_SIZE (128 * 1024)
+// The size of the deflate window, the most a block can use of the one before
+#define FONC_ENCODER_DICTIONARY_SIZE 32768
+
+/** @brief Read from a file until a buffer is full or the file ends
+ *
+ * @param digest If not null, the bytes read are added to it
+ * @return The number of bytes read
+ * @throws BESInternalError if the file cannot be read
+ */
+static size_t read_block(int fd, char *buf, size_t size, FONcDigest *digest)
+{
+    size_t total = 0;
+    while (total < size) {
+        ssize_t nbytes = read(fd, buf + total, size - total);
+        if (nbytes == 0) break;
+        if (nbytes < 0) {
+            if (errno == EINTR) continue;
+            throw BESInternalError("Failed to read the temporary file", __FILE__, __LINE__);
+        }
+        total += nbytes;
+    }
+    if (digest) digest->update(buf, total);
+    return total;
+}
+
+/** @brief Write a 32-bit number least significant byte first, as gzip
+ * does
+ */
+static void put_le32(ostream &strm, unsigned long value)
+{
+    char bytes[4];
+    for (int i = 0; i < 4; ++i)
+        bytes[i] = (char) ((value >> (8 * i)) & 0xff);
+    strm.write(bytes, 4);
+}
+
+/** @brief Compress one block of a gzip response
+ *
+ * The block is a raw deflate stream flushed with Z_SYNC_FLUSH, so it ends
+ * on a byte boundary and the next block can follow it directly.
+ */
+class FONcDeflateBlock: public FONcTask {
+public:
+    int d_level;
+    vector<char> d_dictionary;
+    vector<char> d_in;
+    vector<char> d_out;
+    unsigned long d_crc;
+
+    FONcDeflateBlock(int level) :
+        d_level(level), d_crc(0)
+    {
+    }
+
+    virtual void run()
+    {
+        z_stream zs;
+        zs.zalloc = Z_NULL;
+        zs.zfree = Z_NULL;
+        zs.opaque = Z_NULL;
+        if (deflateInit2(&zs, d_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw BESInternalError("Failed to start compressing a block of the response", __FILE__, __LINE__);
+
+        if (!d_dictionary.empty())
+            deflateSetDictionary(&zs, reinterpret_cast<Bytef *>(&d_dictionary[0]), d_dictionary.size());
+
+        // The sync flush adds at most a few bytes to the bound
+        d_out.resize(deflateBound(&zs, d_in.size()) + 16);
+        zs.next_in = reinterpret_cast<Bytef *>(&d_in[0]);
+        zs.avail_in = d_in.size();
+        zs.next_out = reinterpret_cast<Bytef *>(&d_out[0]);
+        zs.avail_out = d_out.size();
+        int status = deflate(&zs, Z_SYNC_FLUSH);
+        d_out.resize(d_out.size() - zs.avail_out);
+        deflateEnd(&zs);
+        if (status != Z_OK || zs.avail_in != 0)
+            throw BESInternalError("Failed to compress a block of the response", __FILE__, __LINE__);
+
+        d_crc = crc32(0L, reinterpret_cast<Bytef *>(&d_in[0]), d_in.size());
+    }
+};
+
+/** @brief Make an encoder
+ *
+ * @param encoding The encoding of the output
+ * @param level The compression level; 0 uses the default of the encoding
+ * @param threads The number of threads that compress; 0 or 1 compresses
+ * in the calling thread
+ */
+FONcEncoder::FONcEncoder(Encoding encoding, int level, unsigned int threads) :
+    d_encoding(encoding), d_level(level), d_threads(threads), d_digest(0), d_bytes_in(0), d_bytes_out(0)
+{
+    if (d_encoding == encoding_gzip && (d_level < 1 || d_level > 9)) d_level = Z_DEFAULT_COMPRESSION;
+}
+
+/** @brief Send a file to a stream, compressed
+ *
+ * @param fd The file, read from its current offset to its end
+ * @param strm The stream the compressed bytes are written to
+ * @throws BESInternalError if the file cannot be read or compressed
+ */
+void FONcEncoder::encode(int fd, ostream &strm)
+{
+    switch (d_encoding) {
+    case encoding_gzip:
+        gzip(fd, strm);
+        break;
+    case encoding_zstd:
+        zstd(fd, strm);
+        break;
+    default: {
+        vector<char> block(FONC_ENCODER_BLOCK_SIZE);
+        size_t nbytes;
+        while ((nbytes = read_block(fd, &block[0], block.size(), d_digest)) > 0) {
+            strm.write(&block[0], nbytes);
+            d_bytes_in += nbytes;
+            d_bytes_out += nbytes;
+        }
+        break;
+    }
+    }
+
+    BESDEBUG("fonc", "FONcEncoder::encode() - " << encoding_name(d_encoding) << " sent " << d_bytes_in
+        << " bytes as " << d_bytes_out << endl);
+}
+
+/** @brief Write a file as one gzip member, compressing its blocks in
+ * parallel
+ *
+ * Up to two blocks per thread are read ahead; each finished block is
+ * written as soon as the ones before it are.
+ */
+void FONcEncoder::gzip(int fd, ostream &strm)
+{
+    // A gzip header with no name or time, from a Unix system (RFC 1952)
+    static const char header[10] = { 0x1f, (char) 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    strm.write(header, sizeof header);
+    d_bytes_out += sizeof header;
+
+    FONcWorkerPool pool(d_threads > 1 ? d_threads : 0);
+    size_t in_flight = d_threads > 1 ? 2 * d_threads : 1;
+    deque<FONcDeflateBlock *> blocks;
+    unsigned long crc = crc32(0L, Z_NULL, 0);
+    vector<char> dictionary;
+
+    try {
+        bool more = true;
+        while (more || !blocks.empty()) {
+            while (more && blocks.size() < in_flight) {
+                FONcDeflateBlock *block = new FONcDeflateBlock(d_level);
+                block->d_in.resize(FONC_ENCODER_BLOCK_SIZE);
+                size_t nbytes = 0;
+                try {
+                    nbytes = read_block(fd, &block->d_in[0], block->d_in.size(), d_digest);
+                }
+                catch (...) {
+                    delete block;
+                    throw;
+                }
+                if (nbytes == 0) {
+                    delete block;
+                    more = false;
+                    break;
+                }
+                block->d_in.resize(nbytes);
+                block->d_dictionary.swap(dictionary);
+
+                // The end of this block is the dictionary of the next
+                size_t dict = nbytes < FONC_ENCODER_DICTIONARY_SIZE ? nbytes : FONC_ENCODER_DICTIONARY_SIZE;
+                dictionary.assign(block->d_in.end() - dict, block->d_in.end());
+
+                blocks.push_back(block);
+                pool.submit(block);
+            }
+
+            if (blocks.empty()) break;
+
+            FONcDeflateBlock *block = blocks.front();
+            pool.wait(block);
+            blocks.pop_front();
+
+            strm.write(&block->d_out[0], block->d_out.size());
+            crc = crc32_combine(crc, block->d_crc, block->d_in.size());
+            d_bytes_in += block->d_in.size();
+            d_bytes_out += block->d_out.size();
+            delete block;
+        }
+    }
+    catch (...) {
+        // The pool must not run blocks that are gone
+        while (!blocks.empty()) {
+            try {
+                pool.wait(blocks.front());
+            }
+            catch (...) {
+            }
+            delete blocks.front();
+            blocks.pop_front();
+        }
+        throw;
+    }
+
+    // An empty final block ends the deflate stream, then the trailer
+    static const char last[2] = { 3, 0 };
+    strm.write(last, sizeof last);
+    put_le32(strm, crc);
+    put_le32(strm, d_bytes_in & 0xffffffffUL);
+    d_bytes_out += sizeof last + 8;
+}
+
+/** @brief Write a file as one zstd frame
+ *
+ * libzstd compresses with its own worker threads, if it was built with
+ * them; otherwise it compresses in this thread.
+ */
+void FONcEncoder::zstd(int fd, ostream &strm)
+{
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (!cctx) throw BESInternalError("Failed to start compressing the response", __FILE__, __LINE__);
+
+    if (d_level != 0) ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, d_level);
+    if (d_threads > 1) ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, d_threads);
+
+    vector<char> in(ZSTD_CStreamInSize());
+    vector<char> out(ZSTD_CStreamOutSize());
+
+    try {
+        bool more = true;
+        while (more) {
+            size_t nbytes = read_block(fd, &in[0], in.size(), d_digest);
+            more = nbytes > 0;
+            d_bytes_in += nbytes;
+
+            ZSTD_EndDirective mode = more ? ZSTD_e_continue : ZSTD_e_end;
+            ZSTD_inBuffer input = { &in[0], nbytes, 0 };
+            bool finished = false;
+            while (!finished) {
+                ZSTD_outBuffer output = { &out[0], out.size(), 0 };
+                size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+                if (ZSTD_isError(remaining))
+                    throw BESInternalError(string("Failed to compress the response: ") + ZSTD_getErrorName(remaining),
+                        __FILE__, __LINE__);
+                strm.write(&out[0], output.pos);
+                d_bytes_out += output.pos;
+                finished = more ? (input.pos == input.size) : (remaining == 0);
+            }
+        }
+    }
+    catch (...) {
+        ZSTD_freeCCtx(cctx);
+        throw;
+    }
+
+    ZSTD_freeCCtx(cctx);
+#else
+    (void) fd;
+    (void) strm;
+    throw BESInternalError("This server was built without zstd", __FILE__, __LINE__);
+#endif
+}
+
+/** @brief Choose the encoding of a response
+ *
+ * @param offered The encodings the server may use, in the order it
+ * prefers them, separated by commas (FONc.TransferEncodings)
+ * @param accepted The value of the client's Accept-Encoding header
+ * @return The first offered encoding the client accepts, or encoding_none
+ */
+FONcEncoder::Encoding FONcEncoder::negotiate(const string &offered, const string &accepted)
+{
+    // The codings the client accepts, less those with q=0
+    vector<string> codings;
+    bool any = false;
+    string::size_type start = 0;
+    while (start < accepted.length()) {
+        string::size_type end = accepted.find(',', start);
+        if (end == string::npos) end = accepted.length();
+        string item = BESUtil::lowercase(accepted.substr(start, end - start));
+        start = end + 1;
+
+        string::size_type semi = item.find(';');
+        string coding = item.substr(0, semi);
+        string::size_type first = coding.find_first_not_of(" \t");
+        if (first == string::npos) continue;
+        coding = coding.substr(first, coding.find_last_not_of(" \t") - first + 1);
+
+        if (semi != string::npos) {
+            string::size_type q = item.find("q=", semi);
+            if (q != string::npos) {
+                istringstream iss(item.substr(q + 2));
+                double weight = 1.0;
+                iss >> weight;
+                if (!iss.fail() && weight <= 0.0) continue;
+            }
+        }
+
+        if (coding == "*")
+            any = true;
+        else
+            codings.push_back(coding);
+    }
+
+    start = 0;
+    while (start < offered.length()) {
+        string::size_type end = offered.find(',', start);
+        if (end == string::npos) end = offered.length();
+        string name = BESUtil::lowercase(offered.substr(start, end - start));
+        start = end + 1;
+
+        string::size_type first = name.find_first_not_of(" \t");
+        if (first == string::npos) continue;
+        name = name.substr(first, name.find_last_not_of(" \t") - first + 1);
+
+        Encoding encoding = encoding_id(name);
+        if (encoding == encoding_none) continue;
+        if (any) return encoding;
+        for (vector<string>::iterator i = codings.begin(); i != codings.end(); ++i) {
+            if (*i == name || (encoding == encoding_gzip && *i == "x-gzip")) return encoding;
+        }
+    }
+
+    return encoding_none;
+}
+
+/** @brief The encoding with a name
+ *
+ * @return encoding_none if the name is not gzip or, when the module is
+ * built with libzstd, zstd
+ */
+FONcEncoder::Encoding FONcEncoder::encoding_id(const string &name)
+{
+    if (name == "gzip") return encoding_gzip;
+#ifdef HAVE_ZSTD
+    if (name == "zstd") return encoding_zstd;
+#endif
+    return encoding_none;
+}
+
+/** @brief The Content-Encoding name of an encoding
+ */
+string FONcEncoder::encoding_name(Encoding encoding)
+{
+    switch (encoding) {
+    case encoding_gzip:
+        return "gzip";
+    case encoding_zstd:
+        return "zstd";
+    default:
+        return "identity";
+    }
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcEncoder::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcEncoder::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "encoding = " << encoding_name(d_encoding) << endl;
+    strm << BESIndent::LMarg << "level = " << d_level << endl;
+    strm << BESIndent::LMarg << "threads = " << d_threads << endl;
+    strm << BESIndent::LMarg << "bytes in = " << d_bytes_in << endl;
+    strm << BESIndent::LMarg << "bytes out = " << d_bytes_out << endl;
+    BESIndent::UnIndent();
+}
@@ -0,0 +1,92 @@
+// FONcEncoder.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef FONcEncoder_h_
+#define FONcEncoder_h_ 1
+
+#include <string>
+
+#include <BESObj.h>
+
+class FONcDigest;
+
+/** @brief Compresses a response file as it is sent to the client
+ *
+ * netCDF-3 files cannot use the netCDF-4 deflate filter, but they often
+ * compress well. When FONc.TransferEncodings is set and the front end
+ * says, in the fonc_accept_encoding context, that the client accepts one
+ * of those encodings, FONcTransmitter sends the file through an encoder.
+ * The front end passes on the client's Accept-Encoding header and labels
+ * the response with the Content-Encoding named in the
+ * fonc_content_encoding context.
+ *
+ * The file is read in blocks and compressed bytes are written while the
+ * rest of the file is read. gzip output compresses the blocks in
+ * parallel, as pigz does: each block is a raw deflate stream that ends
+ * on a byte boundary and uses the end of the block before it as its
+ * dictionary, so the blocks concatenate into one gzip member. zstd
+ * output, when the module is built with libzstd, uses the library's own
+ * worker threads.
+ */
+class FONcEncoder: public BESObj {
+public:
+    enum Encoding {
+        encoding_none, encoding_gzip, encoding_zstd
+    };
+
+private:
+    Encoding d_encoding;
+    int d_level;
+    unsigned int d_threads;
+
+    // The checksum of the file, if one is computed as it is sent
+    FONcDigest *d_digest;
+
+    unsigned long long d_bytes_in;
+    unsigned long long d_bytes_out;
+
+    void gzip(int fd, std::ostream &strm);
+    void zstd(int fd, std::ostream &strm);
+
+    FONcEncoder(const FONcEncoder &);
+    FONcEncoder &operator=(const FONcEncoder &);
+
+public:
+    FONcEncoder(Encoding encoding, int level, unsigned int threads);
+    virtual ~FONcEncoder() { }
+
+    virtual void encode(int fd, std::ostream &strm);
+
+    /** @brief Add the bytes of the file to a checksum as they are read */
+    virtual void set_digest(FONcDigest *digest) { d_digest = digest; }
+
+    virtual unsigned long long bytes_in() const { return d_bytes_in; }
+    virtual unsigned long long bytes_out() const { return d_bytes_out; }
+
+    static Encoding negotiate(const std::string &offered, const std::string &accepted);
+    static Encoding encoding_id(const std::string &name);
+    static std::string encoding_name(Encoding encoding);
+
+    virtual void dump(std::ostream &strm) const;
+};
+
+#endif // FONcEncoder_h_
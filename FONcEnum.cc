@@ -0,0 +1,292 @@
+// FONcEnum.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+
+#include <BESInternalError.h>
+#include <BESDebug.h>
+
+#include "FONcEnum.h"
+#include "FONcUtils.h"
+#include "FONcAttributes.h"
+#include "FONcWriter.h"
+#include "FONcNc3Stream.h"
+
+using std::map;
+
+map<D4EnumDef *, nc_type> FONcEnum::Types;
+
+/** @brief Constructor for FONcEnum that takes a DAP4 Enum
+ *
+ * @param b A DAP BaseType that should be an Enum
+ * @throws BESInternalError if the BaseType is not an Enum
+ */
+FONcEnum::FONcEnum(BaseType *b) :
+    FONcBaseType(), _e(0), _type(NC_NAT)
+{
+    _e = dynamic_cast<D4Enum *>(b);
+    if (!_e) {
+        string s = (string) "File out netcdf, FONcEnum was passed a " + "variable that is not a DAP Enum";
+        throw BESInternalError(s, __FILE__, __LINE__);
+    }
+}
+
+/** @brief Destructor
+ *
+ * The DAP Enum instance does not belong to the FONcEnum instance, so it
+ * is not deleted.
+ */
+FONcEnum::~FONcEnum()
+{
+}
+
+/** @brief Check that the response can hold the values of the Enum
+ *
+ * @param embed The parent names of this variable
+ * @throws BESSyntaxUserError if the Enum holds 64-bit integers and the
+ * response cannot
+ */
+void FONcEnum::convert(vector<string> embed)
+{
+    FONcBaseType::convert(embed);
+    if (FONcUtils::get_nc_type(_e) == NC_INT64 || FONcUtils::get_nc_type(_e) == NC_UINT64)
+        FONcUtils::require_enhanced_model(_e->type_name(), _e->name());
+}
+
+/** @brief define the DAP Enum in the netcdf file
+ *
+ * The enum type is defined first, if it was not already defined with
+ * the group that declares it.
+ *
+ * @param ncid The id of the NetCDF file or group
+ * @throws BESInternalError if there is a problem defining the Enum
+ */
+void FONcEnum::define(int ncid)
+{
+    if (!_defined) {
+        _type = FONcUtils::enhanced_model ? define_type(ncid, _e->enumeration()) : FONcUtils::get_nc_type(_e);
+    }
+
+    FONcBaseType::define(ncid);
+
+    if (!_defined) {
+        FONcAttributes::add_variable_attributes(ncid, _varid, _e);
+        FONcAttributes::add_original_name(ncid, _varid, _varname, _orig_varname);
+
+        _defined = true;
+    }
+}
+
+/** @brief Write the value of the Enum to the netcdf file
+ *
+ * @param ncid The id of the netcdf file
+ * @throws BESInternalError if there is a problem writing the value
+ */
+void FONcEnum::write(int ncid)
+{
+    BESDEBUG("fonc", "FONcEnum::write for var " << _varname << endl);
+    size_t var_index[] = { 0 };
+    dods_int64 value = 0;
+    _e->value(&value);
+    int stax;
+    if (FONcUtils::enhanced_model) {
+        long long data = 0;
+        store(value, base_type(_e->element_type()), &data);
+        if (FONcWriter::Current) {
+            FONcWriter::Current->put_var1(ncid, _varid, NC_NAT, &data, _varname);
+            return;
+        }
+        stax = nc_put_var1(ncid, _varid, var_index, &data);
+    }
+    else {
+        long long data = value;
+        if (FONcWriter::Current) {
+            FONcWriter::Current->put_var1(ncid, _varid, NC_INT64, &data, _varname);
+            return;
+        }
+        stax = FONcNc3Stream::Current ? FONcNc3Stream::Current->put_var1(_varid, NC_INT64, &data)
+            : nc_put_var1_longlong(ncid, _varid, var_index, &data);
+    }
+    if (stax != NC_NOERR) {
+        string err = (string) "fileout.netcdf - " + "Failed to write enum data for " + _varname;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+}
+
+/** @brief returns the name of the DAP Enum
+ */
+string FONcEnum::name()
+{
+    return _e->name();
+}
+
+/** @brief returns the netcdf type of the DAP Enum
+ *
+ * @returns The enum type, or the integer type of the values when the file
+ * does not use the enhanced data model. NC_NAT until the Enum is defined.
+ */
+nc_type FONcEnum::type()
+{
+    return _type;
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcEnum::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcEnum::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "name = " << _e->name() << endl;
+    strm << BESIndent::LMarg << "type = " << _type << endl;
+    BESIndent::UnIndent();
+}
+
+/** @brief The netCDF-4 integer type of the values of an enumeration
+ *
+ * @param element_type The DAP4 type of the values
+ * @throws BESInternalError if the type is not an integer type
+ */
+nc_type FONcEnum::base_type(Type element_type)
+{
+    switch (element_type) {
+    case dods_int8_c:
+        return NC_BYTE;
+    case dods_byte_c:
+    case dods_uint8_c:
+        return NC_UBYTE;
+    case dods_int16_c:
+        return NC_SHORT;
+    case dods_uint16_c:
+        return NC_USHORT;
+    case dods_int32_c:
+        return NC_INT;
+    case dods_uint32_c:
+        return NC_UINT;
+    case dods_int64_c:
+        return NC_INT64;
+    case dods_uint64_c:
+        return NC_UINT64;
+    default:
+        throw BESInternalError("File out netcdf, an enumeration must hold integer values", __FILE__, __LINE__);
+    }
+}
+
+template<typename T>
+static void store_as(long long value, void *out)
+{
+    *static_cast<T *>(out) = static_cast<T>(value);
+}
+
+/** @brief Store an integer as a value of a netCDF-4 integer type
+ *
+ * @param value The value
+ * @param base The integer type
+ * @param out At least eight bytes, aligned for a long long
+ */
+void FONcEnum::store(long long value, nc_type base, void *out)
+{
+    switch (base) {
+    case NC_BYTE:
+        store_as<signed char>(value, out);
+        break;
+    case NC_UBYTE:
+        store_as<unsigned char>(value, out);
+        break;
+    case NC_SHORT:
+        store_as<short>(value, out);
+        break;
+    case NC_USHORT:
+        store_as<unsigned short>(value, out);
+        break;
+    case NC_INT:
+        store_as<int>(value, out);
+        break;
+    case NC_UINT:
+        store_as<unsigned int>(value, out);
+        break;
+    default:
+        store_as<long long>(value, out);
+        break;
+    }
+}
+
+/** @brief Define the netcdf enum type of an enumeration
+ *
+ * Each enumeration is defined once per response; later calls return the
+ * type already defined.
+ *
+ * @param ncid The id of the file or group that declares the enumeration
+ * @param def The enumeration
+ * @return The id of the enum type
+ * @throws BESInternalError if the type cannot be defined
+ */
+nc_type FONcEnum::define_type(int ncid, D4EnumDef *def)
+{
+    if (!def) throw BESInternalError("File out netcdf, an Enum has no enumeration", __FILE__, __LINE__);
+
+    map<D4EnumDef *, nc_type>::iterator i = Types.find(def);
+    if (i != Types.end()) return i->second;
+
+    string type_name = FONcUtils::id2netcdf(def->name());
+    nc_type base = base_type(def->type());
+    nc_type type_id;
+    int stax = nc_def_enum(ncid, base, type_name.c_str(), &type_id);
+    if (stax != NC_NOERR) {
+        string err = (string) "fileout.netcdf - " + "Failed to define enum type " + type_name;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+
+    D4EnumDef::D4EnumValueIter vi = def->value_begin();
+    D4EnumDef::D4EnumValueIter ve = def->value_end();
+    for (; vi != ve; vi++) {
+        long long value = 0;
+        store(def->value(vi), base, &value);
+        stax = nc_insert_enum(ncid, type_id, FONcUtils::id2netcdf(def->label(vi)).c_str(), &value);
+        if (stax != NC_NOERR) {
+            string err = (string) "fileout.netcdf - " + "Failed to add " + def->label(vi) + " to enum type " + type_name;
+            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+        }
+    }
+
+    BESDEBUG("fonc", "FONcEnum::define_type() - defined " << type_name << " as type " << type_id << endl);
+    Types[def] = type_id;
+
+    return type_id;
+}
+
+/** @brief Define the enum types declared by a group
+ *
+ * @param ncid The id of the netcdf file or group for the group
+ * @param g The DAP4 group
+ */
+void FONcEnum::define_types(int ncid, D4Group *g)
+{
+    D4EnumDefs *defs = g->enum_defs();
+    if (!defs) return;
+
+    D4EnumDefs::D4EnumDefIter di = defs->enum_begin();
+    D4EnumDefs::D4EnumDefIter de = defs->enum_end();
+    for (; di != de; di++) {
+        define_type(ncid, *di);
+    }
+}
@@ -0,0 +1,71 @@
+// FONcEnum.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+
+#ifndef FONcEnum_h_
+#define FONcEnum_h_ 1
+
+#include <map>
+
+#include <D4Enum.h>
+#include <D4EnumDefs.h>
+#include <D4Group.h>
+
+using namespace libdap;
+
+#include "FONcBaseType.h"
+
+/** @brief A DAP4 Enum with file out netcdf information included
+ *
+ * In netCDF-4 files that use the enhanced data model each enumeration of
+ * the DMR becomes a netcdf enum type, defined in the group that declares
+ * it, and the Enums are variables of that type. Otherwise the Enums are
+ * written as their integer values.
+ *
+ * The static methods define the enum types; FONcArray uses them for
+ * Arrays of Enums.
+ */
+class FONcEnum: public FONcBaseType {
+private:
+    D4Enum *_e;
+    nc_type _type;
+public:
+    FONcEnum(BaseType *b);
+    virtual ~FONcEnum();
+
+    virtual void convert(vector<string> embed);
+    virtual void define(int ncid);
+    virtual void write(int ncid);
+
+    virtual string name();
+    virtual nc_type type();
+
+    virtual void dump(ostream &strm) const;
+
+    static std::map<D4EnumDef *, nc_type> Types;
+    static nc_type base_type(Type element_type);
+    static nc_type define_type(int ncid, D4EnumDef *def);
+    static void define_types(int ncid, D4Group *g);
+    static void store(long long value, nc_type base, void *out);
+};
+
+#endif // FONcEnum_h_
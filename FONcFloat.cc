@@ -36,6 +36,8 @@
 #include "FONcFloat.h"
 #include "FONcUtils.h"
 #include "FONcAttributes.h"
+#include "FONcWriter.h"
+#include "FONcNc3Stream.h"
 
 /** @brief Constructor for FONcFloat that takes a DAP Float32
  *
@@ -105,9 +107,16 @@ FONcFloat::write( int ncid )
 {
     BESDEBUG( "fonc", "FONcFloat::write for var " << _varname << endl ) ;
     size_t var_index[] = {0} ;
-    float *data = new float ;
+    float value = 0 ;
+    float *data = &value ;
     _f->buf2val( (void**)&data ) ;
-    int stax = nc_put_var1_float( ncid, _varid, var_index, data ) ;
+    if( FONcWriter::Current )
+    {
+	FONcWriter::Current->put_var1( ncid, _varid, NC_FLOAT, data, _varname ) ;
+	return ;
+    }
+    int stax = FONcNc3Stream::Current ? FONcNc3Stream::Current->put_var1( _varid, NC_FLOAT, data )
+		   : nc_put_var1_float( ncid, _varid, var_index, data ) ;
     ncopts = NC_VERBOSE ;
     if( stax != NC_NOERR )
     {
@@ -116,7 +125,6 @@ FONcFloat::write( int ncid )
 		     + _varname ;
 	FONcUtils::handle_error( stax, err, __FILE__, __LINE__ ) ;
     }
-    delete data ;
     BESDEBUG( "fonc", "FONcFloat::done write for var " << _varname << endl ) ;
 }
 
@@ -172,6 +172,7 @@ void FONcGrid::convert(vector<string> embed)
         // FONcMap to the FONcGrid.
         if (!map_found) {
             FONcArray *fa = new FONcArray(map);
+            fa->setVersion(_ncVersion);
             fa->convert(map_embed);
             map_found = new FONcMap(fa, true);
             FONcGrid::Maps.push_back(map_found);
@@ -193,6 +194,7 @@ void FONcGrid::convert(vector<string> embed)
     // jhrg 11/3/16
     if (_grid->get_array()->send_p()) {
         _arr = new FONcArray(_grid->get_array());
+        _arr->setVersion(_ncVersion);
         _arr->convert(_embed);
     }
 
@@ -0,0 +1,204 @@
+// FONcGroup.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+
+#include <BESInternalError.h>
+#include <BESDebug.h>
+
+#include "FONcGroup.h"
+#include "FONcEnum.h"
+#include "FONcUtils.h"
+#include "FONcAttributes.h"
+
+/** @brief Constructor for FONcGroup that takes a DAP4 Group
+ *
+ * @param b A DAP BaseType that should be a D4Group
+ * @throws BESInternalError if the BaseType is not a D4Group
+ */
+FONcGroup::FONcGroup(BaseType *b) :
+    FONcBaseType(), _g(0), _grpid(0)
+{
+    _g = dynamic_cast<D4Group *>(b);
+    if (!_g) {
+        string s = (string) "File out netcdf, FONcGroup was passed a " + "variable that is not a DAP4 group";
+        throw BESInternalError(s, __FILE__, __LINE__);
+    }
+}
+
+/** @brief Destructor that deletes the FONc objects of the group's
+ * variables
+ */
+FONcGroup::~FONcGroup()
+{
+    vector<FONcBaseType *>::iterator i = _vars.begin();
+    vector<FONcBaseType *>::iterator e = _vars.end();
+    for (; i != e; i++) {
+        delete *i;
+    }
+}
+
+/** @brief Does a group, or one of the groups it holds, have a variable
+ * that is to be sent?
+ *
+ * @param g The DAP4 group
+ */
+bool FONcGroup::sends(D4Group *g)
+{
+    Constructor::Vars_iter vi = g->var_begin();
+    Constructor::Vars_iter ve = g->var_end();
+    for (; vi != ve; vi++) {
+        if ((*vi)->send_p()) return true;
+    }
+
+    D4Group::groupsIter gi = g->grp_begin();
+    D4Group::groupsIter ge = g->grp_end();
+    for (; gi != ge; gi++) {
+        if (sends(*gi)) return true;
+    }
+
+    return false;
+}
+
+/** @brief Creates the FONc objects for the variables and groups of the
+ * DAP4 group
+ *
+ * Only the variables to be sent are converted, and only the groups that
+ * hold such variables.
+ *
+ * @param embed The parent names of this group
+ * @throws BESInternalError if there is a problem converting the group
+ */
+void FONcGroup::convert(vector<string> embed)
+{
+    FONcBaseType::convert(embed);
+    if (FONcUtils::enhanced_model)
+        embed.clear();
+    else
+        embed.push_back(name());
+
+    Constructor::Vars_iter vi = _g->var_begin();
+    Constructor::Vars_iter ve = _g->var_end();
+    for (; vi != ve; vi++) {
+        BaseType *bt = *vi;
+        if (bt->send_p()) {
+            BESDEBUG("fonc", "FONcGroup::convert - converting " << bt->name() << endl);
+            FONcBaseType *fbt = FONcUtils::convert(bt);
+            fbt->setVersion(_ncVersion);
+            _vars.push_back(fbt);
+            fbt->convert(embed);
+        }
+    }
+
+    D4Group::groupsIter gi = _g->grp_begin();
+    D4Group::groupsIter ge = _g->grp_end();
+    for (; gi != ge; gi++) {
+        if (sends(*gi)) {
+            BESDEBUG("fonc", "FONcGroup::convert - converting group " << (*gi)->name() << endl);
+            FONcBaseType *fbt = FONcUtils::convert(*gi);
+            fbt->setVersion(_ncVersion);
+            _vars.push_back(fbt);
+            fbt->convert(embed);
+        }
+    }
+}
+
+/** @brief Define the group and its variables in the netcdf file
+ *
+ * With the enhanced data model the netcdf group is defined along with
+ * the enum types the group declares, and the attributes of the group
+ * become attributes of the netcdf group.
+ *
+ * @param ncid The id of the netcdf file or parent group
+ * @throws BESInternalError if there is a problem defining the group
+ */
+void FONcGroup::define(int ncid)
+{
+    if (!_defined) {
+        BESDEBUG("fonc", "FONcGroup::define - defining " << _varname << endl);
+        _grpid = ncid;
+        if (FONcUtils::enhanced_model) {
+            string grpname = FONcUtils::id2netcdf(_varname);
+            int stax = nc_def_grp(ncid, grpname.c_str(), &_grpid);
+            if (stax != NC_NOERR) {
+                string err = (string) "fileout.netcdf - " + "Failed to define group " + grpname;
+                FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+            }
+
+            FONcEnum::define_types(_grpid, _g);
+            FONcAttributes::add_attributes(_grpid, NC_GLOBAL, _g->get_attr_table(), "", "");
+        }
+
+        vector<FONcBaseType *>::const_iterator i = _vars.begin();
+        vector<FONcBaseType *>::const_iterator e = _vars.end();
+        for (; i != e; i++) {
+            (*i)->define(_grpid);
+        }
+
+        _defined = true;
+
+        BESDEBUG("fonc", "FONcGroup::define - done defining " << _varname << endl);
+    }
+}
+
+/** @brief Write the variables of the group to the netcdf file
+ *
+ * @param ncid The id of the netcdf file (not used)
+ * @throws BESInternalError if there is a problem writing the variables
+ */
+void FONcGroup::write(int /*ncid*/)
+{
+    BESDEBUG("fonc", "FONcGroup::write - writing " << _varname << endl);
+    vector<FONcBaseType *>::const_iterator i = _vars.begin();
+    vector<FONcBaseType *>::const_iterator e = _vars.end();
+    for (; i != e; i++) {
+        (*i)->write(_grpid);
+    }
+    BESDEBUG("fonc", "FONcGroup::write - done writing " << _varname << endl);
+}
+
+/** @brief Returns the name of the group
+ */
+string FONcGroup::name()
+{
+    return _g->name();
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcGroup::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcGroup::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "name = " << _g->name() << " {" << endl;
+    if (FONcUtils::enhanced_model) strm << BESIndent::LMarg << "group id = " << _grpid << endl;
+    BESIndent::Indent();
+    vector<FONcBaseType *>::const_iterator i = _vars.begin();
+    vector<FONcBaseType *>::const_iterator e = _vars.end();
+    for (; i != e; i++) {
+        (*i)->dump(strm);
+    }
+    BESIndent::UnIndent();
+    strm << BESIndent::LMarg << "}" << endl;
+    BESIndent::UnIndent();
+}
@@ -0,0 +1,63 @@
+// FONcGroup.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+
+#ifndef FONcGroup_h_
+#define FONcGroup_h_ 1
+
+#include <D4Group.h>
+
+using namespace libdap;
+
+#include "FONcBaseType.h"
+
+/** @brief A DAP4 Group with file out netcdf information included
+ *
+ * In netCDF-4 files that use the enhanced data model the group becomes a
+ * netcdf group, with its enumerations, attributes and variables. Otherwise
+ * it is flattened like a Structure: the name of the group is embedded in
+ * the names of its variables.
+ *
+ * The root group of a DMR is not a FONcGroup; FONcTransform writes it as
+ * the file itself.
+ */
+class FONcGroup: public FONcBaseType {
+private:
+    D4Group *_g;
+    vector<FONcBaseType *> _vars;
+    int _grpid;
+public:
+    FONcGroup(BaseType *b);
+    virtual ~FONcGroup();
+
+    virtual void convert(vector<string> embed);
+    virtual void define(int ncid);
+    virtual void write(int ncid);
+
+    virtual string name();
+
+    virtual void dump(ostream &strm) const;
+
+    static bool sends(D4Group *g);
+};
+
+#endif // FONcGroup_h_
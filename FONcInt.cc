@@ -37,6 +37,8 @@
 #include "FONcInt.h"
 #include "FONcUtils.h"
 #include "FONcAttributes.h"
+#include "FONcWriter.h"
+#include "FONcNc3Stream.h"
 
 /** @brief Constructor for FOncInt that takes a DAP Int32 or UInt32
  *
@@ -105,9 +107,16 @@ FONcInt::write( int ncid )
 {
     BESDEBUG( "fonc", "FONcInt::write for var " << _varname << endl ) ;
     size_t var_index[] = {0} ;
-    int *data = new int ;
+    int value = 0 ;
+    int *data = &value ;
     _bt->buf2val( (void**)&data ) ;
-    int stax = nc_put_var1_int( ncid, _varid, var_index, data ) ;
+    if( FONcWriter::Current )
+    {
+	FONcWriter::Current->put_var1( ncid, _varid, NC_INT, data, _varname ) ;
+	return ;
+    }
+    int stax = FONcNc3Stream::Current ? FONcNc3Stream::Current->put_var1( _varid, NC_INT, data )
+		   : nc_put_var1_int( ncid, _varid, var_index, data ) ;
     if( stax != NC_NOERR )
     {
 	string err = (string)"fileout.netcdf - "
@@ -115,7 +124,6 @@ FONcInt::write( int ncid )
 		     + _varname ;
 	FONcUtils::handle_error( stax, err, __FILE__, __LINE__ ) ;
     }
-    delete data ;
     BESDEBUG( "fonc", "FONcInt::done write for var " << _varname << endl ) ;
 }
 
@@ -0,0 +1,152 @@
+// FONcInt64.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+
+#include <BESInternalError.h>
+#include <BESDebug.h>
+#include <Int64.h>
+#include <UInt64.h>
+
+#include "FONcInt64.h"
+#include "FONcUtils.h"
+#include "FONcAttributes.h"
+#include "FONcWriter.h"
+#include "FONcNc3Stream.h"
+
+/** @brief Constructor for FONcInt64 that takes a DAP4 Int64 or UInt64
+ *
+ * @param b A DAP BaseType that should be an Int64 or UInt64
+ * @throws BESInternalError if the BaseType is not an Int64 or UInt64
+ */
+FONcInt64::FONcInt64(BaseType *b) :
+    FONcBaseType(), _bt(b)
+{
+    if (!dynamic_cast<Int64 *>(b) && !dynamic_cast<UInt64 *>(b)) {
+        string s = (string) "File out netcdf, FONcInt64 was passed a " + "variable that is not a DAP Int64 or UInt64";
+        throw BESInternalError(s, __FILE__, __LINE__);
+    }
+}
+
+/** @brief Destructor
+ *
+ * The DAP Int64 or UInt64 instance does not belong to the FONcInt64
+ * instance, so it is not deleted.
+ */
+FONcInt64::~FONcInt64()
+{
+}
+
+/** @brief Check that the response can hold a 64-bit integer
+ *
+ * @param embed The parent names of this variable
+ * @throws BESSyntaxUserError if the response is a netCDF-3 file or uses
+ * the classic model
+ */
+void FONcInt64::convert(vector<string> embed)
+{
+    FONcBaseType::convert(embed);
+    FONcUtils::require_enhanced_model(_bt->type_name(), _bt->name());
+}
+
+/** @brief define the DAP Int64 or UInt64 in the netcdf file
+ *
+ * @param ncid The id of the NetCDF file
+ * @throws BESInternalError if there is a problem defining the variable
+ */
+void FONcInt64::define(int ncid)
+{
+    FONcBaseType::define(ncid);
+
+    if (!_defined) {
+        FONcAttributes::add_variable_attributes(ncid, _varid, _bt);
+        FONcAttributes::add_original_name(ncid, _varid, _varname, _orig_varname);
+
+        _defined = true;
+    }
+}
+
+/** @brief Write the value of the Int64 or UInt64 to the netcdf file
+ *
+ * @param ncid The id of the netcdf file
+ * @throws BESInternalError if there is a problem writing the value
+ */
+void FONcInt64::write(int ncid)
+{
+    BESDEBUG("fonc", "FONcInt64::write for var " << _varname << endl);
+    size_t var_index[] = { 0 };
+    int stax;
+    if (_bt->type() == dods_uint64_c) {
+        unsigned long long value = 0;
+        unsigned long long *data = &value;
+        _bt->buf2val((void**) &data);
+        if (FONcWriter::Current) {
+            FONcWriter::Current->put_var1(ncid, _varid, NC_UINT64, data, _varname);
+            return;
+        }
+        stax = FONcNc3Stream::Current ? FONcNc3Stream::Current->put_var1(_varid, NC_UINT64, data)
+            : nc_put_var1_ulonglong(ncid, _varid, var_index, data);
+    }
+    else {
+        long long value = 0;
+        long long *data = &value;
+        _bt->buf2val((void**) &data);
+        if (FONcWriter::Current) {
+            FONcWriter::Current->put_var1(ncid, _varid, NC_INT64, data, _varname);
+            return;
+        }
+        stax = FONcNc3Stream::Current ? FONcNc3Stream::Current->put_var1(_varid, NC_INT64, data)
+            : nc_put_var1_longlong(ncid, _varid, var_index, data);
+    }
+    if (stax != NC_NOERR) {
+        string err = (string) "fileout.netcdf - " + "Failed to write int64 data for " + _varname;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+}
+
+/** @brief returns the name of the DAP Int64 or UInt64
+ */
+string FONcInt64::name()
+{
+    return _bt->name();
+}
+
+/** @brief returns the netcdf type of the DAP Int64 or UInt64
+ *
+ * @returns NC_INT64 or NC_UINT64
+ */
+nc_type FONcInt64::type()
+{
+    return _bt->type() == dods_uint64_c ? NC_UINT64 : NC_INT64;
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcInt64::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcInt64::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "name = " << _bt->name() << endl;
+    strm << BESIndent::LMarg << "type = " << _bt->type_name() << endl;
+    BESIndent::UnIndent();
+}
@@ -0,0 +1,55 @@
+// FONcInt64.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+
+#ifndef FONcInt64_h_
+#define FONcInt64_h_ 1
+
+#include <BaseType.h>
+
+using namespace libdap;
+
+#include "FONcBaseType.h"
+
+/** @brief A DAP4 Int64 or UInt64 with file out netcdf information included
+ *
+ * The 64-bit integers are written as NC_INT64 and NC_UINT64, which only
+ * netCDF-4 files that use the enhanced data model have.
+ */
+class FONcInt64: public FONcBaseType {
+private:
+    BaseType *_bt;
+public:
+    FONcInt64(BaseType *b);
+    virtual ~FONcInt64();
+
+    virtual void convert(vector<string> embed);
+    virtual void define(int ncid);
+    virtual void write(int ncid);
+
+    virtual string name();
+    virtual nc_type type();
+
+    virtual void dump(ostream &strm) const;
+};
+
+#endif // FONcInt64_h_
@@ -0,0 +1,124 @@
+// FONcInt8.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+
+#include <BESInternalError.h>
+#include <BESDebug.h>
+#include <Int8.h>
+
+#include "FONcInt8.h"
+#include "FONcUtils.h"
+#include "FONcAttributes.h"
+#include "FONcWriter.h"
+#include "FONcNc3Stream.h"
+
+/** @brief Constructor for FONcInt8 that takes a DAP4 Int8
+ *
+ * @param b A DAP BaseType that should be an Int8
+ * @throws BESInternalError if the BaseType is not an Int8
+ */
+FONcInt8::FONcInt8(BaseType *b) :
+    FONcBaseType(), _bt(b)
+{
+    if (!dynamic_cast<Int8 *>(b)) {
+        string s = (string) "File out netcdf, FONcInt8 was passed a " + "variable that is not a DAP Int8";
+        throw BESInternalError(s, __FILE__, __LINE__);
+    }
+}
+
+/** @brief Destructor
+ *
+ * The DAP Int8 instance does not belong to the FONcInt8 instance, so it
+ * is not deleted.
+ */
+FONcInt8::~FONcInt8()
+{
+}
+
+/** @brief define the DAP Int8 in the netcdf file
+ *
+ * @param ncid The id of the NetCDF file
+ * @throws BESInternalError if there is a problem defining the Int8
+ */
+void FONcInt8::define(int ncid)
+{
+    FONcBaseType::define(ncid);
+
+    if (!_defined) {
+        FONcAttributes::add_variable_attributes(ncid, _varid, _bt);
+        FONcAttributes::add_original_name(ncid, _varid, _varname, _orig_varname);
+
+        _defined = true;
+    }
+}
+
+/** @brief Write the value of the Int8 to the netcdf file
+ *
+ * @param ncid The id of the netcdf file
+ * @throws BESInternalError if there is a problem writing the value
+ */
+void FONcInt8::write(int ncid)
+{
+    BESDEBUG("fonc", "FONcInt8::write for var " << _varname << endl);
+    size_t var_index[] = { 0 };
+    signed char value = 0;
+    signed char *data = &value;
+    _bt->buf2val((void**) &data);
+    if (FONcWriter::Current) {
+        FONcWriter::Current->put_var1(ncid, _varid, NC_BYTE, data, _varname);
+        return;
+    }
+    int stax = FONcNc3Stream::Current ? FONcNc3Stream::Current->put_var1(_varid, NC_BYTE, data)
+        : nc_put_var1_schar(ncid, _varid, var_index, data);
+    if (stax != NC_NOERR) {
+        string err = (string) "fileout.netcdf - " + "Failed to write int8 data for " + _varname;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+}
+
+/** @brief returns the name of the DAP Int8
+ */
+string FONcInt8::name()
+{
+    return _bt->name();
+}
+
+/** @brief returns the netcdf type of the DAP Int8
+ *
+ * @returns The nc_type of NC_BYTE
+ */
+nc_type FONcInt8::type()
+{
+    return NC_BYTE;
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcInt8::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcInt8::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "name = " << _bt->name() << endl;
+    BESIndent::UnIndent();
+}
@@ -0,0 +1,54 @@
+// FONcInt8.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+
+#ifndef FONcInt8_h_
+#define FONcInt8_h_ 1
+
+#include <BaseType.h>
+
+using namespace libdap;
+
+#include "FONcBaseType.h"
+
+/** @brief A DAP4 Int8 with file out netcdf information included
+ *
+ * The signed bytes of DAP4 are the netcdf byte type, so unlike the DAP2
+ * Byte they are written without being widened.
+ */
+class FONcInt8: public FONcBaseType {
+private:
+    BaseType *_bt;
+public:
+    FONcInt8(BaseType *b);
+    virtual ~FONcInt8();
+
+    virtual void define(int ncid);
+    virtual void write(int ncid);
+
+    virtual string name();
+    virtual nc_type type();
+
+    virtual void dump(ostream &strm) const;
+};
+
+#endif // FONcInt8_h_
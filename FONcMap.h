@@ -34,6 +34,8 @@
 
 #include <BESObj.h>
 
+#include "FONcArena.h"
+
 //#include "FONcArray.h"
 
 class FONcArray;
@@ -61,6 +63,10 @@ public:
     FONcMap(FONcArray *a, bool ingrid = false);
     virtual ~FONcMap();
 
+    // Maps are made in the arena of the response
+    static void *operator new(size_t bytes) { return FONcArena::allocate_object(bytes); }
+    static void operator delete(void *p) { FONcArena::release_object(p); }
+
     virtual void incref() { _ref++; }
     virtual void decref();
 
@@ -0,0 +1,411 @@
+// FONcMemoryAccountant.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sstream>
+
+#include <BESInternalError.h>
+#include <BESDebug.h>
+
+#include "FONcMemoryAccountant.h"
+#include "FONcRequestHandler.h"
+
+using namespace std;
+
+// The name of the shared memory segment used by all of the BES processes
+// and the number of processes it can track
+#define FONC_MEMORY_SEGMENT "/fonc_memory"
+#define FONC_MEMORY_SLOTS 512
+
+// How often a waiting reservation checks for released memory
+#define FONC_MEMORY_POLL_USEC 50000
+
+#define MB(x) (static_cast<size_t>(x) * 1024 * 1024)
+
+struct FONcMemoryAccountant::SharedTable {
+    pthread_mutex_t lock;
+    volatile int ready;
+    struct {
+        pid_t pid;
+        size_t bytes;
+    } slots[FONC_MEMORY_SLOTS];
+};
+
+FONcMemoryAccountant *FONcMemoryAccountant::d_instance = 0;
+
+static void lock_table(pthread_mutex_t *lock)
+{
+    int status = pthread_mutex_lock(lock);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+    // A process died holding the lock; the slots are still usable
+    if (status == EOWNERDEAD) pthread_mutex_consistent(lock);
+#else
+    (void) status;
+#endif
+}
+
+FONcMemoryAccountant::FONcMemoryAccountant() :
+    d_table(0), d_slot(-1), d_pid(getpid()), d_used(0), d_high_water(0), d_request_high_water(0), d_reservations(0),
+    d_streamed(0), d_waited(0), d_refused(0)
+{
+    pthread_mutex_init(&d_lock, 0);
+
+    if (FONcRequestHandler::memory_budget > 0) attach();
+}
+
+FONcMemoryAccountant::~FONcMemoryAccountant()
+{
+    detach();
+    pthread_mutex_destroy(&d_lock);
+}
+
+/** @brief Get the accountant, making it the first time
+ */
+FONcMemoryAccountant *
+FONcMemoryAccountant::TheAccountant()
+{
+    if (!d_instance) d_instance = new FONcMemoryAccountant;
+    return d_instance;
+}
+
+/** @brief Delete the accountant when the module is unloaded
+ */
+void FONcMemoryAccountant::delete_instance()
+{
+    delete d_instance;
+    d_instance = 0;
+}
+
+/** @brief Map the shared memory segment that holds the usage of each BES
+ * process, making it if this is the first process to use it
+ *
+ * If the segment cannot be used, only the memory of this process is
+ * counted against FONc.MemoryBudget.
+ */
+void FONcMemoryAccountant::attach()
+{
+#ifdef HAVE_SHM_OPEN
+    bool creator = true;
+    int fd = shm_open(FONC_MEMORY_SEGMENT, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        creator = false;
+        fd = shm_open(FONC_MEMORY_SEGMENT, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        BESDEBUG("fonc", "FONcMemoryAccountant::attach() - could not open " << FONC_MEMORY_SEGMENT << endl);
+        return;
+    }
+
+    if (creator) {
+        // ftruncate() fills the new segment with zeros, so all the slots are free
+        if (ftruncate(fd, sizeof(SharedTable)) != 0) {
+            close(fd);
+            shm_unlink(FONC_MEMORY_SEGMENT);
+            return;
+        }
+    }
+    else {
+        struct stat sb;
+        for (int tries = 0; tries < 100; tries++) {
+            if (fstat(fd, &sb) == 0 && sb.st_size >= static_cast<off_t>(sizeof(SharedTable))) break;
+            usleep(10000);
+        }
+        if (fstat(fd, &sb) != 0 || sb.st_size < static_cast<off_t>(sizeof(SharedTable))) {
+            close(fd);
+            return;
+        }
+    }
+
+    void *addr = mmap(0, sizeof(SharedTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return;
+
+    SharedTable *table = static_cast<SharedTable *>(addr);
+    if (creator) {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+        pthread_mutex_init(&table->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        __sync_synchronize();
+        table->ready = 1;
+    }
+    else {
+        for (int tries = 0; tries < 100 && !table->ready; tries++)
+            usleep(10000);
+        if (!table->ready) {
+            munmap(addr, sizeof(SharedTable));
+            return;
+        }
+    }
+
+    d_table = table;
+
+    // Take a slot now so that detach() knows this process uses the segment
+    publish();
+
+    BESDEBUG("fonc", "FONcMemoryAccountant::attach() - using " << FONC_MEMORY_SEGMENT << endl);
+#endif
+}
+
+/** @brief Give up this process' slot and unmap the shared segment
+ *
+ * The last live process to detach removes the segment's name, so that
+ * it is not left behind once the BES stops.
+ */
+void FONcMemoryAccountant::detach()
+{
+    if (!d_table) return;
+
+#ifdef HAVE_SHM_OPEN
+    bool last = true;
+    lock_table(&d_table->lock);
+    for (int i = 0; i < FONC_MEMORY_SLOTS; i++) {
+        pid_t pid = d_table->slots[i].pid;
+        if (pid == 0) continue;
+        if (pid == getpid() || (kill(pid, 0) != 0 && errno == ESRCH)) {
+            d_table->slots[i].pid = 0;
+            d_table->slots[i].bytes = 0;
+        }
+        else {
+            last = false;
+        }
+    }
+    if (last) {
+        shm_unlink(FONC_MEMORY_SEGMENT);
+        BESDEBUG("fonc", "FONcMemoryAccountant::detach() - removed " << FONC_MEMORY_SEGMENT << endl);
+    }
+    pthread_mutex_unlock(&d_table->lock);
+#endif
+
+    munmap(d_table, sizeof(SharedTable));
+    d_table = 0;
+}
+
+/** @brief The memory used by the other BES processes
+ *
+ * The slots of processes that no longer exist are freed.
+ */
+size_t FONcMemoryAccountant::others_used()
+{
+    if (!d_table) return 0;
+
+    size_t total = 0;
+    lock_table(&d_table->lock);
+    for (int i = 0; i < FONC_MEMORY_SLOTS; i++) {
+        pid_t pid = d_table->slots[i].pid;
+        if (pid == 0 || pid == d_pid) continue;
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            d_table->slots[i].pid = 0;
+            d_table->slots[i].bytes = 0;
+        }
+        else {
+            total += d_table->slots[i].bytes;
+        }
+    }
+    pthread_mutex_unlock(&d_table->lock);
+
+    return total;
+}
+
+/** @brief Record the memory used by this process in its slot
+ */
+void FONcMemoryAccountant::publish()
+{
+    if (!d_table) return;
+
+    lock_table(&d_table->lock);
+    if (d_slot < 0 || d_table->slots[d_slot].pid != d_pid) {
+        d_slot = -1;
+        for (int i = 0; i < FONC_MEMORY_SLOTS && d_slot < 0; i++) {
+            pid_t pid = d_table->slots[i].pid;
+            if (pid == 0 || pid == d_pid || (kill(pid, 0) != 0 && errno == ESRCH)) d_slot = i;
+        }
+        if (d_slot >= 0) d_table->slots[d_slot].pid = d_pid;
+    }
+    if (d_slot >= 0) d_table->slots[d_slot].bytes = d_used;
+    pthread_mutex_unlock(&d_table->lock);
+}
+
+/** @brief Would a reservation fit in the budget of the request?
+ */
+bool FONcMemoryAccountant::fits_request(size_t bytes, size_t request_budget)
+{
+    return !request_budget || d_used + bytes <= request_budget;
+}
+
+/** @brief Would a reservation fit in the budget shared by all of the BES
+ * processes?
+ */
+bool FONcMemoryAccountant::fits_global(size_t bytes, size_t global_budget)
+{
+    return !global_budget || others_used() + d_used + bytes <= global_budget;
+}
+
+/** @brief Note the start of a new response
+ *
+ * This resets the high water mark of the request.
+ */
+void FONcMemoryAccountant::begin_request()
+{
+    pthread_mutex_lock(&d_lock);
+    d_request_high_water = d_used;
+    pthread_mutex_unlock(&d_lock);
+}
+
+/** @brief Reserve memory before it is allocated
+ *
+ * @param bytes The size of the allocation
+ * @param can_stream True if the caller can do without this memory by
+ * writing its data in slabs
+ * @param what What the memory is for, used in messages
+ * @returns true if the memory was reserved; false if the caller should
+ * write in slabs instead (only if can_stream is true)
+ * @throws BESInternalError if the memory cannot be reserved
+ */
+bool FONcMemoryAccountant::reserve(size_t bytes, bool can_stream, const string &what)
+{
+    if (bytes == 0) return true;
+
+    size_t request_budget = MB(FONcRequestHandler::request_memory_budget);
+    size_t global_budget = MB(FONcRequestHandler::memory_budget);
+    const string &policy = FONcRequestHandler::over_budget_policy;
+
+    pthread_mutex_lock(&d_lock);
+
+    // A child of the process that made the accountant gets its own slot
+    // and starts with nothing reserved
+    if (d_pid != getpid()) {
+        d_pid = getpid();
+        d_slot = -1;
+        d_used = 0;
+    }
+
+    d_reservations++;
+    bool request_ok = fits_request(bytes, request_budget);
+    if (!request_ok || !fits_global(bytes, global_budget)) {
+        if (policy == "stream" && can_stream) {
+            d_streamed++;
+            pthread_mutex_unlock(&d_lock);
+            BESDEBUG("fonc", "FONcMemoryAccountant::reserve() - " << what << " will be streamed" << endl);
+            return false;
+        }
+
+        // Waiting only helps when the memory of other responses is what
+        // is in the way; this request's own use does not go down while
+        // it waits.
+        bool ok = false;
+        if (policy != "fail" && request_ok && bytes <= global_budget) {
+            d_waited++;
+            time_t deadline = time(0) + FONcRequestHandler::over_budget_wait;
+            while (!ok && time(0) < deadline) {
+                pthread_mutex_unlock(&d_lock);
+                usleep(FONC_MEMORY_POLL_USEC);
+                pthread_mutex_lock(&d_lock);
+                ok = fits_global(bytes, global_budget);
+            }
+        }
+
+        if (!ok) {
+            d_refused++;
+            size_t used = d_used;
+            pthread_mutex_unlock(&d_lock);
+
+            ostringstream err;
+            err << "fileout.netcdf - The response needs " << bytes << " more bytes for " << what << " but the "
+                << (request_ok ? "memory budget for netCDF responses" : "memory budget for one request")
+                << " is exhausted (" << used << " bytes in use by this request). Try a smaller request.";
+            throw BESInternalError(err.str(), __FILE__, __LINE__);
+        }
+    }
+
+    d_used += bytes;
+    if (d_used > d_high_water) d_high_water = d_used;
+    if (d_used > d_request_high_water) d_request_high_water = d_used;
+    publish();
+
+    pthread_mutex_unlock(&d_lock);
+
+    return true;
+}
+
+/** @brief Release memory reserved with reserve()
+ *
+ * @param bytes The size of the allocation that was freed
+ */
+void FONcMemoryAccountant::release(size_t bytes)
+{
+    if (bytes == 0) return;
+
+    pthread_mutex_lock(&d_lock);
+    d_used -= (bytes < d_used) ? bytes : d_used;
+    publish();
+    pthread_mutex_unlock(&d_lock);
+}
+
+/** @brief The memory reserved by this process
+ */
+size_t FONcMemoryAccountant::used() const
+{
+    pthread_mutex_lock(&d_lock);
+    size_t used = d_used;
+    pthread_mutex_unlock(&d_lock);
+
+    return used;
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * Displays the budgets, the memory in use and the number of
+ * reservations that were streamed, had to wait or were refused.
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcMemoryAccountant::dump(ostream &strm) const
+{
+    pthread_mutex_lock(&d_lock);
+    strm << BESIndent::LMarg << "FONcMemoryAccountant::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "budget (MB) = " << FONcRequestHandler::memory_budget << ", per request (MB) = "
+        << FONcRequestHandler::request_memory_budget << ", policy = " << FONcRequestHandler::over_budget_policy
+        << endl;
+    strm << BESIndent::LMarg << "shared segment = " << (d_table ? FONC_MEMORY_SEGMENT : "none") << endl;
+    strm << BESIndent::LMarg << "bytes in use = " << d_used << endl;
+    strm << BESIndent::LMarg << "high water = " << d_high_water << ", this request = " << d_request_high_water << endl;
+    strm << BESIndent::LMarg << "reservations = " << d_reservations << ", streamed = " << d_streamed << ", waited = "
+        << d_waited << ", refused = " << d_refused << endl;
+    BESIndent::UnIndent();
+    pthread_mutex_unlock(&d_lock);
+}
@@ -0,0 +1,127 @@
+// FONcMemoryAccountant.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef FONcMemoryAccountant_h_
+#define FONcMemoryAccountant_h_ 1
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <string>
+
+#include <BESObj.h>
+
+/** @brief Keeps track of the memory allocated to build netcdf responses
+ *
+ * Each buffer the module allocates for a response (array conversion
+ * buffers, copies of string data, attribute values) is reserved here
+ * before it is allocated and released after it is freed. Two budgets
+ * are enforced:
+ *
+ * - FONc.RequestMemoryBudget, the memory used by this process. A BES
+ *   process builds one response at a time, so this is the budget of
+ *   the request.
+ * - FONc.MemoryBudget, the memory used by all of the BES processes on
+ *   the host. The processes share their totals through a POSIX shared
+ *   memory segment, one slot per process. The slots of processes that
+ *   have exited are reclaimed.
+ *
+ * What happens to a reservation that does not fit depends on
+ * FONc.OverBudgetPolicy: 'stream' refuses it if the caller can write
+ * the data in slabs instead (and waits otherwise), 'wait' waits up to
+ * FONc.OverBudgetWait seconds for memory to be released and 'fail'
+ * throws an error right away. Only FONc.MemoryBudget is waited on; a
+ * reservation over the request's own budget fails at once unless it can
+ * be streamed.
+ *
+ * The last BES process to delete its accountant removes the shared
+ * memory segment.
+ */
+class FONcMemoryAccountant: public BESObj {
+private:
+    struct SharedTable;
+
+    static FONcMemoryAccountant *d_instance;
+
+    mutable pthread_mutex_t d_lock;
+    SharedTable *d_table;
+    int d_slot;
+    pid_t d_pid;
+
+    size_t d_used;
+    size_t d_high_water;
+    size_t d_request_high_water;
+    unsigned long d_reservations;
+    unsigned long d_streamed;
+    unsigned long d_waited;
+    unsigned long d_refused;
+
+    FONcMemoryAccountant();
+
+    void attach();
+    void detach();
+    size_t others_used();
+    void publish();
+    bool fits_request(size_t bytes, size_t request_budget);
+    bool fits_global(size_t bytes, size_t global_budget);
+
+public:
+    virtual ~FONcMemoryAccountant();
+
+    static FONcMemoryAccountant *TheAccountant();
+    static void delete_instance();
+
+    virtual void begin_request();
+    virtual bool reserve(size_t bytes, bool can_stream, const std::string &what);
+    virtual void release(size_t bytes);
+
+    virtual size_t used() const;
+
+    virtual void dump(std::ostream &strm) const;
+};
+
+/** @brief A reservation of memory that is released when it goes out of
+ * scope
+ */
+class FONcMemoryReservation {
+private:
+    size_t d_bytes;
+    bool d_granted;
+
+    FONcMemoryReservation(const FONcMemoryReservation &);
+    FONcMemoryReservation &operator=(const FONcMemoryReservation &);
+
+public:
+    FONcMemoryReservation(size_t bytes, bool can_stream, const std::string &what) :
+        d_bytes(bytes), d_granted(FONcMemoryAccountant::TheAccountant()->reserve(bytes, can_stream, what))
+    {
+    }
+
+    ~FONcMemoryReservation()
+    {
+        if (d_granted) FONcMemoryAccountant::TheAccountant()->release(d_bytes);
+    }
+
+    bool granted() const { return d_granted; }
+};
+
+#endif // FONcMemoryAccountant_h_
@@ -39,6 +39,7 @@ using std::endl;
 #include "FONcModule.h"
 #include "FONcTransmitter.h"
 #include "FONcRequestHandler.h"
+#include "FONcMemoryAccountant.h"
 #include "BESRequestHandlerList.h"
 
 #include <BESReturnManager.h>
@@ -54,7 +55,8 @@ using std::endl;
  *
  * Registers the request handler to add to a version or help request,
  * and adds the File Out transmitter for a "returnAs netcdf" request.
- * Also adds netcdf as a return for the dap service dods request and
+ * Also adds netcdf as a return for the dap service dods and dap (DAP4
+ * data) requests and
  * registers the debug context.
  *
  * @param modname The name of the module being loaded
@@ -69,10 +71,27 @@ void FONcModule::initialize(const string &modname)
     BESReturnManager::TheManager()->add_transmitter( RETURNAS_NETCDF, new FONcTransmitter());
 
     BESServiceRegistry::TheRegistry()->add_format( OPENDAP_SERVICE, DATA_SERVICE, RETURNAS_NETCDF);
+    BESServiceRegistry::TheRegistry()->add_format( OPENDAP_SERVICE, DAP4DATA_SERVICE, RETURNAS_NETCDF);
 
     BESReturnManager::TheManager()->add_transmitter( RETURNAS_NETCDF4, new FONcTransmitter());
 
     BESServiceRegistry::TheRegistry()->add_format( OPENDAP_SERVICE, DATA_SERVICE, RETURNAS_NETCDF4);
+    BESServiceRegistry::TheRegistry()->add_format( OPENDAP_SERVICE, DAP4DATA_SERVICE, RETURNAS_NETCDF4);
+
+    BESReturnManager::TheManager()->add_transmitter( RETURNAS_ZARR, new FONcTransmitter());
+
+    BESServiceRegistry::TheRegistry()->add_format( OPENDAP_SERVICE, DATA_SERVICE, RETURNAS_ZARR);
+    BESServiceRegistry::TheRegistry()->add_format( OPENDAP_SERVICE, DAP4DATA_SERVICE, RETURNAS_ZARR);
+
+#ifdef HAVE_H5DGET_CHUNK_INFO
+    // The chunk index of a netCDF-4 response refers to the kept response
+    if (FONcRequestHandler::retain_seconds > 0) {
+        BESReturnManager::TheManager()->add_transmitter( RETURNAS_NETCDF4_REFS, new FONcTransmitter());
+
+        BESServiceRegistry::TheRegistry()->add_format( OPENDAP_SERVICE, DATA_SERVICE, RETURNAS_NETCDF4_REFS);
+        BESServiceRegistry::TheRegistry()->add_format( OPENDAP_SERVICE, DAP4DATA_SERVICE, RETURNAS_NETCDF4_REFS);
+    }
+#endif
 
     BESDebug::Register("fonc");
 
@@ -95,9 +114,17 @@ void FONcModule::terminate(const string &modname)
 
     BESReturnManager::TheManager()->del_transmitter( RETURNAS_NETCDF4);
 
+    BESReturnManager::TheManager()->del_transmitter( RETURNAS_ZARR);
+
+#ifdef HAVE_H5DGET_CHUNK_INFO
+    if (FONcRequestHandler::retain_seconds > 0) BESReturnManager::TheManager()->del_transmitter( RETURNAS_NETCDF4_REFS);
+#endif
+
     BESRequestHandler *rh = BESRequestHandlerList::TheList()->remove_handler(modname);
     delete rh;
 
+    FONcMemoryAccountant::delete_instance();
+
     BESDEBUG("fonc", "Done Cleaning module " << modname << endl);
 }
 
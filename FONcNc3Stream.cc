@@ -0,0 +1,973 @@
+// FONcNc3Stream.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include <BESDebug.h>
+#include <BESIndent.h>
+#include <BESInternalError.h>
+
+#include "FONcNc3Stream.h"
+#include "FONcDigest.h"
+#include "FONcWorkerPool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FONC_NC3_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+using namespace std;
+
+// Values are swapped and sent this many bytes at a time
+#define FONC_NC3_BLOCK_BYTES 65536
+
+// Writes to a file smaller than this are made by the request thread
+#define FONC_NC3_PARALLEL_BYTES (1024 * 1024)
+
+FONcNc3Stream *FONcNc3Stream::Current = 0;
+
+/** @brief Reads the fields of a classic netCDF header
+ */
+struct FONcNc3Header {
+    const string &d_bytes;
+    size_t d_pos;
+    int d_version;
+
+    FONcNc3Header(const string &bytes) :
+        d_bytes(bytes), d_pos(0), d_version(1)
+    {
+    }
+
+    const unsigned char *take(size_t n)
+    {
+        if (d_pos + n > d_bytes.size() || d_pos + n < d_pos)
+            throw BESInternalError("fileout.netcdf - The netCDF-3 header is truncated", __FILE__, __LINE__);
+        const unsigned char *p = (const unsigned char *) d_bytes.data() + d_pos;
+        d_pos += n;
+        return p;
+    }
+
+    unsigned long long uint(size_t n)
+    {
+        const unsigned char *p = take(n);
+        unsigned long long v = 0;
+        for (size_t i = 0; i < n; ++i)
+            v = (v << 8) | p[i];
+        return v;
+    }
+
+    // NON_NEG is eight bytes in CDF-5 files, four in the others
+    unsigned long long non_neg()
+    {
+        return uint(d_version == 5 ? 8 : 4);
+    }
+
+    // Values and names are padded to four bytes
+    string padded(unsigned long long n)
+    {
+        const char *p = (const char *) take(n);
+        string s(p, n);
+        take((4 - n % 4) % 4);
+        return s;
+    }
+
+    string name()
+    {
+        return padded(non_neg());
+    }
+};
+
+/** @brief The size of a value of a netCDF-3 type */
+static size_t type_size(nc_type type)
+{
+    switch (type) {
+    case NC_BYTE:
+    case NC_CHAR:
+    case NC_UBYTE:
+        return 1;
+    case NC_SHORT:
+    case NC_USHORT:
+        return 2;
+    case NC_INT:
+    case NC_UINT:
+    case NC_FLOAT:
+        return 4;
+    case NC_DOUBLE:
+    case NC_INT64:
+    case NC_UINT64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/** @brief The default fill value of a netCDF-3 type, big-endian */
+static string default_fill(nc_type type)
+{
+    switch (type) {
+    case NC_BYTE:
+        return string("\x81", 1);
+    case NC_SHORT:
+        return string("\x80\x01", 2);
+    case NC_INT:
+        return string("\x80\x00\x00\x01", 4);
+    case NC_FLOAT:
+        return string("\x7c\xf0\x00\x00", 4);
+    case NC_DOUBLE:
+        return string("\x47\x9e\x00\x00\x00\x00\x00\x00", 8);
+    case NC_UBYTE:
+    case NC_USHORT:
+    case NC_UINT:
+        return string(type_size(type), '\xff');
+    case NC_INT64:
+        return string("\x80\x00\x00\x00\x00\x00\x00\x02", 8);
+    case NC_UINT64:
+        return string("\xff\xff\xff\xff\xff\xff\xff\xfe", 8);
+    default:
+        return string(type_size(type), '\0');
+    }
+}
+
+static bool little_endian()
+{
+    const unsigned short one = 1;
+    return *(const unsigned char *) &one == 1;
+}
+
+#ifdef FONC_NC3_SSSE3
+/** @brief Swap sixteen bytes at a time with the SSSE3 pshufb instruction
+ *
+ * @return The number of values swapped; the caller swaps the rest
+ */
+__attribute__((target("ssse3")))
+static size_t swap_ssse3(const char *in, char *out, size_t n, size_t xsz)
+{
+    char order[16];
+    for (int i = 0; i < 16; ++i)
+        order[i] = (i / xsz) * xsz + (xsz - 1 - i % xsz);
+    __m128i mask = _mm_loadu_si128((const __m128i *) order);
+
+    size_t bytes = n * xsz;
+    size_t done = 0;
+    for (; done + 16 <= bytes; done += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + done));
+        _mm_storeu_si128((__m128i *) (out + done), _mm_shuffle_epi8(v, mask));
+    }
+    return done / xsz;
+}
+
+static int have_ssse3 = -1;
+#endif
+
+/** @brief Copy values to big-endian order
+ *
+ * @param in The values, in the order of this machine
+ * @param out Where to put the big-endian values; may be in
+ * @param n The number of values
+ * @param xsz The size of one value: 1, 2, 4 or 8 bytes
+ */
+void FONcNc3Stream::to_big_endian(const char *in, char *out, size_t n, size_t xsz)
+{
+    if (xsz == 1 || !little_endian()) {
+        if (in != out) memmove(out, in, n * xsz);
+        return;
+    }
+
+    size_t i = 0;
+#ifdef FONC_NC3_SSSE3
+    if (have_ssse3 < 0) have_ssse3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
+    if (have_ssse3) i = swap_ssse3(in, out, n, xsz);
+#endif
+    for (; i < n; ++i) {
+        const char *v = in + i * xsz;
+        char *o = out + i * xsz;
+        for (size_t lo = 0, hi = xsz - 1; lo < hi; ++lo, --hi) {
+            char t = v[lo];
+            o[lo] = v[hi];
+            o[hi] = t;
+        }
+    }
+}
+
+/** @brief Write values to a file, big-endian
+ *
+ * @param fd The file
+ * @param offset Where the values go in the file
+ * @param data The values, in the order of this machine
+ * @param size The size of the values in bytes
+ * @param xsz The size of one value
+ * @param block Space to swap the values in
+ * @throws BESInternalError if the values cannot be written
+ */
+void FONcNc3Stream::write_big_endian(int fd, unsigned long long offset, const char *data, unsigned long long size,
+    size_t xsz, vector<char> &block)
+{
+    if (block.size() < FONC_NC3_BLOCK_BYTES) block.resize(FONC_NC3_BLOCK_BYTES);
+    size_t per_block = block.size() / xsz;
+
+    for (unsigned long long done = 0; done < size;) {
+        size_t n = min((size - done) / xsz, (unsigned long long) per_block) * xsz;
+        to_big_endian(data + done, &block[0], n / xsz, xsz);
+        for (size_t written = 0; written < n;) {
+            ssize_t w = pwrite(fd, &block[written], n - written, offset + done + written);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                string err = string("fileout.netcdf - Failed to write the netCDF-3 response: ") + strerror(errno);
+                throw BESInternalError(err, __FILE__, __LINE__);
+            }
+            written += w;
+        }
+        done += n;
+    }
+}
+
+/** @brief Part of a write to a netCDF-3 file, made by a thread of a pool
+ */
+class FONcNc3Write: public FONcTask {
+public:
+    int d_fd;
+    size_t d_xsz;
+    vector<FONcNc3Stream::Segment> d_segments;
+    vector<char> d_block;
+
+    FONcNc3Write(int fd, size_t xsz) :
+        d_fd(fd), d_xsz(xsz)
+    {
+    }
+
+    virtual void run()
+    {
+        for (size_t i = 0; i < d_segments.size(); ++i)
+            FONcNc3Stream::write_big_endian(d_fd, d_segments[i].offset, d_segments[i].data, d_segments[i].size,
+                d_xsz, d_block);
+    }
+};
+
+/** @brief A value to convert to the type of a variable */
+struct FONcNc3Value {
+    enum Kind {
+        signed_value, unsigned_value, float_value
+    } kind;
+    long long i;
+    unsigned long long u;
+    double d;
+};
+
+/** @brief Convert a value to type T
+ *
+ * @return false if the value is out of the range of T, as libnetcdf
+ * reports with NC_ERANGE
+ */
+template<typename T>
+static bool convert(const FONcNc3Value &v, T &out)
+{
+    if (!numeric_limits<T>::is_integer) {
+        double d = v.kind == FONcNc3Value::signed_value ? (double) v.i
+            : v.kind == FONcNc3Value::unsigned_value ? (double) v.u : v.d;
+        out = (T) d;
+        // NaN and infinity are stored as they are
+        if (d != d || d - d != 0) return true;
+        return d <= (double) numeric_limits<T>::max() && d >= -(double) numeric_limits<T>::max();
+    }
+
+    switch (v.kind) {
+    case FONcNc3Value::signed_value:
+        out = (T) v.i;
+        if (v.i < 0) return numeric_limits<T>::is_signed && v.i >= (long long) numeric_limits<T>::min();
+        return (unsigned long long) v.i <= (unsigned long long) numeric_limits<T>::max();
+    case FONcNc3Value::unsigned_value:
+        out = (T) v.u;
+        return v.u <= (unsigned long long) numeric_limits<T>::max();
+    default:
+        if (!(v.d >= (double) numeric_limits<T>::min() && v.d <= (double) numeric_limits<T>::max())) {
+            out = 0;
+            return false;
+        }
+        out = (T) v.d;
+        return true;
+    }
+}
+
+template<typename T>
+static bool store(const FONcNc3Value &v, char *out)
+{
+    T t;
+    bool ok = convert(v, t);
+    memcpy(out, &t, sizeof t);
+    return ok;
+}
+
+/** @brief Make a stream for a defined netCDF-3 file
+ *
+ * @param ncid The id of the file, which libnetcdf has defined and left
+ * define mode for; nothing is written to it after this
+ * @param header_file The file libnetcdf is writing; it must hold the
+ * header, so call nc_sync() first
+ * @param strm Where to send the response
+ * @param fill True if libnetcdf would fill the variables
+ * @param digest If not null, the bytes sent are added to it
+ * @param records The number of records, if the file has record variables
+ * @throws BESInternalError if the header cannot be read
+ */
+FONcNc3Stream::FONcNc3Stream(int ncid, const string &header_file, ostream &strm, bool fill, FONcDigest *digest,
+    unsigned long long records) :
+    d_ncid(ncid), d_strm(&strm), d_fill(fill), d_digest(digest), d_fd(-1), d_pool(0), d_numrecs(records),
+    d_recsize(0), d_next(0), d_position(0), d_end(0), d_pending_bytes(0), d_pending_peak(0)
+{
+    read_header(header_file);
+}
+
+/** @brief Make a writer for the values of a defined netCDF-3 file
+ *
+ * @param ncid The id of the file, which libnetcdf has defined and left
+ * define mode for; nothing is written to it after this
+ * @param file The file libnetcdf is writing; it must hold the header, and
+ * the fill values if any, so call nc_sync() first
+ * @param threads The number of threads that write the values; 0 or 1 to
+ * write them in the request thread
+ * @throws BESInternalError if the file cannot be opened or has record
+ * variables
+ */
+FONcNc3Stream::FONcNc3Stream(int ncid, const string &file, unsigned int threads) :
+    d_ncid(ncid), d_strm(0), d_fill(false), d_digest(0), d_fd(-1), d_pool(0), d_numrecs(0), d_recsize(0), d_next(0),
+    d_position(0), d_end(0), d_pending_bytes(0), d_pending_peak(0)
+{
+    read_header(file);
+    if (!d_records.empty())
+        throw BESInternalError("fileout.netcdf - Record variables cannot be written to " + file, __FILE__, __LINE__);
+
+    d_fd = open(file.c_str(), O_WRONLY);
+    if (d_fd == -1) throw BESInternalError("fileout.netcdf - Could not open " + file, __FILE__, __LINE__);
+    d_pool = new FONcWorkerPool(threads > 1 ? threads : 0);
+}
+
+FONcNc3Stream::~FONcNc3Stream()
+{
+    delete d_pool;
+    if (d_fd != -1) close(d_fd);
+    if (Current == this) Current = 0;
+}
+
+/** @brief Can the values of a defined netCDF-3 file be written by a
+ * FONcNc3Stream?
+ *
+ * @param ncid The id of the file
+ * @return false if the file has an unlimited dimension
+ */
+bool FONcNc3Stream::writable(int ncid)
+{
+    int unlimdim = -1;
+    return nc_inq_unlimdim(ncid, &unlimdim) == NC_NOERR && unlimdim == -1;
+}
+
+/** @brief Read the layout of the variables from the header
+ */
+void FONcNc3Stream::read_header(const string &header_file)
+{
+    ifstream in(header_file.c_str(), ios::in | ios::binary);
+    if (!in) throw BESInternalError("fileout.netcdf - Could not read the header of " + header_file, __FILE__, __LINE__);
+    ostringstream bytes;
+    bytes << in.rdbuf();
+    string file = bytes.str();
+
+    FONcNc3Header h(file);
+    const unsigned char *magic = h.take(4);
+    if (memcmp(magic, "CDF", 3) != 0 || (magic[3] != 1 && magic[3] != 2 && magic[3] != 5))
+        throw BESInternalError("fileout.netcdf - " + header_file + " is not a netCDF-3 file", __FILE__, __LINE__);
+    h.d_version = magic[3];
+    d_numrecs_at = h.d_pos;
+    h.non_neg(); // numrecs
+
+    vector<unsigned long long> dims;
+    h.uint(4);  // NC_DIMENSION or ABSENT
+    unsigned long long n = h.non_neg();
+    for (unsigned long long i = 0; i < n; ++i) {
+        h.name();
+        dims.push_back(h.non_neg());
+    }
+
+    // Global attributes
+    h.uint(4);
+    n = h.non_neg();
+    for (unsigned long long i = 0; i < n; ++i) {
+        h.name();
+        nc_type type = h.uint(4);
+        unsigned long long nelems = h.non_neg();
+        h.padded(nelems * type_size(type));
+    }
+
+    h.uint(4);  // NC_VARIABLE or ABSENT
+    n = h.non_neg();
+    for (unsigned long long i = 0; i < n; ++i) {
+        Variable var;
+        var.name = h.name();
+
+        // The length of the unlimited dimension is zero; it can only be
+        // the first dimension of a variable
+        var.record = false;
+        unsigned long long ndims = h.non_neg();
+        for (unsigned long long d = 0; d < ndims; ++d) {
+            unsigned long long dimid = h.non_neg();
+            if (dimid >= dims.size() || (d > 0 && dims[dimid] == 0))
+                throw BESInternalError("fileout.netcdf - The netCDF-3 header is not valid", __FILE__, __LINE__);
+            if (dims[dimid] == 0) {
+                var.record = true;
+                var.shape.push_back(d_numrecs);
+            }
+            else {
+                var.shape.push_back(dims[dimid]);
+            }
+        }
+
+        string fill;
+        h.uint(4);
+        unsigned long long natts = h.non_neg();
+        for (unsigned long long a = 0; a < natts; ++a) {
+            string name = h.name();
+            nc_type type = h.uint(4);
+            unsigned long long nelems = h.non_neg();
+            string values = h.padded(nelems * type_size(type));
+            if (name == "_FillValue" && nelems == 1) fill = values.substr(0, type_size(type));
+        }
+
+        var.type = h.uint(4);
+        var.xsz = type_size(var.type);
+        if (!var.xsz) throw BESInternalError("fileout.netcdf - The netCDF-3 header is not valid", __FILE__, __LINE__);
+        h.non_neg(); // vsize, which is not exact for very large variables
+        var.begin = h.uint(h.d_version == 1 ? 4 : 8);
+
+        // The size of a record variable is the size of one record
+        var.size = var.xsz;
+        for (size_t d = var.record ? 1 : 0; d < var.shape.size(); ++d)
+            var.size *= var.shape[d];
+        var.vsize = (var.size + 3) & ~3ULL;
+        var.fill = fill.size() == var.xsz ? fill : default_fill(var.type);
+
+        vector<size_t> &order = var.record ? d_records : d_fixed;
+        if (!order.empty() && var.begin != d_vars[order.back()].begin + d_vars[order.back()].vsize)
+            throw BESInternalError("fileout.netcdf - The variables of " + header_file + " are not in order",
+                __FILE__, __LINE__);
+        order.push_back(d_vars.size());
+        d_vars.push_back(var);
+    }
+    d_version = h.d_version;
+
+    // A record holds one record of each record variable. When there is
+    // only one, its records are not padded.
+    for (size_t i = 0; i < d_records.size(); ++i)
+        d_recsize += d_vars[d_records[i]].vsize;
+    if (d_records.size() == 1) {
+        Variable &only = d_vars[d_records[0]];
+        only.vsize = only.size;
+        d_recsize = only.size;
+    }
+
+    d_header = file.substr(0, h.d_pos);
+    if (!d_records.empty())
+        d_end = d_vars[d_records[0]].begin + d_numrecs * d_recsize;
+    else if (!d_fixed.empty())
+        d_end = d_vars[d_fixed.back()].begin + d_vars[d_fixed.back()].vsize;
+    else
+        d_end = d_header.size();
+
+    BESDEBUG("fonc", "FONcNc3Stream::read_header - CDF-" << h.d_version << ", " << d_vars.size() << " variables ("
+        << d_records.size() << " record), " << d_numrecs << " records, " << d_end << " bytes" << endl);
+}
+
+/** @brief The k-th part of the file that holds values, in file order
+ *
+ * The values of each fixed size variable come first, then one record of
+ * each record variable, record after record.
+ *
+ * @return false if there is no such part
+ */
+bool FONcNc3Stream::region(size_t k, Region &r) const
+{
+    if (k < d_fixed.size()) {
+        const Variable &var = d_vars[d_fixed[k]];
+        r.begin = var.begin;
+        r.size = var.size;
+        r.vsize = var.vsize;
+        r.var = d_fixed[k];
+        return true;
+    }
+
+    k -= d_fixed.size();
+    if (d_records.empty() || k / d_records.size() >= d_numrecs) return false;
+    const Variable &var = d_vars[d_records[k % d_records.size()]];
+    r.begin = var.begin + (k / d_records.size()) * d_recsize;
+    r.size = var.size;
+    r.vsize = var.vsize;
+    r.var = d_records[k % d_records.size()];
+    return true;
+}
+
+/** @brief Send the header
+ */
+void FONcNc3Stream::start()
+{
+    // libnetcdf wrote the header of a file
+    if (d_fd != -1) return;
+
+    // libnetcdf writes the number of records when the file is closed
+    string header = d_header;
+    size_t width = d_version == 5 ? 8 : 4;
+    for (size_t i = 0; i < width; ++i)
+        header[d_numrecs_at + i] = (char) ((d_numrecs >> (8 * (width - 1 - i))) & 0xff);
+    send(header.data(), header.size());
+
+    // The header is padded to the first variable with zeros
+    Region first;
+    if (region(0, first)) send_fill(first.begin);
+    settle();
+}
+
+void FONcNc3Stream::send(const char *data, size_t size)
+{
+    d_strm->write(data, size);
+    if (!*d_strm) throw BESInternalError("fileout.netcdf - Failed to write the response", __FILE__, __LINE__);
+    if (d_digest) d_digest->update(data, size);
+    d_position += size;
+}
+
+/** @brief Send fill values, or zeros, up to an offset
+ *
+ * Each variable's part of the file is filled with its own fill value,
+ * which is cut short at the padding that ends it.
+ */
+void FONcNc3Stream::send_fill(unsigned long long to)
+{
+    if (d_block.size() < FONC_NC3_BLOCK_BYTES) d_block.resize(FONC_NC3_BLOCK_BYTES);
+
+    size_t k = d_next;
+    Region r;
+    bool in = region(k, r);
+    while (d_position < to) {
+        while (in && d_position >= r.begin + r.vsize)
+            in = region(++k, r);
+
+        // Between the parts of the file there are only zeros
+        const string *fill = 0;
+        unsigned long long stop = to;
+        if (in && d_position >= r.begin) {
+            stop = min(to, r.begin + r.vsize);
+            if (d_fill) fill = &d_vars[r.var].fill;
+        }
+        else if (in) {
+            stop = min(to, r.begin);
+        }
+        size_t n = min(stop - d_position, (unsigned long long) d_block.size());
+
+        if (!fill) {
+            memset(&d_block[0], 0, n);
+        }
+        else {
+            size_t phase = (d_position - r.begin) % fill->size();
+            for (size_t i = 0; i < n; ++i)
+                d_block[i] = (*fill)[(phase + i) % fill->size()];
+        }
+        send(&d_block[0], n);
+    }
+}
+
+/** @brief Send what can be sent now
+ *
+ * Sends held values that are next in the file and the padding of each
+ * variable once all of its values are sent.
+ */
+void FONcNc3Stream::settle()
+{
+    for (;;) {
+        if (!d_pending.empty() && d_pending.begin()->first <= d_position) {
+            map<unsigned long long, vector<char> >::iterator p = d_pending.begin();
+            if (p->first < d_position)
+                throw BESInternalError("fileout.netcdf - Values were written twice to the netCDF-3 response",
+                    __FILE__, __LINE__);
+            send(&p->second[0], p->second.size());
+            d_pending_bytes -= p->second.size();
+            d_pending.erase(p);
+            continue;
+        }
+
+        Region r, next;
+        if (region(d_next, r) && d_position == r.begin + r.size) {
+            send_fill(region(d_next + 1, next) ? next.begin : d_end);
+            ++d_next;
+            continue;
+        }
+
+        break;
+    }
+}
+
+/** @brief Send values, or hold them until their place in the file is
+ * next
+ *
+ * @param var The variable the values belong to
+ * @param offset The offset in the file of the first value
+ * @param data The values, in the order of this machine
+ * @param size The size of the values in bytes
+ * @throws BESInternalError if that part of the file was already sent
+ */
+void FONcNc3Stream::write_run(const Variable &var, unsigned long long offset, const char *data,
+    unsigned long long size)
+{
+    if (offset < d_position)
+        throw BESInternalError("fileout.netcdf - The values of " + var.name
+            + " were written after that part of the netCDF-3 response was sent", __FILE__, __LINE__);
+
+    if (offset > d_position) {
+        vector<char> &held = d_pending[offset];
+        if (!held.empty())
+            throw BESInternalError("fileout.netcdf - The values of " + var.name + " were written twice", __FILE__,
+                __LINE__);
+        held.resize(size);
+        to_big_endian(data, &held[0], size / var.xsz, var.xsz);
+        d_pending_bytes += size;
+        if (d_pending_bytes > d_pending_peak) {
+            d_pending_peak = d_pending_bytes;
+            BESDEBUG("fonc", "FONcNc3Stream::write_run - Holding " << d_pending_bytes << " bytes written ahead of "
+                << d_position << endl);
+        }
+        return;
+    }
+
+    if (d_block.size() < FONC_NC3_BLOCK_BYTES) d_block.resize(FONC_NC3_BLOCK_BYTES);
+    size_t per_block = d_block.size() / var.xsz;
+    for (unsigned long long done = 0; done < size;) {
+        size_t n = min((size - done) / var.xsz, (unsigned long long) per_block);
+        to_big_endian(data + done, &d_block[0], n, var.xsz);
+        send(&d_block[0], n * var.xsz);
+        done += n * var.xsz;
+    }
+
+    settle();
+}
+
+/** @brief Write a hyperslab of values
+ *
+ * The same as nc_put_vara(): the values must already be of the
+ * variable's type.
+ *
+ * @return NC_NOERR, or the netcdf error code for a bad variable or
+ * hyperslab
+ * @throws BESInternalError if the values cannot be sent
+ */
+int FONcNc3Stream::put_vara(int varid, const size_t *start, const size_t *count, const void *data)
+{
+    if (varid < 0 || (size_t) varid >= d_vars.size()) return NC_ENOTVAR;
+    const Variable &var = d_vars[varid];
+    size_t ndims = var.shape.size();
+
+    unsigned long long values = 1;
+    for (size_t d = 0; d < ndims; ++d) {
+        if (start[d] > var.shape[d]) return NC_EINVALCOORDS;
+        if (count[d] > var.shape[d] - start[d]) return NC_EEDGE;
+        values *= count[d];
+    }
+    if (values == 0) return NC_NOERR;
+
+    // The hyperslab is a run of values for each index of its outer
+    // dimensions; a dimension is inner when it and the dimensions after it
+    // are whole. The records of a record variable are never in one run.
+    size_t first = var.record ? 1 : 0;
+    size_t inner = ndims;
+    unsigned long long run = 1;
+    while (inner > first) {
+        --inner;
+        run *= count[inner];
+        if (count[inner] != var.shape[inner]) break;
+    }
+
+    vector<size_t> index(inner, 0);
+    const char *p = (const char *) data;
+    for (;;) {
+        unsigned long long offset = 0;
+        for (size_t d = first; d < ndims; ++d)
+            offset = offset * var.shape[d] + start[d] + (d < inner ? index[d] : 0);
+        unsigned long long at = var.begin + offset * var.xsz;
+        if (var.record) at += (start[0] + index[0]) * d_recsize;
+
+        if (d_fd == -1) {
+            write_run(var, at, p, run * var.xsz);
+        }
+        else {
+            Segment segment = { at, p, run * var.xsz };
+            d_segments.push_back(segment);
+        }
+        p += run * var.xsz;
+
+        size_t d = inner;
+        while (d > 0 && ++index[d - 1] == count[d - 1]) {
+            index[d - 1] = 0;
+            --d;
+        }
+        if (d == 0) break;
+    }
+
+    if (d_fd != -1) write_segments(var.xsz);
+
+    return NC_NOERR;
+}
+
+/** @brief Write the segments of a hyperslab to the file
+ *
+ * Large writes are split evenly between the threads of the pool, which
+ * swap and write their parts at the same time. This returns when they
+ * are done, so the caller may reuse its values.
+ *
+ * @param xsz The size of one value
+ * @throws BESInternalError if the values cannot be written
+ */
+void FONcNc3Stream::write_segments(size_t xsz)
+{
+    unsigned long long total = 0;
+    for (size_t i = 0; i < d_segments.size(); ++i)
+        total += d_segments[i].size;
+
+    unsigned int threads = d_pool->threads();
+    if (threads < 2 || total < FONC_NC3_PARALLEL_BYTES) {
+        for (size_t i = 0; i < d_segments.size(); ++i)
+            write_big_endian(d_fd, d_segments[i].offset, d_segments[i].data, d_segments[i].size, xsz, d_block);
+        d_segments.clear();
+        return;
+    }
+
+    // Each thread gets about the same number of bytes, in whole values
+    unsigned long long share = (total / threads + xsz - 1) / xsz * xsz;
+    vector<FONcNc3Write *> writes;
+    unsigned long long room = 0;
+    for (size_t i = 0; i < d_segments.size(); ++i) {
+        Segment segment = d_segments[i];
+        while (segment.size > 0) {
+            if (room == 0) {
+                writes.push_back(new FONcNc3Write(d_fd, xsz));
+                room = share;
+            }
+            Segment part = segment;
+            part.size = min(segment.size, room);
+            writes.back()->d_segments.push_back(part);
+            segment.offset += part.size;
+            segment.data += part.size;
+            segment.size -= part.size;
+            room -= part.size;
+        }
+    }
+    d_segments.clear();
+
+    for (size_t i = 0; i < writes.size(); ++i)
+        d_pool->submit(writes[i]);
+
+    // Every write must be done before the values can go away
+    string error;
+    for (size_t i = 0; i < writes.size(); ++i) {
+        try {
+            d_pool->wait(writes[i]);
+        }
+        catch (BESError &e) {
+            if (error.empty()) error = e.get_message();
+        }
+        delete writes[i];
+    }
+    if (!error.empty()) throw BESInternalError(error, __FILE__, __LINE__);
+}
+
+/** @brief Write the value of a scalar variable
+ *
+ * The same as the nc_put_var1_* functions: the value is converted to the
+ * type of the variable. As in a classic file, an unsigned char written to
+ * an NC_BYTE variable is stored as it is.
+ *
+ * @param varid The variable
+ * @param mem_type The type of the value: NC_BYTE for signed char, NC_UBYTE
+ * for unsigned char, NC_INT64 for long long, and so on
+ * @param value The value
+ * @return NC_NOERR, or NC_ERANGE if the value does not fit the type of the
+ * variable; the value is written either way
+ */
+int FONcNc3Stream::put_var1(int varid, nc_type mem_type, const void *value)
+{
+    if (varid < 0 || (size_t) varid >= d_vars.size()) return NC_ENOTVAR;
+    const Variable &var = d_vars[varid];
+
+    FONcNc3Value v;
+    v.kind = FONcNc3Value::signed_value;
+    v.i = 0;
+    v.u = 0;
+    v.d = 0;
+    switch (mem_type) {
+    case NC_BYTE:
+        v.i = *(const signed char *) value;
+        break;
+    case NC_CHAR:
+        v.i = *(const char *) value;
+        break;
+    case NC_SHORT:
+        v.i = *(const short *) value;
+        break;
+    case NC_INT:
+        v.i = *(const int *) value;
+        break;
+    case NC_INT64:
+        v.i = *(const long long *) value;
+        break;
+    case NC_UBYTE:
+        v.kind = FONcNc3Value::unsigned_value;
+        v.u = *(const unsigned char *) value;
+        break;
+    case NC_USHORT:
+        v.kind = FONcNc3Value::unsigned_value;
+        v.u = *(const unsigned short *) value;
+        break;
+    case NC_UINT:
+        v.kind = FONcNc3Value::unsigned_value;
+        v.u = *(const unsigned int *) value;
+        break;
+    case NC_UINT64:
+        v.kind = FONcNc3Value::unsigned_value;
+        v.u = *(const unsigned long long *) value;
+        break;
+    case NC_FLOAT:
+        v.kind = FONcNc3Value::float_value;
+        v.d = *(const float *) value;
+        break;
+    case NC_DOUBLE:
+        v.kind = FONcNc3Value::float_value;
+        v.d = *(const double *) value;
+        break;
+    default:
+        return NC_EBADTYPE;
+    }
+
+    char out[8];
+    bool ok;
+    switch (var.type) {
+    case NC_BYTE:
+        if (mem_type == NC_UBYTE) {
+            out[0] = *(const char *) value;
+            ok = true;
+        }
+        else {
+            ok = store<signed char>(v, out);
+        }
+        break;
+    case NC_CHAR:
+        if (mem_type != NC_CHAR) return NC_ECHAR;
+        out[0] = *(const char *) value;
+        ok = true;
+        break;
+    case NC_SHORT:
+        ok = store<short>(v, out);
+        break;
+    case NC_INT:
+        ok = store<int>(v, out);
+        break;
+    case NC_FLOAT:
+        ok = store<float>(v, out);
+        break;
+    case NC_DOUBLE:
+        ok = store<double>(v, out);
+        break;
+    case NC_UBYTE:
+        ok = store<unsigned char>(v, out);
+        break;
+    case NC_USHORT:
+        ok = store<unsigned short>(v, out);
+        break;
+    case NC_UINT:
+        ok = store<unsigned int>(v, out);
+        break;
+    case NC_INT64:
+        ok = store<long long>(v, out);
+        break;
+    case NC_UINT64:
+        ok = store<unsigned long long>(v, out);
+        break;
+    default:
+        return NC_EBADTYPE;
+    }
+
+    if (d_fd == -1)
+        write_run(var, var.begin, out, var.xsz);
+    else
+        write_big_endian(d_fd, var.begin, out, var.xsz, var.xsz, d_block);
+
+    return ok ? NC_NOERR : NC_ERANGE;
+}
+
+/** @brief Send the rest of the file
+ *
+ * Values that were never written are sent as libnetcdf would have left
+ * them.
+ */
+void FONcNc3Stream::finish()
+{
+    // A file without fill values is only as long as the last value
+    // written; libnetcdf would extend it when it is closed
+    if (d_fd != -1) {
+        struct stat st;
+        if (fstat(d_fd, &st) != 0 || ((unsigned long long) st.st_size < d_end && ftruncate(d_fd, d_end) != 0))
+            throw BESInternalError("fileout.netcdf - Failed to set the size of the netCDF-3 response", __FILE__,
+                __LINE__);
+        return;
+    }
+
+    while (d_position < d_end) {
+        send_fill(d_pending.empty() ? d_end : d_pending.begin()->first);
+        // send_fill() does not follow d_next
+        Region r;
+        while (region(d_next, r) && d_position > r.begin + r.size)
+            ++d_next;
+        settle();
+    }
+
+    BESDEBUG("fonc", "FONcNc3Stream::finish - Sent " << d_position << " bytes; held at most " << d_pending_peak
+        << " bytes" << endl);
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcNc3Stream::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcNc3Stream::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "ncid = " << d_ncid << endl;
+    strm << BESIndent::LMarg << "mode = " << (d_fd == -1 ? "stream" : "file") << endl;
+    strm << BESIndent::LMarg << "variables = " << d_vars.size() << " (" << d_records.size() << " record)" << endl;
+    strm << BESIndent::LMarg << "records = " << d_numrecs << endl;
+    strm << BESIndent::LMarg << "bytes sent = " << d_position << " of " << d_end << endl;
+    strm << BESIndent::LMarg << "bytes held = " << d_pending_bytes << endl;
+    strm << BESIndent::LMarg << "fill = " << (d_fill ? "true" : "false") << endl;
+    BESIndent::UnIndent();
+}
@@ -0,0 +1,168 @@
+// FONcNc3Stream.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef FONcNc3Stream_h_
+#define FONcNc3Stream_h_ 1
+
+#include <netcdf.h>
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <BESObj.h>
+
+class FONcDigest;
+class FONcWorkerPool;
+
+/** @brief Sends a netCDF-3 response to the client as its values are
+ * written
+ *
+ * A classic netCDF file is a header followed by the values of each
+ * variable, big-endian, in the order the variables were defined. FONc
+ * writes the variables in that order, so with FONc.StreamClassic the file
+ * goes to the client as it is written instead of from a temporary file
+ * once it is complete.
+ *
+ * libnetcdf still defines the file, in a scratch file that only ever holds
+ * the header. The header is sent as libnetcdf wrote it, and the offset and
+ * size of each variable are read from it, so the response is the same file
+ * nc_close() would have made. While the values are written, Current points
+ * to the stream and FONcUtils::put_vara() and the write() methods of the
+ * scalar types hand their values to it instead of to libnetcdf.
+ *
+ * Values that arrive ahead of their place in the file are held in memory
+ * until everything before them has been sent. Padding, and values that are
+ * never written, are sent as the fill value when FONc.UseFill is true and
+ * as zeros otherwise, as libnetcdf leaves them.
+ *
+ * With FONc.ClassicWriteThreads the values of a netCDF-3 file that is
+ * built in a temporary file are written the same way, but to the file:
+ * each variable's place in the file is fixed once it is defined, so the
+ * values of each write are split between the threads of a pool, which
+ * swap them and write them at their offsets with pwrite(). The header and
+ * the fill values are left as libnetcdf wrote them.
+ *
+ * A streamed file may have record variables; their records are sent in
+ * order once the fixed size variables are done, so FONcArray writes them
+ * one record at a time. A file with record variables cannot be written
+ * this way.
+ */
+class FONcNc3Stream: public BESObj {
+private:
+    struct Variable {
+        std::string name;
+        nc_type type;
+        size_t xsz;                 // bytes in one value
+        std::vector<size_t> shape;
+        bool record;                // the first dimension is unlimited
+        unsigned long long begin;   // offset of the values in the file
+        unsigned long long size;    // bytes of values, or of one record
+        unsigned long long vsize;   // size rounded up to four bytes
+        std::string fill;           // one fill value, big-endian
+    };
+
+    // The part of the file with the values of a variable or of one of
+    // its records
+    struct Region {
+        unsigned long long begin;
+        unsigned long long size;
+        unsigned long long vsize;
+        size_t var;
+    };
+
+    // Part of a write, made in the file by a thread of the pool
+    struct Segment {
+        unsigned long long offset;
+        const char *data;
+        unsigned long long size;
+    };
+
+    int d_ncid;
+    std::ostream *d_strm;
+    bool d_fill;
+    FONcDigest *d_digest;
+
+    // The file and the threads that write it, when it is not a stream
+    int d_fd;
+    FONcWorkerPool *d_pool;
+    std::vector<Segment> d_segments;
+
+    std::string d_header;
+    int d_version;
+    size_t d_numrecs_at;            // offset of numrecs in the header
+    std::vector<Variable> d_vars;   // indexed by varid
+    std::vector<size_t> d_fixed;    // varids of the fixed size variables
+    std::vector<size_t> d_records;  // varids of the record variables
+    unsigned long long d_numrecs;
+    unsigned long long d_recsize;
+    size_t d_next;                  // the region being sent
+    unsigned long long d_position;  // bytes sent
+    unsigned long long d_end;
+
+    // Values that arrived early, by their offset in the file
+    std::map<unsigned long long, std::vector<char> > d_pending;
+    unsigned long long d_pending_bytes;
+    unsigned long long d_pending_peak;
+
+    std::vector<char> d_block;
+
+    void read_header(const std::string &header_file);
+    bool region(size_t k, Region &r) const;
+    void send(const char *data, size_t size);
+    void send_fill(unsigned long long to);
+    void settle();
+    void write_run(const Variable &var, unsigned long long offset, const char *data, unsigned long long size);
+    void write_segments(size_t xsz);
+
+    friend class FONcNc3Write;
+
+    FONcNc3Stream(const FONcNc3Stream &);
+    FONcNc3Stream &operator=(const FONcNc3Stream &);
+
+public:
+    FONcNc3Stream(int ncid, const std::string &header_file, std::ostream &strm, bool fill, FONcDigest *digest,
+        unsigned long long records = 0);
+    FONcNc3Stream(int ncid, const std::string &file, unsigned int threads);
+    virtual ~FONcNc3Stream();
+
+    virtual int ncid() const { return d_ncid; }
+
+    virtual void start();
+    virtual int put_vara(int varid, const size_t *start, const size_t *count, const void *data);
+    virtual int put_var1(int varid, nc_type mem_type, const void *value);
+    virtual void finish();
+
+    virtual unsigned long long bytes() const { return d_position; }
+
+    virtual void dump(std::ostream &strm) const;
+
+    static FONcNc3Stream *Current;
+
+    static bool writable(int ncid);
+    static void to_big_endian(const char *in, char *out, size_t n, size_t xsz);
+    static void write_big_endian(int fd, unsigned long long offset, const char *data, unsigned long long size,
+        size_t xsz, std::vector<char> &block);
+};
+
+#endif // FONcNc3Stream_h_
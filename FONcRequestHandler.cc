@@ -43,12 +43,22 @@
 #include <TheBESKeys.h>
 #include <BESDebug.h>
 #include <BESUtil.h>
+#include <BESInternalError.h>
 
 #include "FONcRequestHandler.h"
+#include "FONcMemoryAccountant.h"
+#include "FONcSettings.h"
+#include "FONcTempStore.h"
+#include "FONcArena.h"
+#include "FONcDigest.h"
 
 #define FONC_TEMP_DIR "/tmp"
 #define FONC_TEMP_DIR_KEY "FONc.Tempdir"
 
+// An ordered list of dir:quota (MB) pairs for the temporary files; empty means FONc.Tempdir
+#define FONC_TEMP_TIERS ""
+#define FONC_TEMP_TIERS_KEY "FONc.TempTiers"
+
 // I think this should be true always. I'm leaving it in for now
 // but the code does not use the key. Maybe this will be used when
 // there is more comprehensive support for DAP4. jhrg 11/30/15
@@ -61,14 +71,188 @@
 #define FONC_CHUNK_SIZE 4096
 #define FONC_CHUNK_SIZE_KEY "FONc.ChunkSize"
 
+#define FONC_DEFLATE_LEVEL 4
+#define FONC_DEFLATE_LEVEL_KEY "FONc.DeflateLevel"
+
+#define FONC_SHUFFLE false
+#define FONC_SHUFFLE_KEY "FONc.Shuffle"
+
+#define FONC_FILL true
+#define FONC_FILL_KEY "FONc.Fill"
+
+// Arrays that need a conversion buffer larger than this (KB) are written in slabs; zero means no limit
+#define FONC_IN_MEMORY_THRESHOLD 0
+#define FONC_IN_MEMORY_THRESHOLD_KEY "FONc.InMemoryThreshold"
+
+// The limits on the settings a client can make using BES contexts
+#define FONC_ALLOW_CONTEXT_SETTINGS true
+#define FONC_ALLOW_CONTEXT_SETTINGS_KEY "FONc.AllowContextSettings"
+
+#define FONC_MIN_DEFLATE_LEVEL 0
+#define FONC_MIN_DEFLATE_LEVEL_KEY "FONc.MinDeflateLevel"
+
+#define FONC_MAX_DEFLATE_LEVEL 9
+#define FONC_MAX_DEFLATE_LEVEL_KEY "FONc.MaxDeflateLevel"
+
+#define FONC_MIN_CHUNK_SIZE 0
+#define FONC_MIN_CHUNK_SIZE_KEY "FONc.MinChunkSize"
+
+#define FONC_MAX_CHUNK_SIZE 65536
+#define FONC_MAX_CHUNK_SIZE_KEY "FONc.MaxChunkSize"
+
+// Floating point variables to pack into short or byte values; empty means none
+#define FONC_PACK_VARIABLES ""
+#define FONC_PACK_VARIABLES_KEY "FONc.PackVariables"
+
+#define FONC_PACK_TYPE "short"
+#define FONC_PACK_TYPE_KEY "FONc.PackType"
+
+// Floating point variables to quantize; zero digits means no quantization
+#define FONC_QUANTIZE_VARIABLES ""
+#define FONC_QUANTIZE_VARIABLES_KEY "FONc.QuantizeVariables"
+
+#define FONC_QUANTIZE_ALGORITHM "bitround"
+#define FONC_QUANTIZE_ALGORITHM_KEY "FONc.QuantizeAlgorithm"
+
+#define FONC_QUANTIZE_DIGITS 0
+#define FONC_QUANTIZE_DIGITS_KEY "FONc.QuantizeDigits"
+
 #define FONC_CLASSIC_MODEL true
 #define FONC_CLASSIC_MODEL_KEY "FONc.ClassicModel"
 
+// These only apply to netCDF-4 files that do not use the classic model
+#define FONC_STRUCTURES_AS_GROUPS false
+#define FONC_STRUCTURES_AS_GROUPS_KEY "FONc.StructuresAsGroups"
+
+#define FONC_COMPOUND_STRUCTURE_ARRAYS false
+#define FONC_COMPOUND_STRUCTURE_ARRAYS_KEY "FONc.CompoundStructureArrays"
+
+#define FONC_AGGREGATE_CONTAINERS false
+#define FONC_AGGREGATE_CONTAINERS_KEY "FONc.AggregateContainers"
+
+#define FONC_AGGREGATION_DIMENSION "time"
+#define FONC_AGGREGATION_DIMENSION_KEY "FONc.AggregationDimension"
+
+#define FONC_AGGREGATION_THREADS 4
+#define FONC_AGGREGATION_THREADS_KEY "FONc.AggregationThreads"
+
+// Memory budgets are in MB; zero means there is no budget
+#define FONC_MEMORY_BUDGET 0
+#define FONC_MEMORY_BUDGET_KEY "FONc.MemoryBudget"
+
+#define FONC_REQUEST_MEMORY_BUDGET 0
+#define FONC_REQUEST_MEMORY_BUDGET_KEY "FONc.RequestMemoryBudget"
+
+#define FONC_OVER_BUDGET_POLICY "stream"
+#define FONC_OVER_BUDGET_POLICY_KEY "FONc.OverBudgetPolicy"
+
+#define FONC_OVER_BUDGET_WAIT 30
+#define FONC_OVER_BUDGET_WAIT_KEY "FONc.OverBudgetWait"
+
+// The size of the slabs used to write arrays that do not fit the budget, in KB
+#define FONC_SLAB_SIZE 4096
+#define FONC_SLAB_SIZE_KEY "FONc.SlabSize"
+
+// Read Arrays from the handlers one slab at a time as they are written
+#define FONC_LAZY_READS false
+#define FONC_LAZY_READS_KEY "FONc.LazyReads"
+
+// Write the values of arrays on a thread of their own
+#define FONC_ASYNC_WRITES false
+#define FONC_ASYNC_WRITES_KEY "FONc.AsyncWrites"
+
+// Compress netCDF-3 responses for clients that accept these encodings
+#define FONC_TRANSFER_ENCODINGS ""
+#define FONC_TRANSFER_ENCODINGS_KEY "FONc.TransferEncodings"
+
+#define FONC_TRANSFER_ENCODING_LEVEL 0
+#define FONC_TRANSFER_ENCODING_LEVEL_KEY "FONc.TransferEncodingLevel"
+
+#define FONC_TRANSFER_ENCODING_THREADS 4
+#define FONC_TRANSFER_ENCODING_THREADS_KEY "FONc.TransferEncodingThreads"
+
+// Make the FONc objects of a response in an arena
+#define FONC_USE_ARENA true
+#define FONC_USE_ARENA_KEY "FONc.UseArena"
+
+// The threads that compress the chunks of a Zarr response
+#define FONC_ZARR_THREADS 4
+#define FONC_ZARR_THREADS_KEY "FONc.ZarrThreads"
+
+// How long, in seconds, a built response is kept for byte range requests
+#define FONC_RETAIN_SECONDS 0
+#define FONC_RETAIN_SECONDS_KEY "FONc.RetainSeconds"
+
+// The checksum computed as a response is sent; see FONcDigest
+#define FONC_RESPONSE_DIGEST ""
+#define FONC_RESPONSE_DIGEST_KEY "FONc.ResponseDigest"
+
+#define FONC_STREAM_CLASSIC false
+#define FONC_STREAM_CLASSIC_KEY "FONc.StreamClassic"
+
+#define FONC_CLASSIC_WRITE_THREADS 0
+#define FONC_CLASSIC_WRITE_THREADS_KEY "FONc.ClassicWriteThreads"
+
+// The dimension made unlimited; a name, or 'time' for the CF time axis
+#define FONC_RECORD_DIMENSION ""
+#define FONC_RECORD_DIMENSION_KEY "FONc.RecordDimension"
+
+// The largest chunk cache, in KB, given to a variable of a netCDF-4 file
+#define FONC_MAX_CHUNK_CACHE 65536
+#define FONC_MAX_CHUNK_CACHE_KEY "FONc.MaxChunkCache"
+
+// How the blocks of an overview are reduced, and the largest factor a
+// client may ask for
+#define FONC_OVERVIEW_METHOD "mean"
+#define FONC_OVERVIEW_METHOD_KEY "FONc.OverviewMethod"
+#define FONC_MAX_OVERVIEW_FACTOR 64
+#define FONC_MAX_OVERVIEW_FACTOR_KEY "FONc.MaxOverviewFactor"
+
 string FONcRequestHandler::temp_dir;
+string FONcRequestHandler::temp_tiers;
 bool FONcRequestHandler::byte_to_short;
 bool FONcRequestHandler::use_compression;
 int FONcRequestHandler::chunk_size;
+int FONcRequestHandler::deflate_level;
+bool FONcRequestHandler::shuffle;
+bool FONcRequestHandler::fill;
+int FONcRequestHandler::in_memory_threshold;
+bool FONcRequestHandler::allow_context_settings;
+int FONcRequestHandler::min_deflate_level;
+int FONcRequestHandler::max_deflate_level;
+int FONcRequestHandler::min_chunk_size;
+int FONcRequestHandler::max_chunk_size;
+string FONcRequestHandler::pack_variables;
+string FONcRequestHandler::pack_type;
+string FONcRequestHandler::quantize_variables;
+string FONcRequestHandler::quantize_algorithm;
+int FONcRequestHandler::quantize_digits;
 bool FONcRequestHandler::classic_model;
+bool FONcRequestHandler::structures_as_groups;
+bool FONcRequestHandler::compound_structure_arrays;
+bool FONcRequestHandler::aggregate_containers;
+string FONcRequestHandler::aggregation_dimension;
+int FONcRequestHandler::aggregation_threads;
+int FONcRequestHandler::memory_budget;
+int FONcRequestHandler::request_memory_budget;
+string FONcRequestHandler::over_budget_policy;
+int FONcRequestHandler::over_budget_wait;
+int FONcRequestHandler::slab_size;
+bool FONcRequestHandler::lazy_reads;
+bool FONcRequestHandler::async_writes;
+string FONcRequestHandler::transfer_encodings;
+int FONcRequestHandler::transfer_encoding_level;
+int FONcRequestHandler::transfer_encoding_threads;
+bool FONcRequestHandler::use_arena;
+int FONcRequestHandler::zarr_threads;
+int FONcRequestHandler::retain_seconds;
+string FONcRequestHandler::response_digest;
+bool FONcRequestHandler::stream_classic;
+int FONcRequestHandler::classic_write_threads;
+string FONcRequestHandler::record_dimension;
+int FONcRequestHandler::max_chunk_cache;
+string FONcRequestHandler::overview_method;
+int FONcRequestHandler::max_overview_factor;
 
 using namespace std;
 
@@ -144,20 +328,200 @@ FONcRequestHandler::FONcRequestHandler( const string &name )
         read_key_value(FONC_TEMP_DIR_KEY, FONcRequestHandler::temp_dir, FONC_TEMP_DIR);
     }
 
+    read_key_value(FONC_TEMP_TIERS_KEY, FONcRequestHandler::temp_tiers, FONC_TEMP_TIERS);
+
     // Not currently used. jhrg 11/30/15
     read_key_value(FONC_BYTE_TO_SHORT_KEY, FONcRequestHandler::byte_to_short, FONC_BYTE_TO_SHORT);
 
     read_key_value(FONC_USE_COMP_KEY, FONcRequestHandler::use_compression, FONC_USE_COMP);
 
     read_key_value(FONC_CHUNK_SIZE_KEY, FONcRequestHandler::chunk_size, FONC_CHUNK_SIZE);
+    if (FONcRequestHandler::chunk_size < 0) FONcRequestHandler::chunk_size = 0;
+
+    read_key_value(FONC_DEFLATE_LEVEL_KEY, FONcRequestHandler::deflate_level, FONC_DEFLATE_LEVEL);
+    if (FONcRequestHandler::deflate_level < 0 || FONcRequestHandler::deflate_level > 9) {
+        string err = string("The value of ") + FONC_DEFLATE_LEVEL_KEY + " must be between 0 and 9";
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
+
+    read_key_value(FONC_SHUFFLE_KEY, FONcRequestHandler::shuffle, FONC_SHUFFLE);
+
+    read_key_value(FONC_FILL_KEY, FONcRequestHandler::fill, FONC_FILL);
+
+    read_key_value(FONC_IN_MEMORY_THRESHOLD_KEY, FONcRequestHandler::in_memory_threshold, FONC_IN_MEMORY_THRESHOLD);
+    if (FONcRequestHandler::in_memory_threshold < 0) FONcRequestHandler::in_memory_threshold = 0;
+
+    read_key_value(FONC_ALLOW_CONTEXT_SETTINGS_KEY, FONcRequestHandler::allow_context_settings,
+        FONC_ALLOW_CONTEXT_SETTINGS);
+
+    read_key_value(FONC_MIN_DEFLATE_LEVEL_KEY, FONcRequestHandler::min_deflate_level, FONC_MIN_DEFLATE_LEVEL);
+    read_key_value(FONC_MAX_DEFLATE_LEVEL_KEY, FONcRequestHandler::max_deflate_level, FONC_MAX_DEFLATE_LEVEL);
+    if (FONcRequestHandler::min_deflate_level < 0 || FONcRequestHandler::max_deflate_level > 9
+        || FONcRequestHandler::min_deflate_level > FONcRequestHandler::max_deflate_level) {
+        string err = string("The values of ") + FONC_MIN_DEFLATE_LEVEL_KEY + " and " + FONC_MAX_DEFLATE_LEVEL_KEY
+            + " must make a range within 0 to 9";
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
+
+    read_key_value(FONC_MIN_CHUNK_SIZE_KEY, FONcRequestHandler::min_chunk_size, FONC_MIN_CHUNK_SIZE);
+    read_key_value(FONC_MAX_CHUNK_SIZE_KEY, FONcRequestHandler::max_chunk_size, FONC_MAX_CHUNK_SIZE);
+    if (FONcRequestHandler::min_chunk_size < 0
+        || FONcRequestHandler::min_chunk_size > FONcRequestHandler::max_chunk_size) {
+        string err = string("The values of ") + FONC_MIN_CHUNK_SIZE_KEY + " and " + FONC_MAX_CHUNK_SIZE_KEY
+            + " must make a range of sizes";
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
 
     read_key_value(FONC_CLASSIC_MODEL_KEY, FONcRequestHandler::classic_model, FONC_CLASSIC_MODEL);
 
+    read_key_value(FONC_STRUCTURES_AS_GROUPS_KEY, FONcRequestHandler::structures_as_groups, FONC_STRUCTURES_AS_GROUPS);
+
+    read_key_value(FONC_COMPOUND_STRUCTURE_ARRAYS_KEY, FONcRequestHandler::compound_structure_arrays,
+        FONC_COMPOUND_STRUCTURE_ARRAYS);
+
+    read_key_value(FONC_PACK_VARIABLES_KEY, FONcRequestHandler::pack_variables, FONC_PACK_VARIABLES);
+
+    read_key_value(FONC_PACK_TYPE_KEY, FONcRequestHandler::pack_type, FONC_PACK_TYPE);
+    if (!FONcSettings::pack_type_bits(FONcRequestHandler::pack_type)) {
+        string err = string("The value of ") + FONC_PACK_TYPE_KEY + " must be short or byte";
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
+
+    read_key_value(FONC_QUANTIZE_VARIABLES_KEY, FONcRequestHandler::quantize_variables, FONC_QUANTIZE_VARIABLES);
+
+    read_key_value(FONC_QUANTIZE_ALGORITHM_KEY, FONcRequestHandler::quantize_algorithm, FONC_QUANTIZE_ALGORITHM);
+    if (!FONcSettings::quantize_algorithm_id(FONcRequestHandler::quantize_algorithm)) {
+        string err = string("The value of ") + FONC_QUANTIZE_ALGORITHM_KEY + " must be bitgroom, granularbr or bitround";
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
+
+    read_key_value(FONC_QUANTIZE_DIGITS_KEY, FONcRequestHandler::quantize_digits, FONC_QUANTIZE_DIGITS);
+    if (FONcRequestHandler::quantize_digits < 0) FONcRequestHandler::quantize_digits = 0;
+
+    read_key_value(FONC_AGGREGATE_CONTAINERS_KEY, FONcRequestHandler::aggregate_containers, FONC_AGGREGATE_CONTAINERS);
+
+    read_key_value(FONC_AGGREGATION_DIMENSION_KEY, FONcRequestHandler::aggregation_dimension,
+        FONC_AGGREGATION_DIMENSION);
+
+    read_key_value(FONC_AGGREGATION_THREADS_KEY, FONcRequestHandler::aggregation_threads, FONC_AGGREGATION_THREADS);
+    if (FONcRequestHandler::aggregation_threads < 0) FONcRequestHandler::aggregation_threads = 0;
+
+    read_key_value(FONC_MEMORY_BUDGET_KEY, FONcRequestHandler::memory_budget, FONC_MEMORY_BUDGET);
+
+    read_key_value(FONC_REQUEST_MEMORY_BUDGET_KEY, FONcRequestHandler::request_memory_budget,
+        FONC_REQUEST_MEMORY_BUDGET);
+
+    read_key_value(FONC_OVER_BUDGET_POLICY_KEY, FONcRequestHandler::over_budget_policy, FONC_OVER_BUDGET_POLICY);
+    FONcRequestHandler::over_budget_policy = BESUtil::lowercase(FONcRequestHandler::over_budget_policy);
+    if (FONcRequestHandler::over_budget_policy != "stream" && FONcRequestHandler::over_budget_policy != "wait"
+        && FONcRequestHandler::over_budget_policy != "fail") {
+        string err = string("The value of ") + FONC_OVER_BUDGET_POLICY_KEY + " must be stream, wait or fail";
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
+
+    read_key_value(FONC_OVER_BUDGET_WAIT_KEY, FONcRequestHandler::over_budget_wait, FONC_OVER_BUDGET_WAIT);
+
+    read_key_value(FONC_SLAB_SIZE_KEY, FONcRequestHandler::slab_size, FONC_SLAB_SIZE);
+    if (FONcRequestHandler::slab_size < 1) FONcRequestHandler::slab_size = FONC_SLAB_SIZE;
+
+    read_key_value(FONC_LAZY_READS_KEY, FONcRequestHandler::lazy_reads, FONC_LAZY_READS);
+
+    read_key_value(FONC_ASYNC_WRITES_KEY, FONcRequestHandler::async_writes, FONC_ASYNC_WRITES);
+
+    read_key_value(FONC_TRANSFER_ENCODINGS_KEY, FONcRequestHandler::transfer_encodings, FONC_TRANSFER_ENCODINGS);
+
+    read_key_value(FONC_TRANSFER_ENCODING_LEVEL_KEY, FONcRequestHandler::transfer_encoding_level,
+        FONC_TRANSFER_ENCODING_LEVEL);
+
+    read_key_value(FONC_TRANSFER_ENCODING_THREADS_KEY, FONcRequestHandler::transfer_encoding_threads,
+        FONC_TRANSFER_ENCODING_THREADS);
+    if (FONcRequestHandler::transfer_encoding_threads < 0) FONcRequestHandler::transfer_encoding_threads = 0;
+
+    read_key_value(FONC_USE_ARENA_KEY, FONcRequestHandler::use_arena, FONC_USE_ARENA);
+
+    read_key_value(FONC_ZARR_THREADS_KEY, FONcRequestHandler::zarr_threads, FONC_ZARR_THREADS);
+    if (FONcRequestHandler::zarr_threads < 0) FONcRequestHandler::zarr_threads = 0;
+
+    read_key_value(FONC_RETAIN_SECONDS_KEY, FONcRequestHandler::retain_seconds, FONC_RETAIN_SECONDS);
+    if (FONcRequestHandler::retain_seconds < 0) FONcRequestHandler::retain_seconds = 0;
+
+    read_key_value(FONC_RESPONSE_DIGEST_KEY, FONcRequestHandler::response_digest, FONC_RESPONSE_DIGEST);
+    if (!FONcRequestHandler::response_digest.empty()
+        && FONcDigest::algorithm_id(FONcRequestHandler::response_digest) == FONcDigest::digest_none)
+        throw BESInternalError(string(FONC_RESPONSE_DIGEST_KEY) + " must be crc32c, xxh64 or sha256, not "
+            + FONcRequestHandler::response_digest, __FILE__, __LINE__);
+
+    read_key_value(FONC_STREAM_CLASSIC_KEY, FONcRequestHandler::stream_classic, FONC_STREAM_CLASSIC);
+
+    read_key_value(FONC_CLASSIC_WRITE_THREADS_KEY, FONcRequestHandler::classic_write_threads,
+        FONC_CLASSIC_WRITE_THREADS);
+    if (FONcRequestHandler::classic_write_threads < 0) FONcRequestHandler::classic_write_threads = 0;
+
+    read_key_value(FONC_RECORD_DIMENSION_KEY, FONcRequestHandler::record_dimension, FONC_RECORD_DIMENSION);
+
+    read_key_value(FONC_MAX_CHUNK_CACHE_KEY, FONcRequestHandler::max_chunk_cache, FONC_MAX_CHUNK_CACHE);
+    if (FONcRequestHandler::max_chunk_cache < 0) FONcRequestHandler::max_chunk_cache = 0;
+
+    read_key_value(FONC_OVERVIEW_METHOD_KEY, FONcRequestHandler::overview_method, FONC_OVERVIEW_METHOD);
+    if (!FONcSettings::overview_method_id(FONcRequestHandler::overview_method)) {
+        string err = string("The value of ") + FONC_OVERVIEW_METHOD_KEY + " must be mean, min, max or mode";
+        throw BESInternalError(err, __FILE__, __LINE__);
+    }
+
+    read_key_value(FONC_MAX_OVERVIEW_FACTOR_KEY, FONcRequestHandler::max_overview_factor, FONC_MAX_OVERVIEW_FACTOR);
+    if (FONcRequestHandler::max_overview_factor < 1) FONcRequestHandler::max_overview_factor = 1;
+
+    // Make the accountant now so that the BES processes share its memory segment
+    FONcMemoryAccountant::TheAccountant();
+
+    // and the temporary file store, so errors in FONc.TempTiers show up at startup
+    FONcTempStore::TheStore();
+
     BESDEBUG("fonc", "FONcRequestHandler::temp_dir: " << FONcRequestHandler::temp_dir << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::temp_tiers: " << FONcRequestHandler::temp_tiers << endl);
     BESDEBUG("fonc", "FONcRequestHandler::byte_to_short: " << FONcRequestHandler::byte_to_short << endl);
     BESDEBUG("fonc", "FONcRequestHandler::use_compression: " << FONcRequestHandler::use_compression << endl);
     BESDEBUG("fonc", "FONcRequestHandler::chunk_size: " << FONcRequestHandler::chunk_size << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::deflate_level: " << FONcRequestHandler::deflate_level << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::shuffle: " << FONcRequestHandler::shuffle << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::fill: " << FONcRequestHandler::fill << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::in_memory_threshold: " << FONcRequestHandler::in_memory_threshold << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::allow_context_settings: " << FONcRequestHandler::allow_context_settings << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::deflate_level limits: " << FONcRequestHandler::min_deflate_level << " to "
+        << FONcRequestHandler::max_deflate_level << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::chunk_size limits: " << FONcRequestHandler::min_chunk_size << " to "
+        << FONcRequestHandler::max_chunk_size << endl);
     BESDEBUG("fonc", "FONcRequestHandler::classic_model: " << FONcRequestHandler::classic_model << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::structures_as_groups: " << FONcRequestHandler::structures_as_groups << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::compound_structure_arrays: " << FONcRequestHandler::compound_structure_arrays << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::pack_variables: " << FONcRequestHandler::pack_variables << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::pack_type: " << FONcRequestHandler::pack_type << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::quantize_variables: " << FONcRequestHandler::quantize_variables << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::quantize_algorithm: " << FONcRequestHandler::quantize_algorithm << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::quantize_digits: " << FONcRequestHandler::quantize_digits << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::aggregate_containers: " << FONcRequestHandler::aggregate_containers << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::aggregation_dimension: " << FONcRequestHandler::aggregation_dimension << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::aggregation_threads: " << FONcRequestHandler::aggregation_threads << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::memory_budget: " << FONcRequestHandler::memory_budget << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::request_memory_budget: " << FONcRequestHandler::request_memory_budget << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::over_budget_policy: " << FONcRequestHandler::over_budget_policy << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::over_budget_wait: " << FONcRequestHandler::over_budget_wait << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::slab_size: " << FONcRequestHandler::slab_size << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::lazy_reads: " << FONcRequestHandler::lazy_reads << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::async_writes: " << FONcRequestHandler::async_writes << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::transfer_encodings: " << FONcRequestHandler::transfer_encodings << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::transfer_encoding_level: " << FONcRequestHandler::transfer_encoding_level << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::transfer_encoding_threads: " << FONcRequestHandler::transfer_encoding_threads << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::use_arena: " << FONcRequestHandler::use_arena << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::zarr_threads: " << FONcRequestHandler::zarr_threads << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::retain_seconds: " << FONcRequestHandler::retain_seconds << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::response_digest: " << FONcRequestHandler::response_digest << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::stream_classic: " << FONcRequestHandler::stream_classic << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::classic_write_threads: " << FONcRequestHandler::classic_write_threads << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::record_dimension: " << FONcRequestHandler::record_dimension << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::max_chunk_cache: " << FONcRequestHandler::max_chunk_cache << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::overview_method: " << FONcRequestHandler::overview_method << endl);
+    BESDEBUG("fonc", "FONcRequestHandler::max_overview_factor: " << FONcRequestHandler::max_overview_factor << endl);
 }
 
 /** @brief Any cleanup that needs to take place
@@ -229,6 +593,9 @@ FONcRequestHandler::dump( ostream &strm ) const
 			     << (void *)this << ")" << endl ;
     BESIndent::Indent() ;
     BESRequestHandler::dump( strm ) ;
+    FONcMemoryAccountant::TheAccountant()->dump( strm ) ;
+    FONcTempStore::TheStore()->dump( strm ) ;
+    FONcArena::dump_high_water( strm ) ;
     BESIndent::UnIndent() ;
 }
 
@@ -50,10 +50,50 @@ public:
     virtual void dump(ostream &strm) const;
 
     static string temp_dir;
+    static string temp_tiers;
     static bool byte_to_short;
     static bool use_compression;
     static int chunk_size;
+    static int deflate_level;
+    static bool shuffle;
+    static bool fill;
+    static int in_memory_threshold;
+    static bool allow_context_settings;
+    static int min_deflate_level;
+    static int max_deflate_level;
+    static int min_chunk_size;
+    static int max_chunk_size;
+    static string pack_variables;
+    static string pack_type;
+    static string quantize_variables;
+    static string quantize_algorithm;
+    static int quantize_digits;
     static bool classic_model;
+    static bool structures_as_groups;
+    static bool compound_structure_arrays;
+    static bool aggregate_containers;
+    static string aggregation_dimension;
+    static int aggregation_threads;
+    static int memory_budget;
+    static int request_memory_budget;
+    static string over_budget_policy;
+    static int over_budget_wait;
+    static int slab_size;
+    static bool lazy_reads;
+    static bool async_writes;
+    static string transfer_encodings;
+    static int transfer_encoding_level;
+    static int transfer_encoding_threads;
+    static bool use_arena;
+    static int zarr_threads;
+    static int retain_seconds;
+    static string response_digest;
+    static bool stream_classic;
+    static int classic_write_threads;
+    static string record_dimension;
+    static int max_chunk_cache;
+    static string overview_method;
+    static int max_overview_factor;
 
     static bool build_help(BESDataHandlerInterface &dhi);
     static bool build_version(BESDataHandlerInterface &dhi);
@@ -0,0 +1,307 @@
+// FONcSettings.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <sstream>
+
+#include <BESContextManager.h>
+#include <BESSyntaxUserError.h>
+#include <BESDebug.h>
+#include <BESUtil.h>
+
+#include "FONcSettings.h"
+#include "FONcRequestHandler.h"
+
+using namespace std;
+
+FONcSettings FONcSettings::Current;
+
+/** @brief Read a boolean context
+ *
+ * @throws BESSyntaxUserError if the value is not true or false
+ */
+static bool bool_context(const string &name, bool &value)
+{
+    bool found = false;
+    string text = BESContextManager::TheManager()->get_context(name, found);
+    if (!found) return false;
+
+    text = BESUtil::lowercase(text);
+    if (text == "true" || text == "yes")
+        value = true;
+    else if (text == "false" || text == "no")
+        value = false;
+    else
+        throw BESSyntaxUserError("The value of the " + name + " context must be true or false", __FILE__, __LINE__);
+
+    return true;
+}
+
+/** @brief Read an integer context
+ *
+ * @throws BESSyntaxUserError if the value is not a number
+ */
+static bool int_context(const string &name, int &value)
+{
+    bool found = false;
+    string text = BESContextManager::TheManager()->get_context(name, found);
+    if (!found) return false;
+
+    istringstream iss(text);
+    int number;
+    iss >> number;
+    if (iss.fail() || !iss.eof())
+        throw BESSyntaxUserError("The value of the " + name + " context must be an integer", __FILE__, __LINE__);
+    value = number;
+
+    return true;
+}
+
+static int clamp(int value, int low, int high)
+{
+    if (value < low) return low;
+    if (value > high) return high;
+    return value;
+}
+
+/** @brief Make settings that turn every option off
+ *
+ * This reads nothing from FONcRequestHandler, since FONcSettings::Current
+ * is made during static initialization, before the handler has read
+ * fonc.conf (and possibly before its own statics are made). resolve()
+ * sets the configured defaults.
+ */
+FONcSettings::FONcSettings() :
+    deflate_level(0), shuffle(false), chunk_size(0), fill(false), classic_model(false), in_memory_threshold(0),
+    pack_bits(0), quantize_algorithm(0), quantize_digits(0), overview_factor(1), overview_method(0)
+{
+}
+
+/** @brief Set the default settings, those of fonc.conf
+ */
+void FONcSettings::set_defaults()
+{
+    deflate_level = FONcRequestHandler::use_compression ? FONcRequestHandler::deflate_level : 0;
+    shuffle = FONcRequestHandler::shuffle;
+    chunk_size = FONcRequestHandler::chunk_size;
+    fill = FONcRequestHandler::fill;
+    classic_model = FONcRequestHandler::classic_model;
+    in_memory_threshold = FONcRequestHandler::in_memory_threshold;
+    pack_variables = FONcRequestHandler::pack_variables;
+    pack_bits = pack_type_bits(FONcRequestHandler::pack_type);
+    quantize_variables = FONcRequestHandler::quantize_variables;
+    quantize_algorithm = quantize_algorithm_id(FONcRequestHandler::quantize_algorithm);
+    quantize_digits = FONcRequestHandler::quantize_digits;
+    record_dimension = FONcRequestHandler::record_dimension;
+    overview_factor = 1;
+    overview_method = overview_method_id(FONcRequestHandler::overview_method);
+}
+
+/** @brief Set the settings of the current request
+ *
+ * Start from the defaults and apply the contexts set by the client, if
+ * that is allowed, keeping each within its configured limits.
+ *
+ * @throws BESSyntaxUserError if a context has a value of the wrong type
+ */
+void FONcSettings::resolve()
+{
+    set_defaults();
+
+    if (!FONcRequestHandler::allow_context_settings) return;
+
+    if (int_context("fonc_deflate_level", deflate_level))
+        deflate_level = clamp(deflate_level, FONcRequestHandler::min_deflate_level,
+            FONcRequestHandler::max_deflate_level);
+
+    bool_context("fonc_shuffle", shuffle);
+
+    if (int_context("fonc_chunk_size", chunk_size)) {
+        if (chunk_size != 0 || FONcRequestHandler::min_chunk_size > 0)
+            chunk_size = clamp(chunk_size, FONcRequestHandler::min_chunk_size, FONcRequestHandler::max_chunk_size);
+    }
+
+    bool_context("fonc_fill", fill);
+
+    bool_context("fonc_classic_model", classic_model);
+
+    int threshold;
+    if (int_context("fonc_in_memory_threshold", threshold) && threshold > 0) {
+        if (FONcRequestHandler::in_memory_threshold == 0 || threshold < FONcRequestHandler::in_memory_threshold)
+            in_memory_threshold = threshold;
+    }
+
+    bool found = false;
+    string text = BESContextManager::TheManager()->get_context("fonc_pack_variables", found);
+    if (found) pack_variables = text;
+
+    text = BESContextManager::TheManager()->get_context("fonc_pack_type", found);
+    if (found) {
+        pack_bits = pack_type_bits(text);
+        if (!pack_bits)
+            throw BESSyntaxUserError("The value of the fonc_pack_type context must be short or byte", __FILE__,
+                __LINE__);
+    }
+
+    text = BESContextManager::TheManager()->get_context("fonc_quantize_variables", found);
+    if (found) quantize_variables = text;
+
+    text = BESContextManager::TheManager()->get_context("fonc_quantize_algorithm", found);
+    if (found) {
+        quantize_algorithm = quantize_algorithm_id(text);
+        if (!quantize_algorithm)
+            throw BESSyntaxUserError(
+                "The value of the fonc_quantize_algorithm context must be bitgroom, granularbr or bitround",
+                __FILE__, __LINE__);
+    }
+
+    if (int_context("fonc_quantize_digits", quantize_digits) && quantize_digits < 0) quantize_digits = 0;
+
+    text = BESContextManager::TheManager()->get_context("fonc_record_dimension", found);
+    if (found) record_dimension = text;
+
+    if (int_context("fonc_overview_factor", overview_factor))
+        overview_factor = clamp(overview_factor, 1, FONcRequestHandler::max_overview_factor);
+
+    text = BESContextManager::TheManager()->get_context("fonc_overview_method", found);
+    if (found) {
+        overview_method = overview_method_id(text);
+        if (!overview_method)
+            throw BESSyntaxUserError("The value of the fonc_overview_method context must be mean, min, max or mode",
+                __FILE__, __LINE__);
+    }
+
+    BESDEBUG("fonc", "FONcSettings::resolve() - " << *this << endl);
+}
+
+/** @brief Is a name in a comma separated list of names?
+ *
+ * @param list The list; * matches every name
+ * @param name The name to look for
+ */
+static bool in_list(const string &list, const string &name)
+{
+    if (list.empty()) return false;
+    if (list == "*") return true;
+
+    string::size_type start = 0;
+    while (start <= list.length()) {
+        string::size_type end = list.find(',', start);
+        if (end == string::npos) end = list.length();
+        string item = list.substr(start, end - start);
+        string::size_type first = item.find_first_not_of(" \t");
+        string::size_type last = item.find_last_not_of(" \t");
+        if (first != string::npos && item.substr(first, last - first + 1) == name) return true;
+        start = end + 1;
+    }
+
+    return false;
+}
+
+/** @brief Should the named variable be packed?
+ *
+ * @param name The name of a variable, as in the DDS
+ * @return true if the name is in the list of variables to pack or that
+ * list is *
+ */
+bool FONcSettings::packs(const string &name) const
+{
+    return in_list(pack_variables, name);
+}
+
+/** @brief Should the named variable be quantized?
+ *
+ * @param name The name of a variable, as in the DDS
+ * @return true if quantization is on and the name is in the list of
+ * variables to quantize or that list is *
+ */
+bool FONcSettings::quantizes(const string &name) const
+{
+    return quantize_digits > 0 && in_list(quantize_variables, name);
+}
+
+/** @brief The quantize algorithm named by a string
+ *
+ * @param name bitgroom, granularbr or bitround
+ * @return One of the QuantizeAlgorithm values, or 0 if the name is not
+ * known
+ */
+int FONcSettings::quantize_algorithm_id(const string &name)
+{
+    string n = BESUtil::lowercase(name);
+    if (n == "bitgroom") return quantize_bitgroom;
+    if (n == "granularbr") return quantize_granularbr;
+    if (n == "bitround") return quantize_bitround;
+    return 0;
+}
+
+/** @brief The overview method named by a string
+ *
+ * @param name mean, min, max or mode
+ * @return One of the OverviewMethod values, or 0 if the name is not known
+ */
+int FONcSettings::overview_method_id(const string &name)
+{
+    string n = BESUtil::lowercase(name);
+    if (n == "mean") return overview_mean;
+    if (n == "min") return overview_min;
+    if (n == "max") return overview_max;
+    if (n == "mode") return overview_mode;
+    return 0;
+}
+
+/** @brief The number of bits of a pack type
+ *
+ * @param type short or byte
+ * @return 16 or 8, or 0 if the type is not known
+ */
+int FONcSettings::pack_type_bits(const string &type)
+{
+    string t = BESUtil::lowercase(type);
+    if (t == "short") return 16;
+    if (t == "byte") return 8;
+    return 0;
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcSettings::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcSettings::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "deflate level = " << deflate_level << endl;
+    strm << BESIndent::LMarg << "shuffle = " << (shuffle ? "true" : "false") << endl;
+    strm << BESIndent::LMarg << "chunk size (KB) = " << chunk_size << endl;
+    strm << BESIndent::LMarg << "fill = " << (fill ? "true" : "false") << endl;
+    strm << BESIndent::LMarg << "classic model = " << (classic_model ? "true" : "false") << endl;
+    strm << BESIndent::LMarg << "in memory threshold (KB) = " << in_memory_threshold << endl;
+    strm << BESIndent::LMarg << "pack variables = " << pack_variables << endl;
+    strm << BESIndent::LMarg << "pack bits = " << pack_bits << endl;
+    strm << BESIndent::LMarg << "quantize variables = " << quantize_variables << endl;
+    strm << BESIndent::LMarg << "quantize algorithm = " << quantize_algorithm << endl;
+    strm << BESIndent::LMarg << "quantize digits = " << quantize_digits << endl;
+    strm << BESIndent::LMarg << "record dimension = " << record_dimension << endl;
+    strm << BESIndent::LMarg << "overview factor = " << overview_factor << endl;
+    strm << BESIndent::LMarg << "overview method = " << overview_method << endl;
+    BESIndent::UnIndent();
+}
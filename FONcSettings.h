@@ -0,0 +1,114 @@
+// FONcSettings.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef FONcSettings_h_
+#define FONcSettings_h_ 1
+
+#include <string>
+
+#include <BESObj.h>
+
+/** @brief The output settings used for one response
+ *
+ * The defaults come from fonc.conf (the FONcRequestHandler keys). If
+ * FONc.AllowContextSettings is true, a client can change them for its
+ * requests by setting BES contexts, but only within the limits the
+ * administrator configured:
+ *
+ * - fonc_deflate_level: 0 (no compression) to 9, kept between
+ *   FONc.MinDeflateLevel and FONc.MaxDeflateLevel
+ * - fonc_shuffle: true or false
+ * - fonc_chunk_size: the target size of a chunk in KB, 0 for contiguous
+ *   storage, kept between FONc.MinChunkSize and FONc.MaxChunkSize
+ * - fonc_fill: true or false, whether netcdf pre-fills variables
+ * - fonc_classic_model: true or false, for netCDF-4 responses
+ * - fonc_in_memory_threshold: arrays that need a conversion buffer
+ *   larger than this many KB are written in slabs; a client can only
+ *   lower the configured value
+ * - fonc_pack_variables: a comma separated list of the floating point
+ *   variables to pack into integers (CF scale_factor and add_offset),
+ *   or * for all of them
+ * - fonc_pack_type: short or byte, the type of the packed values
+ * - fonc_quantize_variables: a comma separated list of the floating
+ *   point variables to quantize, or * for all of them
+ * - fonc_quantize_algorithm: bitgroom, granularbr or bitround
+ * - fonc_quantize_digits: the number of significant decimal digits
+ *   (bitgroom, granularbr) or bits (bitround) to keep; 0 turns
+ *   quantization off
+ * - fonc_record_dimension: the dimension to make the unlimited (record)
+ *   dimension, by name, or time for the CF time axis; empty for none
+ * - fonc_overview_factor: reduce the last two dimensions of each Grid by
+ *   this factor, for a quick look; 1 for the full resolution
+ * - fonc_overview_method: mean, min, max or mode, how the values of a
+ *   block are reduced to one
+ *
+ * FONcTransform resolves the settings of each response into
+ * FONcSettings::Current.
+ */
+class FONcSettings: public BESObj {
+private:
+    void set_defaults();
+
+public:
+    // These match the NC_QUANTIZE_* values of netCDF-C
+    enum QuantizeAlgorithm {
+        quantize_bitgroom = 1, quantize_granularbr = 2, quantize_bitround = 3
+    };
+
+    enum OverviewMethod {
+        overview_mean = 1, overview_min = 2, overview_max = 3, overview_mode = 4
+    };
+
+    int deflate_level;
+    bool shuffle;
+    int chunk_size;
+    bool fill;
+    bool classic_model;
+    int in_memory_threshold;
+    std::string pack_variables;
+    int pack_bits;
+    std::string quantize_variables;
+    int quantize_algorithm;
+    int quantize_digits;
+    std::string record_dimension;
+    int overview_factor;
+    int overview_method;
+
+    FONcSettings();
+    virtual ~FONcSettings() { }
+
+    virtual void resolve();
+
+    virtual bool packs(const std::string &name) const;
+
+    virtual bool quantizes(const std::string &name) const;
+
+    static int pack_type_bits(const std::string &type);
+    static int quantize_algorithm_id(const std::string &name);
+    static int overview_method_id(const std::string &name);
+
+    virtual void dump(std::ostream &strm) const;
+
+    static FONcSettings Current;
+};
+
+#endif // FONcSettings_h_
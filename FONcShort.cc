@@ -37,6 +37,8 @@
 #include "FONcShort.h"
 #include "FONcUtils.h"
 #include "FONcAttributes.h"
+#include "FONcWriter.h"
+#include "FONcNc3Stream.h"
 
 /** @brief Constructor for FOncShort that takes a DAP Int16 or UInt16
  *
@@ -107,9 +109,16 @@ FONcShort::write( int ncid )
 {
     BESDEBUG( "fonc", "FONcShort::write for var " << _varname << endl ) ;
     size_t var_index[] = {0} ;
-    short *data = new short ;
+    short value = 0 ;
+    short *data = &value ;
     _bt->buf2val( (void**)&data ) ;
-    int stax = nc_put_var1_short( ncid, _varid, var_index, data ) ;
+    if( FONcWriter::Current )
+    {
+	FONcWriter::Current->put_var1( ncid, _varid, NC_SHORT, data, _varname ) ;
+	return ;
+    }
+    int stax = FONcNc3Stream::Current ? FONcNc3Stream::Current->put_var1( _varid, NC_SHORT, data )
+		   : nc_put_var1_short( ncid, _varid, var_index, data ) ;
     if( stax != NC_NOERR )
     {
 	string err = (string)"fileout.netcdf - "
@@ -117,7 +126,6 @@ FONcShort::write( int ncid )
 		     + _varname ;
 	FONcUtils::handle_error( stax, err, __FILE__, __LINE__ ) ;
     }
-    delete data ;
     BESDEBUG( "fonc", "FONcShort::done write for var " << _varname << endl ) ;
 }
 
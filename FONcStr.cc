@@ -37,6 +37,8 @@
 #include "FONcStr.h"
 #include "FONcUtils.h"
 #include "FONcAttributes.h"
+#include "FONcWriter.h"
+#include "FONcNc3Stream.h"
 
 using namespace libdap;
 
@@ -81,7 +83,7 @@ void FONcStr::define(int ncid)
     if (!_defined) {
         BESDEBUG("fonc", "FONcStr::define - defining " << _varname << endl);
 
-        _varname = FONcUtils::gen_name(_embed, _varname, _orig_varname);
+        _varname = FONcUtils::gen_var_name(_embed, _varname, _orig_varname);
         _data = new string;
         _str->buf2val((void**) &_data);
         int size = _data->size() + 1;
@@ -128,7 +130,14 @@ void FONcStr::write(int ncid)
 
     var_count[0] = _data->size() + 1;
     var_start[0] = 0;
-    int stax = nc_put_vara_text(ncid, _varid, var_start, var_count, _data->c_str());
+    if (FONcWriter::Current) {
+        FONcWriter::Current->put_copy(ncid, _varid, 1, var_start, var_count, _data->c_str(), var_count[0], _varname);
+        delete _data;
+        _data = 0;
+        return;
+    }
+    int stax = FONcNc3Stream::Current ? FONcNc3Stream::Current->put_vara(_varid, var_start, var_count, _data->c_str())
+        : nc_put_vara_text(ncid, _varid, var_start, var_count, _data->c_str());
     if (stax != NC_NOERR) {
         string err = (string) "fileout.netcdf - " + "Failed to write string data " + *_data + " for " + _varname;
         delete _data;
@@ -36,6 +36,8 @@
 #include "FONcUtils.h"
 #include "FONcAttributes.h"
 
+bool FONcStructure::AsGroups = false;
+
 /** @brief Constructor for FONcStructure that takes a DAP Structure
  *
  * This constructor takes a DAP BaseType and makes sure that it is a DAP
@@ -45,7 +47,7 @@
  * @throws BESInternalError if the BaseType is not a Structure
  */
 FONcStructure::FONcStructure(BaseType *b) :
-    FONcBaseType(), _s(0)
+    FONcBaseType(), _s(0), _grpid(0)
 {
     _s = dynamic_cast<Structure *>(b);
     if (!_s) {
@@ -87,6 +89,9 @@ FONcStructure::~FONcStructure()
  * called i1, then two variables are created in the netcdf file called
  * s1.a1 and s1.i1.
  *
+ * If FONcStructure::AsGroups is set the structure becomes a netCDF-4
+ * group, so the members keep their own names and are not embedded.
+ *
  * @note This method only converts the variables that are to be sent. Thsi keeps
  * the convert() and write() methods below from operating on DAP variables
  * that should not be sent.
@@ -98,7 +103,11 @@ FONcStructure::~FONcStructure()
 void FONcStructure::convert(vector<string> embed)
 {
     FONcBaseType::convert(embed);
-    embed.push_back(name());
+    if (FONcStructure::AsGroups)
+        embed.clear();
+    else
+        embed.push_back(name());
+
     Constructor::Vars_iter vi = _s->var_begin();
     Constructor::Vars_iter ve = _s->var_end();
     for (; vi != ve; vi++) {
@@ -106,6 +115,7 @@ void FONcStructure::convert(vector<string> embed)
         if (bt->send_p()) {
             BESDEBUG("fonc", "FONcStructure::convert - converting " << bt->name() << endl);
             FONcBaseType *fbt = FONcUtils::convert(bt);
+            fbt->setVersion(_ncVersion);
             _vars.push_back(fbt);
             fbt->convert(embed);
         }
@@ -117,6 +127,10 @@ void FONcStructure::convert(vector<string> embed)
  * Since netcdf does not support structures, we define the members of
  * the structure to include the name of the structure in their name.
  *
+ * If FONcStructure::AsGroups is set, a group is defined instead, the
+ * attributes of the structure are written as attributes of that group
+ * and the members are defined in the group.
+ *
  * @note This will call the FONcBaseType's define() method for the FONcBaseType
  * variables. Because the FONcStructure::convert() method above only
  * builds a FONcBaseType for elements of the DAP Structure with send_p true,
@@ -131,12 +145,24 @@ void FONcStructure::define(int ncid)
 {
     if (!_defined) {
         BESDEBUG("fonc", "FONcStructure::define - defining " << _varname << endl);
+        _grpid = ncid;
+        if (FONcStructure::AsGroups) {
+            string grpname = FONcUtils::id2netcdf(_varname);
+            int stax = nc_def_grp(ncid, grpname.c_str(), &_grpid);
+            if (stax != NC_NOERR) {
+                string err = (string) "fileout.netcdf - " + "Failed to define group " + grpname;
+                FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+            }
+
+            FONcAttributes::add_attributes(_grpid, NC_GLOBAL, _s->get_attr_table(), "", "");
+        }
+
         vector<FONcBaseType *>::const_iterator i = _vars.begin();
         vector<FONcBaseType *>::const_iterator e = _vars.end();
         for (; i != e; i++) {
             FONcBaseType *fbt = (*i);
             BESDEBUG("fonc", "defining " << fbt->name() << endl);
-            fbt->define(ncid);
+            fbt->define(_grpid);
         }
 
         _defined = true;
@@ -148,18 +174,21 @@ void FONcStructure::define(int ncid)
 /** @brief write the member variables of the structure to the netcdf
  * file
  *
- * @param ncid The id of the netcdf file
+ * The members are written to the file or group the structure was
+ * defined in.
+ *
+ * @param ncid The id of the netcdf file (not used)
  * @throws BESInternalError if there is a problem writing out the
  * members of the structure.
  */
-void FONcStructure::write(int ncid)
+void FONcStructure::write(int /*ncid*/)
 {
     BESDEBUG("fonc", "FONcStructure::write - writing " << _varname << endl);
     vector<FONcBaseType *>::const_iterator i = _vars.begin();
     vector<FONcBaseType *>::const_iterator e = _vars.end();
     for (; i != e; i++) {
         FONcBaseType *fbt = (*i);
-        fbt->write(ncid);
+        fbt->write(_grpid);
     }
     BESDEBUG("fonc", "FONcStructure::define - done writing " << _varname << endl);
 }
@@ -186,6 +215,7 @@ void FONcStructure::dump(ostream &strm) const
     strm << BESIndent::LMarg << "FONcStructure::dump - (" << (void *) this << ")" << endl;
     BESIndent::Indent();
     strm << BESIndent::LMarg << "name = " << _s->name() << " {" << endl;
+    if (FONcStructure::AsGroups) strm << BESIndent::LMarg << "group id = " << _grpid << endl;
     BESIndent::Indent();
     vector<FONcBaseType *>::const_iterator i = _vars.begin();
     vector<FONcBaseType *>::const_iterator e = _vars.end();
@@ -50,6 +50,7 @@ class FONcStructure : public FONcBaseType
 private:
     Structure *			_s ;
     vector<FONcBaseType *>	_vars ;
+    int				_grpid ;
 public:
     				FONcStructure( BaseType *b ) ;
     virtual			~FONcStructure() ;
@@ -61,6 +62,8 @@ public:
     virtual string 		name() ;
 
     virtual void		dump( ostream &strm ) const ;
+
+    static bool			AsGroups ;
 } ;
 
 #endif // FONcStructure_h_
@@ -0,0 +1,382 @@
+// FONcTempStore.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <sstream>
+
+#include <DDS.h>
+#include <D4Group.h>
+#include <BaseType.h>
+
+#include <BESInternalError.h>
+#include <BESDebug.h>
+#include <BESUtil.h>
+
+#include "FONcTempStore.h"
+#include "FONcBaseType.h"
+#include "FONcRequestHandler.h"
+
+using namespace std;
+using namespace libdap;
+
+// The names of the temporary files start with this; the usage of a tier
+// is the size of these files
+#define FONC_TEMP_PREFIX "fonc"
+
+// The names of the kept responses; see FONc.RetainSeconds
+#define FONC_RETAINED_PREFIX FONC_TEMP_PREFIX "_retained_"
+
+FONcTempStore *FONcTempStore::d_instance = 0;
+
+/** @brief Read the tiers from FONc.TempTiers
+ *
+ * The value is a comma separated list of dir:quota pairs, with the quota
+ * in MB; a quota of 0, or no quota, means the tier is limited only by the
+ * free space of its file system.
+ *
+ * @throws BESInternalError if the value cannot be parsed
+ */
+FONcTempStore::FONcTempStore() :
+    d_retained(0), d_reused(0), d_expired_at(0)
+{
+    vector<string> items;
+    if (!FONcRequestHandler::temp_tiers.empty()) BESUtil::explode(',', FONcRequestHandler::temp_tiers, items);
+
+    for (vector<string>::iterator i = items.begin(); i != items.end(); ++i) {
+        Tier tier;
+        string::size_type colon = i->rfind(':');
+        tier.dir = i->substr(0, colon);
+        tier.quota = 0;
+        if (colon != string::npos) {
+            istringstream iss(i->substr(colon + 1));
+            iss >> tier.quota;
+            if (iss.fail())
+                throw BESInternalError("The quota of the temporary file tier " + tier.dir + " is not a number",
+                    __FILE__, __LINE__);
+            tier.quota *= 1024 * 1024;
+        }
+        tier.chosen = 0;
+        tier.spilled = 0;
+        if (!tier.dir.empty()) d_tiers.push_back(tier);
+    }
+
+    if (d_tiers.empty()) {
+        Tier tier;
+        tier.dir = FONcRequestHandler::temp_dir;
+        tier.quota = 0;
+        tier.chosen = 0;
+        tier.spilled = 0;
+        d_tiers.push_back(tier);
+    }
+}
+
+FONcTempStore *
+FONcTempStore::TheStore()
+{
+    if (!d_instance) d_instance = new FONcTempStore;
+    return d_instance;
+}
+
+/** @brief The room a response needs in its tier, given the size of its
+ * netcdf file
+ *
+ * A Zarr store is built from a scratch netCDF-4 file in the same tier,
+ * and both are there until the store is done, so it needs twice the room.
+ */
+static unsigned long long with_scratch(unsigned long long bytes, const string &return_as)
+{
+    return return_as == RETURNAS_ZARR ? 2 * bytes : bytes;
+}
+
+/** @brief Estimate the size of the temporary files of a response
+ *
+ * This is the size of the projected variables, after the constraint, which
+ * is an upper bound when the response is compressed.
+ *
+ * @param dds The DDS of the response, with its constraint applied
+ * @param return_as The return type of the response
+ */
+unsigned long long FONcTempStore::estimate(DDS *dds, const string &return_as)
+{
+    unsigned long long bytes = 0;
+    DDS::Vars_iter vi = dds->var_begin();
+    DDS::Vars_iter ve = dds->var_end();
+    for (; vi != ve; vi++) {
+        if ((*vi)->send_p()) bytes += (*vi)->width(true);
+    }
+    return with_scratch(bytes, return_as);
+}
+
+/** @brief Estimate the size of the temporary files of a DAP4 response
+ *
+ * @param group The root group of the DMR of the response, with its
+ * constraint applied
+ * @param return_as The return type of the response
+ */
+unsigned long long FONcTempStore::estimate(D4Group *group, const string &return_as)
+{
+    return with_scratch(group_bytes(group), return_as);
+}
+
+/** @brief The size of the projected variables of a group and its groups
+ */
+unsigned long long FONcTempStore::group_bytes(D4Group *group)
+{
+    unsigned long long bytes = 0;
+    Constructor::Vars_iter vi = group->var_begin();
+    Constructor::Vars_iter ve = group->var_end();
+    for (; vi != ve; vi++) {
+        if ((*vi)->send_p()) bytes += (*vi)->width(true);
+    }
+
+    D4Group::groupsIter gi = group->grp_begin();
+    D4Group::groupsIter ge = group->grp_end();
+    for (; gi != ge; gi++) {
+        bytes += group_bytes(*gi);
+    }
+    return bytes;
+}
+
+/** @brief The bytes of temporary files in a tier
+ */
+unsigned long long FONcTempStore::used(const Tier &tier) const
+{
+    unsigned long long bytes = 0;
+    DIR *dir = opendir(tier.dir.c_str());
+    if (!dir) return 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != 0) {
+        if (string(entry->d_name).compare(0, sizeof(FONC_TEMP_PREFIX) - 1, FONC_TEMP_PREFIX) != 0) continue;
+
+        struct stat sb;
+        string path = tier.dir + "/" + entry->d_name;
+        if (stat(path.c_str(), &sb) == 0) bytes += static_cast<unsigned long long>(sb.st_blocks) * 512;
+    }
+    closedir(dir);
+
+    return bytes;
+}
+
+/** @brief The bytes a new response can use in a tier
+ */
+unsigned long long FONcTempStore::available(const Tier &tier) const
+{
+    struct statvfs fs;
+    if (statvfs(tier.dir.c_str(), &fs) != 0) return 0;
+    unsigned long long bytes = static_cast<unsigned long long>(fs.f_bavail) * fs.f_frsize;
+
+    if (tier.quota) {
+        unsigned long long in_use = used(tier);
+        unsigned long long left = (in_use < tier.quota) ? tier.quota - in_use : 0;
+        if (left < bytes) bytes = left;
+    }
+
+    return bytes;
+}
+
+/** @brief Choose the tier for a response
+ *
+ * @param bytes The estimated size of the response
+ * @param first The first tier to consider
+ * @return The first tier, starting with first, with room for the
+ * response, or the last tier if none has room
+ */
+unsigned int FONcTempStore::choose(unsigned long long bytes, unsigned int first)
+{
+    // Expired responses still count in the usage of their tiers
+    expire();
+
+    unsigned int last = d_tiers.size() - 1;
+    unsigned int t = first;
+    for (; t < last; t++) {
+        if (available(d_tiers[t]) >= bytes) break;
+    }
+    if (t > last) t = last;
+
+    d_tiers[t].chosen++;
+    BESDEBUG("fonc", "FONcTempStore::choose() - " << bytes << " bytes go in " << d_tiers[t].dir << endl);
+
+    return t;
+}
+
+/** @brief The mkstemp() template for a temporary file in a tier
+ */
+string FONcTempStore::temp_file_template(unsigned int tier) const
+{
+    return d_tiers[tier].dir + "/" + FONC_TEMP_PREFIX + "XXXXXX";
+}
+
+/** @brief Is a tier too full for a response?
+ *
+ * @param tier The tier
+ * @param bytes The estimated size of the response
+ */
+bool FONcTempStore::full(unsigned int tier, unsigned long long bytes) const
+{
+    return available(d_tiers[tier]) < bytes;
+}
+
+/** @brief Record that a response did not fit in a tier
+ */
+void FONcTempStore::spilled(unsigned int tier)
+{
+    d_tiers[tier].spilled++;
+}
+
+/** @brief Tell the kernel the pages of a transmitted file are not needed
+ *
+ * The temporary file is removed once it is sent, so its pages would only
+ * push other files out of the page cache. Kept responses are left in the
+ * cache for the requests that resume them, and those that have expired
+ * are removed.
+ *
+ * @param fd The open temporary file
+ */
+void FONcTempStore::done(int fd)
+{
+    if (FONcRequestHandler::retain_seconds > 0) {
+        TheStore()->expire();
+        return;
+    }
+
+#ifdef HAVE_POSIX_FADVISE
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+/** @brief Keep a built response for later requests with the same signature
+ *
+ * The kept file is a hard link to the temporary file, in the same tier, so
+ * nothing is copied. If another process kept the same response first, its
+ * file is left as it is.
+ *
+ * @param temp_file The temporary file of the response
+ * @param tier The tier of the temporary file
+ * @param signature The signature of the request; see FONcTransmitter
+ */
+void FONcTempStore::retain(const string &temp_file, unsigned int tier, const string &signature)
+{
+    if (FONcRequestHandler::retain_seconds <= 0) return;
+
+    expire();
+
+    string name = d_tiers[tier].dir + "/" + FONC_RETAINED_PREFIX + signature;
+    if (link(temp_file.c_str(), name.c_str()) == 0) {
+        d_retained++;
+        BESDEBUG("fonc", "FONcTempStore::retain() - Keeping " << temp_file << " as " << name << endl);
+    }
+    else if (errno != EEXIST) {
+        BESDEBUG("fonc", "FONcTempStore::retain() - Could not keep " << temp_file << ": " << strerror(errno) << endl);
+    }
+}
+
+/** @brief Open the kept response with a signature
+ *
+ * @param signature The signature of the request
+ * @param name If not null, set to the name of the kept file
+ * @return A descriptor open for reading, or -1 if no tier holds the
+ * response or it has expired
+ */
+int FONcTempStore::open_retained(const string &signature, string *name)
+{
+    if (FONcRequestHandler::retain_seconds <= 0) return -1;
+
+    time_t now = time(0);
+    for (vector<Tier>::iterator i = d_tiers.begin(); i != d_tiers.end(); ++i) {
+        string path = i->dir + "/" + FONC_RETAINED_PREFIX + signature;
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) continue;
+
+        // The file may expire, and be removed by another process, after
+        // it is opened; the descriptor keeps it until it is sent
+        struct stat sb;
+        if (fstat(fd, &sb) == 0 && now - sb.st_mtime < FONcRequestHandler::retain_seconds) {
+            d_reused++;
+            BESDEBUG("fonc", "FONcTempStore::open_retained() - Sending the kept response " << path << endl);
+            if (name) *name = path;
+            return fd;
+        }
+        close(fd);
+    }
+
+    return -1;
+}
+
+/** @brief Remove the kept responses that are older than FONc.RetainSeconds
+ *
+ * The tiers are scanned at most once a second.
+ */
+void FONcTempStore::expire()
+{
+    if (FONcRequestHandler::retain_seconds <= 0) return;
+
+    time_t now = time(0);
+    if (now == d_expired_at) return;
+    d_expired_at = now;
+
+    for (vector<Tier>::iterator i = d_tiers.begin(); i != d_tiers.end(); ++i) {
+        DIR *dir = opendir(i->dir.c_str());
+        if (!dir) continue;
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != 0) {
+            if (string(entry->d_name).compare(0, sizeof(FONC_RETAINED_PREFIX) - 1, FONC_RETAINED_PREFIX) != 0)
+                continue;
+
+            struct stat sb;
+            string path = i->dir + "/" + entry->d_name;
+            if (stat(path.c_str(), &sb) == 0 && now - sb.st_mtime >= FONcRequestHandler::retain_seconds) {
+                BESDEBUG("fonc", "FONcTempStore::expire() - Removing " << path << endl);
+                (void) unlink(path.c_str());
+            }
+        }
+        closedir(dir);
+    }
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcTempStore::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcTempStore::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    for (vector<Tier>::const_iterator i = d_tiers.begin(); i != d_tiers.end(); ++i) {
+        strm << BESIndent::LMarg << "tier " << i->dir << ": quota " << i->quota << ", used " << used(*i)
+            << ", chosen " << i->chosen << ", spilled " << i->spilled << endl;
+    }
+    strm << BESIndent::LMarg << "retained " << d_retained << ", reused " << d_reused << endl;
+    BESIndent::UnIndent();
+}
@@ -0,0 +1,106 @@
+// FONcTempStore.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef FONcTempStore_h_
+#define FONcTempStore_h_ 1
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <BESObj.h>
+
+namespace libdap {
+class DDS;
+class D4Group;
+}
+
+/** @brief Chooses where the temporary netcdf file of a response is built
+ *
+ * The store has an ordered list of tiers, each a directory with a quota
+ * (FONc.TempTiers), for example a tmpfs such as /dev/shm first, then a
+ * local SSD and then a larger disk. A tier on a tmpfs is the in-memory
+ * tier; the netcdf library and the transmitter need a file, so there is
+ * no tier inside the BES process. A response goes in the first tier
+ * with room for its estimated size under both the tier's quota and the
+ * free space of its file system. If a response fails because its tier
+ * filled up, FONcTransmitter builds it again in the next tier.
+ *
+ * The usage of a tier is the size of the temporary files in it, so it
+ * counts the responses of every BES process. Without FONc.TempTiers there
+ * is one tier, FONc.Tempdir, with no quota.
+ *
+ * With FONc.RetainSeconds a built response is also kept, as a second link
+ * to its temporary file named for the signature of the request, so that a
+ * resumed or ranged download of it is not built again. Kept files count
+ * in the usage of their tier until they expire; they are removed when a
+ * tier is chosen, a response is kept or one is sent, at most once a
+ * second.
+ */
+class FONcTempStore: public BESObj {
+private:
+    struct Tier {
+        std::string dir;
+        unsigned long long quota;
+        unsigned long chosen;
+        unsigned long spilled;
+    };
+
+    static FONcTempStore *d_instance;
+
+    std::vector<Tier> d_tiers;
+
+    unsigned long d_retained;
+    unsigned long d_reused;
+    time_t d_expired_at;
+
+    FONcTempStore();
+
+    static unsigned long long group_bytes(libdap::D4Group *group);
+
+    unsigned long long used(const Tier &tier) const;
+    unsigned long long available(const Tier &tier) const;
+
+public:
+    virtual ~FONcTempStore() { }
+
+    static FONcTempStore *TheStore();
+
+    static unsigned long long estimate(libdap::DDS *dds, const std::string &return_as = "");
+    static unsigned long long estimate(libdap::D4Group *group, const std::string &return_as = "");
+
+    virtual unsigned int choose(unsigned long long bytes, unsigned int first = 0);
+    virtual std::string temp_file_template(unsigned int tier) const;
+    virtual bool full(unsigned int tier, unsigned long long bytes) const;
+    virtual void spilled(unsigned int tier);
+    virtual unsigned int tiers() const { return d_tiers.size(); }
+
+    virtual void retain(const std::string &temp_file, unsigned int tier, const std::string &signature);
+    virtual int open_retained(const std::string &signature, std::string *name = 0);
+    virtual void expire();
+
+    static void done(int fd);
+
+    virtual void dump(std::ostream &strm) const;
+};
+
+#endif // FONcTempStore_h_
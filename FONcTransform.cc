@@ -31,19 +31,37 @@
 
 #include "config.h"
 
+#include <sys/time.h>
+#include <unistd.h>
+
 #include <sstream>
+#include <set>
+#include <algorithm>
+#include <memory>
 
 using std::ostringstream;
 using std::istringstream;
+using std::auto_ptr;
 
 #include "FONcRequestHandler.h" // for the keys
+#include "FONcSettings.h"
+#include "FONcWriter.h"
+#include "FONcNc3Stream.h"
 
 #include "FONcTransform.h"
 #include "FONcUtils.h"
 #include "FONcBaseType.h"
+#include "FONcArray.h"
+#include "FONcDim.h"
 #include "FONcAttributes.h"
+#include "FONcStructure.h"
+#include "FONcGroup.h"
+#include "FONcEnum.h"
+#include "FONcZarr.h"
 
 #include <DDS.h>
+#include <DMR.h>
+#include <D4Group.h>
 #include <Structure.h>
 #include <Array.h>
 #include <Grid.h>
@@ -53,6 +71,94 @@ using std::istringstream;
 
 #include "DapFunctionUtils.h"
 
+/** @brief Return the number of seconds elapsed since 'start'
+ */
+static double elapsed_since(const struct timeval &start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1.0e6;
+}
+
+/** @brief Is this the netcdf type of one of the simple (scalar) FONc types?
+ *
+ * FONcByte, FONcInt8, FONcShort, FONcInt, FONcInt64, FONcFloat and
+ * FONcDouble return their netcdf type from type(), as does FONcEnum when
+ * the file has no enum types; all of the other FONc types return NC_NAT
+ * or, for strings, NC_CHAR.
+ */
+static bool is_scalar_type(nc_type type)
+{
+    switch (type) {
+    case NC_BYTE:
+    case NC_SHORT:
+    case NC_INT:
+    case NC_INT64:
+    case NC_UINT64:
+    case NC_FLOAT:
+    case NC_DOUBLE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/** @brief Order scalars by their netcdf type */
+static bool scalar_type_less(FONcBaseType *a, FONcBaseType *b)
+{
+    return a->type() < b->type();
+}
+
+/** @brief Find the dimensions an overview reduces
+ *
+ * These are the last two dimensions of the array of each Grid that is
+ * sent, in a variable or in the members of a constructor.
+ *
+ * @param v The variable
+ * @param dims Value-result parameter; the names are added
+ */
+static void overview_dimensions(BaseType *v, std::set<string> &dims)
+{
+    if (!v->send_p()) return;
+
+    if (v->type() == dods_grid_c) {
+        Array *a = static_cast<Grid *>(v)->get_array();
+        Array::Dim_iter d = a->dim_end();
+        for (int n = 0; n < 2 && d != a->dim_begin(); n++) {
+            --d;
+            string name = a->dimension_name(d);
+            if (!name.empty()) dims.insert(name);
+        }
+    }
+    else if (v->is_constructor_type()) {
+        Constructor *c = static_cast<Constructor *>(v);
+        Constructor::Vars_iter vi = c->var_begin();
+        Constructor::Vars_iter ve = c->var_end();
+        for (; vi != ve; vi++)
+            overview_dimensions(*vi, dims);
+    }
+}
+
+/** @brief Set the prefix for names that netcdf does not allow
+ *
+ * if there is a variable, attribute, dimension name that is not
+ * compliant with netcdf naming conventions then we will create
+ * a new name. If the new name does not begin with an alpha
+ * character then we will prefix it with name_prefix. We will
+ * get this prefix from the type of data that we are reading in,
+ * such as nc, h4, h5, ff, jg, etc...
+ */
+static void set_name_prefix(BESDataHandlerInterface &dhi)
+{
+    dhi.first_container();
+    if (dhi.container) {
+        FONcUtils::name_prefix = dhi.container->get_container_type() + "_";
+    }
+    else {
+        FONcUtils::name_prefix = "nc_";
+    }
+}
+
 /** @brief Constructor that creates transformation object from the specified
  * DataDDS object to the specified file
  *
@@ -65,7 +171,8 @@ using std::istringstream;
  * file is not specified or failed to create the netcdf file
  */
 FONcTransform::FONcTransform(DDS *dds, BESDataHandlerInterface &dhi, const string &localfile, const string &ncVersion) :
-        _ncid(0), _dds(0)
+        _ncid(0), _dds(0), _dmr(0), _stream(0), _stream_digest(0), _convert_time(0.0), _define_time(0.0),
+        _write_time(0.0)
 {
     if (!dds) {
         string s = (string) "File out netcdf, " + "null DDS passed to constructor";
@@ -79,19 +186,50 @@ FONcTransform::FONcTransform(DDS *dds, BESDataHandlerInterface &dhi, const strin
     _dds = dds;
     _returnAs = ncVersion;
 
-    // if there is a variable, attribute, dimension name that is not
-    // compliant with netcdf naming conventions then we will create
-    // a new name. If the new name does not begin with an alpha
-    // character then we will prefix it with name_prefix. We will
-    // get this prefix from the type of data that we are reading in,
-    // such as nc, h4, h5, ff, jg, etc...
-    dhi.first_container();
-    if (dhi.container) {
-        FONcUtils::name_prefix = dhi.container->get_container_type() + "_";
+    // A Zarr store is built from a netCDF-4 file, and the reference index
+    // of a netCDF-4 file describes that file
+    _zarr = ncVersion == RETURNAS_ZARR;
+    if (_zarr || ncVersion == RETURNAS_NETCDF4_REFS) _returnAs = RETURNAS_NETCDF4;
+
+    set_name_prefix(dhi);
+}
+
+/** @brief Constructor that creates transformation object from the specified
+ * DMR to the specified file
+ *
+ * The DAP4 attributes of the groups and variables of the DMR must already
+ * be in their DAP2 attribute tables; see D4Attributes::transform_to_dap2().
+ *
+ * @param dmr DMR that holds the data, with its constraint applied
+ * @param dhi The data interface containing information about the current
+ * request
+ * @param localfile netcdf to create and write the information to
+ * @param ncVersion "netcdf" or "netcdf-4"
+ * @throws BESInternalError if the DMR is null or the file is not
+ * specified
+ */
+FONcTransform::FONcTransform(DMR *dmr, BESDataHandlerInterface &dhi, const string &localfile, const string &ncVersion) :
+        _ncid(0), _dds(0), _dmr(0), _stream(0), _stream_digest(0), _convert_time(0.0), _define_time(0.0),
+        _write_time(0.0)
+{
+    if (!dmr) {
+        string s = (string) "File out netcdf, " + "null DMR passed to constructor";
+        throw BESInternalError(s, __FILE__, __LINE__);
     }
-    else {
-        FONcUtils::name_prefix = "nc_";
+    if (localfile.empty()) {
+        string s = (string) "File out netcdf, " + "empty local file name passed to constructor";
+        throw BESInternalError(s, __FILE__, __LINE__);
     }
+    _localfile = localfile;
+    _dmr = dmr;
+    _returnAs = ncVersion;
+
+    // A Zarr store is built from a netCDF-4 file, and the reference index
+    // of a netCDF-4 file describes that file
+    _zarr = ncVersion == RETURNAS_ZARR;
+    if (_zarr || ncVersion == RETURNAS_NETCDF4_REFS) _returnAs = RETURNAS_NETCDF4;
+
+    set_name_prefix(dhi);
 }
 
 /** @brief Destructor
@@ -100,20 +238,32 @@ FONcTransform::FONcTransform(DDS *dds, BESDataHandlerInterface &dhi, const strin
  */
 FONcTransform::~FONcTransform()
 {
-    bool done = false;
-    while (!done) {
-        vector<FONcBaseType *>::iterator i = _fonc_vars.begin();
-        vector<FONcBaseType *>::iterator e = _fonc_vars.end();
-        if (i == e) {
-            done = true;
-        }
-        else {
-            // These are the FONc types, not the actual ones
-            FONcBaseType *b = (*i);
-            delete b;
-            _fonc_vars.erase(i);
-        }
+    // These are the FONc types, not the actual ones. They must be deleted
+    // before the arena that holds them.
+    vector<FONcBaseType *>::iterator i = _fonc_vars.begin();
+    vector<FONcBaseType *>::iterator e = _fonc_vars.end();
+    for (; i != e; i++) {
+        delete *i;
     }
+    _fonc_vars.clear();
+}
+
+/** @brief Send the response to a stream as it is written
+ *
+ * Only the header of the file is written to the local file; see
+ * FONcNc3Stream. Only netCDF-3 responses can be streamed.
+ *
+ * @param strm Where to send the response
+ * @param digest If not null, the bytes sent are added to it
+ * @throws BESInternalError if the response is not a netCDF-3 file
+ */
+void FONcTransform::stream_to(ostream &strm, FONcDigest *digest)
+{
+    if (_returnAs != RETURNAS_NETCDF)
+        throw BESInternalError("File out netcdf, only netCDF-3 responses can be streamed", __FILE__, __LINE__);
+
+    _stream = &strm;
+    _stream_digest = digest;
 }
 
 /** @brief Transforms each of the variables of the DataDDS to the NetCDF
@@ -128,54 +278,136 @@ void FONcTransform::transform()
 {
     FONcUtils::reset();
 
+    // Make the FONc objects of this response in its arena, until this
+    // returns or throws
+    FONcArena::Use arena(FONcRequestHandler::use_arena ? &_arena : 0);
+
+    // The settings of this response: the configured defaults, with any
+    // changes the client made using contexts
+    FONcSettings::Current.resolve();
+
+    // The chunks of a Zarr store are compressed when they are copied to
+    // it, so its netCDF-4 file is not
+    int zarr_level = FONcSettings::Current.deflate_level;
+    if (_zarr) {
+        FONcSettings::Current.classic_model = false;
+        FONcSettings::Current.deflate_level = 0;
+    }
+
+    // Groups, enum types and 64-bit integers need the enhanced data model
+    FONcUtils::enhanced_model = FONcTransform::_returnAs == RETURNAS_NETCDF4 && !FONcSettings::Current.classic_model;
+    FONcStructure::AsGroups = FONcUtils::enhanced_model && FONcRequestHandler::structures_as_groups;
+
+    struct timeval phase_start;
+    gettimeofday(&phase_start, NULL);
+
     // Convert the DDS into an internal format to keep track of
     // variables, arrays, shared dimensions, grids, common maps,
     // embedded structures. It only grabs the variables that are to be
-    // sent.
-    DDS::Vars_iter vi = _dds->var_begin();
-    DDS::Vars_iter ve = _dds->var_end();
+    // sent. The variables of the root group of a DMR are the top level
+    // variables of the file, and its groups follow them.
+    vector<BaseType *> vars;
+    if (_dmr) {
+        D4Group *root = _dmr->root();
+        Constructor::Vars_iter vi = root->var_begin();
+        Constructor::Vars_iter ve = root->var_end();
+        for (; vi != ve; vi++) {
+            if ((*vi)->send_p()) vars.push_back(*vi);
+        }
+        D4Group::groupsIter gi = root->grp_begin();
+        D4Group::groupsIter ge = root->grp_end();
+        for (; gi != ge; gi++) {
+            if (FONcGroup::sends(*gi)) vars.push_back(*gi);
+        }
+    }
+    else {
+        DDS::Vars_iter vi = _dds->var_begin();
+        DDS::Vars_iter ve = _dds->var_end();
+        for (; vi != ve; vi++) {
+            if ((*vi)->send_p()) vars.push_back(*vi);
+        }
+    }
+
+    // An overview reduces the dimensions of the Grids in every array
+    // that uses them
+    vector<BaseType *>::iterator vi = vars.begin();
+    vector<BaseType *>::iterator ve = vars.end();
+    if (FONcSettings::Current.overview_factor > 1) {
+        for (; vi != ve; vi++)
+            overview_dimensions(*vi, FONcArray::ReducedDims);
+        BESDEBUG("fonc", "FONcTransform::transform() - Reducing " << FONcArray::ReducedDims.size()
+            << " dimensions by " << FONcSettings::Current.overview_factor << endl);
+        vi = vars.begin();
+    }
     for (; vi != ve; vi++) {
-        if ((*vi)->send_p()) {
-            BaseType *v = *vi;
+        BaseType *v = *vi;
 
-            BESDEBUG("fonc", "FONcTransform::transform() - Converting variable '" << v->name() << "'" << endl);
+        BESDEBUG("fonc", "FONcTransform::transform() - Converting variable '" << v->name() << "'" << endl);
 
-            // This is a factory class call, and 'fg' is specialized for 'v'
-            FONcBaseType *fb = FONcUtils::convert(v);
-            fb->setVersion( FONcTransform::_returnAs );
-            _fonc_vars.push_back(fb);
+        // This is a factory class call, and 'fg' is specialized for 'v'
+        FONcBaseType *fb = FONcUtils::convert(v);
+        fb->setVersion( FONcTransform::_returnAs );
+        _fonc_vars.push_back(fb);
 
-            vector<string> embed;
-            fb->convert(embed);
-        }
+        vector<string> embed;
+        fb->convert(embed);
     }
 
-    // Open the file for writing
+    // The record dimension, if any, is made unlimited before the
+    // dimensions are defined. A Zarr store has no unlimited dimensions.
+    FONcDim *record_dim = _zarr ? 0 : FONcArray::set_record_dimension(FONcSettings::Current.record_dimension);
+
+    _convert_time = elapsed_since(phase_start);
+    gettimeofday(&phase_start, NULL);
+
+    // Open the file for writing. For a Zarr store it is a scratch file
+    // next to the store, removed however this returns.
+    string nc_file = _zarr ? _localfile + ".nc" : _localfile;
+    struct remove_scratch {
+        const string *name;
+        ~remove_scratch() { if (name) (void) unlink(name->c_str()); }
+    } scratch = { _zarr ? &nc_file : 0 };
+
     int stax;
     if ( FONcTransform::_returnAs == RETURNAS_NETCDF4 ) {
-        if (FONcRequestHandler::classic_model){
-            BESDEBUG("fonc", "FONcTransform::transform() - Opening NetCDF-4 cache file in classic mode. fileName:  " << _localfile << endl);
-            stax = nc_create(_localfile.c_str(), NC_CLOBBER|NC_NETCDF4|NC_CLASSIC_MODEL, &_ncid);
+        if (FONcSettings::Current.classic_model){
+            BESDEBUG("fonc", "FONcTransform::transform() - Opening NetCDF-4 cache file in classic mode. fileName:  " << nc_file << endl);
+            stax = nc_create(nc_file.c_str(), NC_CLOBBER|NC_NETCDF4|NC_CLASSIC_MODEL, &_ncid);
         }
         else {
-            BESDEBUG("fonc", "FONcTransform::transform() - Opening NetCDF-4 cache file. fileName:  " << _localfile << endl);
-            stax = nc_create(_localfile.c_str(), NC_CLOBBER|NC_NETCDF4, &_ncid);
+            BESDEBUG("fonc", "FONcTransform::transform() - Opening NetCDF-4 cache file. fileName:  " << nc_file << endl);
+            stax = nc_create(nc_file.c_str(), NC_CLOBBER|NC_NETCDF4, &_ncid);
         }
     }
     else {
-        BESDEBUG("fonc", "FONcTransform::transform() - Opening NetCDF-3 cache file. fileName:  " << _localfile << endl);
-    	stax = nc_create(_localfile.c_str(), NC_CLOBBER, &_ncid);
+        BESDEBUG("fonc", "FONcTransform::transform() - Opening NetCDF-3 cache file. fileName:  " << nc_file << endl);
+    	stax = nc_create(nc_file.c_str(), NC_CLOBBER, &_ncid);
     }
 
     if (stax != NC_NOERR) {
         FONcUtils::handle_error(stax, "File out netcdf, unable to open: " + _localfile, __FILE__, __LINE__);
     }
 
+    // Every value of a response is written, so filling is only needed for
+    // readers that look at partly written files. A streamed response is
+    // filled by the stream; the local file only holds the header.
+    int old_fill;
+    stax = nc_set_fill(_ncid, FONcSettings::Current.fill && !_stream ? NC_FILL : NC_NOFILL, &old_fill);
+    if (stax != NC_NOERR) {
+        nc_close(_ncid);
+        FONcUtils::handle_error(stax, "File out netcdf, unable to set the fill mode of: " + _localfile, __FILE__,
+            __LINE__);
+    }
+
     try {
         // Here we will be defining the variables of the netcdf and
         // adding attributes. To do this we must be in define mode.
         nc_redef(_ncid);
 
+        // The enum types declared by the root group, which the variables
+        // of every group may use
+        if (_dmr && FONcUtils::enhanced_model) FONcEnum::define_types(_ncid, _dmr->root());
+
         // For each converted FONc object, call define on it to define
         // that object to the netcdf file. This also adds the attributes
         // for the variables to the netcdf file
@@ -188,7 +420,7 @@ void FONcTransform::transform()
         }
 
         // Add any global attributes to the netcdf file
-        AttrTable &globals = _dds->get_attr_table();
+        AttrTable &globals = _dmr ? _dmr->root()->get_attr_table() : _dds->get_attr_table();
         BESDEBUG("fonc", "FONcTransform::transform() - Adding Global Attributes" << endl << globals << endl);
         FONcAttributes::add_attributes(_ncid, NC_GLOBAL, globals, "", "");
 
@@ -202,25 +434,122 @@ void FONcTransform::transform()
             FONcUtils::handle_error(stax, "File out netcdf, unable to end the define mode: " + _localfile, __FILE__, __LINE__);
         }
 
-        // Write everything out
+        _define_time = elapsed_since(phase_start);
+        gettimeofday(&phase_start, NULL);
+
+        // A streamed response sends the header libnetcdf wrote and then
+        // the values, in the order of the file. With
+        // FONc.ClassicWriteThreads the values of a netCDF-3 file are
+        // written at their offsets by a pool of threads.
+        auto_ptr<FONcNc3Stream> stream;
+        bool classic_threads = _returnAs == RETURNAS_NETCDF && FONcRequestHandler::classic_write_threads > 1
+            && FONcNc3Stream::writable(_ncid);
+        if (_stream || classic_threads) {
+            stax = nc_sync(_ncid);
+            if (stax != NC_NOERR)
+                FONcUtils::handle_error(stax, "File out netcdf, unable to write the header of: " + _localfile, __FILE__,
+                    __LINE__);
+            if (_stream)
+                stream.reset(new FONcNc3Stream(_ncid, nc_file, *_stream, FONcSettings::Current.fill, _stream_digest,
+                    record_dim ? record_dim->size() : 0));
+            else
+                stream.reset(new FONcNc3Stream(_ncid, nc_file, FONcRequestHandler::classic_write_threads));
+            stream->start();
+            FONcNc3Stream::Current = stream.get();
+        }
+
+        // With FONc.AsyncWrites the values are written by a thread of
+        // their own while the next ones are converted (or read, for the
+        // arrays read lazily)
+        auto_ptr<FONcWriter> writer;
+        if (FONcRequestHandler::async_writes && !stream.get()) writer.reset(new FONcWriter);
+        FONcWriter::Current = writer.get();
+
+        // Write everything out. The top level scalars are set aside and
+        // written together once the other variables are done, except in a
+        // stream, where that would hold back every variable after them.
+        vector<FONcBaseType *> scalars;
         i = _fonc_vars.begin();
         e = _fonc_vars.end();
         for (; i != e; i++) {
             FONcBaseType *fbt = *i;
+            if (!_stream && is_scalar_type(fbt->type())) {
+                scalars.push_back(fbt);
+                continue;
+            }
             BESDEBUG("fonc", "FONcTransform::transform() - Writing data for variable:  " << fbt->name() << endl);
             fbt->write(_ncid);
         }
 
-        stax = nc_close(_ncid);
+        // The arrays that use the record dimension follow the others in
+        // a netCDF-3 file
+        FONcArray::write_records();
+
+        if (writer.get()) {
+            writer->sync();
+            FONcWriter::Current = 0;
+            writer.reset();
+        }
+
+        write_scalars(scalars);
+
+        if (stream.get()) {
+            stream->finish();
+            FONcNc3Stream::Current = 0;
+            // libnetcdf wrote nothing after the header and the fill
+            // values, so nc_close() has nothing to add
+            stax = nc_abort(_ncid);
+        }
+        else {
+            stax = nc_close(_ncid);
+        }
         if (stax != NC_NOERR)
             FONcUtils::handle_error(stax, "File out netcdf, unable to close: " + _localfile, __FILE__, __LINE__);
+
+        if (_zarr) {
+            BESDEBUG("fonc", "FONcTransform::transform() - Writing the Zarr store " << _localfile << endl);
+            FONcZarr zarr(zarr_level, FONcSettings::Current.shuffle, FONcRequestHandler::zarr_threads);
+            zarr.write(nc_file, _localfile);
+        }
+
+        _write_time = elapsed_since(phase_start);
     }
     catch (BESError &e) {
+        // The writer and the stream, if any, were stopped as the exception
+        // left the try block
+        FONcWriter::Current = 0;
+        FONcNc3Stream::Current = 0;
         (void) nc_close(_ncid); // ignore the error at this point
         throw;
     }
 }
 
+/** @brief Write the values of the top level scalar variables
+ *
+ * Datasets often have hundreds of scalar 'metadata' variables. Rather than
+ * interleave each of their single value writes with the (large) array
+ * writes, write them in one pass, grouped by type so that consecutive
+ * calls use the same nc_put_var1_* function. Each scalar's write() reads
+ * its value into a stack variable, so there is no per-value allocation.
+ * For netCDF-4 files the scalars were defined with compact storage in
+ * FONcBaseType::define(), so none of these writes touch a chunk index.
+ *
+ * @param scalars The scalar variables; reordered by type on return
+ * @throws BESInternalError if a value cannot be written
+ */
+void FONcTransform::write_scalars(vector<FONcBaseType *> &scalars)
+{
+    BESDEBUG("fonc", "FONcTransform::write_scalars() - Writing " << scalars.size() << " scalar variables" << endl);
+
+    std::stable_sort(scalars.begin(), scalars.end(), scalar_type_less);
+
+    vector<FONcBaseType *>::iterator i = scalars.begin();
+    vector<FONcBaseType *>::iterator e = scalars.end();
+    for (; i != e; i++) {
+        (*i)->write(_ncid);
+    }
+}
+
 /** @brief dumps information about this transformation object for debugging
  * purposes
  *
@@ -236,6 +565,8 @@ void FONcTransform::dump(ostream &strm) const
     BESIndent::Indent();
     strm << BESIndent::LMarg << "ncid = " << _ncid << endl;
     strm << BESIndent::LMarg << "temporary file = " << _localfile << endl;
+    strm << BESIndent::LMarg << "convert/define/write time (s) = " << _convert_time << "/" << _define_time << "/"
+        << _write_time << endl;
     BESIndent::Indent();
     vector<FONcBaseType *>::const_iterator i = _fonc_vars.begin();
     vector<FONcBaseType *>::const_iterator e = _fonc_vars.end();
@@ -244,6 +575,7 @@ void FONcTransform::dump(ostream &strm) const
         fbt->dump(strm);
     }
     BESIndent::UnIndent();
+    _arena.dump(strm);
     BESIndent::UnIndent();
 }
 
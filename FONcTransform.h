@@ -43,6 +43,7 @@ using std::vector ;
 using std::map ;
 
 #include <DDS.h>
+#include <DMR.h>
 #include <Array.h>
 
 using namespace::libdap ;
@@ -51,22 +52,46 @@ using namespace::libdap ;
 #include <BESDataHandlerInterface.h>
 
 class FONcBaseType ;
+class FONcDigest ;
+
+#include "FONcArena.h"
 
 /** @brief Transformation object that converts an OPeNDAP DataDDS to a
  * netcdf file
  *
- * This class transforms each variable of the DataDDS to a netcdf file. For
- * more information on the transformation please refer to the OpeNDAP
+ * This class transforms each variable of the DataDDS to a netcdf file. A
+ * DAP4 DMR can be transformed as well, keeping its groups, enumerations
+ * and 64-bit integers when the file uses the netCDF-4 enhanced data
+ * model. For more information on the transformation please refer to the OpeNDAP
  * documents wiki.
  */
 class FONcTransform: public BESObj {
 private:
 	int _ncid;
 	DDS *_dds;
+	DMR *_dmr;
 	string _localfile;
 	string _returnAs;
+	// True when the response is a Zarr store; see FONcZarr
+	bool _zarr;
+	// Where a streamed response is sent, and its checksum; see
+	// FONcNc3Stream
+	ostream *_stream;
+	FONcDigest *_stream_digest;
 	vector<FONcBaseType *> _fonc_vars;
 
+	// Holds the FONc objects and write buffers of the response; see
+	// FONcArena
+	FONcArena _arena;
+
+	// Wall clock time, in seconds, spent in each phase of the last call
+	// to transform(). Used by the benchmark programs in 'bench'.
+	double _convert_time;
+	double _define_time;
+	double _write_time;
+
+	virtual void write_scalars(vector<FONcBaseType *> &scalars);
+
 public:
 	/**
 	 * Build a FONcTransform object. By default it builds a netcdf 3 file; pass "netcdf-4"
@@ -79,9 +104,15 @@ public:
 	 * @param netcdfVersion
 	 */
 	FONcTransform(DDS *dds, BESDataHandlerInterface &dhi, const string &localfile, const string &netcdfVersion = "netcdf");
+	FONcTransform(DMR *dmr, BESDataHandlerInterface &dhi, const string &localfile, const string &netcdfVersion = "netcdf");
 	virtual ~FONcTransform();
+	virtual void stream_to(ostream &strm, FONcDigest *digest = 0);
 	virtual void transform();
 
+	virtual double convert_time() const { return _convert_time; }
+	virtual double define_time() const { return _define_time; }
+	virtual double write_time() const { return _write_time; }
+
 	virtual void dump(ostream &strm) const;
 
 };
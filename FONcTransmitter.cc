@@ -47,9 +47,18 @@
 #include <exception>
 #include <sstream>      // std::stringstream
 #include <libgen.h>
+#include <errno.h>
+#include <memory>
+#include <algorithm>
+#include <list>
 
 #include <DataDDS.h>
+#include <DMR.h>
+#include <D4Group.h>
+#include <D4Attributes.h>
 #include <BaseType.h>
+#include <Array.h>
+#include <Grid.h>
 #include <escaping.h>
 #include <ConstraintEvaluator.h>
 
@@ -59,6 +68,7 @@
 #include <BESDapNames.h>
 #include <BESDataNames.h>
 #include <BESDebug.h>
+#include <BESLog.h>
 #include <BESUtil.h>
 
 #include <BESDapResponseBuilder.h>
@@ -67,12 +77,19 @@
 #include <BESDapError.h>
 #include <BESForbiddenError.h>
 #include <BESInternalFatalError.h>
+#include <BESSyntaxUserError.h>
 #include <DapFunctionUtils.h>
 
 #include "FONcBaseType.h"
 #include "FONcRequestHandler.h"
 #include "FONcTransmitter.h"
 #include "FONcTransform.h"
+#include "FONcAggregation.h"
+#include "FONcTempStore.h"
+#include "FONcEncoder.h"
+#include "FONcZarr.h"
+#include "FONcDigest.h"
+#include "FONcUtils.h"
 
 using namespace ::libdap;
 using namespace std;
@@ -96,6 +113,7 @@ FONcTransmitter::FONcTransmitter() :
     BESBasicTransmitter()
 {
     add_method(DATA_SERVICE, FONcTransmitter::send_data);
+    add_method(DAP4DATA_SERVICE, FONcTransmitter::send_dap4_data);
 }
 
 /**
@@ -124,10 +142,11 @@ struct wrap_temp_name {
  *  - SSFunction invocations
  *  - ResourceID? URL?
  *
- * @param dds The DDS to modify
+ * @param globals The top level attributes of the DDS or DMR to modify
+ * @param filename The name of the dataset
  * @param ce The constraint expression that produced this new netCDF file.
  */
-void updateHistoryAttribute(DDS *dds, const string ce)
+void updateHistoryAttribute(AttrTable &globals, const string &filename, const string ce)
 {
     bool foundIt = false;
     string cf_history_entry = BESContextManager::TheManager()->get_context("cf_history_entry", foundIt);
@@ -140,7 +159,7 @@ void updateHistoryAttribute(DDS *dds, const string ce)
         // by host (e.g., the names of cached files that have been decompressed).
         // jhrg 6/3/16
 
-        string request_url = dds->filename();
+        string request_url = filename;
         // remove path info
         request_url = request_url.substr(request_url.find_last_of('/')+1);
         // remove 'uncompress' cache mangling
@@ -170,10 +189,8 @@ void updateHistoryAttribute(DDS *dds, const string ce)
     BESDEBUG("fonc",
         "FONcTransmitter::updateHistoryAttribute() - hist_entry_vec.size(): " << hist_entry_vec.size() << endl);
 
-    // Add the new entry to the "history" attribute
-    // Get the top level Attribute table.
-    AttrTable &globals = dds->get_attr_table();
-
+    // Add the new entry to the "history" attribute, in the top level
+    // Attribute table.
     // Since many files support "CF" conventions the history tag may already exist in the source data
     // and we should add an entry to it if possible.
     bool done = false; // Used to indicate that we located a toplevel ATtrTable whose name ends in "_GLOBAL" and that has an existing "history" attribute.
@@ -211,6 +228,506 @@ void updateHistoryAttribute(DDS *dds, const string ce)
     }
 }
 
+/**
+ * @brief Apply the constraint to a DDS but leave its Arrays unread
+ *
+ * This is used in place of BESDapResponseBuilder::intern_dap2_data() when
+ * FONc.LazyReads is true. Variables other than Arrays and Grids are read
+ * as usual. The projected Arrays, and the arrays of projected Grids, are
+ * left for FONcArray, which reads them from the handler a slab at a time
+ * as they are written, so large variables are never held in memory whole.
+ * The maps of a Grid are read whole here, since FONcGrid compares their
+ * values to find the maps that Grids share.
+ *
+ * @param obj The data response object
+ * @param dhi The data interface of the request
+ * @return The DDS, or null if the constraint calls server functions and
+ * the data must be read as usual
+ */
+static DDS *intern_dap2_data_lazily(BESResponseObject *obj, BESDataHandlerInterface &dhi)
+{
+    string ce = dhi.data[POST_CONSTRAINT];
+    if (ce.find('(') != string::npos) return 0;
+
+    BESDataDDSResponse *bdds = dynamic_cast<BESDataDDSResponse *>(obj);
+    if (!bdds) throw BESInternalError("Expected a data response object", __FILE__, __LINE__);
+
+    DDS *dds = bdds->get_dds();
+    ConstraintEvaluator &eval = bdds->get_ce();
+
+    dhi.first_container();
+    eval.parse_constraint(www2id(ce, "%", "%20"), *dds);
+    dds->tag_nested_sequences();
+
+    DDS::Vars_iter vi = dds->var_begin();
+    DDS::Vars_iter ve = dds->var_end();
+    for (; vi != ve; vi++) {
+        if (!(*vi)->send_p() || (*vi)->type() == dods_array_c) continue;
+
+        if ((*vi)->type() == dods_grid_c) {
+            Grid *g = static_cast<Grid *>(*vi);
+            Grid::Map_iter mi = g->map_begin();
+            Grid::Map_iter me = g->map_end();
+            for (; mi != me; mi++) {
+                if ((*mi)->send_p() && !(*mi)->read_p()) {
+                    (*mi)->read();
+                    (*mi)->set_read_p(true);
+                }
+            }
+        }
+        else {
+            (*vi)->intern_data(eval, *dds);
+        }
+    }
+
+    return dds;
+}
+
+/**
+ * @brief The signature of a request, which names its kept response
+ *
+ * Requests with the same signature get the same netcdf file: the same
+ * service, return type, containers (and the modification times of their
+ * files), constraint and output settings. See FONcTempStore::retain().
+ *
+ * @param dhi The data interface of the request
+ * @param service DATA_SERVICE or DAP4DATA_SERVICE
+ * @return The signature, as 32 hex digits
+ */
+static string request_signature(BESDataHandlerInterface &dhi, const string &service)
+{
+    // The index of a netCDF-4 response refers to the kept netCDF-4 file
+    string return_as = dhi.data[RETURN_CMD];
+    if (return_as == RETURNAS_NETCDF4_REFS) return_as = RETURNAS_NETCDF4;
+
+    ostringstream key;
+    key << service << '\n' << return_as << '\n'
+        << dhi.data[service == DAP4DATA_SERVICE ? DAP4_CONSTRAINT : POST_CONSTRAINT] << '\n';
+
+    list<BESContainer *>::iterator i = dhi.containers.begin();
+    list<BESContainer *>::iterator e = dhi.containers.end();
+    for (; i != e; i++) {
+        string name = (*i)->get_real_name();
+        struct stat sb;
+        if (stat(name.c_str(), &sb) != 0) sb.st_mtime = 0, sb.st_size = 0;
+        key << name << '\n' << sb.st_mtime << ' ' << sb.st_size << '\n' << (*i)->get_constraint() << '\n';
+    }
+
+    // The contexts that change the output; see FONcSettings
+    const char *contexts[] = { "fonc_deflate_level", "fonc_shuffle", "fonc_chunk_size", "fonc_fill",
+        "fonc_classic_model", "fonc_pack_variables", "fonc_pack_type", "fonc_quantize_variables",
+        "fonc_quantize_algorithm", "fonc_quantize_digits", "fonc_record_dimension",
+        "fonc_overview_factor", "fonc_overview_method", 0 };
+    for (const char **c = contexts; *c; c++) {
+        bool found = false;
+        string value = BESContextManager::TheManager()->get_context(*c, found);
+        if (found) key << *c << '=' << value << '\n';
+    }
+
+    // Two 64-bit FNV-1a hashes of the key, with different offset bases
+    string text = key.str();
+    unsigned long long h1 = 14695981039346656037ULL;
+    unsigned long long h2 = 0x9e3779b97f4a7c15ULL;
+    for (string::size_type n = 0; n < text.size(); n++) {
+        h1 = (h1 ^ (unsigned char) text[n]) * 1099511628211ULL;
+        h2 = (h2 ^ (unsigned char) text[n]) * 1099511628211ULL;
+    }
+
+    char hex[33];
+    snprintf(hex, sizeof hex, "%016llx%016llx", h1, h2);
+    return hex;
+}
+
+/**
+ * @brief Parse the value of an HTTP Range header
+ *
+ * Only a single range is supported: bytes=first-last, bytes=first- or
+ * bytes=-suffix_length.
+ *
+ * @param header The value of the header
+ * @param size The size of the response
+ * @param first Set to the offset of the first byte to send
+ * @param last Set to the offset of the last byte to send
+ * @throws BESSyntaxUserError if the range cannot be parsed or is not in
+ * the response
+ */
+static void byte_range(const string &header, off_t size, off_t &first, off_t &last)
+{
+    string spec = header;
+    spec.erase(remove(spec.begin(), spec.end(), ' '), spec.end());
+    if (spec.compare(0, 6, "bytes=") != 0 || spec.find(',') != string::npos || spec.find('-') == string::npos)
+        throw BESSyntaxUserError("The fonc_range context must be a single byte range, not '" + header + "'", __FILE__,
+            __LINE__);
+
+    string::size_type dash = spec.find('-');
+    string from = spec.substr(6, dash - 6);
+    string to = spec.substr(dash + 1);
+    if (from.find_first_not_of("0123456789") != string::npos || to.find_first_not_of("0123456789") != string::npos
+        || (from.empty() && to.empty()))
+        throw BESSyntaxUserError("The fonc_range context must be a single byte range, not '" + header + "'", __FILE__,
+            __LINE__);
+
+    if (from.empty()) {
+        // The last bytes of the response
+        off_t suffix = strtoll(to.c_str(), 0, 10);
+        first = suffix < size ? size - suffix : 0;
+        last = size - 1;
+    }
+    else {
+        first = strtoll(from.c_str(), 0, 10);
+        last = to.empty() ? size - 1 : strtoll(to.c_str(), 0, 10);
+        if (last >= size) last = size - 1;
+    }
+
+    if (first >= size || first > last)
+        throw BESSyntaxUserError("The byte range '" + header + "' is not in the response", __FILE__, __LINE__);
+}
+
+/**
+ * @brief Copy the DAP4 attributes of a variable or group, and those of
+ * the variables and groups it holds, to their DAP2 attribute tables
+ *
+ * FONcAttributes writes the DAP2 attribute tables, so this is done once
+ * for a DMR before it is transformed.
+ *
+ * @param bt The variable or group
+ */
+static void intern_dap4_attributes(BaseType *bt)
+{
+    if (bt->attributes()) bt->attributes()->transform_to_dap2(&bt->get_attr_table());
+
+    Constructor *c = dynamic_cast<Constructor *>(bt);
+    if (c) {
+        Constructor::Vars_iter vi = c->var_begin();
+        Constructor::Vars_iter ve = c->var_end();
+        for (; vi != ve; vi++) {
+            intern_dap4_attributes(*vi);
+        }
+    }
+
+    D4Group *g = dynamic_cast<D4Group *>(bt);
+    if (g) {
+        D4Group::groupsIter gi = g->grp_begin();
+        D4Group::groupsIter ge = g->grp_end();
+        for (; gi != ge; gi++) {
+            intern_dap4_attributes(*gi);
+        }
+    }
+}
+
+/**
+ * @brief The transfer encoding of a response
+ *
+ * netCDF-3 responses are compressed on the way out when the client
+ * accepts it; the front end passes on its Accept-Encoding header in the
+ * fonc_accept_encoding context.
+ */
+static FONcEncoder::Encoding transfer_encoding(BESDataHandlerInterface &dhi)
+{
+    FONcEncoder::Encoding encoding = FONcEncoder::encoding_none;
+    if (dhi.data[RETURN_CMD] == RETURNAS_NETCDF && !FONcRequestHandler::transfer_encodings.empty()) {
+        bool found = false;
+        string accepted = BESContextManager::TheManager()->get_context("fonc_accept_encoding", found);
+        if (found) encoding = FONcEncoder::negotiate(FONcRequestHandler::transfer_encodings, accepted);
+    }
+    return encoding;
+}
+
+/**
+ * @brief Is the response sent as it is built?
+ *
+ * With FONc.StreamClassic, netCDF-3 responses are, unless they must be
+ * kept, sent in a byte range or compressed, which all need the whole file.
+ */
+static bool streams(BESDataHandlerInterface &dhi)
+{
+    if (!FONcRequestHandler::stream_classic || dhi.data[RETURN_CMD] != RETURNAS_NETCDF
+        || FONcRequestHandler::retain_seconds > 0) return false;
+
+    bool ranged = false;
+    string range = BESContextManager::TheManager()->get_context("fonc_range", ranged);
+    if (ranged && !range.empty()) return false;
+
+    return transfer_encoding(dhi) == FONcEncoder::encoding_none;
+}
+
+/**
+ * @brief Build the netcdf file of a response in a temporary file and
+ * stream it to the client
+ *
+ * With FONc.StreamClassic, a netCDF-3 response is sent as it is built and
+ * the temporary file only holds its header; see FONcNc3Stream.
+ *
+ * @param dds The DDS of the response
+ * @param dmr The DMR of the response, which is used in place of the DDS
+ * when it is not null
+ * @param dhi The data interface of the request
+ * @param tier The FONcTempStore tier for the temporary file
+ * @param estimate The estimated size of the file in bytes
+ * @return false if the response could not be built because the tier is
+ * full and there is another tier to try
+ * @throws BESError for any other failure
+ */
+bool FONcTransmitter::build_and_send(DDS *dds, DMR *dmr, BESDataHandlerInterface &dhi, unsigned int tier,
+    unsigned long long estimate)
+{
+    // TODO Make this code and the two struct classes that wrap the name a fd part of
+    // a utility class or file. jhrg 9/7/16
+
+    FONcTempStore *store = FONcTempStore::TheStore();
+    string temp_file_name = store->temp_file_template(tier);
+    vector<char> temp_file(temp_file_name.length() + 1);
+    string::size_type len = temp_file_name.copy(&temp_file[0], temp_file_name.length());
+    temp_file[len] = '\0';
+    // cover the case where older versions of mkstemp() create the file using
+    // a mode of 666.
+    mode_t original_mode = umask(077);
+    int fd = mkstemp(&temp_file[0]);
+    umask(original_mode);
+
+    // Hack: Wrap the name and file descriptors so that the descriptor is closed
+    // and temp file in unlinked no matter hoe we exit. jhrg 9/7/16
+    wrap_temp_name w_temp_file(temp_file);
+    wrap_temp_descriptor w_fd(fd);
+
+    if (fd == -1) {
+        if (errno == ENOSPC && tier + 1 < store->tiers()) return false;
+        throw BESInternalError("Failed to open the temporary file.", __FILE__, __LINE__);
+    }
+
+    if (streams(dhi)) {
+        BESDEBUG("fonc", "FONcTransmitter::build_and_send - Streaming the response; header file " << &temp_file[0] << endl);
+
+        ostream &strm = dhi.get_output_stream();
+        if (!strm) throw BESInternalError("Output stream is not set, can not return as", __FILE__, __LINE__);
+
+        FONcDigest digest(FONcDigest::algorithm_id(FONcRequestHandler::response_digest));
+        FONcDigest *sum = (digest.algorithm() != FONcDigest::digest_none) ? &digest : 0;
+
+        // Part of the response may already be sent when something fails,
+        // so it is not built again in another tier
+        BESContextManager::TheManager()->unset_context("fonc_content_encoding");
+        BESContextManager::TheManager()->unset_context("fonc_content_digest");
+
+        auto_ptr<FONcTransform> ft(dmr ? new FONcTransform(dmr, dhi, &temp_file[0], dhi.data[RETURN_CMD])
+            : new FONcTransform(dds, dhi, &temp_file[0], dhi.data[RETURN_CMD]));
+        ft->stream_to(strm, sum);
+        ft->transform();
+
+        if (sum) log_digest(*sum, dhi, "");
+        return true;
+    }
+
+    BESDEBUG("fonc", "FONcTransmitter::build_and_send - Building response file " << &temp_file[0] << endl);
+
+    try {
+        // Note that 'RETURN_CMD' is the same as the string that determines the file type:
+        // netcdf 3 or netcdf 4. Hack. jhrg 9/7/16
+        auto_ptr<FONcTransform> ft(dmr ? new FONcTransform(dmr, dhi, &temp_file[0], dhi.data[RETURN_CMD])
+            : new FONcTransform(dds, dhi, &temp_file[0], dhi.data[RETURN_CMD]));
+        ft->transform();
+    }
+    catch (BESError &e) {
+        // The tier is full when it has no room for the rest of the file
+        struct stat st;
+        unsigned long long rest = 1;
+        if (fstat(fd, &st) == 0 && estimate > (unsigned long long) st.st_size) rest = estimate - st.st_size;
+        if (tier + 1 < store->tiers() && store->full(tier, rest)) {
+            BESDEBUG("fonc", "FONcTransmitter::build_and_send - " << &temp_file[0] << " filled its tier: " << e.get_message() << endl);
+            return false;
+        }
+        throw;
+    }
+
+    // Keep the file for later requests for the same response, such as a
+    // resumed download
+    store->retain(&temp_file[0], tier, request_signature(dhi, dmr ? DAP4DATA_SERVICE : DATA_SERVICE));
+
+    BESDEBUG("fonc", "FONcTransmitter::build_and_send - Transmitting temp file " << &temp_file[0] << endl);
+
+    if (dhi.data[RETURN_CMD] == RETURNAS_NETCDF4_REFS)
+        send_references(&temp_file[0], dhi);
+    else
+        send_file(fd, dhi);
+
+    return true;
+}
+
+/**
+ * @brief Send a response that was kept by an earlier request
+ *
+ * @param dhi The data interface of the request
+ * @param service DATA_SERVICE or DAP4DATA_SERVICE
+ * @return true if the response was sent, false if it must be built
+ */
+bool FONcTransmitter::send_retained(BESDataHandlerInterface &dhi, const string &service)
+{
+    if (FONcRequestHandler::retain_seconds <= 0) return false;
+
+    string name;
+    int fd = FONcTempStore::TheStore()->open_retained(request_signature(dhi, service), &name);
+    if (fd == -1) return false;
+
+    wrap_temp_descriptor w_fd(fd);
+    if (dhi.data[RETURN_CMD] == RETURNAS_NETCDF4_REFS)
+        send_references(name, dhi);
+    else
+        send_file(fd, dhi);
+
+    return true;
+}
+
+/**
+ * @brief Send the chunk reference index of a kept netCDF-4 response
+ *
+ * The references are to the netCDF-4 response of the same request, which
+ * is kept for FONc.RetainSeconds and sent in byte ranges. The front end
+ * passes the URL of that response in the fonc_data_url context.
+ *
+ * @param file The kept netCDF-4 file
+ * @param dhi The data interface of the request
+ */
+void FONcTransmitter::send_references(const string &file, BESDataHandlerInterface &dhi)
+{
+    ostream &strm = dhi.get_output_stream();
+    if (!strm) throw BESInternalError("Output stream is not set, can not return as", __FILE__, __LINE__);
+
+    bool found = false;
+    string url = BESContextManager::TheManager()->get_context("fonc_data_url", found);
+
+    FONcZarr index(0, false, 0);
+    index.index(file, url, strm);
+}
+
+/**
+ * @brief Send a built netcdf file to the client
+ *
+ * If the front end passed a Range header in the fonc_range context, only
+ * those bytes are sent. Otherwise the whole file is sent, compressed if
+ * it is a netCDF-3 file and the client accepts one of the
+ * FONc.TransferEncodings.
+ *
+ * The front end answers a ranged request with 206 (Partial Content), so
+ * it needs the range that was sent and the size of the whole response.
+ * Before the bytes are sent they are set in two contexts, which the front
+ * end reads with showContext, and written to the BES log:
+ *
+ * - fonc_content_range: the value of the Content-Range header, as
+ *   'bytes first-last/size', or 'bytes *' + '/size' if the range is not
+ *   in the response (the request fails and the answer is 416)
+ * - fonc_content_length: the number of bytes sent
+ *
+ * Both are removed when the whole file is sent. A compressed file is
+ * labeled in a third context, which is removed otherwise:
+ *
+ * - fonc_content_encoding: the encoding, for the Content-Encoding header
+ *
+ * With FONc.ResponseDigest, the checksum of the bytes of the file that are
+ * sent is computed as they are read, written to the BES log and set in the
+ * fonc_content_digest context (see log_digest()).
+ *
+ * @param fd The file, open for reading and positioned at its start
+ * @param dhi The data interface of the request
+ */
+void FONcTransmitter::send_file(int fd, BESDataHandlerInterface &dhi)
+{
+    ostream &strm = dhi.get_output_stream();
+    if (!strm) throw BESInternalError("Output stream is not set, can not return as", __FILE__, __LINE__);
+
+    FONcDigest digest(FONcDigest::algorithm_id(FONcRequestHandler::response_digest));
+    FONcDigest *sum = (digest.algorithm() != FONcDigest::digest_none) ? &digest : 0;
+    BESContextManager::TheManager()->unset_context("fonc_content_digest");
+
+    bool ranged = false;
+    string range = BESContextManager::TheManager()->get_context("fonc_range", ranged);
+    if (ranged && !range.empty()) {
+        BESContextManager::TheManager()->unset_context("fonc_content_encoding");
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) throw BESInternalError("Failed to read the size of the response", __FILE__, __LINE__);
+
+        off_t first, last;
+        try {
+            byte_range(range, st.st_size, first, last);
+        }
+        catch (BESError &e) {
+            ostringstream unsatisfied;
+            unsatisfied << "bytes */" << (long long) st.st_size;
+            BESContextManager::TheManager()->set_context("fonc_content_range", unsatisfied.str());
+            BESContextManager::TheManager()->unset_context("fonc_content_length");
+            throw;
+        }
+
+        ostringstream content_range, content_length;
+        content_range << "bytes " << (long long) first << "-" << (long long) last << "/" << (long long) st.st_size;
+        content_length << (long long) (last - first + 1);
+        BESContextManager::TheManager()->set_context("fonc_content_range", content_range.str());
+        BESContextManager::TheManager()->set_context("fonc_content_length", content_length.str());
+
+        string name = dhi.container ? dhi.container->get_real_name() : "";
+        LOG("fonc " << dhi.data[RETURN_CMD] << " " << name << " range " << content_range.str() << endl);
+
+        BESDEBUG("fonc", "FONcTransmitter::send_file - Sending " << content_range.str() << endl);
+        write_range_to_stream(fd, strm, first, last, sum);
+
+        if (sum) log_digest(*sum, dhi, range);
+        FONcTempStore::done(fd);
+        return;
+    }
+
+    BESContextManager::TheManager()->unset_context("fonc_content_range");
+    BESContextManager::TheManager()->unset_context("fonc_content_length");
+
+    FONcEncoder::Encoding encoding = transfer_encoding(dhi);
+    if (encoding != FONcEncoder::encoding_none) {
+        BESDEBUG("fonc", "FONcTransmitter::send_file - Sending the response as "
+            << FONcEncoder::encoding_name(encoding) << endl);
+        BESContextManager::TheManager()->set_context("fonc_content_encoding", FONcEncoder::encoding_name(encoding));
+        FONcEncoder encoder(encoding, FONcRequestHandler::transfer_encoding_level,
+            FONcRequestHandler::transfer_encoding_threads);
+        encoder.set_digest(sum);
+        encoder.encode(fd, strm);
+    }
+    else {
+        BESContextManager::TheManager()->unset_context("fonc_content_encoding");
+        FONcTransmitter::write_temp_file_to_stream(fd, strm, sum); //, loaded_dds->filename(), ncVersion);
+    }
+
+    if (sum) log_digest(*sum, dhi, "");
+    FONcTempStore::done(fd);
+}
+
+/**
+ * @brief Write the checksum of a sent response to the BES log and pass it
+ * to the front end
+ *
+ * The checksum is set in the fonc_content_digest context as the value of
+ * an HTTP digest field (RFC 9530), the algorithm and the base64 of the
+ * checksum, such as 'sha-256=:<base64>:'. The front end reads it with
+ * showContext.
+ *
+ * @param digest The checksum of the bytes that were sent
+ * @param dhi The data interface of the request
+ * @param range The byte range that was sent, or empty for the whole file
+ */
+void FONcTransmitter::log_digest(FONcDigest &digest, BESDataHandlerInterface &dhi, const string &range)
+{
+    string name = dhi.container ? dhi.container->get_real_name() : "";
+    string hex = digest.hex();
+
+    string sum;
+    for (string::size_type i = 0; i + 1 < hex.length(); i += 2)
+        sum += (char) strtol(hex.substr(i, 2).c_str(), 0, 16);
+    BESContextManager::TheManager()->set_context("fonc_content_digest",
+        FONcDigest::field_name(digest.algorithm()) + "=:" + FONcUtils::base64(sum.data(), sum.length()) + ":");
+
+    BESDEBUG("fonc", "FONcTransmitter::log_digest - " << FONcDigest::algorithm_name(digest.algorithm()) << " " << hex
+        << endl);
+    LOG("fonc " << dhi.data[RETURN_CMD] << " " << name << " " << FONcDigest::algorithm_name(digest.algorithm())
+        << " " << hex << " bytes " << (range.empty() ? string("all") : range) << " (" << (long) digest.bytes()
+        << ")" << endl);
+}
+
 /**
  * @brief The static method registered to transmit OPeNDAP data objects as
  * a netcdf file.
@@ -238,48 +755,44 @@ void FONcTransmitter::send_data(BESResponseObject *obj, BESDataHandlerInterface
         // Note that the BESResponseObject will manage the loaded_dds object's
         // memory. Make this a shared_ptr<>. jhrg 9/6/16
 
+        // A response kept by an earlier request is sent without reading
+        // the data again
+        if (send_retained(dhi, DATA_SERVICE)) return;
+
         BESDEBUG("fonc", "FONcTransmitter::send_data() - Reading data into DataDDS" << endl);
 
-        DDS *loaded_dds = responseBuilder.intern_dap2_data(obj, dhi);
+        // When the request names several containers, they may be joined
+        // into one dataset; FONcAggregation reads them one at a time and
+        // copies their values with a pool of threads.
+        DDS *loaded_dds = 0;
+        auto_ptr<FONcAggregation> aggregation;
+        if (FONcAggregation::requested(dhi)) {
+            BESDataDDSResponse *bdds = dynamic_cast<BESDataDDSResponse *>(obj);
+            if (!bdds) throw BESInternalError("Expected a data response object", __FILE__, __LINE__);
+
+            aggregation.reset(new FONcAggregation(bdds->get_dds(), dhi));
+            loaded_dds = aggregation->read(bdds->get_ce(), dhi.data[POST_CONSTRAINT]);
+        }
+        else {
+            if (FONcRequestHandler::lazy_reads) loaded_dds = intern_dap2_data_lazily(obj, dhi);
+            if (!loaded_dds) loaded_dds = responseBuilder.intern_dap2_data(obj, dhi);
+        }
 
         // ResponseBuilder splits the CE, so use the DHI or make two calls and
         // glue the result together: responseBuilder.get_btp_func_ce() + " " + responseBuilder.get_ce()
         // jhrg 9/6/16
-        updateHistoryAttribute(loaded_dds, dhi.data[POST_CONSTRAINT]);
-
-        // TODO Make this code and the two struct classes that wrap the name a fd part of
-        // a utility class or file. jhrg 9/7/16
-
-        string temp_file_name = FONcRequestHandler::temp_dir + "/ncXXXXXX";
-        vector<char> temp_file(temp_file_name.length() + 1);
-        string::size_type len = temp_file_name.copy(&temp_file[0], temp_file_name.length());
-        temp_file[len] = '\0';
-        // cover the case where older versions of mkstemp() create the file using
-        // a mode of 666.
-        mode_t original_mode = umask(077);
-        int fd = mkstemp(&temp_file[0]);
-        umask(original_mode);
-
-        // Hack: Wrap the name and file descriptors so that the descriptor is closed
-        // and temp file in unlinked no matter hoe we exit. jhrg 9/7/16
-        wrap_temp_name w_temp_file(temp_file);
-        wrap_temp_descriptor w_fd(fd);
-
-        if (fd == -1) throw BESInternalError("Failed to open the temporary file.", __FILE__, __LINE__);
-
-        BESDEBUG("fonc", "FONcTransmitter::send_data - Building response file " << &temp_file[0] << endl);
-
-        // Note that 'RETURN_CMD' is the same as the string that determines the file type:
-        // netcdf 3 or netcdf 4. Hack. jhrg 9/7/16
-        FONcTransform ft(loaded_dds, dhi, &temp_file[0], dhi.data[RETURN_CMD]);
-        ft.transform();
-
-        ostream &strm = dhi.get_output_stream();
-        if (!strm) throw BESInternalError("Output stream is not set, can not return as", __FILE__, __LINE__);
-
-        BESDEBUG("fonc", "FONcTransmitter::send_data - Transmitting temp file " << &temp_file[0] << endl);
-
-        FONcTransmitter::write_temp_file_to_stream(fd, strm); //, loaded_dds->filename(), ncVersion);
+        updateHistoryAttribute(loaded_dds->get_attr_table(), loaded_dds->filename(), dhi.data[POST_CONSTRAINT]);
+
+        // The temporary file goes in the first tier of the store with room
+        // for it. If that tier fills up while the file is built, build it
+        // again in the next one.
+        FONcTempStore *store = FONcTempStore::TheStore();
+        unsigned long long estimate = FONcTempStore::estimate(loaded_dds, dhi.data[RETURN_CMD]);
+        unsigned int tier = store->choose(estimate);
+        while (!build_and_send(loaded_dds, 0, dhi, tier, estimate)) {
+            store->spilled(tier);
+            tier = store->choose(estimate, tier + 1);
+        }
     }
     catch (Error &e) {
         throw BESDapError("Failed to read data: " + e.get_error_message(), false, e.get_error_code(), __FILE__, __LINE__);
@@ -304,16 +817,96 @@ void FONcTransmitter::send_data(BESResponseObject *obj, BESDataHandlerInterface
  *
  * @param filename The name of the file to stream back to the requester
  * @param strm C++ ostream to write the contents of the file to
+ * @param digest If not null, the bytes written are added to it
  * @throws BESInternalError if problem opening the file
  */
-void FONcTransmitter::write_temp_file_to_stream(int fd, ostream &strm) //, const string &filename, const string &ncVersion)
+void FONcTransmitter::write_temp_file_to_stream(int fd, ostream &strm, FONcDigest *digest) //, const string &filename, const string &ncVersion)
 {
     char block[OUTPUT_FILE_BLOCK_SIZE];
 
     int nbytes = read(fd, block, sizeof block);
     while (nbytes > 0) {
         strm.write(block, nbytes /*os.gcount()*/);
+        if (digest) digest->update(block, nbytes);
         nbytes = read(fd, block, sizeof block);
     }
 }
 
+/** @brief stream part of the temporary netcdf file back to the requester
+ *
+ * @param fd The open file
+ * @param strm C++ ostream to write the bytes to
+ * @param first The offset of the first byte to write
+ * @param last The offset of the last byte to write
+ * @param digest If not null, the bytes written are added to it
+ * @throws BESInternalError if the file cannot be read
+ */
+void FONcTransmitter::write_range_to_stream(int fd, ostream &strm, off_t first, off_t last, FONcDigest *digest)
+{
+    char block[OUTPUT_FILE_BLOCK_SIZE];
+
+    while (first <= last) {
+        off_t want = last - first + 1;
+        ssize_t nbytes = pread(fd, block, want < (off_t) sizeof block ? want : sizeof block, first);
+        if (nbytes <= 0) throw BESInternalError("Failed to read the response file", __FILE__, __LINE__);
+        strm.write(block, nbytes);
+        if (digest) digest->update(block, nbytes);
+        first += nbytes;
+    }
+}
+
+/**
+ * @brief The static method registered to transmit DAP4 data objects as a
+ * netcdf file.
+ *
+ * Like send_data(), but for the DAP4 data response. The DMR is
+ * transformed directly, so its groups, enumerations and 64-bit integers
+ * are kept in netCDF-4 files that use the enhanced data model.
+ *
+ * @param obj The BESResponseObject containing the DMR
+ * @param dhi BESDataHandlerInterface containing information about the
+ * request and response
+ * @throws BESInternalError if the response is not a DMR or if there are
+ * any problems reading the data, writing to a netcdf file, or streaming
+ * the netcdf file
+ */
+void FONcTransmitter::send_dap4_data(BESResponseObject *obj, BESDataHandlerInterface &dhi)
+{
+    BESDEBUG("fonc", "FONcTransmitter::send_dap4_data() - BEGIN" << endl);
+
+    try {
+        BESDapResponseBuilder responseBuilder;
+
+        if (send_retained(dhi, DAP4DATA_SERVICE)) return;
+
+        BESDEBUG("fonc", "FONcTransmitter::send_dap4_data() - Reading data into DMR" << endl);
+        DMR *loaded_dmr = responseBuilder.intern_dap4_data(obj, dhi);
+        if (!loaded_dmr) throw BESInternalError("Expected a DMR with data", __FILE__, __LINE__);
+
+        D4Group *root = loaded_dmr->root();
+        intern_dap4_attributes(root);
+        updateHistoryAttribute(root->get_attr_table(), loaded_dmr->filename(), dhi.data[DAP4_CONSTRAINT]);
+
+        FONcTempStore *store = FONcTempStore::TheStore();
+        unsigned long long estimate = FONcTempStore::estimate(root, dhi.data[RETURN_CMD]);
+        unsigned int tier = store->choose(estimate);
+        while (!build_and_send(0, loaded_dmr, dhi, tier, estimate)) {
+            store->spilled(tier);
+            tier = store->choose(estimate, tier + 1);
+        }
+    }
+    catch (Error &e) {
+        throw BESDapError("Failed to read data: " + e.get_error_message(), false, e.get_error_code(), __FILE__, __LINE__);
+    }
+    catch (BESError &e) {
+        throw;
+    }
+    catch (std::exception &e) {
+        throw BESInternalError("Failed to read data: STL Error: " + string(e.what()), __FILE__, __LINE__);
+    }
+    catch (...) {
+        throw BESInternalError("Failed to get read data: Unknown exception caught", __FILE__, __LINE__);
+    }
+
+    BESDEBUG("fonc", "FONcTransmitter::send_dap4_data - done transmitting to netcdf" << endl);
+}
@@ -33,19 +33,21 @@
 #define A_FONcTransmitter_h 1
 
 #include <DataDDS.h>
+#include <DMR.h>
 #include <ConstraintEvaluator.h>
 
 #include <BESBasicTransmitter.h>
 
 class BESContainer;
+class FONcDigest;
 
 using namespace libdap;
 
 /** @brief BESTransmitter class named "netcdf" that transmits an OPeNDAP
  * data object as a netcdf file
  *
- * The FONcTransmitter transforms an OPeNDAP DataDDS object into a
- * netcdf file and streams the new (temporary) netcdf file back to the
+ * The FONcTransmitter transforms an OPeNDAP DataDDS object, or a DAP4
+ * DMR, into a netcdf file and streams the new (temporary) netcdf file back to the
  * client.
  *
  * @see BESBasicTransmitter
@@ -54,13 +56,21 @@ class FONcTransmitter: public BESBasicTransmitter {
 private:
 	static string temp_dir;
 
-	static void write_temp_file_to_stream(int fd, ostream &strm); //, const string &filename, const string &ncVersion);
+	static void write_temp_file_to_stream(int fd, ostream &strm, FONcDigest *digest = 0); //, const string &filename, const string &ncVersion);
+	static void write_range_to_stream(int fd, ostream &strm, off_t first, off_t last, FONcDigest *digest = 0);
+	static void log_digest(FONcDigest &digest, BESDataHandlerInterface &dhi, const string &range);
+	static void send_file(int fd, BESDataHandlerInterface &dhi);
+	static bool send_retained(BESDataHandlerInterface &dhi, const string &service);
+	static void send_references(const string &file, BESDataHandlerInterface &dhi);
+	static bool build_and_send(DDS *dds, DMR *dmr, BESDataHandlerInterface &dhi, unsigned int tier,
+		unsigned long long estimate);
 
 public:
 	FONcTransmitter();
 	virtual ~FONcTransmitter() {}
 
 	static void send_data(BESResponseObject *obj, BESDataHandlerInterface &dhi);
+	static void send_dap4_data(BESResponseObject *obj, BESDataHandlerInterface &dhi);
 };
 
 #endif // A_FONcTransmitter_h
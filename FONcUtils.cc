@@ -32,6 +32,8 @@
 #include "config.h"
 
 #include <cassert>
+#include <cstring>
+#include <sstream>
 
 #include "FONcUtils.h"
 #include "FONcDim.h"
@@ -39,14 +41,24 @@
 #include "FONcStr.h"
 #include "FONcShort.h"
 #include "FONcInt.h"
+#include "FONcInt8.h"
+#include "FONcInt64.h"
+#include "FONcEnum.h"
 #include "FONcFloat.h"
 #include "FONcDouble.h"
 #include "FONcStructure.h"
+#include "FONcGroup.h"
+#include "FONcMemoryAccountant.h"
+#include "FONcWriter.h"
+#include "FONcNc3Stream.h"
 #include "FONcGrid.h"
 #include "FONcArray.h"
 #include "FONcSequence.h"
+#include "FONcAttributes.h"
 
 #include <BESInternalError.h>
+#include <BESSyntaxUserError.h>
+#include <BESDebug.h>
 
 /** @brief If a variable name, dimension name, or attribute name begins
  * with a character that is not supported by netcdf, then use this
@@ -54,47 +66,118 @@
  */
 string FONcUtils::name_prefix = "";
 
+/** @brief True if the response is a netCDF-4 file that uses the enhanced
+ * data model, so it may have groups, user defined types and 64-bit
+ * integers
+ */
+bool FONcUtils::enhanced_model = false;
+
 /** @brief Resets the FONc transformation for a new input and out file
  */
 void FONcUtils::reset()
 {
     FONcArray::Dimensions.clear();
+    FONcArray::RecordArrays.clear();
+    FONcArray::ReducedDims.clear();
     FONcGrid::Maps.clear();
     FONcDim::DimNameNum = 0;
+    FONcStructure::AsGroups = false;
+    FONcUtils::enhanced_model = false;
+    FONcEnum::Types.clear();
+    FONcWriter::Current = 0;
+    FONcArena::Current = 0;
+    FONcUtils::Names.clear();
+    FONcUtils::VarNames.clear();
+    FONcAttributes::Translated.clear();
+    FONcMemoryAccountant::TheAccountant()->begin_request();
 }
 
+// The classes of the characters of netcdf names
+#define FONC_NAME_CHAR 1        // allowed in a name
+#define FONC_NAME_FIRST 2       // allowed as the first character
+
+/** @brief The class of each character, indexed by its (unsigned) value
+ *
+ * Letters, digits and _ may start a name; - + . and @ may only follow the
+ * first character. Every other character is replaced by _.
+ */
+static const unsigned char name_class[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,   // 0x00
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,   // 0x10
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 1, 0,   // 0x20
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 0, 0,   // 0x30
+    1, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,   // 0x40
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 3,   // 0x50
+    0, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,   // 0x60
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 0,   // 0x70
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,   // 0x80
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,   // 0x90
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,   // 0xa0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,   // 0xb0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,   // 0xc0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,   // 0xd0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,   // 0xe0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0    // 0xf0
+};
+
+/** @brief The netcdf names already made for the current response, keyed
+ * by the names they were made from
+ */
+map<string, string> FONcUtils::Names;
+
+/** @brief The names of the variables of the current response, mapped to
+ * the (embedded) DAP names they were made from
+ */
+map<string, string> FONcUtils::VarNames;
+
 /** @brief convert the provided string to a netcdf allowed
  * identifier.
  *
- * The function makes a copy of the incoming parameter to use and
- * returns the new string.
+ * Each name is converted once per response; later calls return the
+ * saved name.
  *
  * @param in identifier to convert
  * @returns new netcdf compliant identifier
  */
-string FONcUtils::id2netcdf(string in)
+string FONcUtils::id2netcdf(const string &in)
 {
-    // string of allowed characters in netcdf naming convention
-    string allowed = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-+_.@";
-    // string of allowed first characters in netcdf naming
-    // convention
-    string first = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_";
+    map<string, string>::iterator i = Names.find(in);
+    if (i != Names.end()) return i->second;
 
-    string::size_type i = 0;
+    static string buffer;
+    id2netcdf(in, buffer);
+    Names.insert(make_pair(in, buffer));
 
-    while ((i = in.find_first_not_of(allowed, i)) != string::npos) {
-        in.replace(i, 1, "_");
-        i++;
-    }
+    return buffer;
+}
 
-    if (first.find(in[0]) == string::npos) {
-        in = FONcUtils::name_prefix + in;
-    }
+/** @brief convert the provided string to a netcdf allowed identifier,
+ * in one pass and without allocating when out has room
+ *
+ * @param in identifier to convert
+ * @param out the new netcdf compliant identifier
+ */
+void FONcUtils::id2netcdf(const string &in, string &out)
+{
+    out.clear();
+
+    // Characters that are not allowed become _, which may start a name,
+    // so only a name that starts with - + . or @ (or is empty) needs the
+    // prefix
+    unsigned char first_class = in.empty() ? 0 : name_class[(unsigned char) in[0]];
+    if (in.empty() || ((first_class & FONC_NAME_CHAR) && !(first_class & FONC_NAME_FIRST)))
+        out = FONcUtils::name_prefix;
 
-    return in;
+    out.reserve(out.length() + in.length());
+    string::const_iterator i = in.begin();
+    string::const_iterator e = in.end();
+    for (; i != e; i++)
+        out += (name_class[(unsigned char) *i] & FONC_NAME_CHAR) ? *i : '_';
 }
 
 /** @brief translate the OPeNDAP data type to a netcdf data type
+ *
+ * The values of an Enum are translated as those of its integer type.
  *
  * @param element The OPeNDAP element to translate
  * @return the netcdf data type
@@ -103,32 +186,68 @@ nc_type FONcUtils::get_nc_type(BaseType *element)
 {
     nc_type x_type = NC_NAT; // the constant ncdf uses to define simple type
 
-    string var_type = element->type_name();
-    if (var_type == "Byte")        	// check this for dods type
+    Type var_type = element->type();
+    if (var_type == dods_enum_c) var_type = static_cast<D4Enum *>(element)->element_type();
+
+    switch (var_type) {
+    case dods_byte_c:          // check this for dods type
+    case dods_uint8_c:
         x_type = NC_SHORT;
-    else if (var_type == "String")
+        break;
+    case dods_int8_c:
+        x_type = NC_BYTE;
+        break;
+    case dods_str_c:
         x_type = NC_CHAR;
-    else if (var_type == "Int16")
+        break;
+    case dods_int16_c:
         x_type = NC_SHORT;
+        break;
     // The attribute of UInt16 maps to NC_INT, so we need to map UInt16
     // to NC_INT for the variable so that end_def won't complain about
     // the inconsistent datatype between fillvalue and the variable. KY 2012-10-25
-    //else if( var_type == "UInt16" )
-    //  x_type = NC_SHORT ;
-    else if (var_type == "UInt16")
-        x_type = NC_INT;
-    else if (var_type == "Int32")
+    case dods_uint16_c:
         x_type = NC_INT;
-    else if (var_type == "UInt32")
+        break;
+    case dods_int32_c:
+    case dods_uint32_c:
         x_type = NC_INT;
-    else if (var_type == "Float32")
+        break;
+    case dods_int64_c:
+        x_type = NC_INT64;
+        break;
+    case dods_uint64_c:
+        x_type = NC_UINT64;
+        break;
+    case dods_float32_c:
         x_type = NC_FLOAT;
-    else if (var_type == "Float64")
+        break;
+    case dods_float64_c:
         x_type = NC_DOUBLE;
+        break;
+    default:
+        break;
+    }
 
     return x_type;
 }
 
+/** @brief Make sure a response can hold a variable of a netCDF-4 type
+ *
+ * @param type_name The DAP type of the variable
+ * @param var_name The name of the variable
+ * @throws BESSyntaxUserError if the response is a netCDF-3 file or uses
+ * the classic model
+ */
+void FONcUtils::require_enhanced_model(const string &type_name, const string &var_name)
+{
+    if (!FONcUtils::enhanced_model) {
+        string err = (string) "File out netcdf, " + var_name + " is a " + type_name
+            + ", which can only be returned in a netCDF-4 file that does not use the classic model";
+        throw BESSyntaxUserError(err, __FILE__, __LINE__);
+    }
+}
+
 /** @brief generate a new name for the embedded variable
  *
  * This function takes the name of a variable as it exists in a data
@@ -147,25 +266,56 @@ nc_type FONcUtils::get_nc_type(BaseType *element)
  */
 string FONcUtils::gen_name(const vector<string> &embed, const string &name, string &original)
 {
-    string new_name;
+    // The embedded name is built in the caller's string, which keeps
+    // its memory from one variable to the next
+    original.clear();
     vector<string>::const_iterator i = embed.begin();
     vector<string>::const_iterator e = embed.end();
-    bool first = true;
     for (; i != e; i++) {
-        if (first)
-            new_name = (*i);
-        else
-            new_name += FONC_EMBEDDED_SEPARATOR + (*i);
-        first = false;
+        original += (*i);
+        original += FONC_EMBEDDED_SEPARATOR;
+    }
+    original += name;
+
+    return FONcUtils::id2netcdf(original);
+}
+
+/** @brief generate the name of a variable
+ *
+ * Like gen_name(), but two different DAP names can convert to the same
+ * netcdf name ("a b" and "a_b"), which netcdf would reject when the
+ * second variable is defined. The second one gets a numeric suffix
+ * instead, and, since its name changed, a fonc_original_name attribute.
+ *
+ * @param embed A list of names for parent structures
+ * @param name The name of the variable to use for the new name
+ * @param original The variable name before calling id2netcdf
+ * @returns the netcdf name of the variable, unique in this response
+ */
+string FONcUtils::gen_var_name(const vector<string> &embed, const string &name, string &original)
+{
+    string new_name = gen_name(embed, name, original);
+
+    map<string, string>::iterator i = VarNames.find(new_name);
+    if (i == VarNames.end()) {
+        VarNames.insert(make_pair(new_name, original));
+        return new_name;
+    }
+    if (i->second == original) return new_name;
+
+    // Find the first free suffix; a variable may itself be called a_b_1
+    string unique;
+    for (int n = 1; unique.empty(); n++) {
+        ostringstream strm;
+        strm << new_name << "_" << n;
+        if (VarNames.find(strm.str()) == VarNames.end()) unique = strm.str();
     }
-    if (first)
-        new_name = name;
-    else
-        new_name += FONC_EMBEDDED_SEPARATOR + name;
+    VarNames.insert(make_pair(unique, original));
 
-    original = new_name;
+    BESDEBUG("fonc", "FONcUtils::gen_var_name() - " << original << " and " << i->second << " both become "
+        << new_name << ", using " << unique << endl);
 
-    return FONcUtils::id2netcdf(new_name);
+    return unique;
 }
 
 /** @brief Creates a FONc object for the given DAP object
@@ -188,8 +338,12 @@ FONcUtils::convert(BaseType *v)
         b = new FONcStr(v);
         break;
     case dods_byte_c:
+    case dods_uint8_c:
         b = new FONcByte(v);
         break;
+    case dods_int8_c:
+        b = new FONcInt8(v);
+        break;
     case dods_int16_c:
     case dods_uint16_c:
         b = new FONcShort(v);
@@ -198,6 +352,13 @@ FONcUtils::convert(BaseType *v)
     case dods_uint32_c:
         b = new FONcInt(v);
         break;
+    case dods_int64_c:
+    case dods_uint64_c:
+        b = new FONcInt64(v);
+        break;
+    case dods_enum_c:
+        b = new FONcEnum(v);
+        break;
     case dods_float32_c:
         b = new FONcFloat(v);
         break;
@@ -216,6 +377,9 @@ FONcUtils::convert(BaseType *v)
     case dods_sequence_c:
         b = new FONcSequence(v);
         break;
+    case dods_group_c:
+        b = new FONcGroup(v);
+        break;
     default:
         string err = (string) "file out netcdf, unable to " + "write unknown variable type";
         throw BESInternalError(err, __FILE__, __LINE__);
@@ -249,3 +413,66 @@ void FONcUtils::handle_error(int stax, const string &err, const string &file, in
     throw BESInternalError(err + string(": ") + nc_strerror(stax), file, line);
 }
 
+/** @brief Write a hyperslab of values to a netcdf variable
+ *
+ * All of the array values written by this module go through this
+ * function. The values must already be of the variable's netcdf type.
+ * If there is a FONcWriter, they are copied into its free buffer and
+ * written by its thread; this does not wait for the write, but the caller
+ * may reuse data when this returns. If the response is streamed (see
+ * FONcNc3Stream), the values go to the stream.
+ *
+ * @param ncid The id of the netcdf file or group
+ * @param varid The id of the variable
+ * @param ndims The number of dimensions of the variable
+ * @param start The index of the first value in each dimension
+ * @param count The number of values in each dimension
+ * @param data The values
+ * @param width The size of one value
+ * @param var_name The name of the variable, used in messages
+ * @throws BESInternalError if the values cannot be written
+ */
+void FONcUtils::put_vara(int ncid, int varid, int ndims, const size_t *start, const size_t *count, const void *data,
+    size_t width, const string &var_name)
+{
+    if (FONcWriter::Current) {
+        size_t bytes = width;
+        for (int d = 0; d < ndims; d++)
+            bytes *= count[d];
+        char *buffer = FONcWriter::Current->buffer(bytes);
+        memcpy(buffer, data, bytes);
+        FONcWriter::Current->put(ncid, varid, ndims, start, count, buffer, var_name);
+        return;
+    }
+
+    int stax = FONcNc3Stream::Current ? FONcNc3Stream::Current->put_vara(varid, start, count, data)
+        : nc_put_vara(ncid, varid, start, count, data);
+    if (stax != NC_NOERR) {
+        string err = (string) "fileout.netcdf - Failed to write the values of " + var_name;
+        FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+    }
+}
+
+/** @brief Encode bytes as base64
+ *
+ * @param data The bytes
+ * @param size The number of bytes
+ * @return The base64 text, padded with '='
+ */
+string FONcUtils::base64(const char *data, size_t size)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    string out;
+    out.reserve((size + 2) / 3 * 4);
+    for (size_t i = 0; i < size; i += 3) {
+        unsigned long group = (unsigned char) data[i] << 16;
+        if (i + 1 < size) group |= (unsigned char) data[i + 1] << 8;
+        if (i + 2 < size) group |= (unsigned char) data[i + 2];
+        out += digits[(group >> 18) & 0x3f];
+        out += digits[(group >> 12) & 0x3f];
+        out += i + 1 < size ? digits[(group >> 6) & 0x3f] : '=';
+        out += i + 2 < size ? digits[group & 0x3f] : '=';
+    }
+    return out;
+}
@@ -35,7 +35,9 @@
 #include <netcdf.h>
 
 #include <string>
+#include <map>
 using std::string;
+using std::map;
 
 #include <BaseType.h>
 using namespace libdap;
@@ -55,12 +57,21 @@ class FONcBaseType;
 class FONcUtils {
 public:
     static string name_prefix;
+    static bool enhanced_model;
+    static map<string, string> Names;
+    static map<string, string> VarNames;
     static void reset();
-    static string id2netcdf(string in);
+    static string id2netcdf(const string &in);
+    static void id2netcdf(const string &in, string &out);
     static nc_type get_nc_type(BaseType *element);
+    static void require_enhanced_model(const string &type_name, const string &var_name);
     static string gen_name(const vector<string> &embed, const string &name, string &original);
+    static string gen_var_name(const vector<string> &embed, const string &name, string &original);
     static FONcBaseType * convert(BaseType *v);
     static void handle_error(int stax, const string &err, const string &file, int line);
+    static void put_vara(int ncid, int varid, int ndims, const size_t *start, const size_t *count,
+        const void *data, size_t width, const string &var_name);
+    static string base64(const char *data, size_t size);
 };
 
 #endif // FONcUtils
@@ -0,0 +1,204 @@
+// FONcWorkerPool.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <exception>
+
+#include <BESInternalError.h>
+#include <BESDebug.h>
+#include <Error.h>
+
+#include "FONcWorkerPool.h"
+
+using namespace std;
+
+/** @brief Start the worker threads
+ *
+ * @param threads The number of threads; zero runs tasks in the thread
+ * that submits them
+ * @throws BESInternalError if a thread cannot be started
+ */
+FONcWorkerPool::FONcWorkerPool(unsigned int threads) :
+    d_stop(false)
+{
+    pthread_mutex_init(&d_lock, 0);
+    pthread_cond_init(&d_work, 0);
+    pthread_cond_init(&d_finished, 0);
+
+    for (unsigned int i = 0; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, 0, FONcWorkerPool::worker, this) != 0) {
+            // stop the threads already running before giving up
+            stop();
+            pthread_cond_destroy(&d_finished);
+            pthread_cond_destroy(&d_work);
+            pthread_mutex_destroy(&d_lock);
+            throw BESInternalError("fileout.netcdf - Failed to start a worker thread", __FILE__, __LINE__);
+        }
+        d_threads.push_back(thread);
+    }
+
+    BESDEBUG("fonc", "FONcWorkerPool::FONcWorkerPool() - started " << d_threads.size() << " threads" << endl);
+}
+
+/** @brief Stop the worker threads and release the pool
+ */
+FONcWorkerPool::~FONcWorkerPool()
+{
+    stop();
+
+    pthread_cond_destroy(&d_finished);
+    pthread_cond_destroy(&d_work);
+    pthread_mutex_destroy(&d_lock);
+}
+
+/** @brief Stop the worker threads
+ *
+ * Tasks still in the queue are not run; tasks that are running are
+ * allowed to finish.
+ */
+void FONcWorkerPool::stop()
+{
+    pthread_mutex_lock(&d_lock);
+    d_stop = true;
+    d_queue.clear();
+    pthread_cond_broadcast(&d_work);
+    pthread_mutex_unlock(&d_lock);
+
+    vector<pthread_t>::iterator i = d_threads.begin();
+    vector<pthread_t>::iterator e = d_threads.end();
+    for (; i != e; i++) {
+        pthread_join(*i, 0);
+    }
+    d_threads.clear();
+}
+
+/** @brief Run a task, saving the message of any exception it throws
+ *
+ * @param task The task to run
+ */
+void FONcWorkerPool::run_task(FONcTask *task)
+{
+    try {
+        task->run();
+    }
+    catch (BESError &e) {
+        task->d_error = e.get_message();
+    }
+    catch (libdap::Error &e) {
+        task->d_error = e.get_error_message();
+    }
+    catch (std::exception &e) {
+        task->d_error = e.what();
+    }
+    catch (...) {
+        task->d_error = "unknown exception";
+    }
+}
+
+/** @brief The function run by each thread of the pool
+ *
+ * @param arg The pool
+ */
+void *FONcWorkerPool::worker(void *arg)
+{
+    FONcWorkerPool *pool = static_cast<FONcWorkerPool *>(arg);
+
+    pthread_mutex_lock(&pool->d_lock);
+    while (true) {
+        while (!pool->d_stop && pool->d_queue.empty())
+            pthread_cond_wait(&pool->d_work, &pool->d_lock);
+        if (pool->d_stop) break;
+
+        FONcTask *task = pool->d_queue.front();
+        pool->d_queue.pop_front();
+        pthread_mutex_unlock(&pool->d_lock);
+
+        FONcWorkerPool::run_task(task);
+
+        pthread_mutex_lock(&pool->d_lock);
+        task->d_done = true;
+        pthread_cond_broadcast(&pool->d_finished);
+    }
+    pthread_mutex_unlock(&pool->d_lock);
+
+    return 0;
+}
+
+/** @brief Queue a task to be run
+ *
+ * @param task The task; it must stay alive until wait() returns for it
+ */
+void FONcWorkerPool::submit(FONcTask *task)
+{
+    if (d_threads.empty()) {
+        FONcWorkerPool::run_task(task);
+        task->d_done = true;
+        return;
+    }
+
+    pthread_mutex_lock(&d_lock);
+    d_queue.push_back(task);
+    pthread_cond_signal(&d_work);
+    pthread_mutex_unlock(&d_lock);
+}
+
+/** @brief Wait for a task to finish
+ *
+ * @param task A task passed to submit()
+ * @throws BESInternalError if the task failed
+ */
+void FONcWorkerPool::wait(FONcTask *task)
+{
+    pthread_mutex_lock(&d_lock);
+    while (!task->d_done)
+        pthread_cond_wait(&d_finished, &d_lock);
+    pthread_mutex_unlock(&d_lock);
+
+    if (!task->d_error.empty()) throw BESInternalError(task->d_error, __FILE__, __LINE__);
+}
+
+/** @brief Has a task finished?
+ *
+ * @param task A task passed to submit()
+ * @return true if wait() would not block for the task
+ */
+bool FONcWorkerPool::finished(FONcTask *task)
+{
+    pthread_mutex_lock(&d_lock);
+    bool done = task->d_done;
+    pthread_mutex_unlock(&d_lock);
+
+    return done;
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcWorkerPool::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcWorkerPool::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "threads = " << d_threads.size() << endl;
+    strm << BESIndent::LMarg << "queued tasks = " << d_queue.size() << endl;
+    BESIndent::UnIndent();
+}
@@ -0,0 +1,94 @@
+// FONcWorkerPool.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef FONcWorkerPool_h_
+#define FONcWorkerPool_h_ 1
+
+#include <pthread.h>
+
+#include <deque>
+#include <vector>
+#include <string>
+
+#include <BESObj.h>
+
+/** @brief A unit of work run by a FONcWorkerPool
+ *
+ * Subclasses implement run(). Exceptions thrown by run() are caught by
+ * the worker thread and their message is saved so that the thread
+ * waiting on the task can report it.
+ */
+class FONcTask {
+private:
+    bool d_done;
+    std::string d_error;
+
+    friend class FONcWorkerPool;
+
+public:
+    FONcTask() : d_done(false) { }
+    virtual ~FONcTask() { }
+
+    virtual void run() = 0;
+
+    bool done() const { return d_done; }
+    const std::string &error() const { return d_error; }
+};
+
+/** @brief A fixed set of threads that run FONcTask instances in the order
+ * they are submitted
+ *
+ * The pool does not own the tasks. A pool with zero threads runs each
+ * task in the calling thread when it is submitted, which makes it easy to
+ * turn the parallelism off.
+ */
+class FONcWorkerPool: public BESObj {
+private:
+    pthread_mutex_t d_lock;
+    pthread_cond_t d_work;
+    pthread_cond_t d_finished;
+
+    std::deque<FONcTask *> d_queue;
+    std::vector<pthread_t> d_threads;
+    bool d_stop;
+
+    static void *worker(void *arg);
+    static void run_task(FONcTask *task);
+    void stop();
+
+    FONcWorkerPool(const FONcWorkerPool &);
+    FONcWorkerPool &operator=(const FONcWorkerPool &);
+
+public:
+    FONcWorkerPool(unsigned int threads);
+    virtual ~FONcWorkerPool();
+
+    virtual void submit(FONcTask *task);
+    virtual void wait(FONcTask *task);
+    virtual bool finished(FONcTask *task);
+
+    virtual unsigned int threads() const { return d_threads.size(); }
+
+    virtual void dump(std::ostream &strm) const;
+};
+
+#endif // FONcWorkerPool_h_
@@ -0,0 +1,335 @@
+// FONcWriter.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <netcdf.h>
+
+#include <BESDebug.h>
+#include <BESIndent.h>
+
+#include "FONcWriter.h"
+#include "FONcUtils.h"
+#include "FONcMemoryAccountant.h"
+
+using namespace std;
+
+FONcWriter *FONcWriter::Current = 0;
+
+/** @brief One queued nc_put_vara() or nc_put_var1_*() call
+ */
+class FONcPutVara: public FONcTask {
+public:
+    pthread_mutex_t *d_library_lock;
+    int d_ncid;
+    int d_varid;
+    vector<size_t> d_start;
+    vector<size_t> d_count;
+    const void *d_data;
+    vector<char> d_copy;        // the values, when they are copied
+    bool d_var1;
+    nc_type d_mem_type;         // the type of the value of nc_put_var1_*()
+    string d_var_name;
+
+    FONcPutVara(pthread_mutex_t *library_lock, int ncid, int varid, int ndims, const size_t *start,
+        const size_t *count, const void *data, const string &var_name) :
+        d_library_lock(library_lock), d_ncid(ncid), d_varid(varid), d_start(start, start + ndims),
+        d_count(count, count + ndims), d_data(data), d_var1(false), d_mem_type(NC_NAT), d_var_name(var_name)
+    {
+    }
+
+    /** @brief Keep a copy of the values, so the caller may reuse them
+     */
+    void copy(size_t bytes)
+    {
+        const char *data = static_cast<const char *>(d_data);
+        d_copy.assign(data, data + bytes);
+        d_data = d_copy.empty() ? 0 : &d_copy[0];
+    }
+
+    int put_var1()
+    {
+        size_t index[] = { 0 };
+        switch (d_mem_type) {
+        case NC_BYTE:
+            return nc_put_var1_schar(d_ncid, d_varid, index, static_cast<const signed char *>(d_data));
+        case NC_UBYTE:
+            return nc_put_var1_uchar(d_ncid, d_varid, index, static_cast<const unsigned char *>(d_data));
+        case NC_SHORT:
+            return nc_put_var1_short(d_ncid, d_varid, index, static_cast<const short *>(d_data));
+        case NC_INT:
+            return nc_put_var1_int(d_ncid, d_varid, index, static_cast<const int *>(d_data));
+        case NC_INT64:
+            return nc_put_var1_longlong(d_ncid, d_varid, index, static_cast<const long long *>(d_data));
+        case NC_UINT64:
+            return nc_put_var1_ulonglong(d_ncid, d_varid, index, static_cast<const unsigned long long *>(d_data));
+        case NC_FLOAT:
+            return nc_put_var1_float(d_ncid, d_varid, index, static_cast<const float *>(d_data));
+        case NC_DOUBLE:
+            return nc_put_var1_double(d_ncid, d_varid, index, static_cast<const double *>(d_data));
+        default:
+            // The value is of the type of the variable
+            return nc_put_var1(d_ncid, d_varid, index, d_data);
+        }
+    }
+
+    virtual void run()
+    {
+        pthread_mutex_lock(d_library_lock);
+        int stax = d_var1 ? put_var1() : nc_put_vara(d_ncid, d_varid, &d_start[0], &d_count[0], d_data);
+        pthread_mutex_unlock(d_library_lock);
+        if (stax != NC_NOERR) {
+            string err = (string) "fileout.netcdf - Failed to write the values of " + d_var_name;
+            FONcUtils::handle_error(stax, err, __FILE__, __LINE__);
+        }
+    }
+};
+
+/** @brief The size of a value given to nc_put_var1_*()
+ */
+static size_t mem_type_size(nc_type mem_type)
+{
+    switch (mem_type) {
+    case NC_BYTE:
+    case NC_UBYTE:
+        return 1;
+    case NC_SHORT:
+        return sizeof(short);
+    case NC_INT:
+        return sizeof(int);
+    case NC_FLOAT:
+        return sizeof(float);
+    case NC_DOUBLE:
+        return sizeof(double);
+    default:
+        // NC_INT64, NC_UINT64 and the values of enums, which are stored in
+        // a long long
+        return sizeof(long long);
+    }
+}
+
+/** @brief Start the writer thread
+ */
+FONcWriter::FONcWriter() :
+    d_pool(1), d_buffer_bytes(0), d_next(0), d_writes(0)
+{
+    d_buffer_writes[0] = d_buffer_writes[1] = 0;
+    pthread_mutex_init(&d_library_lock, 0);
+}
+
+/** @brief Wait for the queued writes and stop the writer thread
+ *
+ * Errors are not reported here; call sync() to see them.
+ */
+FONcWriter::~FONcWriter()
+{
+    while (!d_pending.empty()) {
+        try {
+            d_pool.wait(d_pending.front());
+        }
+        catch (BESError &e) {
+            // The response is being abandoned
+        }
+        delete d_pending.front();
+        d_pending.pop_front();
+    }
+
+    FONcMemoryAccountant::TheAccountant()->release(d_buffer_bytes);
+    pthread_mutex_destroy(&d_library_lock);
+
+    if (Current == this) Current = 0;
+}
+
+/** @brief Delete the writes at the front of the queue that are done
+ *
+ * @throws BESInternalError if one of them failed
+ */
+void FONcWriter::reap()
+{
+    while (!d_pending.empty() && d_pool.finished(d_pending.front())) {
+        FONcPutVara *done = d_pending.front();
+        d_pending.pop_front();
+        for (int i = 0; i < 2; i++)
+            if (d_buffer_writes[i] == done) d_buffer_writes[i] = 0;
+
+        try {
+            d_pool.wait(done);
+        }
+        catch (BESError &e) {
+            delete done;
+            throw;
+        }
+        delete done;
+    }
+}
+
+/** @brief Get a buffer for values to write
+ *
+ * The buffers are used in turn. If the writer is still writing from the
+ * one that is next, this waits for it.
+ *
+ * @param bytes The size needed
+ * @return The buffer, which must be passed to put() before buffer() is
+ * called again
+ * @throws BESInternalError if a write failed
+ */
+char *FONcWriter::buffer(size_t bytes)
+{
+    int i = d_next;
+    d_next = 1 - d_next;
+
+    if (d_buffer_writes[i]) d_pool.wait(d_buffer_writes[i]);
+    reap();
+
+    if (d_buffers[i].size() < bytes) {
+        size_t more = bytes - d_buffers[i].size();
+        FONcMemoryAccountant::TheAccountant()->reserve(more, false, "the write buffers");
+        d_buffer_bytes += more;
+        d_buffers[i].resize(bytes);
+    }
+
+    return &d_buffers[i][0];
+}
+
+/** @brief Queue a write and start it
+ *
+ * @param write The write, which the writer now owns
+ * @throws BESInternalError if an earlier write failed
+ */
+void FONcWriter::queue(FONcPutVara *write)
+{
+    try {
+        reap();
+    }
+    catch (BESError &e) {
+        delete write;
+        throw;
+    }
+
+    d_pending.push_back(write);
+    d_pool.submit(write);
+    d_writes++;
+}
+
+/** @brief Queue a write
+ *
+ * @param ncid The id of the netcdf file or group
+ * @param varid The id of the variable
+ * @param ndims The number of values in start and count
+ * @param start The index of the first value to write
+ * @param count The number of values along each dimension
+ * @param data The values, either a buffer from buffer() or memory that
+ * stays unchanged until sync() returns
+ * @param var_name The name of the variable, for error messages
+ * @throws BESInternalError if an earlier write failed
+ */
+void FONcWriter::put(int ncid, int varid, int ndims, const size_t *start, const size_t *count, const void *data,
+    const string &var_name)
+{
+    FONcPutVara *write = new FONcPutVara(&d_library_lock, ncid, varid, ndims, start, count, data, var_name);
+    for (int i = 0; i < 2; i++)
+        if (!d_buffers[i].empty() && data == &d_buffers[i][0]) d_buffer_writes[i] = write;
+
+    queue(write);
+}
+
+/** @brief Queue a write of a copy of the values
+ *
+ * For small writes, such as those of a string; the caller may reuse data
+ * as soon as this returns.
+ *
+ * @param bytes The size of the values
+ * @see put()
+ */
+void FONcWriter::put_copy(int ncid, int varid, int ndims, const size_t *start, const size_t *count,
+    const void *data, size_t bytes, const string &var_name)
+{
+    FONcPutVara *write = new FONcPutVara(&d_library_lock, ncid, varid, ndims, start, count, data, var_name);
+    write->copy(bytes);
+    queue(write);
+}
+
+/** @brief Queue a write of the value of a scalar variable
+ *
+ * The same as the nc_put_var1_* functions: the value is converted to the
+ * type of the variable. It is copied, so the caller may reuse it as soon
+ * as this returns.
+ *
+ * @param ncid The id of the netcdf file or group
+ * @param varid The id of the variable
+ * @param mem_type The type of the value: NC_BYTE for signed char, NC_UBYTE
+ * for unsigned char, NC_INT64 for long long, and so on, or NC_NAT if it is
+ * of the type of the variable (an enum)
+ * @param value The value
+ * @param var_name The name of the variable, for error messages
+ * @throws BESInternalError if an earlier write failed
+ */
+void FONcWriter::put_var1(int ncid, int varid, nc_type mem_type, const void *value, const string &var_name)
+{
+    FONcPutVara *write = new FONcPutVara(&d_library_lock, ncid, varid, 0, 0, 0, value, var_name);
+    write->d_var1 = true;
+    write->d_mem_type = mem_type;
+    write->copy(mem_type_size(mem_type));
+    queue(write);
+}
+
+/** @brief Wait for all of the queued writes
+ *
+ * @throws BESInternalError if one of them failed
+ */
+void FONcWriter::sync()
+{
+    while (!d_pending.empty()) {
+        d_pool.wait(d_pending.front());
+        reap();
+    }
+}
+
+/** @brief Keep the writer out of libnetcdf
+ *
+ * Waits for the write in progress, if any, to leave libnetcdf; the writer
+ * does not start another until unlock() is called. Use Hold rather than
+ * calling this directly.
+ */
+void FONcWriter::lock()
+{
+    pthread_mutex_lock(&d_library_lock);
+}
+
+/** @brief Let the writer use libnetcdf again
+ */
+void FONcWriter::unlock()
+{
+    pthread_mutex_unlock(&d_library_lock);
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcWriter::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcWriter::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "writes queued = " << d_writes << endl;
+    strm << BESIndent::LMarg << "writes pending = " << d_pending.size() << endl;
+    strm << BESIndent::LMarg << "buffer bytes = " << d_buffer_bytes << endl;
+    BESIndent::UnIndent();
+}
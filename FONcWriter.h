@@ -0,0 +1,116 @@
+// FONcWriter.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef FONcWriter_h_
+#define FONcWriter_h_ 1
+
+#include <pthread.h>
+#include <netcdf.h>
+
+#include <deque>
+#include <vector>
+#include <string>
+
+#include <BESObj.h>
+
+#include "FONcWorkerPool.h"
+
+class FONcPutVara;
+
+/** @brief Writes the values of a response on a thread of its own
+ *
+ * netCDF is not thread safe, so once the variables are defined one
+ * thread, the writer, makes all of the nc_put_vara() calls, in the order
+ * they are queued. The request thread converts the next slab of values
+ * while the writer compresses and writes the last one.
+ *
+ * Converted values go in the writer's two buffers (double buffering):
+ * buffer() hands out the one the writer is not using, waiting for it if
+ * needed. Values written from memory that outlives the write, such as the
+ * buffer of a DAP Array, are queued without a copy. Small values, such as
+ * those of scalars, are copied into their write by put_copy() and
+ * put_var1(). None of these wait for the write.
+ *
+ * FONcTransform makes a writer for the data phase of a response when
+ * FONc.AsyncWrites is true; while it exists, FONcWriter::Current points to
+ * it. Code that calls other nc_* functions during that phase must call
+ * sync() first. The handlers that read the values of lazily read arrays
+ * may use libnetcdf as well; they read while holding the writer (see
+ * Hold), which keeps it out of libnetcdf.
+ */
+class FONcWriter: public BESObj {
+private:
+    FONcWorkerPool d_pool;
+    std::deque<FONcPutVara *> d_pending;
+    pthread_mutex_t d_library_lock;
+
+    std::vector<char> d_buffers[2];
+    FONcPutVara *d_buffer_writes[2];
+    size_t d_buffer_bytes;
+    int d_next;
+
+    unsigned long d_writes;
+
+    void reap();
+    void queue(FONcPutVara *write);
+
+    FONcWriter(const FONcWriter &);
+    FONcWriter &operator=(const FONcWriter &);
+
+public:
+    FONcWriter();
+    virtual ~FONcWriter();
+
+    virtual char *buffer(size_t bytes);
+    virtual void put(int ncid, int varid, int ndims, const size_t *start, const size_t *count, const void *data,
+        const std::string &var_name);
+    virtual void put_copy(int ncid, int varid, int ndims, const size_t *start, const size_t *count,
+        const void *data, size_t bytes, const std::string &var_name);
+    virtual void put_var1(int ncid, int varid, nc_type mem_type, const void *value, const std::string &var_name);
+    virtual void sync();
+
+    virtual void lock();
+    virtual void unlock();
+
+    virtual void dump(std::ostream &strm) const;
+
+    static FONcWriter *Current;
+
+    /** @brief Keeps a writer out of libnetcdf for as long as it exists
+     *
+     * The write in progress, if any, is finished first. A null writer is
+     * not held.
+     */
+    class Hold {
+    private:
+        FONcWriter *d_writer;
+
+        Hold(const Hold &);
+        Hold &operator=(const Hold &);
+
+    public:
+        Hold(FONcWriter *writer) : d_writer(writer) { if (d_writer) d_writer->lock(); }
+        ~Hold() { if (d_writer) d_writer->unlock(); }
+    };
+};
+
+#endif // FONcWriter_h_
@@ -0,0 +1,997 @@
+// FONcZarr.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <sstream>
+
+#include <netcdf.h>
+#include <zlib.h>
+
+#ifdef HAVE_H5DGET_CHUNK_INFO
+#include <hdf5.h>
+#endif
+
+#include <BESInternalError.h>
+#include <BESSyntaxUserError.h>
+#include <BESDebug.h>
+#include <BESIndent.h>
+
+#include "FONcZarr.h"
+#include "FONcUtils.h"
+#include "FONcWorkerPool.h"
+
+using namespace std;
+
+// The target size of the chunks of variables the netCDF-4 file stores
+// contiguously
+#define FONC_ZARR_CHUNK_BYTES (1024 * 1024)
+
+// The date of the members of the archive, 1980-01-01, in MS-DOS format
+#define FONC_ZIP_DATE 0x21
+// The largest size or offset the zip format holds without zip64
+#define FONC_ZIP_MAX_32 0xffffffffULL
+
+/** @brief Append a little endian number of n bytes to a string */
+static void put_le(string &out, unsigned long long value, int n)
+{
+    for (int i = 0; i < n; ++i)
+        out += (char) ((value >> (8 * i)) & 0xff);
+}
+
+/** @brief Quote a string for JSON */
+static string json_string(const string &in)
+{
+    string out = "\"";
+    for (string::const_iterator i = in.begin(); i != in.end(); ++i) {
+        unsigned char c = *i;
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c < 0x20) {
+                char hex[8];
+                snprintf(hex, sizeof hex, "\\u%04x", c);
+                out += hex;
+            }
+            else {
+                out += c;
+            }
+            break;
+        }
+    }
+    return out + "\"";
+}
+
+/** @brief Write a floating point number as JSON
+ *
+ * JSON has no NaN or infinity. Zarr writes them as strings in the
+ * fill_value of an array; in attributes they are written as Python's json
+ * module does, which the usual Zarr clients read.
+ */
+static void json_real(ostringstream &strm, double value, int digits, bool quote_special)
+{
+    const char *q = quote_special ? "\"" : "";
+    if (std::isnan(value))
+        strm << q << "NaN" << q;
+    else if (std::isinf(value))
+        strm << q << (value < 0 ? "-Infinity" : "Infinity") << q;
+    else {
+        strm.precision(digits);
+        strm << value;
+    }
+}
+
+/** @brief Write the i-th of a set of netcdf values as JSON */
+static void json_value(ostringstream &strm, nc_type type, const char *values, size_t i, bool quote_special)
+{
+    switch (type) {
+    case NC_BYTE:
+        strm << (int) reinterpret_cast<const signed char *>(values)[i];
+        break;
+    case NC_UBYTE:
+        strm << (unsigned int) reinterpret_cast<const unsigned char *>(values)[i];
+        break;
+    case NC_SHORT:
+        strm << reinterpret_cast<const short *>(values)[i];
+        break;
+    case NC_USHORT:
+        strm << reinterpret_cast<const unsigned short *>(values)[i];
+        break;
+    case NC_INT:
+        strm << reinterpret_cast<const int *>(values)[i];
+        break;
+    case NC_UINT:
+        strm << reinterpret_cast<const unsigned int *>(values)[i];
+        break;
+    case NC_INT64:
+        strm << reinterpret_cast<const long long *>(values)[i];
+        break;
+    case NC_UINT64:
+        strm << reinterpret_cast<const unsigned long long *>(values)[i];
+        break;
+    case NC_FLOAT:
+        json_real(strm, reinterpret_cast<const float *>(values)[i], 9, quote_special);
+        break;
+    case NC_DOUBLE:
+        json_real(strm, reinterpret_cast<const double *>(values)[i], 17, quote_special);
+        break;
+    default:
+        strm << "null";
+        break;
+    }
+}
+
+/** @brief The Zarr (numpy) data type of a netcdf atomic type
+ *
+ * @param type The netcdf type
+ * @param size Set to the size of a value in bytes
+ * @return The dtype, or an empty string if Zarr has none for the type
+ */
+static string zarr_dtype(nc_type type, size_t &size)
+{
+    unsigned short one = 1;
+    string order = *reinterpret_cast<unsigned char *>(&one) == 1 ? "<" : ">";
+
+    switch (type) {
+    case NC_BYTE:
+        size = 1;
+        return "|i1";
+    case NC_UBYTE:
+        size = 1;
+        return "|u1";
+    case NC_CHAR:
+        size = 1;
+        return "|S1";
+    case NC_SHORT:
+        size = 2;
+        return order + "i2";
+    case NC_USHORT:
+        size = 2;
+        return order + "u2";
+    case NC_INT:
+        size = 4;
+        return order + "i4";
+    case NC_UINT:
+        size = 4;
+        return order + "u4";
+    case NC_INT64:
+        size = 8;
+        return order + "i8";
+    case NC_UINT64:
+        size = 8;
+        return order + "u8";
+    case NC_FLOAT:
+        size = 4;
+        return order + "f4";
+    case NC_DOUBLE:
+        size = 8;
+        return order + "f8";
+    default:
+        size = 0;
+        return "";
+    }
+}
+
+/** @brief The size of the values of a netcdf atomic type, 0 for others */
+static size_t nc_type_size(nc_type type)
+{
+    size_t size;
+    zarr_dtype(type, size);
+    return size;
+}
+
+/** @brief The attributes of a variable, or of a group, as a JSON object
+ *
+ * The _FillValue of a variable is the fill_value of its .zarray, so it
+ * is left out. Attributes of user defined types have no JSON form and are
+ * left out too.
+ *
+ * @param dims The names of the dimensions of a variable, written as the
+ * _ARRAY_DIMENSIONS attribute that xarray uses; null for a group
+ */
+static string attributes_json(int ncid, int varid, const vector<string> *dims)
+{
+    int natts = 0;
+    int stax = nc_inq_varnatts(ncid, varid, &natts);
+    if (stax != NC_NOERR) FONcUtils::handle_error(stax, "fileout.netcdf - Failed to read attributes", __FILE__, __LINE__);
+
+    ostringstream strm;
+    strm << "{";
+    const char *sep = "";
+    for (int a = 0; a < natts; ++a) {
+        char name[NC_MAX_NAME + 1];
+        nc_type type;
+        size_t len;
+        stax = nc_inq_attname(ncid, varid, a, name);
+        if (stax == NC_NOERR) stax = nc_inq_att(ncid, varid, name, &type, &len);
+        if (stax != NC_NOERR)
+            FONcUtils::handle_error(stax, "fileout.netcdf - Failed to read an attribute", __FILE__, __LINE__);
+
+        if (dims && strcmp(name, "_FillValue") == 0) continue;
+
+        if (type == NC_CHAR) {
+            vector<char> text(len + 1, 0);
+            stax = nc_get_att_text(ncid, varid, name, &text[0]);
+            if (stax != NC_NOERR)
+                FONcUtils::handle_error(stax, string("fileout.netcdf - Failed to read attribute ") + name, __FILE__,
+                    __LINE__);
+            strm << sep << json_string(name) << ": " << json_string(string(&text[0]));
+        }
+        else if (type == NC_STRING) {
+            vector<char *> values(len, (char *) 0);
+            if (len) {
+                stax = nc_get_att_string(ncid, varid, name, &values[0]);
+                if (stax != NC_NOERR)
+                    FONcUtils::handle_error(stax, string("fileout.netcdf - Failed to read attribute ") + name,
+                        __FILE__, __LINE__);
+            }
+            strm << sep << json_string(name) << ": ";
+            if (len != 1) strm << "[";
+            for (size_t i = 0; i < len; ++i)
+                strm << (i ? ", " : "") << json_string(values[i] ? values[i] : "");
+            if (len != 1) strm << "]";
+            if (len) nc_free_string(len, &values[0]);
+        }
+        else if (nc_type_size(type) && type != NC_CHAR) {
+            vector<char> values(len * nc_type_size(type) + 1);
+            stax = nc_get_att(ncid, varid, name, &values[0]);
+            if (stax != NC_NOERR)
+                FONcUtils::handle_error(stax, string("fileout.netcdf - Failed to read attribute ") + name, __FILE__,
+                    __LINE__);
+            strm << sep << json_string(name) << ": ";
+            if (len != 1) strm << "[";
+            for (size_t i = 0; i < len; ++i) {
+                if (i) strm << ", ";
+                json_value(strm, type, &values[0], i, false);
+            }
+            if (len != 1) strm << "]";
+        }
+        else {
+            BESDEBUG("fonc", "FONcZarr - Attribute " << name << " has a type JSON cannot hold" << endl);
+            continue;
+        }
+        sep = ", ";
+    }
+
+    if (dims) {
+        strm << sep << "\"_ARRAY_DIMENSIONS\": [";
+        for (size_t d = 0; d < dims->size(); ++d)
+            strm << (d ? ", " : "") << json_string((*dims)[d]);
+        strm << "]";
+    }
+    strm << "}";
+
+    return strm.str();
+}
+
+/** @brief Encode one chunk of a Zarr array
+ *
+ * The values are shuffled, if d_element_size is more than one byte, and
+ * compressed, if d_level is more than zero, as the numcodecs shuffle and
+ * zlib codecs do.
+ */
+class FONcZarrChunk: public FONcTask {
+public:
+    string d_name;
+    int d_level;
+    size_t d_element_size;
+    vector<char> d_in;
+    vector<char> d_out;
+    unsigned long d_crc;
+
+    FONcZarrChunk(const string &name, int level, size_t element_size) :
+        d_name(name), d_level(level), d_element_size(element_size), d_crc(0)
+    {
+    }
+
+    virtual void run()
+    {
+        vector<char> shuffled;
+        const vector<char> *values = &d_in;
+        if (d_element_size > 1) {
+            size_t count = d_in.size() / d_element_size;
+            shuffled.resize(d_in.size());
+            for (size_t i = 0; i < count; ++i)
+                for (size_t b = 0; b < d_element_size; ++b)
+                    shuffled[b * count + i] = d_in[i * d_element_size + b];
+            values = &shuffled;
+        }
+
+        if (d_level > 0) {
+            uLongf size = compressBound(values->size());
+            d_out.resize(size);
+            if (compress2(reinterpret_cast<Bytef *>(&d_out[0]), &size, reinterpret_cast<const Bytef *>(&(*values)[0]),
+                values->size(), d_level) != Z_OK)
+                throw BESInternalError("Failed to compress the chunk " + d_name, __FILE__, __LINE__);
+            d_out.resize(size);
+        }
+        else {
+            d_out = *values;
+        }
+
+        d_crc = crc32(0L, reinterpret_cast<const Bytef *>(&d_out[0]), d_out.size());
+    }
+};
+
+/** @brief Make a Zarr writer
+ *
+ * @param level The zlib level of the chunks, 0 for no compression
+ * @param shuffle Shuffle the bytes of the values of each chunk before
+ * they are compressed
+ * @param threads The number of threads that encode chunks; 0 or 1
+ * encodes them in the calling thread
+ */
+FONcZarr::FONcZarr(int level, bool shuffle, unsigned int threads) :
+    d_level(level < 0 ? 0 : (level > 9 ? 9 : level)), d_shuffle(shuffle), d_threads(threads), d_index(false),
+    d_offset(0), d_chunks(0), d_bytes_in(0)
+{
+}
+
+/** @brief Write a netCDF-4 file as a zipped Zarr store
+ *
+ * @param nc_file The netCDF-4 file
+ * @param zip_file The archive to write; it is replaced
+ * @throws BESInternalError if the file cannot be read or the archive
+ * written
+ * @throws BESSyntaxUserError if a variable has a type Zarr cannot hold
+ */
+void FONcZarr::write(const string &nc_file, const string &zip_file)
+{
+    int ncid;
+    int stax = nc_open(nc_file.c_str(), NC_NOWRITE, &ncid);
+    if (stax != NC_NOERR) FONcUtils::handle_error(stax, "fileout.netcdf - Failed to open " + nc_file, __FILE__, __LINE__);
+
+    try {
+        d_out.open(zip_file.c_str(), ios::out | ios::binary | ios::trunc);
+        if (!d_out) throw BESInternalError("fileout.netcdf - Failed to open " + zip_file, __FILE__, __LINE__);
+
+        FONcWorkerPool pool(d_threads > 1 ? d_threads : 0);
+        write_group(ncid, "", pool);
+
+        // The consolidated metadata, as zarr.consolidate_metadata() writes it
+        string consolidated = "{\"metadata\": {";
+        vector<pair<string, string> >::const_iterator i = d_metadata.begin();
+        vector<pair<string, string> >::const_iterator e = d_metadata.end();
+        for (; i != e; ++i)
+            consolidated += (i == d_metadata.begin() ? "" : ", ") + json_string(i->first) + ": " + i->second;
+        consolidated += "}, \"zarr_consolidated_format\": 1}";
+        write_entry(".zmetadata", consolidated.data(), consolidated.size(),
+            crc32(0L, reinterpret_cast<const Bytef *>(consolidated.data()), consolidated.size()));
+
+        write_central_directory();
+
+        d_out.close();
+        if (d_out.fail()) throw BESInternalError("fileout.netcdf - Failed to write " + zip_file, __FILE__, __LINE__);
+    }
+    catch (...) {
+        nc_close(ncid);
+        throw;
+    }
+    nc_close(ncid);
+
+    BESDEBUG("fonc", "FONcZarr::write() - " << d_chunks << " chunks, " << d_bytes_in << " bytes as " << d_offset << endl);
+}
+
+/** @brief Write a reference index of a netCDF-4 file
+ *
+ * The index is a kerchunk (version 1) reference file: the Zarr metadata
+ * of the groups and variables of the file, and for each chunk the offset
+ * and size of its bytes in the file, which HDF5 reports once the file is
+ * closed. A client reads a chunk with a byte range request on the file,
+ * without reading the HDF5 metadata of the file itself. The values of
+ * compact variables are put in the index.
+ *
+ * @param nc_file The netCDF-4 file
+ * @param url The URL of the file, the 'u' template of the references; may
+ * be empty for the client to fill in
+ * @param strm Where the index (JSON) is written
+ * @throws BESInternalError if the file cannot be read or the module was
+ * built without H5Dget_chunk_info()
+ */
+void FONcZarr::index(const string &nc_file, const string &url, ostream &strm)
+{
+#ifdef HAVE_H5DGET_CHUNK_INFO
+    d_index = true;
+
+    int ncid;
+    int stax = nc_open(nc_file.c_str(), NC_NOWRITE, &ncid);
+    if (stax != NC_NOERR) FONcUtils::handle_error(stax, "fileout.netcdf - Failed to open " + nc_file, __FILE__, __LINE__);
+
+    try {
+        FONcWorkerPool pool(0);
+        write_group(ncid, "", pool);
+    }
+    catch (...) {
+        nc_close(ncid);
+        throw;
+    }
+    nc_close(ncid);
+
+    locate_chunks(nc_file);
+
+    strm << "{\"version\": 1, \"templates\": {\"u\": " << json_string(url) << "}, \"refs\": {";
+    vector<pair<string, string> >::const_iterator i = d_metadata.begin();
+    vector<pair<string, string> >::const_iterator e = d_metadata.end();
+    for (; i != e; ++i)
+        strm << (i == d_metadata.begin() ? "" : ", ") << json_string(i->first) << ": " << json_string(i->second);
+    for (i = d_refs.begin(), e = d_refs.end(); i != e; ++i)
+        strm << ", " << json_string(i->first) << ": " << i->second;
+    strm << "}}";
+
+    BESDEBUG("fonc", "FONcZarr::index() - " << d_chunks << " chunks of " << nc_file << endl);
+#else
+    throw BESInternalError("fileout.netcdf - This module was built without support for chunk indexes", __FILE__,
+        __LINE__);
+#endif
+}
+
+/** @brief Find the chunks of the variables of an index in the file
+ *
+ * @param nc_file The netCDF-4 (HDF5) file, which must be closed
+ */
+void FONcZarr::locate_chunks(const string &nc_file)
+{
+#ifdef HAVE_H5DGET_CHUNK_INFO
+    hid_t file = H5Fopen(nc_file.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file < 0) throw BESInternalError("fileout.netcdf - Failed to open " + nc_file + " with HDF5", __FILE__, __LINE__);
+
+    try {
+        vector<Located>::const_iterator i = d_located.begin();
+        vector<Located>::const_iterator e = d_located.end();
+        for (; i != e; ++i) {
+            // netCDF renames a variable that has the name of a dimension
+            // but is not its coordinate variable
+            hid_t dset = H5Dopen2(file, i->dataset.c_str(), H5P_DEFAULT);
+            if (dset < 0) {
+                string::size_type slash = i->dataset.rfind('/');
+                string renamed = i->dataset.substr(0, slash + 1) + "_nc4_non_coord_" + i->dataset.substr(slash + 1);
+                dset = H5Dopen2(file, renamed.c_str(), H5P_DEFAULT);
+            }
+            if (dset < 0)
+                throw BESInternalError("fileout.netcdf - Failed to open the dataset " + i->dataset, __FILE__, __LINE__);
+
+            int ndims = i->chunks.size();
+            vector<hsize_t> offset(ndims ? ndims : 1);
+            hid_t plist = H5Dget_create_plist(dset);
+            H5D_layout_t layout = H5Pget_layout(plist);
+            H5Pclose(plist);
+
+            // Older versions of HDF5 do not take H5S_ALL for the space
+            hid_t space = H5Dget_space(dset);
+            hsize_t nchunks = 0;
+            if (layout == H5D_CHUNKED && H5Dget_num_chunks(dset, space, &nchunks) < 0) {
+                H5Sclose(space);
+                H5Dclose(dset);
+                throw BESInternalError("fileout.netcdf - Failed to count the chunks of " + i->dataset, __FILE__,
+                    __LINE__);
+            }
+            for (hsize_t c = 0; c < nchunks; ++c) {
+                unsigned int filter_mask = 0;
+                haddr_t address;
+                hsize_t size;
+                if (H5Dget_chunk_info(dset, space, c, &offset[0], &filter_mask, &address, &size) < 0
+                    || filter_mask != 0) {
+                    H5Sclose(space);
+                    H5Dclose(dset);
+                    throw BESInternalError("fileout.netcdf - Failed to locate a chunk of " + i->dataset, __FILE__,
+                        __LINE__);
+                }
+
+                ostringstream key, ref;
+                key << i->key << "/";
+                for (int d = 0; d < ndims; ++d)
+                    key << (d ? "." : "") << offset[d] / i->chunks[d];
+                ref << "[\"{{u}}\", " << address << ", " << size << "]";
+                d_refs.push_back(make_pair(key.str(), ref.str()));
+                ++d_chunks;
+            }
+
+            // Unwritten chunks, and contiguous variables with no storage,
+            // are left out and read as the fill value
+            if (layout == H5D_CONTIGUOUS) {
+                haddr_t address = H5Dget_offset(dset);
+                if (address != HADDR_UNDEF) {
+                    ostringstream key, ref;
+                    key << i->key << "/0";
+                    for (int d = 1; d < ndims; ++d)
+                        key << ".0";
+                    ref << "[\"{{u}}\", " << address << ", " << H5Dget_storage_size(dset) << "]";
+                    d_refs.push_back(make_pair(key.str(), ref.str()));
+                    ++d_chunks;
+                }
+            }
+
+            H5Sclose(space);
+            H5Dclose(dset);
+        }
+    }
+    catch (...) {
+        H5Fclose(file);
+        throw;
+    }
+    H5Fclose(file);
+#endif
+}
+
+/** @brief Write a group, its variables and the groups it holds
+ *
+ * @param ncid The netcdf id of the group
+ * @param path The path of the group in the store; empty or ending in /
+ */
+void FONcZarr::write_group(int ncid, const string &path, FONcWorkerPool &pool)
+{
+    write_metadata(path + ".zgroup", "{\"zarr_format\": 2}");
+    write_metadata(path + ".zattrs", attributes_json(ncid, NC_GLOBAL, 0));
+
+    int nvars = 0;
+    int stax = nc_inq_varids(ncid, &nvars, 0);
+    vector<int> varids(nvars);
+    if (stax == NC_NOERR && nvars) stax = nc_inq_varids(ncid, &nvars, &varids[0]);
+    if (stax != NC_NOERR) FONcUtils::handle_error(stax, "fileout.netcdf - Failed to read the variables", __FILE__, __LINE__);
+
+    for (int v = 0; v < nvars; ++v)
+        write_variable(ncid, varids[v], path, pool);
+
+    int ngrps = 0;
+    stax = nc_inq_grps(ncid, &ngrps, 0);
+    vector<int> grpids(ngrps);
+    if (stax == NC_NOERR && ngrps) stax = nc_inq_grps(ncid, &ngrps, &grpids[0]);
+    if (stax != NC_NOERR) FONcUtils::handle_error(stax, "fileout.netcdf - Failed to read the groups", __FILE__, __LINE__);
+
+    for (int g = 0; g < ngrps; ++g) {
+        char name[NC_MAX_NAME + 1];
+        stax = nc_inq_grpname(grpids[g], name);
+        if (stax != NC_NOERR) FONcUtils::handle_error(stax, "fileout.netcdf - Failed to read a group", __FILE__, __LINE__);
+        write_group(grpids[g], path + name + "/", pool);
+    }
+}
+
+/** @brief Write the metadata and the chunks of a variable
+ *
+ * Chunks are read in order, in the calling thread since the netcdf
+ * library is not thread safe, and are encoded by the pool. Up to two
+ * chunks per thread are in flight; each is added to the archive once the
+ * ones before it are.
+ *
+ * @param ncid The netcdf id of the group of the variable
+ * @param varid The netcdf id of the variable
+ * @param path The path of the group in the store
+ * @param pool The threads that encode the chunks
+ */
+void FONcZarr::write_variable(int ncid, int varid, const string &path, FONcWorkerPool &pool)
+{
+    char name[NC_MAX_NAME + 1];
+    nc_type type;
+    int ndims;
+    int dimids[NC_MAX_VAR_DIMS];
+    int stax = nc_inq_var(ncid, varid, name, &type, &ndims, dimids, 0);
+    if (stax != NC_NOERR) FONcUtils::handle_error(stax, "fileout.netcdf - Failed to read a variable", __FILE__, __LINE__);
+
+    // The values of an enum are those of its integer type
+    nc_type value_type = type;
+    if (type > NC_MAX_ATOMIC_TYPE) {
+        int type_class = 0;
+        stax = nc_inq_user_type(ncid, type, 0, 0, &value_type, 0, &type_class);
+        if (stax != NC_NOERR)
+            FONcUtils::handle_error(stax, string("fileout.netcdf - Failed to read the type of ") + name, __FILE__,
+                __LINE__);
+        if (type_class != NC_ENUM)
+            throw BESSyntaxUserError(string("File out netcdf, ") + name + " has a type that a Zarr store cannot hold",
+                __FILE__, __LINE__);
+    }
+
+    size_t element_size;
+    string dtype = zarr_dtype(value_type, element_size);
+    if (dtype.empty())
+        throw BESSyntaxUserError(string("File out netcdf, ") + name + " has a type that a Zarr store cannot hold",
+            __FILE__, __LINE__);
+
+    vector<size_t> shape(ndims);
+    vector<string> dims(ndims);
+    for (int d = 0; d < ndims; ++d) {
+        char dim_name[NC_MAX_NAME + 1];
+        stax = nc_inq_dimlen(ncid, dimids[d], &shape[d]);
+        if (stax == NC_NOERR) stax = nc_inq_dimname(ncid, dimids[d], dim_name);
+        if (stax != NC_NOERR)
+            FONcUtils::handle_error(stax, string("fileout.netcdf - Failed to read the dimensions of ") + name,
+                __FILE__, __LINE__);
+        dims[d] = dim_name;
+    }
+
+    // Use the chunks of the netCDF-4 variable, or split a contiguous one
+    // along its leading dimensions. An index refers to the storage of the
+    // file, so a contiguous variable is one chunk.
+    vector<size_t> chunks(ndims);
+    int storage = NC_CONTIGUOUS;
+    if (ndims) stax = nc_inq_var_chunking(ncid, varid, &storage, &chunks[0]);
+    if (stax != NC_NOERR) storage = NC_CONTIGUOUS;
+    if (d_index && storage != NC_CHUNKED) {
+        for (int d = 0; d < ndims; ++d)
+            chunks[d] = shape[d] ? shape[d] : 1;
+    }
+    else if (storage != NC_CHUNKED) {
+        size_t bytes = element_size;
+        for (int d = 0; d < ndims; ++d) {
+            chunks[d] = shape[d] ? shape[d] : 1;
+            bytes *= chunks[d];
+        }
+        for (int d = 0; d < ndims && bytes > FONC_ZARR_CHUNK_BYTES;) {
+            if (chunks[d] == 1) {
+                ++d;
+                continue;
+            }
+            bytes = bytes / chunks[d];
+            chunks[d] = (chunks[d] + 1) / 2;
+            bytes *= chunks[d];
+        }
+    }
+
+    size_t chunk_values = 1;
+    for (int d = 0; d < ndims; ++d)
+        chunk_values *= chunks[d];
+    size_t chunk_bytes = chunk_values * element_size;
+    if (chunk_bytes >= FONC_ZIP_MAX_32)
+        throw BESInternalError(string("fileout.netcdf - The chunks of ") + name + " are too large", __FILE__, __LINE__);
+
+    // The fill value, if the variable has one
+    vector<char> fill;
+    size_t fill_len = 0;
+    nc_type fill_type;
+    if (nc_inq_att(ncid, varid, "_FillValue", &fill_type, &fill_len) == NC_NOERR && fill_len == 1
+        && fill_type == type && element_size) {
+        fill.resize(element_size > sizeof(long long) ? element_size : sizeof(long long));
+        stax = nc_get_att(ncid, varid, "_FillValue", &fill[0]);
+        if (stax != NC_NOERR) fill.clear();
+    }
+
+    string var_path = path + name;
+    int level = d_level;
+    size_t shuffle_size = d_shuffle && element_size > 1 ? element_size : 0;
+
+    // An index uses the filters of the variable in the file
+    if (d_index) {
+        int shuffle = 0, deflate = 0;
+        stax = nc_inq_var_deflate(ncid, varid, &shuffle, &deflate, &level);
+        if (stax != NC_NOERR)
+            FONcUtils::handle_error(stax, string("fileout.netcdf - Failed to read the filters of ") + name, __FILE__,
+                __LINE__);
+        if (!deflate) level = 0;
+        shuffle_size = shuffle && element_size > 1 ? element_size : 0;
+    }
+
+    ostringstream zarray;
+    zarray << "{\"chunks\": [";
+    for (int d = 0; d < ndims; ++d)
+        zarray << (d ? ", " : "") << chunks[d];
+    zarray << "], \"compressor\": ";
+    if (level > 0)
+        zarray << "{\"id\": \"zlib\", \"level\": " << level << "}";
+    else
+        zarray << "null";
+    zarray << ", \"dtype\": \"" << dtype << "\", \"fill_value\": ";
+    if (!fill.empty() && value_type != NC_CHAR)
+        json_value(zarray, value_type, &fill[0], 0, true);
+    else
+        zarray << "null";
+    zarray << ", \"filters\": ";
+    if (shuffle_size)
+        zarray << "[{\"elementsize\": " << shuffle_size << ", \"id\": \"shuffle\"}]";
+    else
+        zarray << "null";
+    zarray << ", \"order\": \"C\", \"shape\": [";
+    for (int d = 0; d < ndims; ++d)
+        zarray << (d ? ", " : "") << shape[d];
+    zarray << "], \"zarr_format\": 2}";
+
+    write_metadata(var_path + "/.zarray", zarray.str());
+    write_metadata(var_path + "/.zattrs", attributes_json(ncid, varid, &dims));
+
+    if (d_index) {
+        // Compact variables, the scalars, have no place in the file of
+        // their own and are put in the index, encoded as a chunk would be
+        if (!ndims || storage == NC_COMPACT) {
+            FONcZarrChunk chunk(var_path, level, shuffle_size);
+            chunk.d_in.resize(chunk_bytes);
+            stax = nc_get_var(ncid, varid, &chunk.d_in[0]);
+            if (stax != NC_NOERR)
+                FONcUtils::handle_error(stax, string("fileout.netcdf - Failed to read ") + name, __FILE__, __LINE__);
+            chunk.run();
+            string key = "0";
+            for (int d = 1; d < ndims; ++d)
+                key += ".0";
+            d_refs.push_back(make_pair(var_path + "/" + key, json_string("base64:" + FONcUtils::base64(chunk.d_out.empty() ? 0 : &chunk.d_out[0],
+                chunk.d_out.size()))));
+        }
+        else {
+            Located located;
+            located.dataset = "/" + var_path;
+            located.key = var_path;
+            located.chunks = chunks;
+            d_located.push_back(located);
+        }
+        return;
+    }
+
+    // The chunks, in C order of their indices
+    vector<size_t> index(ndims, 0);
+    vector<size_t> start(ndims), count(ndims);
+    bool more = true;
+    for (int d = 0; d < ndims; ++d)
+        if (shape[d] == 0) more = false;
+
+    size_t in_flight = d_threads > 1 ? 2 * d_threads : 1;
+    deque<FONcZarrChunk *> pending;
+    vector<char> part;
+
+    try {
+        while (more || !pending.empty()) {
+            while (more && pending.size() < in_flight) {
+                ostringstream key;
+                size_t part_values = 1;
+                bool whole = true;
+                for (int d = 0; d < ndims; ++d) {
+                    key << (d ? "." : "") << index[d];
+                    start[d] = index[d] * chunks[d];
+                    count[d] = std::min(chunks[d], shape[d] - start[d]);
+                    part_values *= count[d];
+                    if (count[d] != chunks[d]) whole = false;
+                }
+                if (!ndims) key << "0";
+
+                FONcZarrChunk *chunk = new FONcZarrChunk(var_path + "/" + key.str(), d_level, shuffle_size);
+                pending.push_back(chunk);
+                chunk->d_in.resize(chunk_bytes);
+
+                // A chunk at the end of a dimension is only partly in the
+                // array; it is read and then copied, row by row, into a
+                // whole chunk
+                char *values = whole ? &chunk->d_in[0] : 0;
+                if (!whole) {
+                    part.resize(part_values * element_size);
+                    values = part.empty() ? 0 : &part[0];
+                }
+                stax = ndims ? nc_get_vara(ncid, varid, &start[0], &count[0], values) : nc_get_var(ncid, varid, values);
+                if (stax != NC_NOERR)
+                    FONcUtils::handle_error(stax, "fileout.netcdf - Failed to read " + chunk->d_name, __FILE__, __LINE__);
+
+                if (!whole) {
+                    if (!fill.empty())
+                        for (size_t i = 0; i < chunk_values; ++i)
+                            memcpy(&chunk->d_in[i * element_size], &fill[0], element_size);
+                    else
+                        memset(&chunk->d_in[0], 0, chunk_bytes);
+
+                    size_t row = count[ndims - 1] * element_size;
+                    size_t rows = part_values / count[ndims - 1];
+                    vector<size_t> r(ndims, 0);
+                    for (size_t n = 0; n < rows; ++n) {
+                        size_t offset = 0;
+                        for (int d = 0; d < ndims; ++d)
+                            offset = offset * chunks[d] + r[d];
+                        memcpy(&chunk->d_in[offset * element_size], &part[n * row], row);
+                        for (int d = ndims - 2; d >= 0; --d) {
+                            if (++r[d] < count[d]) break;
+                            r[d] = 0;
+                        }
+                    }
+                }
+
+                pool.submit(chunk);
+                d_bytes_in += part_values * element_size;
+
+                // The next chunk index, the last dimension fastest
+                more = false;
+                for (int d = ndims - 1; d >= 0; --d) {
+                    if (++index[d] * chunks[d] < shape[d]) {
+                        more = true;
+                        break;
+                    }
+                    index[d] = 0;
+                }
+            }
+
+            if (pending.empty()) break;
+
+            FONcZarrChunk *chunk = pending.front();
+            pool.wait(chunk);
+            pending.pop_front();
+            write_entry(chunk->d_name, &chunk->d_out[0], chunk->d_out.size(), chunk->d_crc);
+            ++d_chunks;
+            delete chunk;
+        }
+    }
+    catch (...) {
+        // The pool must not run chunks that are gone
+        while (!pending.empty()) {
+            try {
+                pool.wait(pending.front());
+            }
+            catch (...) {
+            }
+            delete pending.front();
+            pending.pop_front();
+        }
+        throw;
+    }
+}
+
+/** @brief Add a metadata document to the store and to .zmetadata */
+void FONcZarr::write_metadata(const string &key, const string &json)
+{
+    if (!d_index)
+        write_entry(key, json.data(), json.size(), crc32(0L, reinterpret_cast<const Bytef *>(json.data()), json.size()));
+    d_metadata.push_back(make_pair(key, json));
+}
+
+/** @brief Write the bytes to the archive */
+void FONcZarr::put(const string &bytes)
+{
+    d_out.write(bytes.data(), bytes.size());
+    d_offset += bytes.size();
+}
+
+/** @brief Add a member to the archive, stored as it is
+ *
+ * @param name The name of the member
+ * @param data The bytes of the member
+ * @param size The number of bytes, less than 4 GB
+ * @param crc The CRC-32 of the bytes
+ */
+void FONcZarr::write_entry(const string &name, const char *data, size_t size, unsigned long crc)
+{
+    Entry entry;
+    entry.name = name;
+    entry.crc = crc;
+    entry.size = size;
+    entry.offset = d_offset;
+    d_entries.push_back(entry);
+
+    string header;
+    put_le(header, 0x04034b50, 4);
+    put_le(header, entry.offset >= FONC_ZIP_MAX_32 ? 45 : 20, 2); // version needed
+    put_le(header, 0, 2);               // flags
+    put_le(header, 0, 2);               // stored
+    put_le(header, 0, 2);               // time
+    put_le(header, FONC_ZIP_DATE, 2);
+    put_le(header, crc, 4);
+    put_le(header, size, 4);            // compressed size
+    put_le(header, size, 4);            // uncompressed size
+    put_le(header, name.size(), 2);
+    put_le(header, 0, 2);               // extra field length
+    header += name;
+    put(header);
+
+    d_out.write(data, size);
+    d_offset += size;
+
+    if (!d_out) throw BESInternalError("fileout.netcdf - Failed to write " + name + " to the Zarr store", __FILE__, __LINE__);
+}
+
+/** @brief Write the central directory that ends the archive
+ *
+ * Members that start past 4 GB get a zip64 extra field with their offset,
+ * and the zip64 end records are added when the directory itself is past
+ * 4 GB or there are more than 65535 members.
+ */
+void FONcZarr::write_central_directory()
+{
+    unsigned long long directory_offset = d_offset;
+
+    vector<Entry>::const_iterator i = d_entries.begin();
+    vector<Entry>::const_iterator e = d_entries.end();
+    for (; i != e; ++i) {
+        bool zip64 = i->offset >= FONC_ZIP_MAX_32;
+        string header;
+        put_le(header, 0x02014b50, 4);
+        put_le(header, 45 | (3 << 8), 2);           // made by: zip 4.5 on Unix
+        put_le(header, zip64 ? 45 : 20, 2);
+        put_le(header, 0, 2);
+        put_le(header, 0, 2);
+        put_le(header, 0, 2);
+        put_le(header, FONC_ZIP_DATE, 2);
+        put_le(header, i->crc, 4);
+        put_le(header, i->size, 4);
+        put_le(header, i->size, 4);
+        put_le(header, i->name.size(), 2);
+        put_le(header, zip64 ? 12 : 0, 2);          // extra field length
+        put_le(header, 0, 2);                       // comment length
+        put_le(header, 0, 2);                       // disk
+        put_le(header, 0, 2);                       // internal attributes
+        put_le(header, 0100644UL << 16, 4);         // external attributes: rw-r--r--
+        put_le(header, zip64 ? FONC_ZIP_MAX_32 : i->offset, 4);
+        header += i->name;
+        if (zip64) {
+            put_le(header, 1, 2);
+            put_le(header, 8, 2);
+            put_le(header, i->offset, 8);
+        }
+        put(header);
+    }
+
+    unsigned long long directory_size = d_offset - directory_offset;
+    unsigned long long entries = d_entries.size();
+
+    string end;
+    if (entries >= 0xffff || directory_offset >= FONC_ZIP_MAX_32 || directory_size >= FONC_ZIP_MAX_32) {
+        unsigned long long end64_offset = d_offset;
+        put_le(end, 0x06064b50, 4);
+        put_le(end, 44, 8);
+        put_le(end, 45 | (3 << 8), 2);
+        put_le(end, 45, 2);
+        put_le(end, 0, 4);
+        put_le(end, 0, 4);
+        put_le(end, entries, 8);
+        put_le(end, entries, 8);
+        put_le(end, directory_size, 8);
+        put_le(end, directory_offset, 8);
+
+        put_le(end, 0x07064b50, 4);
+        put_le(end, 0, 4);
+        put_le(end, end64_offset, 8);
+        put_le(end, 1, 4);
+    }
+    put_le(end, 0x06054b50, 4);
+    put_le(end, 0, 2);
+    put_le(end, 0, 2);
+    put_le(end, entries < 0xffff ? entries : 0xffff, 2);
+    put_le(end, entries < 0xffff ? entries : 0xffff, 2);
+    put_le(end, directory_size < FONC_ZIP_MAX_32 ? directory_size : FONC_ZIP_MAX_32, 4);
+    put_le(end, directory_offset < FONC_ZIP_MAX_32 ? directory_offset : FONC_ZIP_MAX_32, 4);
+    put_le(end, 0, 2);
+    put(end);
+}
+
+/** @brief dumps information about this object for debugging purposes
+ *
+ * @param strm C++ i/o stream to dump the information to
+ */
+void FONcZarr::dump(ostream &strm) const
+{
+    strm << BESIndent::LMarg << "FONcZarr::dump - (" << (void *) this << ")" << endl;
+    BESIndent::Indent();
+    strm << BESIndent::LMarg << "level = " << d_level << endl;
+    strm << BESIndent::LMarg << "shuffle = " << (d_shuffle ? "true" : "false") << endl;
+    strm << BESIndent::LMarg << "threads = " << d_threads << endl;
+    strm << BESIndent::LMarg << "chunks = " << d_chunks << endl;
+    strm << BESIndent::LMarg << "bytes in/out = " << d_bytes_in << "/" << d_offset << endl;
+    BESIndent::UnIndent();
+}
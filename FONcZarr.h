@@ -0,0 +1,119 @@
+// FONcZarr.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+
+#ifndef FONcZarr_h_
+#define FONcZarr_h_ 1
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <BESObj.h>
+
+class FONcWorkerPool;
+
+/** @brief Writes a netCDF-4 file as a Zarr v2 store in a zip archive
+ *
+ * This is the 'zarr' return type. FONcTransform builds the response as
+ * a netCDF-4 file, as usual but without compression, and then this class
+ * copies it to the store: each group gets a .zgroup and .zattrs, each
+ * variable a .zarray and .zattrs (with the xarray _ARRAY_DIMENSIONS
+ * attribute) and one object per chunk. A .zmetadata holds all of the
+ * metadata so that clients can open the store with one read.
+ *
+ * The chunks are those of the netCDF-4 variables, or, for contiguous
+ * variables, about FONC_ZARR_CHUNK_BYTES. Each chunk is an object of its
+ * own, so they are shuffled and compressed (zlib) in parallel by a
+ * FONcWorkerPool while the next ones are read. The archive stores the
+ * objects as they are, since they are already compressed; it uses the
+ * zip64 extensions once it passes 4 GB.
+ *
+ * index() writes the same metadata as a kerchunk reference file instead,
+ * with the location of each chunk in the netCDF-4 file, for the
+ * 'netcdf-4-refs' return type.
+ */
+class FONcZarr: public BESObj {
+private:
+    // A chunked or contiguous variable of an index, whose chunks are
+    // found with HDF5
+    struct Located {
+        std::string dataset;
+        std::string key;
+        std::vector<size_t> chunks;
+    };
+
+    // A member of the zip archive
+    struct Entry {
+        std::string name;
+        unsigned long crc;
+        unsigned long long size;
+        unsigned long long offset;
+    };
+
+    int d_level;
+    bool d_shuffle;
+    unsigned int d_threads;
+
+    // Write an index of the file rather than a copy; see index()
+    bool d_index;
+    std::vector<Located> d_located;
+    // The chunk references of an index, by key, as JSON
+    std::vector<std::pair<std::string, std::string> > d_refs;
+
+    std::ofstream d_out;
+    unsigned long long d_offset;
+    std::vector<Entry> d_entries;
+
+    // The metadata documents, by key, for .zmetadata
+    std::vector<std::pair<std::string, std::string> > d_metadata;
+
+    unsigned long long d_chunks;
+    unsigned long long d_bytes_in;
+
+    void write_group(int ncid, const std::string &path, FONcWorkerPool &pool);
+    void write_variable(int ncid, int varid, const std::string &path, FONcWorkerPool &pool);
+    void write_metadata(const std::string &key, const std::string &json);
+    void write_entry(const std::string &name, const char *data, size_t size, unsigned long crc);
+    void write_central_directory();
+    void locate_chunks(const std::string &nc_file);
+    void put(const std::string &bytes);
+
+    FONcZarr(const FONcZarr &);
+    FONcZarr &operator=(const FONcZarr &);
+
+public:
+    FONcZarr(int level, bool shuffle, unsigned int threads);
+    virtual ~FONcZarr() { }
+
+    virtual void write(const std::string &nc_file, const std::string &zip_file);
+    virtual void index(const std::string &nc_file, const std::string &url, std::ostream &strm);
+
+    virtual unsigned long long chunks() const { return d_chunks; }
+    virtual unsigned long long bytes_in() const { return d_bytes_in; }
+    virtual unsigned long long bytes_out() const { return d_offset; }
+
+    virtual void dump(std::ostream &strm) const;
+};
+
+#endif // FONcZarr_h_
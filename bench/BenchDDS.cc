@@ -0,0 +1,366 @@
+// BenchDDS.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include <sstream>
+#include <vector>
+
+#include <BaseTypeFactory.h>
+#include <DDS.h>
+#include <Byte.h>
+#include <Int16.h>
+#include <UInt16.h>
+#include <Int32.h>
+#include <UInt32.h>
+#include <Float32.h>
+#include <Float64.h>
+#include <Str.h>
+#include <Array.h>
+#include <Structure.h>
+#include <Grid.h>
+
+#include <BESInternalError.h>
+
+#include "BenchDDS.h"
+
+using namespace libdap;
+using std::ostringstream;
+using std::vector;
+using std::string;
+
+// The grids shape uses maps of this size and shares them among all of the
+// grids in the DDS.
+#define BENCH_LAT_SIZE 180
+#define BENCH_LON_SIZE 360
+
+// The arrays shape uses arrays that are 'scale' x BENCH_ROW_SIZE x
+// BENCH_ROW_SIZE elements
+#define BENCH_ROW_SIZE 1024
+
+static string numbered(const string &prefix, int n)
+{
+    ostringstream oss;
+    oss << prefix << n;
+    return oss.str();
+}
+
+static void add_units(BaseType *bt, const string &units)
+{
+    bt->get_attr_table().append_attr("units", "String", units);
+}
+
+/** Many small scalars. 'scale' is the number of scalar variables; the
+ * types cycle through all of the DAP2 numeric types.
+ */
+static void add_scalars(DDS *dds, BaseTypeFactory &factory, int scale)
+{
+    for (int i = 0; i < scale; ++i) {
+        BaseType *bt = 0;
+        switch (i % 7) {
+        case 0: {
+            Byte *b = factory.NewByte(numbered("byte_", i));
+            b->set_value(i % 256);
+            bt = b;
+            break;
+        }
+        case 1: {
+            Int16 *s = factory.NewInt16(numbered("i16_", i));
+            s->set_value(-i % 32768);
+            bt = s;
+            break;
+        }
+        case 2: {
+            UInt16 *s = factory.NewUInt16(numbered("ui16_", i));
+            s->set_value(i % 65536);
+            bt = s;
+            break;
+        }
+        case 3: {
+            Int32 *l = factory.NewInt32(numbered("i32_", i));
+            l->set_value(-i);
+            bt = l;
+            break;
+        }
+        case 4: {
+            UInt32 *l = factory.NewUInt32(numbered("ui32_", i));
+            l->set_value(i);
+            bt = l;
+            break;
+        }
+        case 5: {
+            Float32 *f = factory.NewFloat32(numbered("f32_", i));
+            f->set_value(i * 0.5);
+            bt = f;
+            break;
+        }
+        default: {
+            Float64 *d = factory.NewFloat64(numbered("f64_", i));
+            d->set_value(i * 0.25);
+            bt = d;
+            break;
+        }
+        }
+        add_units(bt, "1");
+        dds->add_var_nocopy(bt);
+    }
+}
+
+/** A few huge arrays. Four arrays (float32, float64, int16 and byte), each
+ * 'scale' x 1024 x 1024 elements.
+ */
+static void add_arrays(DDS *dds, BaseTypeFactory &factory, int scale)
+{
+    unsigned int nelements = scale * BENCH_ROW_SIZE * BENCH_ROW_SIZE;
+
+    Float32 *f32 = factory.NewFloat32("f32");
+    Array *a = factory.NewArray("f32_array", f32);
+    delete f32;
+    a->append_dim(scale, "time");
+    a->append_dim(BENCH_ROW_SIZE, "y");
+    a->append_dim(BENCH_ROW_SIZE, "x");
+    {
+        vector<dods_float32> values(nelements);
+        for (unsigned int i = 0; i < nelements; ++i)
+            values[i] = (i % 10000) * 0.01;
+        a->set_value(&values[0], nelements);
+    }
+    add_units(a, "K");
+    dds->add_var_nocopy(a);
+
+    Float64 *f64 = factory.NewFloat64("f64");
+    a = factory.NewArray("f64_array", f64);
+    delete f64;
+    a->append_dim(scale, "time");
+    a->append_dim(BENCH_ROW_SIZE, "y");
+    a->append_dim(BENCH_ROW_SIZE, "x");
+    {
+        vector<dods_float64> values(nelements);
+        for (unsigned int i = 0; i < nelements; ++i)
+            values[i] = (i % 10000) * 0.001;
+        a->set_value(&values[0], nelements);
+    }
+    add_units(a, "Pa");
+    dds->add_var_nocopy(a);
+
+    Int16 *i16 = factory.NewInt16("i16");
+    a = factory.NewArray("i16_array", i16);
+    delete i16;
+    a->append_dim(scale, "time");
+    a->append_dim(BENCH_ROW_SIZE, "y");
+    a->append_dim(BENCH_ROW_SIZE, "x");
+    {
+        vector<dods_int16> values(nelements);
+        for (unsigned int i = 0; i < nelements; ++i)
+            values[i] = i % 32768;
+        a->set_value(&values[0], nelements);
+    }
+    dds->add_var_nocopy(a);
+
+    // Bytes are promoted to shorts by the handler, so this exercises the
+    // conversion copy in FONcArray::write().
+    Byte *b = factory.NewByte("byte");
+    a = factory.NewArray("byte_array", b);
+    delete b;
+    a->append_dim(scale, "time");
+    a->append_dim(BENCH_ROW_SIZE, "y");
+    a->append_dim(BENCH_ROW_SIZE, "x");
+    {
+        vector<dods_byte> values(nelements);
+        for (unsigned int i = 0; i < nelements; ++i)
+            values[i] = i % 256;
+        a->set_value(&values[0], nelements);
+    }
+    dds->add_var_nocopy(a);
+}
+
+/** String arrays. Two arrays of 'scale' x 1000 strings whose lengths vary
+ * from 1 to 64 characters.
+ */
+static void add_strings(DDS *dds, BaseTypeFactory &factory, int scale)
+{
+    unsigned int nelements = scale * 1000;
+
+    for (int n = 0; n < 2; ++n) {
+        Str *s = factory.NewStr("str");
+        Array *a = factory.NewArray(numbered("str_array_", n), s);
+        delete s;
+        a->append_dim(nelements, "strings");
+
+        vector<string> values(nelements);
+        for (unsigned int i = 0; i < nelements; ++i)
+            values[i] = string(1 + (i * 7 + n) % 64, 'a' + (i % 26));
+        a->set_value(values, nelements);
+
+        dds->add_var_nocopy(a);
+    }
+}
+
+static Array *build_map(BaseTypeFactory &factory, const string &name, int size, double first, double delta)
+{
+    Float64 *f64 = factory.NewFloat64(name);
+    Array *map = factory.NewArray(name, f64);
+    delete f64;
+    map->append_dim(size, name);
+
+    vector<dods_float64> values(size);
+    for (int i = 0; i < size; ++i)
+        values[i] = first + i * delta;
+    map->set_value(&values[0], size);
+
+    add_units(map, name == "lat" ? "degrees_north" : "degrees_east");
+
+    return map;
+}
+
+/** Many grids sharing maps. 'scale' grids, each 180 x 360 float32 values,
+ * all using the same lat and lon maps.
+ */
+static void add_grids(DDS *dds, BaseTypeFactory &factory, int scale)
+{
+    unsigned int nelements = BENCH_LAT_SIZE * BENCH_LON_SIZE;
+    vector<dods_float32> values(nelements);
+
+    for (int n = 0; n < scale; ++n) {
+        Grid *g = factory.NewGrid(numbered("grid_", n));
+
+        Float32 *f32 = factory.NewFloat32(g->name());
+        Array *a = factory.NewArray(g->name(), f32);
+        delete f32;
+        a->append_dim(BENCH_LAT_SIZE, "lat");
+        a->append_dim(BENCH_LON_SIZE, "lon");
+        for (unsigned int i = 0; i < nelements; ++i)
+            values[i] = n + (i % BENCH_LON_SIZE) * 0.1;
+        a->set_value(&values[0], nelements);
+        add_units(a, "K");
+        g->set_array(a);
+
+        g->add_map(build_map(factory, "lat", BENCH_LAT_SIZE, -89.5, 1.0), false);
+        g->add_map(build_map(factory, "lon", BENCH_LON_SIZE, -179.5, 1.0), false);
+
+        g->set_read_p(true);
+        dds->add_var_nocopy(g);
+    }
+}
+
+/** Deep structures. Structures nested 'scale' deep; each level holds a
+ * few scalars and a small array and has its own attributes, which are
+ * copied to every flattened member below it.
+ */
+static void add_structures(DDS *dds, BaseTypeFactory &factory, int scale)
+{
+    Structure *top = factory.NewStructure("level_0");
+    Structure *s = top;
+    for (int level = 0; level < scale; ++level) {
+        s->get_attr_table().append_attr("level", "Int32", numbered("", level));
+        s->get_attr_table().append_attr("description", "String", numbered("structure level ", level));
+
+        Int32 *i32 = factory.NewInt32("count");
+        i32->set_value(level);
+        s->add_var_nocopy(i32);
+
+        Float64 *f64 = factory.NewFloat64("value");
+        f64->set_value(level * 1.5);
+        s->add_var_nocopy(f64);
+
+        Float32 *f32 = factory.NewFloat32("samples");
+        Array *a = factory.NewArray("samples", f32);
+        delete f32;
+        a->append_dim(100, "sample");
+        vector<dods_float32> values(100);
+        for (int i = 0; i < 100; ++i)
+            values[i] = level + i * 0.01;
+        a->set_value(&values[0], 100);
+        s->add_var_nocopy(a);
+
+        if (level + 1 < scale) {
+            Structure *child = factory.NewStructure(numbered("level_", level + 1));
+            s->add_var_nocopy(child);
+            s = child;
+        }
+    }
+
+    top->set_read_p(true);
+    dds->add_var_nocopy(top);
+}
+
+/** @brief Build a DataDDS with the given shape
+ *
+ * The variables are built with the given factory, have values and are
+ * marked to be sent, just as if they had been read by a data handler.
+ *
+ * Shapes are 'scalars', 'arrays', 'strings', 'grids', 'structures' and
+ * 'mixed' (all of the others at the same scale).
+ *
+ * @param shape The shape and scale of the DDS
+ * @param factory Build variables using this factory
+ * @return A new DDS; the caller must delete it
+ * @throws BESInternalError if the shape is not known
+ */
+DDS *build_bench_dds(const BenchShape &shape, BaseTypeFactory &factory)
+{
+    DDS *dds = new DDS(&factory, "bench_" + shape.name);
+
+    if (shape.name == "scalars") {
+        add_scalars(dds, factory, shape.scale);
+    }
+    else if (shape.name == "arrays") {
+        add_arrays(dds, factory, shape.scale);
+    }
+    else if (shape.name == "strings") {
+        add_strings(dds, factory, shape.scale);
+    }
+    else if (shape.name == "grids") {
+        add_grids(dds, factory, shape.scale);
+    }
+    else if (shape.name == "structures") {
+        add_structures(dds, factory, shape.scale);
+    }
+    else if (shape.name == "mixed") {
+        add_scalars(dds, factory, shape.scale);
+        add_arrays(dds, factory, shape.scale);
+        add_strings(dds, factory, shape.scale);
+        add_grids(dds, factory, shape.scale);
+        add_structures(dds, factory, shape.scale);
+    }
+    else {
+        delete dds;
+        throw BESInternalError("Unknown benchmark shape: " + shape.name, __FILE__, __LINE__);
+    }
+
+    dds->get_attr_table().append_attr("title", "String", "FONc benchmark: " + shape.name);
+    dds->mark_all(true);
+
+    return dds;
+}
+
+/** @brief The number of bytes of data held by the variables of the DDS
+ *
+ * This is the amount of data the transform has to move and is the basis
+ * of the throughput numbers the benchmark reports.
+ */
+unsigned long bench_dds_bytes(DDS *dds)
+{
+    unsigned long bytes = 0;
+    for (DDS::Vars_iter i = dds->var_begin(), e = dds->var_end(); i != e; ++i)
+        bytes += (*i)->width(true);
+
+    return bytes;
+}
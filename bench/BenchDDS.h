@@ -0,0 +1,52 @@
+// BenchDDS.h
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef BenchDDS_h_
+#define BenchDDS_h_ 1
+
+#include <string>
+
+namespace libdap {
+class DDS;
+class BaseTypeFactory;
+}
+
+/** @brief The shape of a synthetic DataDDS built for the benchmarks
+ *
+ * Each shape stresses a different part of the transform: the number of
+ * variables (scalars), raw data volume (arrays), string packing
+ * (strings), map sharing (grids) and name/attribute flattening
+ * (structures). The scale parameter sets the size of the shape; its
+ * meaning depends on the shape and is described in build_bench_dds().
+ */
+struct BenchShape {
+    std::string name;
+    int scale;
+
+    BenchShape() : scale(1) { }
+    BenchShape(const std::string &n, int s) : name(n), scale(s) { }
+};
+
+libdap::DDS *build_bench_dds(const BenchShape &shape, libdap::BaseTypeFactory &factory);
+unsigned long bench_dds_bytes(libdap::DDS *dds);
+
+#endif // BenchDDS_h_
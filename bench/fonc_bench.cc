@@ -0,0 +1,317 @@
+// fonc_bench.cc
+
+// This file is part of BES Netcdf File Out Module
+
+// Copyright (c) 2016 OPeNDAP, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+// Time the FONcTransform end to end for synthetic DataDDS objects of
+// different shapes and report the results as JSON, one object per line,
+// so that runs can be compared by scripts.
+//
+// Usage: fonc_bench [-s shape] [-n scale] [-f netcdf|netcdf-4] [-r reps]
+//        [-t tempdir] [-d]
+
+#include "config.h"
+
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <cstdlib>
+#include <new>
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include <BaseTypeFactory.h>
+#include <DDS.h>
+
+#include <BESDataHandlerInterface.h>
+#include <BESError.h>
+#include <BESDebug.h>
+
+#include "FONcBaseType.h"
+#include "FONcRequestHandler.h"
+#include "FONcTransform.h"
+#include "FONcEncoder.h"
+#include "FONcArena.h"
+
+#include "ReadTypeFactory.h"
+#include "BenchDDS.h"
+
+using namespace std;
+using namespace libdap;
+
+// Count the calls to the global operator new, to show how hard the
+// transform works the allocator. Every replaceable form of new and delete
+// is replaced, so that none of them mixes with the library's allocator.
+static unsigned long allocations = 0;
+
+#if __cplusplus >= 201103L
+#define BENCH_THROWS_BAD_ALLOC
+#define BENCH_NOTHROW noexcept
+#else
+#define BENCH_THROWS_BAD_ALLOC throw (std::bad_alloc)
+#define BENCH_NOTHROW throw ()
+#endif
+
+static void *counted_alloc(size_t bytes)
+{
+    allocations++;
+    return malloc(bytes ? bytes : 1);
+}
+
+void *operator new(size_t bytes) BENCH_THROWS_BAD_ALLOC
+{
+    void *p = counted_alloc(bytes);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t bytes) BENCH_THROWS_BAD_ALLOC
+{
+    void *p = counted_alloc(bytes);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(size_t bytes, const std::nothrow_t &) BENCH_NOTHROW
+{
+    return counted_alloc(bytes);
+}
+
+void *operator new[](size_t bytes, const std::nothrow_t &) BENCH_NOTHROW
+{
+    return counted_alloc(bytes);
+}
+
+void operator delete(void *p) BENCH_NOTHROW
+{
+    free(p);
+}
+
+void operator delete[](void *p) BENCH_NOTHROW
+{
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) BENCH_NOTHROW
+{
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) BENCH_NOTHROW
+{
+    free(p);
+}
+
+#if __cplusplus >= 201402L
+// C++14 compilers call the sized forms when they know the size
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+#endif
+
+static void usage(const char *name)
+{
+    cerr << "Usage: " << name << " [-s shape] [-n scale] [-f netcdf|netcdf-4] [-r reps] [-t tempdir]"
+        << " [-e gzip|zstd] [-l level] [-j threads] [-A] [-d]" << endl
+        << "    shapes: scalars, arrays, strings, grids, structures, mixed" << endl;
+}
+
+static double elapsed_since(const struct timeval &start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1.0e6;
+}
+
+/** Peak resident set size of this process in KB */
+static long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchShape shape("mixed", 1);
+    string format = RETURNAS_NETCDF;
+    string temp_dir = "/tmp";
+    int reps = 3;
+    string encoding_name;
+    int level = 0;
+    int threads = 1;
+    bool use_arena = true;
+
+    int option_char;
+    while ((option_char = getopt(argc, argv, "s:n:f:r:t:e:l:j:Adh")) != -1) {
+        switch (option_char) {
+        case 's':
+            shape.name = optarg;
+            break;
+        case 'n':
+            shape.scale = atoi(optarg);
+            break;
+        case 'f':
+            format = optarg;
+            break;
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        case 't':
+            temp_dir = optarg;
+            break;
+        case 'e':
+            encoding_name = optarg;
+            break;
+        case 'l':
+            level = atoi(optarg);
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'A':
+            use_arena = false;
+            break;
+        case 'd':
+            BESDebug::SetUp("cerr,fonc");
+            break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (shape.scale < 1 || reps < 1 || (format != RETURNAS_NETCDF && format != RETURNAS_NETCDF4)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FONcEncoder::Encoding encoding = FONcEncoder::encoding_none;
+    if (!encoding_name.empty()) {
+        encoding = FONcEncoder::encoding_id(encoding_name);
+        if (encoding == FONcEncoder::encoding_none || threads < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // These are normally read from fonc.conf by the request handler.
+    FONcRequestHandler::temp_dir = temp_dir;
+    FONcRequestHandler::use_compression = true;
+    FONcRequestHandler::chunk_size = 4096;
+    FONcRequestHandler::classic_model = true;
+    FONcRequestHandler::slab_size = 4096;
+    FONcRequestHandler::use_arena = use_arena;
+
+    try {
+        ReadTypeFactory factory;
+
+        struct timeval build_start;
+        gettimeofday(&build_start, NULL);
+        DDS *dds = build_bench_dds(shape, factory);
+        double build_time = elapsed_since(build_start);
+        unsigned long input_bytes = bench_dds_bytes(dds);
+
+        double convert_time = 0, define_time = 0, write_time = 0;
+        for (int rep = 0; rep < reps; ++rep) {
+            string file_name = temp_dir + "/fonc_bench_XXXXXX";
+            vector<char> temp_file(file_name.begin(), file_name.end());
+            temp_file.push_back('\0');
+            int fd = mkstemp(&temp_file[0]);
+            if (fd == -1) {
+                cerr << "Could not make a temporary file in " << temp_dir << endl;
+                return 1;
+            }
+            close(fd);
+
+            BESDataHandlerInterface dhi;
+
+            struct timeval start;
+            gettimeofday(&start, NULL);
+            unsigned long start_allocations = allocations;
+            double total_time;
+            {
+                FONcTransform ft(dds, dhi, &temp_file[0], format);
+                ft.transform();
+                convert_time = ft.convert_time();
+                define_time = ft.define_time();
+                write_time = ft.write_time();
+            }
+            // Include freeing the FONc objects
+            total_time = elapsed_since(start);
+            unsigned long transform_allocations = allocations - start_allocations;
+
+            struct stat st;
+            long output_bytes = (stat(&temp_file[0], &st) == 0) ? st.st_size: -1;
+
+            // Time sending the file with a transfer encoding, as the
+            // transmitter would, to a stream that drops the bytes
+            unsigned long long encoded_bytes = 0;
+            double encode_time = 0;
+            if (encoding != FONcEncoder::encoding_none) {
+                int in = open(&temp_file[0], O_RDONLY);
+                ofstream sink("/dev/null", ios::binary);
+                FONcEncoder encoder(encoding, level, threads);
+                struct timeval encode_start;
+                gettimeofday(&encode_start, NULL);
+                encoder.encode(in, sink);
+                encode_time = elapsed_since(encode_start);
+                encoded_bytes = encoder.bytes_out();
+                close(in);
+            }
+            unlink(&temp_file[0]);
+
+            cout << "{\"shape\": \"" << shape.name << "\", \"scale\": " << shape.scale
+                << ", \"format\": \"" << format << "\", \"rep\": " << rep
+                << ", \"input_bytes\": " << input_bytes << ", \"output_bytes\": " << output_bytes
+                << ", \"build_s\": " << build_time
+                << ", \"convert_s\": " << convert_time << ", \"define_s\": " << define_time
+                << ", \"write_s\": " << write_time << ", \"total_s\": " << total_time
+                << ", \"mb_per_s\": " << (total_time > 0 ? input_bytes / total_time / 1.0e6: 0.0)
+                << ", \"peak_rss_kb\": " << peak_rss_kb() << ", \"arena\": " << (use_arena ? "true" : "false")
+                << ", \"allocations\": " << transform_allocations
+                << ", \"arena_high_water_kb\": " << FONcArena::high_water() / 1024;
+            if (encoding != FONcEncoder::encoding_none)
+                cout << ", \"encoding\": \"" << encoding_name << "\", \"level\": " << level << ", \"threads\": "
+                    << threads << ", \"encoded_bytes\": " << encoded_bytes << ", \"encode_s\": " << encode_time
+                    << ", \"encode_mb_per_s\": " << (encode_time > 0 ? output_bytes / encode_time / 1.0e6: 0.0);
+            cout << "}" << endl;
+        }
+
+        delete dds;
+    }
+    catch (BESError &e) {
+        cerr << "Error: " << e.get_message() << endl;
+        return 1;
+    }
+
+    return 0;
+}
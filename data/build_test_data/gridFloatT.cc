@@ -0,0 +1,95 @@
+// gridFloatT.cc
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+using std::ofstream;
+using std::ios;
+using std::cerr;
+using std::endl;
+
+#include <DataDDS.h>
+#include <Array.h>
+#include <Grid.h>
+#include <Float32.h>
+
+using namespace libdap;
+
+#include <BESDataHandlerInterface.h>
+#include <BESDataNames.h>
+#include <BESDebug.h>
+
+#include "test_send_data.h"
+
+int main(int argc, char **argv)
+{
+    bool debug = false;
+    if (argc > 1) {
+        for (int i = 0; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "debug") {
+                debug = true;
+            }
+        }
+    }
+
+    try {
+        if (debug)
+            BESDebug::SetUp("cerr,fonc");
+
+        // build a DataDDS with a Grid of floating point values, which can
+        // be packed and quantized
+        DDS *dds = new DDS(NULL, "virtual");
+        Grid temp("temp");
+
+        {
+            Float32 bt("temp");
+            Array a("temp", &bt);
+            a.append_dim(2, "lat");
+            a.append_dim(3, "lon");
+            vector<dods_float32> btv;
+            btv.push_back(0.1);
+            btv.push_back(1.7);
+            btv.push_back(3.3);
+            btv.push_back(4.9);
+            btv.push_back(6.5);
+            btv.push_back(8.1);
+            a.set_value(btv, 6);
+            temp.add_var(&a, libdap::array);
+        }
+        {
+            Float32 bt("lat");
+            Array a("lat", &bt);
+            a.append_dim(2, "lat");
+            vector<dods_float32> btv;
+            btv.push_back(-45);
+            btv.push_back(45);
+            a.set_value(btv, 2);
+            temp.add_var(&a, maps);
+        }
+        {
+            Float32 bt("lon");
+            Array a("lon", &bt);
+            a.append_dim(3, "lon");
+            vector<dods_float32> btv;
+            btv.push_back(0);
+            btv.push_back(120);
+            btv.push_back(240);
+            a.set_value(btv, 3);
+            temp.add_var(&a, maps);
+        }
+        temp.set_read_p(true);
+        dds->add_var(&temp);
+
+        build_dods_response(&dds, "./gridFloatT.dods");
+
+        delete dds;
+    }
+    catch (BESError &e) {
+        cerr << e.get_message() << endl;
+        return 1;
+    }
+
+    return 0;
+}
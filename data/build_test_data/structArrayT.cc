@@ -0,0 +1,97 @@
+// structArrayT.cc
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+using std::ofstream;
+using std::ios;
+using std::cerr;
+using std::endl;
+
+#include <DataDDS.h>
+#include <Structure.h>
+#include <Array.h>
+#include <Int16.h>
+#include <Float32.h>
+#include <Float64.h>
+
+using namespace libdap;
+
+#include <BESDataHandlerInterface.h>
+#include <BESDataNames.h>
+#include <BESDebug.h>
+
+//#include "test_config.h"
+#include "test_send_data.h"
+
+int main(int argc, char **argv)
+{
+    bool debug = false;
+    if (argc > 1) {
+        for (int i = 0; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "debug") {
+                debug = true;
+            }
+        }
+    }
+
+    try {
+        if (debug)
+            BESDebug::SetUp("cerr,fonc");
+
+        // build a DataDDS with an Array of Structures, which the handler
+        // writes as an array of a compound type
+        DDS *dds = new DDS(NULL, "virtual");
+
+        Structure proto("casts");
+
+        Int16 id("id");
+        proto.add_var(&id);
+
+        Float32 temp("temp");
+        proto.add_var(&temp);
+
+        Float64 depth("depth");
+        proto.add_var(&depth);
+
+        Array casts("casts", &proto);
+        casts.append_dim(3, "cast");
+
+        dods_int16 ids[] = { 1, 2, 3 };
+        dods_float32 temps[] = { 10.5, 11.25, 12.0 };
+        dods_float64 depths[] = { 5.0, 10.5, 20.25 };
+        for (int i = 0; i < 3; i++) {
+            Structure s("casts");
+
+            Int16 s_id("id");
+            s_id.set_value(ids[i]);
+            s.add_var(&s_id);
+
+            Float32 s_temp("temp");
+            s_temp.set_value(temps[i]);
+            s.add_var(&s_temp);
+
+            Float64 s_depth("depth");
+            s_depth.set_value(depths[i]);
+            s.add_var(&s_depth);
+
+            s.set_read_p(true);
+            casts.set_vec(i, &s);
+        }
+        casts.set_read_p(true);
+
+        dds->add_var(&casts);
+
+        build_dods_response(&dds, "./structArrayT.dods");
+
+        delete dds;
+    }
+    catch (BESError &e) {
+        cerr << e.get_message() << endl;
+        return 1;
+    }
+
+    return 0;
+}
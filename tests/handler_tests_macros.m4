@@ -16,25 +16,27 @@ AT_ARG_OPTION_ARG([baselines],
      baselines=$at_arg_baselines],[baselines=])
 
 # Usage: _AT_TEST_*(<bescmd source>, <baseline file>, <xpass/xfail> [default is xpass] <repeat|cached> [default is no])
+# _AT_BESCMD_TEST also takes a bes.<name>.conf to use in place of bes.conf
 
 m4_define([_AT_BESCMD_TEST], [dnl
 
-    AT_SETUP([BESCMD $1])
+    AT_SETUP([BESCMD $1]m4_ifval([$5], [ ($5)]))
     AT_KEYWORDS([bescmd])
 
     input=$1
     baseline=$2
     pass=$3
     repeat=$4
+    conf=m4_default([$5], [bes.conf])
     AS_IF([test -n "$repeat" -a x$repeat = xrepeat -o x$repeat = xcached], [repeat="-r 3"])
 
     AS_IF([test -n "$baselines" -a x$baselines = xyes],
         [
-        AT_CHECK([besstandalone $repeat -c $abs_builddir/bes.conf -i $input], [], [stdout])
+        AT_CHECK([besstandalone $repeat -c $abs_builddir/$conf -i $input], [], [stdout])
         AT_CHECK([mv stdout $baseline.tmp])
         ],
         [
-        AT_CHECK([besstandalone $repeat -c $abs_builddir/bes.conf -i $input], [], [stdout])
+        AT_CHECK([besstandalone $repeat -c $abs_builddir/$conf -i $input], [], [stdout])
         AT_CHECK([diff -b -B $baseline stdout])
         AT_XFAIL_IF([test z$pass = zxfail])
         ])
@@ -46,21 +48,24 @@ dnl This PATTREN test reads a set of patterns from a file and if any
 dnl of those patterns match, the test passes. In many ways it's just
 dnl a better version of _AT_BESCMD_ERROR_TEST below
 
+dnl It also takes a bes.<name>.conf to use in place of bes.conf.
+
 m4_define([_AT_BESCMD_PATTERN_TEST], [dnl
 
-    AT_SETUP([BESCMD $1])
+    AT_SETUP([BESCMD $1]m4_ifval([$4], [ ($4)]))
     AT_KEYWORDS([bescmd])
 
     input=$1
     baseline=$2
+    conf=m4_default([$4], [bes.conf])
 
     AS_IF([test -n "$baselines" -a x$baselines = xyes],
         [
-        AT_CHECK([besstandalone -c $abs_builddir/bes.conf -i $input], [0], [stdout])
+        AT_CHECK([besstandalone -c $abs_builddir/$conf -i $input], [0], [stdout])
         AT_CHECK([mv stdout $baseline.tmp])
         ],
         [
-        AT_CHECK([besstandalone -c $abs_builddir/bes.conf -i $input], [0], [stdout])
+        AT_CHECK([besstandalone -c $abs_builddir/$conf -i $input], [0], [stdout])
         AT_CHECK([grep -f $baseline stdout], [0], [ignore])
         AT_XFAIL_IF([test "$3" = "xfail"])
         ])
@@ -157,15 +162,16 @@ dnl requires ncdump be accessible.
 
 m4_define([_AT_BESCMD_NETCDF_TEST],  [dnl
 
-    AT_SETUP([BESCMD $1])
+    AT_SETUP([BESCMD $1]m4_ifval([$4], [ ($4)]))
     AT_KEYWORDS([netcdf])
     
     input=$1
     baseline=$2
+    conf=m4_default([$4], [bes.conf])
 
     AS_IF([test -n "$baselines" -a x$baselines = xyes],
         [
-        AT_CHECK([besstandalone -c $abs_builddir/bes.conf -i $input > test.nc])
+        AT_CHECK([besstandalone -c $abs_builddir/$conf -i $input > test.nc])
         
         dnl first get the version number, then the header, then the data
         AT_CHECK([ncdump -k test.nc > $baseline.ver.tmp])
@@ -175,7 +181,7 @@ m4_define([_AT_BESCMD_NETCDF_TEST],  [dnl
         REMOVE_DATE_TIME([$baseline.data.tmp])
         ],
         [
-        AT_CHECK([besstandalone -c $abs_builddir/bes.conf -i $input > test.nc])
+        AT_CHECK([besstandalone -c $abs_builddir/$conf -i $input > test.nc])
         
         AT_CHECK([ncdump -k test.nc > tmp])
         AT_CHECK([diff -b -B $baseline.ver tmp])
@@ -246,12 +252,23 @@ m4_define([AT_BESCMD_REPEAT_RESPONSE_TEST],
 [_AT_BESCMD_TEST([$abs_srcdir/$1], [$abs_srcdir/$1.baseline], [$2], [$3])
 ])
 
+dnl Usage: AT_BESCMD_CONF_RESPONSE_TEST(<bescmd>, <conf>, [xfail]); see
+dnl AT_BESCMD_NETCDF_CONF_RESPONSE_TEST below
+m4_define([AT_BESCMD_CONF_RESPONSE_TEST],
+[_AT_BESCMD_TEST([$abs_srcdir/$1], [$abs_srcdir/$1.baseline], [$3], [], [$2])
+])
+
 dnl Simple pattern tests. The baseline file holds a set of patterns, one per line,
 dnl and the test will pass if any pattern matches with the test result. 
 m4_define([AT_BESCMD_RESPONSE_PATTERN_TEST],
 [_AT_BESCMD_PATTERN_TEST([$abs_srcdir/$1], [$abs_srcdir/$1.baseline], [$2])
 ])
 
+dnl Usage: AT_BESCMD_CONF_RESPONSE_PATTERN_TEST(<bescmd>, <conf>, [xfail])
+m4_define([AT_BESCMD_CONF_RESPONSE_PATTERN_TEST],
+[_AT_BESCMD_PATTERN_TEST([$abs_srcdir/$1], [$abs_srcdir/$1.baseline], [$3], [$2])
+])
+
 m4_define([AT_BESCMD_ERROR_RESPONSE_TEST],
 [_AT_BESCMD_ERROR_TEST([$abs_srcdir/$1], [$abs_srcdir/$1.baseline], [$2])
 ])
@@ -264,3 +281,11 @@ m4_define([AT_BESCMD_BINARY_DAP4_RESPONSE_TEST],
 
 m4_define([AT_BESCMD_NETCDF_RESPONSE_TEST],
 [_AT_BESCMD_NETCDF_TEST([$abs_srcdir/$1], [$abs_srcdir/$1.baseline], [$2])])
+
+dnl Run a netcdf test with one of the bes.<name>.conf files made from bes.conf
+dnl and conf/<name>.keys, for the options that cannot be set with contexts.
+dnl The baseline is that of the bescmd file, so a test of an option that
+dnl must not change the response can reuse the baseline of an existing test.
+dnl Usage: AT_BESCMD_NETCDF_CONF_RESPONSE_TEST(<bescmd>, <conf>, [xfail])
+m4_define([AT_BESCMD_NETCDF_CONF_RESPONSE_TEST],
+[_AT_BESCMD_NETCDF_TEST([$abs_srcdir/$1], [$abs_srcdir/$1.baseline], [$3], [$2])])